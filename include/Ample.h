@@ -8,11 +8,13 @@
 #define __AMPLE_H__
 
 #include <algorithm>
+#include <deque>
 #include <string>
 #include <vector>
 #include <stack>
 #include <list>
 #include <map>
+#include <set>
 
 #include <AmpleUtil.h>
 
@@ -25,6 +27,8 @@ namespace verse
 
 const uint32 INVALID_VERTEX_ID = ((uint32) ~0);
 const uint32 INVALID_POLYGON_ID = ((uint32) ~0);
+const uint32 INVALID_EDGE_ID = ((uint32) ~0);
+const uint16 INVALID_BONE_ID = ((uint16) ~0);
 
 const VLayerID BASE_VERTEX_LAYER_ID = 0;
 const VLayerID BASE_POLYGON_LAYER_ID = 1;
@@ -59,10 +63,25 @@ class TextNodeObserver;
 
 class GeometryLayer;
 class GeometryLayerObserver;
+template <VNGLayerType T>
+class GeometryLayerTraits;
+template <VNGLayerType T>
+class GeometryLayerView;
 class Bone;
 class BoneObserver;
 class GeometryNode;
 class GeometryNodeObserver;
+class GeometryNormals;
+class GeometryBoundsTree;
+class GeometryTopology;
+class GeometryEdges;
+class GeometrySubdivision;
+class GeometrySkinning;
+class GeometrySimplification;
+class GeometryQuantization;
+class GeometryBatch;
+class GeometryExtraction;
+class GeometryImport;
 
 class Method;
 class MethodObserver;
@@ -197,6 +216,10 @@ public:
   void resize(size_t count);
   void reserve(size_t count);
   void release(void);
+  void share(const Block& source);
+  bool isShared(void) const;
+  void setMapping(const std::string& directory, size_t threshold);
+  bool isMapped(void) const;
   operator void* (void);
   operator const void* (void) const;
   Block& operator = (const Block& source);
@@ -211,10 +234,178 @@ public:
   size_t getGranularity(void) const;
   void setGranularity(size_t grain);
 private:
+  void detach(void);
+  void drop(void);
+  uint8* allocate(size_t count, size_t capacity, size_t& mapSize) const;
   size_t mItemCount;
   size_t mItemSize;
   size_t mGrain;
   uint8* mData;
+  mutable volatile long* mShares;
+  std::string mMapDirectory;
+  size_t mMapThreshold;
+  size_t mMapSize;
+};
+
+//---------------------------------------------------------------------
+
+/*! Contiguous range of IDs, such as vertex, polygon or slot IDs.
+ */
+class IDRange
+{
+public:
+  IDRange(void);
+  IDRange(uint32 first, uint32 count);
+  /*! @return The ID following the last ID in this range.
+   */
+  uint32 getEnd(void) const;
+  uint32 mFirst;
+  uint32 mCount;
+};
+
+//---------------------------------------------------------------------
+
+/*! Set of IDs, stored as a sorted list of disjoint, non-adjacent ranges.
+ *  @remarks Adding IDs in ascending order is a constant time operation.
+ */
+class IDRangeSet
+{
+public:
+  typedef std::vector<IDRange> RangeList;
+  /*! Adds the specified ID to this set.
+   */
+  void addID(uint32 ID);
+  /*! Adds the specified range of IDs to this set.
+   */
+  void addRange(uint32 first, uint32 count);
+  /*! Adds all IDs in the specified set to this set.
+   */
+  void addRanges(const IDRangeSet& other);
+  /*! Removes all IDs from this set.
+   */
+  void clear(void);
+  /*! @return @c true if this set contains the specified ID, otherwise @c false.
+   */
+  bool contains(uint32 ID) const;
+  /*! @return @c true if this set is empty, otherwise @c false.
+   */
+  bool isEmpty(void) const;
+  /*! @return The total number of IDs in this set.
+   */
+  uint32 getIDCount(void) const;
+  /*! @return The ranges making up this set, in ascending order.
+   */
+  const RangeList& getRanges(void) const;
+private:
+  RangeList mRanges;
+};
+
+//---------------------------------------------------------------------
+
+/*! Worker thread class.
+ *  @remarks Ample itself is not thread safe. Worker threads may only read
+ *  node data while no session is being updated.
+ */
+class Thread
+{
+public:
+  /*! Thread entry point function type.
+   */
+  typedef void (*Function)(void* data);
+  /*! Range function type for Thread::parallelFor.
+   */
+  typedef void (*RangeFunction)(void* data, uint32 first, uint32 count);
+  /*! Destructor. Waits for the thread to finish.
+   */
+  ~Thread(void);
+  /*! Waits for this thread to finish.
+   */
+  void wait(void);
+  /*! Starts a new thread running the specified function.
+   *  @param function The function to run.
+   *  @param data The value to pass to the function.
+   *  @return The newly started thread, or @c NULL if it could not be started.
+   */
+  static Thread* create(Function function, void* data);
+  /*! Splits the range [0, count) into contiguous subranges and runs the
+   *  specified function on each of them, in parallel across all processors.
+   *  Returns when all subranges have been processed.
+   *  @param function The function to call for each subrange.
+   *  @param data The value to pass to the function.
+   *  @param count The total number of items.
+   *  @param grain The smallest number of items worth a separate thread.
+   *  @remarks The subranges are run by a set of worker threads shared by all
+   *  calls, and by the calling thread. Each thread claims the next subrange
+   *  once it is done with the previous one, so uneven subranges do not leave
+   *  threads idle. The function may itself call parallelFor.
+   */
+  static void parallelFor(RangeFunction function, void* data, uint32 count, uint32 grain = 1024);
+  /*! @return The number of processors available for worker threads.
+   */
+  static unsigned int getProcessorCount(void);
+private:
+  Thread(void);
+  Thread(const Thread& source);
+  Thread& operator = (const Thread& source);
+  void* mHandle;
+};
+
+//---------------------------------------------------------------------
+
+/*! Mutual exclusion lock, for handing results from worker threads back to
+ *  the thread running the session.
+ */
+class Mutex
+{
+  friend class Condition;
+public:
+  /*! Constructor.
+   */
+  Mutex(void);
+  /*! Destructor.
+   */
+  ~Mutex(void);
+  /*! Locks this mutex, waiting for any other thread holding it to unlock it.
+   */
+  void lock(void);
+  /*! Unlocks this mutex.
+   */
+  void unlock(void);
+private:
+  Mutex(const Mutex& source);
+  Mutex& operator = (const Mutex& source);
+  void* mHandle;
+};
+
+//---------------------------------------------------------------------
+
+/*! Condition variable, for threads waiting on each other to produce or
+ *  consume work.
+ */
+class Condition
+{
+public:
+  /*! Constructor.
+   */
+  Condition(void);
+  /*! Destructor.
+   */
+  ~Condition(void);
+  /*! Unlocks the specified mutex and waits until this condition is
+   *  signalled, then locks the mutex again.
+   *  @param mutex The mutex protecting the state being waited on, which
+   *  must be locked by the calling thread.
+   *  @remarks Waits may end without a signal, so the state should be checked
+   *  again afterwards.
+   */
+  void wait(Mutex& mutex);
+  /*! Wakes all threads waiting on this condition.
+   */
+  void signal(void);
+private:
+  Condition(const Condition& source);
+  Condition& operator = (const Condition& source);
+  void* mHandle;
 };
 
 //---------------------------------------------------------------------
@@ -652,6 +843,10 @@ protected:
    */
   virtual ~Node(void);
 private:
+  /*! Called by the session at the end of each update pass, after all
+   *  received commands have been processed.
+   */
+  virtual void update(void);
   static void initialize(void);
   static void receiveNodeNameSet(void* user, VNodeID ID, const char *name);
   static void receiveTagGroupCreate(void* user, VNodeID ID, uint16 groupID, const char* name);
@@ -884,6 +1079,16 @@ public:
 class GeometryLayer : public Versioned, public Observable<GeometryLayerObserver>
 {
   friend class GeometryNode;
+  friend class GeometryNormals;
+  friend class GeometryBoundsTree;
+  friend class GeometryTopology;
+  friend class GeometryEdges;
+  friend class GeometrySubdivision;
+  friend class GeometrySkinning;
+  friend class GeometryExtraction;
+  friend class GeometryImport;
+  template <VNGLayerType T>
+  friend class GeometryLayerView;
 public:
   /*! Geometry stack enumeration.
    */
@@ -950,10 +1155,129 @@ public:
   /*! @return The node containing this geometry layer.
    */
   GeometryNode& getNode(void) const;
+  /*! Retrieves the ranges of slots changed in this geometry layer since
+   *  the specified data version.
+   *  @param version The data version, as returned by getDataVersion, up to
+   *  which the caller is already up to date.
+   *  @param slots The set to add the changed slot ranges to.
+   *  @return @c true if the change history reaches back to the specified
+   *  version, or @c false if it does not, in which case all slots of the
+   *  layer are added.
+   *  @remarks All changes made between two calls to this method are kept
+   *  as a single entry, so the result may include slots that were changed
+   *  before the specified version.
+   *  @remarks The history is kept until it holds a quarter as many ranges
+   *  as the layer has slots, so polling once per Session::update reports
+   *  exactly the slots changed in between, even when they are scattered.
+   */
+  bool getChangedSlots(unsigned int version, IDRangeSet& slots) const;
+  /*! Computes the range of each element of the values in this geometry
+   *  layer, skipping the slots of deleted vertices or polygons.
+   *  @param minimum The location to store the smallest value of each element.
+   *  @param maximum The location to store the largest value of each element.
+   *  @return @c true if this is a real-valued layer with at least one valid
+   *  slot, otherwise @c false.
+   *  @remarks The arrays must have room for one value per slot element, i.e.
+   *  three for XYZ layers and four for polygon corner layers.
+   */
+  bool getValueRange(real64* minimum, real64* maximum) const;
+  /*! Converts the values of a range of slots in this geometry layer to
+   *  single precision.
+   *  @param target The location to store the converted values, packed one
+   *  slot after another.
+   *  @param firstID The ID of the first slot to convert.
+   *  @param count The number of slots to convert.
+   *  @return @c true if this is a real-valued layer, otherwise @c false.
+   *  @remarks Deleted vertices in the base vertex layer are stored as zero.
+   */
+  bool packSlots(real32* target, uint32 firstID, uint32 count) const;
+  /*! Transforms the positions in a range of slots in this XYZ geometry layer
+   *  by the specified matrix and stores them in single precision.
+   *  @param target The location to store the transformed positions, packed
+   *  as three values per slot.
+   *  @param matrix The affine transformation matrix, as 16 values in
+   *  column-major order.
+   *  @param firstID The ID of the first slot to transform.
+   *  @param count The number of slots to transform.
+   *  @return @c true if this is an XYZ layer, otherwise @c false.
+   *  @remarks The slots of deleted vertices are stored as zero.
+   */
+  bool transformSlots(real32* target, const real64* matrix, uint32 firstID, uint32 count) const;
+  /*! Copies the current contents of this geometry layer.
+   *  @param snapshot The block to store the copy in.
+   *  @remarks The snapshot shares the slot storage of this layer until
+   *  either of them is changed, so taking one costs nothing up front. The
+   *  exception is a base vertex layer kept in compact form, for which the
+   *  snapshot receives a full precision copy of the dequantized vertices.
+   *  @remarks Like any other read, this may be called from a worker thread,
+   *  but only while no session is being updated. The snapshot itself belongs
+   *  to the caller, and may be read, changed or destroyed on any one thread
+   *  at any time, even while the layer is being changed. The share count
+   *  between the two is updated atomically.
+   */
+  void getSnapshot(Block& snapshot) const;
+  /*! Compares this geometry layer to a previously retrieved snapshot.
+   *  @param snapshot The snapshot to compare against.
+   *  @param slots The set to add the IDs of all slots that differ to.
+   */
+  void compareSnapshot(const Block& snapshot, IDRangeSet& slots) const;
+  /*! @return A hash of the type, default values and slots of this geometry
+   *  layer, up to the highest valid vertex or polygon.
+   *  @remarks The hash is kept per run of 1024 slots, and only the runs
+   *  changed since the last call are hashed again.
+   *  @remarks The name of the layer is not included.
+   */
+  uint32 getContentHash(void);
+  /*! Makes this geometry layer share the slot storage of another one with
+   *  identical contents, until either of them is changed.
+   *  @param source The geometry layer to share storage with.
+   *  @return @c true if the storage is now shared, or @c false if the
+   *  layers differ in type, default values or contents.
+   */
+  bool share(GeometryLayer& source);
+  /*! @return @c true if the slot storage of this geometry layer is shared
+   *  with another one, otherwise @c false.
+   */
+  bool isShared(void) const;
+  /*! @return @c true if the slot storage of this geometry layer is kept in
+   *  a memory-mapped file, otherwise @c false.
+   */
+  bool isMapped(void) const;
+  /*! @return The quantized slots of this geometry layer, or @c NULL if it
+   *  is not a base vertex layer kept in compact form.
+   */
+  const GeometryQuantization* getQuantization(void) const;
 private:
+  class SlotChange
+  {
+  public:
+    typedef std::vector<IDRange> RangeList;
+    SlotChange(unsigned int version);
+    unsigned int mVersion;
+    RangeList mRanges;
+  };
+  typedef std::deque<SlotChange> ChangeList;
+  typedef std::map<uint32, size_t> StagedSlotMap;
   GeometryLayer(VLayerID ID, const std::string& name, VNGLayerType type,
 		GeometryNode& node, uint32 defaultInt, real64 defaultReal);
+  ~GeometryLayer(void);
   void reserve(size_t slotCount);
+  void readSlot(uint32 slotID, void* data) const;
+  bool cloneSlot(uint32 sourceID, uint32 targetID);
+  void shrink(void);
+  bool isConvertible(VNGLayerType type) const;
+  void convert(VNGLayerType type);
+  void convertSlots(const Block& source, Block& target, VNGLayerType type) const;
+  void notifySetSlot(uint32 slotID, const void* data);
+  void flushSlots(void);
+  void recordSlotChange(uint32 slotID);
+  bool stageSlot(uint32 slotID, const void* data);
+  void flushStagedSlots(void);
+  uint32 getSlotLimit(void) const;
+  size_t getStoredSlotCount(void) const;
+  const real64* getRealSlots(Block& expanded, uint32 firstID, uint32 count) const;
+  void setCompactBits(unsigned int bits);
+  void discardChanges(void);
   static void initialize(void);
   static void receiveVertexSetXyzReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real32 x, real32 y, real32 z);
   static void receiveVertexDeleteReal32(void* user, VNodeID nodeID, uint32 vertexID);
@@ -972,6 +1296,8 @@ private:
   static void receivePolygonSetFaceReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real32 value);
   static unsigned int getTypeSize(VNGLayerType type);
   static unsigned int getTypeElementCount(VNGLayerType type);
+  static void hashChunks(void* data, uint32 first, uint32 count);
+  typedef std::vector<uint32> HashList;
   Block mData;
   VLayerID mID;
   std::string mName;
@@ -981,6 +1307,20 @@ private:
   GeometryNode& mNode;
   uint32 mDefaultInt;
   real64 mDefaultReal;
+  IDRangeSet mChangedSlots;
+  ChangeList mChanges;
+  unsigned int mChangeBase;
+  size_t mChangeRangeCount;
+  mutable bool mChangesPolled;
+  StagedSlotMap mStagedSlots;
+  Block mStagedData;
+  size_t mStagedCount;
+  bool mReplaying;
+  HashList mChunkHashes;
+  unsigned int mHashVersion;
+  uint32 mHashLimit;
+  bool mHashValid;
+  GeometryQuantization* mQuantization;
 };
 
 //---------------------------------------------------------------------
@@ -990,56 +1330,403 @@ private:
 class GeometryLayerObserver : public Observer<GeometryLayerObserver>
 {
 public:
+  /*! Constructor.
+   */
+  GeometryLayerObserver(void);
   /*! Called before a slot is changed in an observed geometry layer.
    *  @param layer The observed geometry layer.
    *  @param slotID The ID of the slot to be changed.
    *  @param data The data to be written to the slot.
+   *  @remarks This is not called for batched observers.
    */
   virtual void onSetSlot(GeometryLayer& layer, uint32 slotID, const void* data);
+  /*! Called at the end of an update pass for each range of slots changed
+   *  in an observed geometry layer during that pass.
+   *  @param layer The observed geometry layer.
+   *  @param firstID The ID of the first changed slot.
+   *  @param count The number of changed slots.
+   *  @remarks This is only called for batched observers.
+   *  @remarks The new slot data is already in place when this is called.
+   */
+  virtual void onSetSlots(GeometryLayer& layer, uint32 firstID, uint32 count);
   /*! Called before an observed geometry layer has its name changed.
    *  @param layer The observed geometry layer.
    *  @param name The new name of the geometry layer.
    */
   virtual void onSetName(GeometryLayer& layer, const std::string& name);
+  /*! Called before an observed geometry layer has its slots converted to
+   *  another type.
+   *  @param layer The observed geometry layer.
+   *  @param type The new slot type of the geometry layer.
+   */
+  virtual void onSetType(GeometryLayer& layer, VNGLayerType type);
   /*! Called before an observed geometry layer is destroyed.
    *  @param layer The geometry layer to be destroyed.
    */
   virtual void onDestroy(GeometryLayer& layer);
+  /*! @return @c true if this observer receives slot changes in batches,
+   *  otherwise @c false.
+   */
+  bool isBatched(void) const;
+  /*! Controls whether this observer receives slot changes one by one,
+   *  through onSetSlot, or once per update pass, through onSetSlots.
+   *  @param enabled @c true to receive batched notifications.
+   */
+  void setBatched(bool enabled);
+private:
+  bool mBatched;
+};
+
+//---------------------------------------------------------------------
+
+/*! Compile-time description of the slots of a geometry layer type.
+ *  @remarks Element is the type of a single value and Slot the type of a
+ *  whole slot, which is an array for layers with several values per slot.
+ *  Real values are always stored as 64-bit, whatever the layer format.
+ */
+template <>
+class GeometryLayerTraits<VN_G_LAYER_VERTEX_XYZ>
+{
+public:
+  typedef real64 Element;
+  typedef real64 Slot[3];
+  enum { ELEMENT_COUNT = 3 };
+};
+
+template <>
+class GeometryLayerTraits<VN_G_LAYER_VERTEX_UINT32>
+{
+public:
+  typedef uint32 Element;
+  typedef uint32 Slot;
+  enum { ELEMENT_COUNT = 1 };
+};
+
+template <>
+class GeometryLayerTraits<VN_G_LAYER_VERTEX_REAL>
+{
+public:
+  typedef real64 Element;
+  typedef real64 Slot;
+  enum { ELEMENT_COUNT = 1 };
+};
+
+template <>
+class GeometryLayerTraits<VN_G_LAYER_POLYGON_CORNER_UINT32>
+{
+public:
+  typedef uint32 Element;
+  typedef uint32 Slot[4];
+  enum { ELEMENT_COUNT = 4 };
+};
+
+template <>
+class GeometryLayerTraits<VN_G_LAYER_POLYGON_CORNER_REAL>
+{
+public:
+  typedef real64 Element;
+  typedef real64 Slot[4];
+  enum { ELEMENT_COUNT = 4 };
+};
+
+template <>
+class GeometryLayerTraits<VN_G_LAYER_POLYGON_FACE_UINT8>
+{
+public:
+  typedef uint8 Element;
+  typedef uint8 Slot;
+  enum { ELEMENT_COUNT = 1 };
+};
+
+template <>
+class GeometryLayerTraits<VN_G_LAYER_POLYGON_FACE_UINT32>
+{
+public:
+  typedef uint32 Element;
+  typedef uint32 Slot;
+  enum { ELEMENT_COUNT = 1 };
+};
+
+template <>
+class GeometryLayerTraits<VN_G_LAYER_POLYGON_FACE_REAL>
+{
+public:
+  typedef real64 Element;
+  typedef real64 Slot;
+  enum { ELEMENT_COUNT = 1 };
+};
+
+//---------------------------------------------------------------------
+
+/*! Read-only view of the stored slots of a geometry layer, with the slot
+ *  type fixed at compile time. Access through a view is a plain memory read,
+ *  without the type dispatch done by GeometryLayer::getSlot.
+ *  @remarks A view made from a layer of another type is empty and invalid,
+ *  as is a view of a base vertex layer kept in compact form.
+ *  @remarks Slots at or beyond the slot count are not stored, and hold the
+ *  defaults of the layer.
+ *  @remarks Slots of deleted vertices and polygons are stored as is. Use
+ *  GeometryNode::isVertex and GeometryNode::isPolygon to skip them.
+ *  @remarks A view must not be kept across Session::update, nor across any
+ *  other change to the layer.
+ */
+template <VNGLayerType T>
+class GeometryLayerView
+{
+public:
+  typedef GeometryLayerTraits<T> Traits;
+  typedef typename Traits::Element Element;
+  typedef typename Traits::Slot Slot;
+  typedef const Slot* Iterator;
+  /*! Constructor. Creates an empty, invalid view.
+   */
+  inline GeometryLayerView(void);
+  /*! Constructor. Creates a view of the specified layer.
+   *  @param layer The layer to view.
+   *  @remarks The resulting view is only valid if the layer is of type T.
+   */
+  inline explicit GeometryLayerView(const GeometryLayer& layer);
+  /*! @param slotID The ID of the desired slot, which must be less than the
+   *  slot count.
+   *  @return The specified slot.
+   */
+  inline const Slot& operator [] (uint32 slotID) const;
+  /*! @return An iterator to the first stored slot.
+   */
+  inline Iterator begin(void) const;
+  /*! @return An iterator past the last stored slot.
+   */
+  inline Iterator end(void) const;
+  /*! @return @c true if this view was made from a layer of type T,
+   *  otherwise @c false.
+   */
+  inline bool isValid(void) const;
+  /*! @return @c true if the specified slot is stored, otherwise @c false.
+   */
+  inline bool isStored(uint32 slotID) const;
+  /*! @return The number of stored slots.
+   */
+  inline uint32 getSlotCount(void) const;
+  /*! @return The values of all stored slots, in slot order.
+   */
+  inline const Element* getElements(void) const;
+private:
+  const Slot* mSlots;
+  uint32 mSlotCount;
+  bool mValid;
 };
 
 //---------------------------------------------------------------------
 
+template <VNGLayerType T>
+inline GeometryLayerView<T>::GeometryLayerView(void):
+  mSlots(NULL),
+  mSlotCount(0),
+  mValid(false)
+{
+}
+
+template <VNGLayerType T>
+inline GeometryLayerView<T>::GeometryLayerView(const GeometryLayer& layer):
+  mSlots(NULL),
+  mSlotCount(0),
+  mValid(false)
+{
+  if (layer.getType() != T || layer.getSlotSize() != sizeof(Slot))
+    return;
+
+  if (layer.getQuantization())
+    return;
+
+  mSlots = reinterpret_cast<const Slot*>(layer.mData.getitems());
+  mSlotCount = layer.mData.getItemCount();
+  mValid = true;
+}
+
+template <VNGLayerType T>
+inline const typename GeometryLayerView<T>::Slot& GeometryLayerView<T>::operator [] (uint32 slotID) const
+{
+  return mSlots[slotID];
+}
+
+template <VNGLayerType T>
+inline typename GeometryLayerView<T>::Iterator GeometryLayerView<T>::begin(void) const
+{
+  return mSlots;
+}
+
+template <VNGLayerType T>
+inline typename GeometryLayerView<T>::Iterator GeometryLayerView<T>::end(void) const
+{
+  return mSlots + mSlotCount;
+}
+
+template <VNGLayerType T>
+inline bool GeometryLayerView<T>::isValid(void) const
+{
+  return mValid;
+}
+
+template <VNGLayerType T>
+inline bool GeometryLayerView<T>::isStored(uint32 slotID) const
+{
+  return slotID < mSlotCount;
+}
+
+template <VNGLayerType T>
+inline uint32 GeometryLayerView<T>::getSlotCount(void) const
+{
+  return mSlotCount;
+}
+
+template <VNGLayerType T>
+inline const typename GeometryLayerView<T>::Element* GeometryLayerView<T>::getElements(void) const
+{
+  return reinterpret_cast<const Element*>(mSlots);
+}
+
+//---------------------------------------------------------------------
+
+typedef GeometryLayerView<VN_G_LAYER_VERTEX_XYZ> VertexXyzView;
+typedef GeometryLayerView<VN_G_LAYER_VERTEX_UINT32> VertexUint32View;
+typedef GeometryLayerView<VN_G_LAYER_VERTEX_REAL> VertexRealView;
+typedef GeometryLayerView<VN_G_LAYER_POLYGON_CORNER_UINT32> CornerUint32View;
+typedef GeometryLayerView<VN_G_LAYER_POLYGON_CORNER_REAL> CornerRealView;
+typedef GeometryLayerView<VN_G_LAYER_POLYGON_FACE_UINT8> FaceUint8View;
+typedef GeometryLayerView<VN_G_LAYER_POLYGON_FACE_UINT32> FaceUint32View;
+typedef GeometryLayerView<VN_G_LAYER_POLYGON_FACE_REAL> FaceRealView;
+
+//---------------------------------------------------------------------
+
+/*! Geometry node bone class. Represents a single bone in a geometry node.
+ *  @remarks A bone influences the vertices whose slot in its reference layer
+ *  holds its ID, by the amount in its weight layer. If it has no reference
+ *  layer, it influences every vertex by its weight, and if it has no weight
+ *  layer, it influences every referencing vertex fully.
+ */
 class Bone : public Observable<BoneObserver>
 {
+  friend class GeometryNode;
 public:
+  /*! Destroys this bone.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
   void destroy(void);
+  /*! @return The ID of this bone.
+   */
+  uint16 getID(void) const;
+  /*! @return The ID of the parent of this bone, or @c INVALID_BONE_ID if
+   *  it is a root bone.
+   */
+  uint16 getParentID(void) const;
+  /*! @return The parent of this bone, or @c NULL if it is a root bone or
+   *  the parent doesn't exist.
+   */
+  Bone* getParent(void) const;
+  /*! Sets the parent of this bone.
+   *  @param parentID The ID of the desired parent, or @c INVALID_BONE_ID
+   *  to make this a root bone.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
+  void setParent(uint16 parentID);
+  /*! @return The name of the vertex layer containing the weights of this
+   *  bone.
+   */
+  const std::string& getWeightLayerName(void) const;
+  /*! @return The vertex layer containing the weights of this bone, or @c
+   *  NULL if no such real-valued layer exists.
+   */
+  GeometryLayer* getWeightLayer(void) const;
+  /*! Sets the name of the vertex layer containing the weights of this bone.
+   *  @param name The name of the desired weight layer.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
+  void setWeightLayer(const std::string& name);
+  /*! @return The name of the vertex layer containing the bone references
+   *  for this bone.
+   */
+  const std::string& getReferenceLayerName(void) const;
+  /*! @return The vertex layer containing the bone references for this
+   *  bone, or @c NULL if no such integer layer exists.
+   */
+  GeometryLayer* getReferenceLayer(void) const;
+  /*! Sets the name of the vertex layer containing the bone references for
+   *  this bone.
+   *  @param name The name of the desired reference layer.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
+  void setReferenceLayer(const std::string& name);
+  /*! @return The rest position of this bone, relative to its parent.
+   */
   const Vector3d getPosition(void) const;
+  /*! Sets the rest position of this bone, relative to its parent.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
   void setPosition(const Vector3d& position);
+  /*! @return The rest rotation of this bone, relative to its parent.
+   */
   const Quaternion64 getRotation(void) const;
+  /*! Sets the rest rotation of this bone, relative to its parent.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
   void setRotation(const Quaternion64& rotation);
+  /*! @return The label of the animation curve driving this bone.
+   */
   const std::string& getCurveLabel(void) const;
+  /*! Sets the label of the animation curve driving this bone.
+   *  @remarks The curve label is not part of the bone command, so this is
+   *  only kept locally.
+   */
   void setCurveLabel(const std::string& label);
-  uint16 getID(void) const;
+  /*! @return The geometry node containing this bone.
+   */
+  GeometryNode& getNode(void) const;
 private:
-  Bone(uint16 ID,
-       const std::string& weight,
-       const std::string& reference,
-       const Vector3d& position,
-       const Quaternion64& rotation,
-       const std::string& curveLabel);
+  Bone(uint16 ID, GeometryNode& node);
+  void sendData(void);
+  class Data
+  {
+  public:
+    std::string mWeight;
+    std::string mReference;
+    uint16 mParentID;
+    Vector3d mPosition;
+    Quaternion64 mRotation;
+  };
+  Data mState;
+  Data mCache;
   uint16 mID;
-  std::string mWeight;
-  std::string mReference;
-  Vector3d mPosition;
-  Quaternion64 mRotation;
   std::string mCurveLabel;
+  GeometryNode& mNode;
 };
 
 //---------------------------------------------------------------------
 
+/*! Observer interface for geometry node bones.
+ */
 class BoneObserver : public Observer<BoneObserver>
 {
 public:
+  /*! Called after an observed bone has its parent, layers, position or
+   *  rotation changed.
+   *  @param bone The changed bone.
+   */
+  virtual void onChange(Bone& bone);
+  /*! Called before an observed bone is destroyed.
+   *  @param bone The bone to be destroyed.
+   */
   virtual void onDestroy(Bone& bone);
 };
 
@@ -1050,8 +1737,23 @@ public:
 class GeometryNode : public Node
 {
   friend class GeometryLayer;
+  friend class GeometryNormals;
+  friend class GeometryBoundsTree;
+  friend class GeometryTopology;
+  friend class GeometryEdges;
+  friend class GeometrySubdivision;
+  friend class GeometrySkinning;
+  friend class GeometrySimplification;
+  friend class GeometryBatch;
+  friend class GeometryExtraction;
   friend class Session;
 public:
+  /*! Progress function type for long-running operations.
+   *  @param data The user data pointer passed along with the function.
+   *  @param done The number of steps completed so far.
+   *  @param total The total number of steps.
+   */
+  typedef void (*ProgressFunction)(void* data, uint32 done, uint32 total);
   /*! Creates a geometry layer in this node.
    *  @param name The desired name of the geometry layer.
    *  @param type The desired slot type of the geometry layer.
@@ -1069,8 +1771,87 @@ public:
    *  @param mesh The mesh to receive the constructed geometry.
    *  @return @c true if successful, or @c false if no valid geometry was available.
    *  @remarks This method is intended to make geometry extraction easier.
+   *  @remarks Vertices not used by any valid polygon are not included.
    */
   bool getBaseMesh(BaseMesh& mesh);
+  /*! Makes the base layers of this geometry node match the specified mesh,
+   *  sending only the vertices and polygons that differ from the current
+   *  ones, followed by the deletion of any that are left over.
+   *  @param mesh The desired geometry.
+   *  @param keepLooseVertices Whether to keep current vertices that are not
+   *  used by any polygon and not matched by the mesh, or to treat them as
+   *  left over.
+   *  @param function The function to call with the progress of the upload,
+   *  or @c NULL.
+   *  @param data The user data pointer to pass to the progress function.
+   *  @return @c true if successful, or @c false if the mesh references
+   *  vertices it does not contain.
+   *  @remarks Vertices of the mesh are first matched to current vertices
+   *  at the exact same position, and polygons to current polygons with the
+   *  same corners, so inserting or removing elements does not cause the
+   *  others to be resent. Elements without a match take over the IDs of
+   *  unmatched current elements, starting with the one at the same index
+   *  in getBaseMesh order, and are given the lowest free IDs once those
+   *  run out.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
+  bool setBaseMesh(const BaseMesh& mesh,
+                   bool keepLooseVertices = true,
+                   ProgressFunction function = NULL,
+                   void* data = NULL);
+  /*! Writes the current state of this geometry node to a binary PLY file.
+   *  @param path The path of the file to write.
+   *  @return @c true if successful, or @c false if the base layers are
+   *  missing or the file could not be written.
+   *  @remarks All valid vertices are written, in the order of their IDs,
+   *  followed by all valid polygons. Every other geometry layer is written
+   *  as one property per element of its slots, named after the layer.
+   *  Whitespace and other unprintable characters in layer names are
+   *  written as underscores, and names that would collide with another
+   *  property of the same element are given a numeric suffix.
+   *  @remarks The slots are streamed straight from the layers through a
+   *  large buffer, so no copy of the geometry is made.
+   */
+  bool exportPLY(const std::string& path) const;
+  /*! Creates a bone in this geometry node.
+   *  @param parentID The ID of the parent bone, or @c INVALID_BONE_ID to
+   *  create a root bone.
+   *  @param weight The name of the vertex layer containing the weights of
+   *  the bone.
+   *  @param reference The name of the vertex layer containing the bone
+   *  references for the bone.
+   *  @param position The rest position of the bone, relative to its parent.
+   *  @param rotation The rest rotation of the bone, relative to its parent.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update.
+   */
+  void createBone(uint16 parentID,
+                  const std::string& weight,
+                  const std::string& reference,
+                  const Vector3d& position,
+                  const Quaternion64& rotation);
+  /*! @param ID The ID of the desired bone.
+   *  @return The bone with the specified ID, or @c NULL if no such bone exists.
+   */
+  Bone* getBoneByID(uint16 ID);
+  /*! @param ID The ID of the desired bone.
+   *  @return The bone with the specified ID, or @c NULL if no such bone exists.
+   */
+  const Bone* getBoneByID(uint16 ID) const;
+  /*! @param index The index of the desired bone.
+   *  @return The bone at the specified index, or @c NULL if no such bone exists.
+   */
+  Bone* getBoneByIndex(unsigned int index);
+  /*! @param index The index of the desired bone.
+   *  @return The bone at the specified index, or @c NULL if no such bone exists.
+   */
+  const Bone* getBoneByIndex(unsigned int index) const;
+  /*! @return The number of bones in this geometry node.
+   */
+  unsigned int getBoneCount(void) const;
   /*! @param ID The ID of the desired geometry layer.
    *  @return The geometry layer with the specified ID, or @c NULL if no such geometry layer exists.
    */
@@ -1199,9 +1980,181 @@ public:
   /*! @return The number of valid polygons.
    */
   uint32 getPolygonCount(void) const;
+  /*! @return The axis-aligned bounding box of all valid vertices in this
+   *  geometry node, or an empty box if there are none.
+   *  @remarks The bounds are maintained as vertices change, and are only
+   *  recalculated from scratch when a vertex on the boundary moves inwards
+   *  or is deleted.
+   */
+  const Box3d& getBounds(void);
+  /*! @return The normals of the base layers of this geometry node, brought
+   *  up to date with any changes received since the last call.
+   *  @remarks The normals are computed the first time this is called.
+   */
+  const GeometryNormals& getNormals(void);
+  /*! @return The bounding volume hierarchy of the polygons of this geometry
+   *  node, brought up to date with any changes received since the last call.
+   *  @remarks The hierarchy is built the first time this is called. Moved
+   *  vertices only refit the affected bounds, while changes to the polygons
+   *  or deleted vertices cause it to be rebuilt.
+   */
+  const GeometryBoundsTree& getBoundsTree(void);
+  /*! @return The half-edge topology of the polygons of this geometry node,
+   *  brought up to date with any changes received since the last call.
+   *  @remarks The topology is built the first time this is called, and is
+   *  then only patched around changed polygons and deleted vertices.
+   */
+  const GeometryTopology& getTopology(void);
+  /*! @return The unique edges of the polygons of this geometry node, with
+   *  their crease values, brought up to date with any changes received since
+   *  the last call.
+   *  @remarks The edges are extracted the first time this is called, and are
+   *  then only patched around changed polygons and creases.
+   */
+  const GeometryEdges& getEdges(void);
+  /*! @return The Catmull-Clark subdivision surface of this geometry node,
+   *  brought up to date with any changes received since the last call.
+   *  @remarks The subdivision stencils are built the first time this is
+   *  called, and are only rebuilt when the polygons or creases change.
+   */
+  const GeometrySubdivision& getSubdivision(void);
+  /*! @return The skinning of the base vertex layer of this geometry node by
+   *  its bones, brought up to date with any changes received since the last
+   *  call.
+   *  @remarks The bone influences are gathered the first time this is
+   *  called, and are only gathered again when the bones or the layers they
+   *  name change.
+   */
+  GeometrySkinning& getSkinning(void);
+  /*! @return The simplified levels of detail of this geometry node, with
+   *  a regeneration started in the background if the base layers have
+   *  changed since the levels were made.
+   *  @remarks This never waits for a regeneration to finish. Until it does,
+   *  the previous levels are kept, or none if there were none.
+   */
+  GeometrySimplification& getSimplification(void);
+  /*! @return A hash of the contents of all geometry layers in this node,
+   *  along with their IDs and names, and of the crease settings.
+   *  @remarks Nodes with equal hashes are likely, but not certain, to be
+   *  identical. Use shareLayers to find out for certain.
+   */
+  uint32 getContentHash(void);
+  /*! Makes the geometry layers in this node share the slot storage of the
+   *  layers with the same IDs in another node, wherever their contents are
+   *  identical.
+   *  @param source The geometry node to share storage with.
+   *  @return The number of layers now sharing storage.
+   *  @remarks Shared storage is copied again by whichever layer is changed
+   *  first.
+   */
+  unsigned int shareLayers(GeometryNode& source);
+  /*! Renumbers the vertices and polygons of this geometry node so that
+   *  their IDs form dense ranges starting at zero, shrinking the storage of
+   *  every layer to the live count. Only elements above the dense range are
+   *  moved, each into the lowest free ID, and only slots whose values differ
+   *  from what the target ID already holds are sent.
+   *  @param function The function to call with the progress of the
+   *  compaction, or @c NULL.
+   *  @param data The user data pointer to pass to the progress function.
+   *  @return The number of commands sent.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update. The storage of each layer shrinks once the
+   *  vertices and polygons at the old IDs have been deleted.
+   */
+  uint32 compactIDs(ProgressFunction function = NULL, void* data = NULL);
+  /*! Merges the vertices of this geometry node lying within the specified
+   *  distance of each other. Each vertex is merged into the lowest-numbered
+   *  matching vertex that is itself kept, and polygons using the merged
+   *  vertices are pointed at the kept ones before the merged vertices are
+   *  deleted.
+   *  @param tolerance The largest distance between vertices to merge, or
+   *  zero to merge only vertices at the same position.
+   *  @param function The function to call with the progress of the weld,
+   *  or @c NULL.
+   *  @param data The user data pointer to pass to the progress function.
+   *  @return The size, in bytes, of the slots of the deleted vertices and
+   *  polygons, summed over all geometry layers.
+   *  @remarks Vertices are only merged if their slots in all other vertex
+   *  layers are identical as well.
+   *  @remarks Only polygons whose corners change are sent. Polygons left
+   *  with fewer than three distinct corners are deleted, and a fourth corner
+   *  made equal to another one is dropped. Other repeated corners are kept,
+   *  so that the corner layers stay valid.
+   *  @remarks This call is asynchronous. It will not take effect
+   *  until, at the earliest, after the first subsequent call to
+   *  Session::update. The storage of each layer only shrinks once the
+   *  deleted IDs are above all remaining ones, which compactIDs ensures.
+   */
+  size_t weldVertices(real64 tolerance, ProgressFunction function = NULL, void* data = NULL);
+  /*! @return The directory in which the slot storage of large layers in
+   *  this node is mapped, or an empty string if it is kept on the heap.
+   */
+  const std::string& getStorageDirectory(void) const;
+  /*! @return The smallest layer size, in bytes, whose slot storage is
+   *  mapped.
+   */
+  size_t getStorageThreshold(void) const;
+  /*! Selects where to keep the slot storage of the layers in this node.
+   *  Layers of at least the specified size are kept in temporary files
+   *  mapped into memory, letting the operating system page out the parts
+   *  not in use, while smaller ones are kept on the heap.
+   *  @param directory The directory in which to create the files, or an
+   *  empty string to keep all layers on the heap.
+   *  @param threshold The smallest layer size, in bytes, to map.
+   *  @remarks Existing layers are moved immediately if this changes whether
+   *  they should be mapped. Layers fall back to the heap if their file cannot
+   *  be created.
+   *  @remarks Mapped layers reserve up to twice their size in their file, so
+   *  that they can grow without being copied each time.
+   */
+  void setStorage(const std::string& directory, size_t threshold = 0);
+  /*! Selects where to keep the slot storage of the layers in geometry nodes
+   *  created after this call.
+   *  @param directory The directory in which to create the files, or an
+   *  empty string to keep all layers on the heap.
+   *  @param threshold The smallest layer size, in bytes, to map.
+   */
+  static void setDefaultStorage(const std::string& directory, size_t threshold = 0);
+  /*! @return The number of bits per coordinate in which the base vertices
+   *  of this node are kept, or zero if they are kept at full precision.
+   */
+  unsigned int getCompactVertexBits(void) const;
+  /*! Selects whether to keep the base vertices of this node at full
+   *  precision or, for clients that only display geometry, in compact form,
+   *  quantized within a box around the vertices of the node.
+   *  @param bits The number of bits per coordinate, between 2 and 21, or
+   *  zero to keep full precision. Up to 16 bits take 6 bytes per vertex and
+   *  up to 21 bits take 8 bytes, instead of 24 bytes at full precision.
+   *  @remarks Received positions are quantized as they arrive, so the
+   *  positions read back differ from those sent by up to half a step of the
+   *  quantization, and more once the box has had to grow.
+   *  @remarks Existing vertices are converted immediately, and the base
+   *  vertex layer is created in this form from then on.
+   *  @remarks Compact nodes are meant for viewing. Anything that needs the
+   *  positions of all vertices at full precision, such as normals,
+   *  subdivision, skinning, export or welding, expands them temporarily each
+   *  time it is brought up to date. Compact layers never share storage.
+   */
+  void setCompactVertexBits(unsigned int bits);
+  /*! Selects the number of bits per coordinate in which to keep the base
+   *  vertices of geometry nodes created after this call.
+   *  @param bits The number of bits per coordinate, or zero to keep full
+   *  precision.
+   */
+  static void setDefaultCompactVertexBits(unsigned int bits);
+  /*! @return The quantized base vertices of this node, or @c NULL if they
+   *  are kept at full precision or there is no base vertex layer.
+   */
+  const GeometryQuantization* getQuantization(void) const;
 private:
   GeometryNode(VNodeID ID, VNodeOwner owner, Session& session);
   ~GeometryNode(void);
+  void update(void);
+  void flushStagedSlots(void);
+  void notifyChangeBaseVertex(uint32 vertexID, const BaseVertex& vertex);
+  void notifyChangeBasePolygon(uint32 polygonID, const BasePolygon& polygon);
+  void changeBounds(const BaseVertex* previous, const BaseVertex* vertex);
   static void initialize(void);
   static void receiveGeometryLayerCreate(void* data, VNodeID ID, VLayerID layerID, const char* name, VNGLayerType type, uint32 defaultInt, real64 defaultReal);
   static void receiveGeometryLayerDestroy(void* data, VNodeID ID, VLayerID layerID);
@@ -1213,8 +2166,10 @@ private:
   static void receiveVertexDeleteReal64(void* user, VNodeID nodeID, uint32 vertexID);
   typedef std::vector<bool> ValidityMap;
   typedef std::vector<GeometryLayer*> LayerList;
+  typedef std::vector<Bone*> BoneList;
   typedef std::map<uint32,uint32> VertexIndexMap;
   LayerList mLayers;
+  BoneList mBones;
   GeometryLayer* mBaseVertexLayer;
   GeometryLayer* mBasePolygonLayer;
   ValidityMap mValidVertices;
@@ -1229,6 +2184,23 @@ private:
   uint32 mFirstFreePolygonID;
   uint32 mVertexCount;
   uint32 mPolygonCount;
+  IDRangeSet mChangedVertices;
+  IDRangeSet mChangedPolygons;
+  Box3d mBounds;
+  bool mBoundsDirty;
+  GeometryNormals* mNormals;
+  GeometryBoundsTree* mBoundsTree;
+  GeometryTopology* mTopology;
+  GeometryEdges* mEdges;
+  GeometrySubdivision* mSubdivision;
+  GeometrySkinning* mSkinning;
+  GeometrySimplification* mSimplification;
+  std::string mStorageDirectory;
+  size_t mStorageThreshold;
+  unsigned int mCompactVertexBits;
+  static std::string msStorageDirectory;
+  static size_t msStorageThreshold;
+  static unsigned int msCompactVertexBits;
 };
 
 //---------------------------------------------------------------------
@@ -1238,6 +2210,9 @@ private:
 class GeometryNodeObserver : public NodeObserver
 {
 public:
+  /*! Constructor.
+   */
+  GeometryNodeObserver(void);
   /*! Called after a new vertex is created in an observed geometry node.
    *  @param node The geometry node in which the vertex was created.
    *  @param vertexID The ID of the newly created vertex.
@@ -1248,8 +2223,18 @@ public:
    *  @param node The node containing the vertex to be changed.
    *  @param vertexID The ID of the vertex to be changed.
    *  @param vertex The new base layer data for the vertex.
+   *  @remarks This is not called for batched observers.
    */
   virtual void onChangeBaseVertex(GeometryNode& node, uint32 vertexID, const BaseVertex& vertex);
+  /*! Called at the end of an update pass for each range of vertices whose
+   *  base layer data was changed in an observed geometry node during that pass.
+   *  @param node The node containing the changed vertices.
+   *  @param firstID The ID of the first changed vertex.
+   *  @param count The number of changed vertices.
+   *  @remarks This is only called for batched observers.
+   *  @remarks Vertices in the range may have been deleted after being changed.
+   */
+  virtual void onChangeBaseVertices(GeometryNode& node, uint32 firstID, uint32 count);
   /*! Called before a vertex is deleted in an observed geometry node.
    *  @param node The geometry node containing the vertex to be deleted.
    *  @param vertexID The ID of the vertex to be deleted.
@@ -1265,8 +2250,18 @@ public:
    *  @param node The node containing the polygon to be changed.
    *  @param polygonID The ID of the polygon to be changed.
    *  @param polygon The new base layer data for the polygon.
+   *  @remarks This is not called for batched observers.
    */
   virtual void onChangeBasePolygon(GeometryNode& node, uint32 polygonID, const BasePolygon& polygon);
+  /*! Called at the end of an update pass for each range of polygons whose
+   *  base layer data was changed in an observed geometry node during that pass.
+   *  @param node The node containing the changed polygons.
+   *  @param firstID The ID of the first changed polygon.
+   *  @param count The number of changed polygons.
+   *  @remarks This is only called for batched observers.
+   *  @remarks Polygons in the range may have been deleted after being changed.
+   */
+  virtual void onChangeBasePolygons(GeometryNode& node, uint32 firstID, uint32 count);
   /*! Called before a polygon is deleted in an observed geometry node.
    *  @param node The geometry node containing the polygon to be deleted.
    *  @param polygonID The ID of the polygon to be deleted.
@@ -1282,6 +2277,993 @@ public:
    *  @param layer The geometry layer to be destroyed.
    */
   virtual void onDestroyLayer(GeometryNode& node, GeometryLayer& layer);
+  /*! Called after a new bone is created in an observed node.
+   *  @param node The node in which the bone was created.
+   *  @param bone The newly created bone.
+   */
+  virtual void onCreateBone(GeometryNode& node, Bone& bone);
+  /*! Called before a bone is destroyed in an observed node.
+   *  @param node The node containing the bone to be destroyed.
+   *  @param bone The bone to be destroyed.
+   */
+  virtual void onDestroyBone(GeometryNode& node, Bone& bone);
+  /*! @return @c true if this observer receives base layer changes in
+   *  batches, otherwise @c false.
+   */
+  bool isBatched(void) const;
+  /*! Controls whether this observer receives base layer changes one by
+   *  one, through onChangeBaseVertex and onChangeBasePolygon, or once per
+   *  update pass, through onChangeBaseVertices and onChangeBasePolygons.
+   *  @param enabled @c true to receive batched notifications.
+   *  @remarks Creation and deletion notifications are never batched.
+   */
+  void setBatched(bool enabled);
+private:
+  bool mBatched;
+};
+
+//---------------------------------------------------------------------
+
+/*! Normal cache for geometry nodes. Holds face normals, area-weighted
+ *  vertex normals and per-corner normals that respect hard edges.
+ *  @remarks An edge is hard if its value in the edge crease layer is at or
+ *  above the hard crease threshold. Corner normals only average the faces
+ *  around a vertex that are connected through smooth edges.
+ */
+class GeometryNormals
+{
+  friend class GeometryNode;
+public:
+  /*! @param polygonID The ID of the desired polygon.
+   *  @return The unit normal of the specified polygon, or a zero vector if
+   *  no such polygon exists.
+   */
+  const Vector3d& getFaceNormal(uint32 polygonID) const;
+  /*! @param vertexID The ID of the desired vertex.
+   *  @return The area-weighted unit normal of the specified vertex, ignoring
+   *  hard edges, or a zero vector if no such vertex exists.
+   */
+  const Vector3d& getVertexNormal(uint32 vertexID) const;
+  /*! @param polygonID The ID of the desired polygon.
+   *  @param corner The index of the desired corner.
+   *  @return The unit normal of the specified polygon corner, or a zero
+   *  vector if no such corner exists.
+   */
+  const Vector3d& getCornerNormal(uint32 polygonID, unsigned int corner) const;
+  /*! @return The smallest edge crease value considered a hard edge.
+   */
+  uint32 getHardCreaseThreshold(void) const;
+  /*! Sets the smallest edge crease value considered a hard edge.
+   *  @param threshold The desired threshold.
+   *  @remarks This takes effect the next time the normals are updated.
+   */
+  void setHardCreaseThreshold(uint32 threshold);
+  /*! @return The geometry node these normals belong to.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  typedef std::vector<Vector3d> NormalList;
+  typedef std::vector<uint32> IDList;
+  GeometryNormals(GeometryNode& node);
+  void update(void);
+  void rebuild(void);
+  void refresh(const IDRangeSet& vertices);
+  void buildIncidence(void);
+  void computeFaces(void);
+  void computeVertices(void);
+  unsigned int getCornerCount(uint32 polygonID) const;
+  uint32 getCrease(uint32 polygonID, unsigned int corner) const;
+  static void computeFaceRange(void* data, uint32 first, uint32 count);
+  static void computeVertexRange(void* data, uint32 first, uint32 count);
+  GeometryNode& mNode;
+  Block mVertexData;
+  const BaseVertex* mVertices;
+  const BasePolygon* mPolygons;
+  const uint32* mCreases;
+  uint32 mCreaseCount;
+  uint32 mDefaultCrease;
+  uint32 mVertexCount;
+  uint32 mPolygonCount;
+  uint32 mThreshold;
+  bool mThresholdChanged;
+  NormalList mFaceAreas;
+  NormalList mFaceNormals;
+  NormalList mVertexNormals;
+  NormalList mCornerNormals;
+  IDList mIncidenceStarts;
+  IDList mIncidence;
+  IDList mFaceQueue;
+  IDList mVertexQueue;
+  const GeometryLayer* mCreaseLayer;
+  unsigned int mNodeVersion;
+  unsigned int mStructureVersion;
+  unsigned int mVertexVersion;
+  unsigned int mPolygonVersion;
+  unsigned int mCreaseVersion;
+  bool mValid;
+};
+
+//---------------------------------------------------------------------
+
+/*! Bounding volume hierarchy over the polygons of a geometry node, for
+ *  picking and proximity queries. Quads are treated as two triangles
+ *  sharing the edge between the first and third corners.
+ */
+class GeometryBoundsTree
+{
+  friend class GeometryNode;
+public:
+  typedef std::vector<uint32> PolygonIDList;
+  /*! Finds the first polygon hit by the specified ray.
+   *  @param origin The origin of the ray.
+   *  @param direction The direction of the ray.
+   *  @param polygonID [out] The ID of the polygon hit.
+   *  @param distance [out] The distance along the ray to the hit, in units
+   *  of the length of the direction vector.
+   *  @return @c true if a polygon was hit, otherwise @c false.
+   */
+  bool castRay(const Vector3d& origin,
+               const Vector3d& direction,
+	       uint32& polygonID,
+	       real64& distance) const;
+  /*! Finds the point on any polygon closest to the specified point.
+   *  @param point The point to search from.
+   *  @param polygonID [out] The ID of the polygon containing the closest
+   *  point.
+   *  @param nearest [out] The closest point.
+   *  @return @c true if a point was found, or @c false if there are no
+   *  polygons.
+   */
+  bool findNearestPoint(const Vector3d& point,
+                        uint32& polygonID,
+			Vector3d& nearest) const;
+  /*! Finds the polygons whose bounds overlap the specified box.
+   *  @param box The box to test against.
+   *  @param polygons [out] The IDs of the overlapping polygons.
+   *  @remarks The test is against the bounds of each polygon, so polygons
+   *  passing near a corner of the box may be included.
+   */
+  void findOverlaps(const Box3d& box, PolygonIDList& polygons) const;
+  /*! @return The bounds of all polygons in this hierarchy, or an empty box if
+   *  there are none.
+   */
+  const Box3d& getBounds(void) const;
+  /*! @return The geometry node this hierarchy belongs to.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  class Branch
+  {
+  public:
+    Box3d mBounds;
+    uint32 mFirst;
+    uint32 mCount;
+  };
+  class Task
+  {
+  public:
+    uint32 mIndex;
+    uint32 mFirst;
+    uint32 mCount;
+  };
+  typedef std::vector<Branch> BranchList;
+  typedef std::vector<Task> TaskList;
+  typedef std::vector<Vector3d> PointList;
+  typedef std::vector<uint32> IndexList;
+  typedef std::vector<uint8> FlagList;
+  GeometryBoundsTree(GeometryNode& node);
+  void update(void);
+  void rebuild(void);
+  void refit(const IDRangeSet* vertices);
+  void indexVertices(void);
+  void split(uint32 index, uint32 first, uint32 count, unsigned int levels);
+  unsigned int getCornerCount(uint32 polygonID) const;
+  Vector3d getPosition(uint32 vertexID) const;
+  static uint32 getBranchCount(uint32 count);
+  static void computeCentroidRange(void* data, uint32 first, uint32 count);
+  static void splitRange(void* data, uint32 first, uint32 count);
+  static void refitRange(void* data, uint32 first, uint32 count);
+  GeometryNode& mNode;
+  const BaseVertex* mVertices;
+  const BasePolygon* mPolygons;
+  uint32 mVertexCount;
+  uint32 mPolygonCount;
+  BranchList mBranches;
+  PolygonIDList mPrimitives;
+  PointList mCentroids;
+  TaskList mTasks;
+  IndexList mLeaves;
+  IndexList mParents;
+  IndexList mVertexLeafOffsets;
+  IndexList mVertexLeaves;
+  IndexList mRefitLeaves;
+  IndexList mRefitBranches;
+  FlagList mDirty;
+  unsigned int mStructureVersion;
+  unsigned int mVertexVersion;
+  unsigned int mPolygonVersion;
+  bool mValid;
+};
+
+//---------------------------------------------------------------------
+
+/*! Half-edge topology cache for geometry nodes. Each polygon corner owns the
+ *  half-edge running from that corner to the next, so the ID of a half-edge
+ *  is the ID of its polygon times four plus the index of its corner.
+ *  @remarks An edge shared by more than two polygons, or by two polygons
+ *  with the same winding, is treated as a boundary edge on all sides.
+ */
+class GeometryTopology
+{
+  friend class GeometryNode;
+public:
+  /*! @param polygonID The ID of the desired polygon.
+   *  @return The half-edge of the first corner of the specified polygon, or
+   *  @c INVALID_EDGE_ID if no such polygon exists.
+   */
+  uint32 getPolygonEdge(uint32 polygonID) const;
+  /*! @param vertexID The ID of the desired vertex.
+   *  @return A half-edge starting at the specified vertex, or @c
+   *  INVALID_EDGE_ID if it is not used by any polygon.
+   *  @remarks If the vertex is on a boundary, a boundary half-edge is
+   *  returned. The twin of the previous half-edge of an outgoing half-edge
+   *  is the next outgoing half-edge around the same vertex.
+   */
+  uint32 getVertexEdge(uint32 vertexID) const;
+  /*! @return The next half-edge around the polygon of the specified
+   *  half-edge.
+   */
+  uint32 getNextEdge(uint32 edgeID) const;
+  /*! @return The previous half-edge around the polygon of the specified
+   *  half-edge.
+   */
+  uint32 getPreviousEdge(uint32 edgeID) const;
+  /*! @return The oppositely directed half-edge of the neighboring polygon,
+   *  or @c INVALID_EDGE_ID if the specified half-edge is on a boundary.
+   */
+  uint32 getTwinEdge(uint32 edgeID) const;
+  /*! @return The ID of the vertex the specified half-edge starts at.
+   */
+  uint32 getEdgeOrigin(uint32 edgeID) const;
+  /*! @return The ID of the vertex the specified half-edge ends at.
+   */
+  uint32 getEdgeTarget(uint32 edgeID) const;
+  /*! @return The ID of the polygon the specified half-edge belongs to.
+   */
+  uint32 getEdgePolygon(uint32 edgeID) const;
+  /*! @return @c true if the specified half-edge is part of a valid polygon,
+   *  otherwise @c false.
+   */
+  bool isValidEdge(uint32 edgeID) const;
+  /*! @return @c true if the specified half-edge has no twin, otherwise @c
+   *  false.
+   */
+  bool isBoundaryEdge(uint32 edgeID) const;
+  /*! @return @c true if the specified vertex is used by a boundary
+   *  half-edge, otherwise @c false.
+   */
+  bool isBoundaryVertex(uint32 vertexID) const;
+  /*! @param polygonID The ID of the desired polygon.
+   *  @return The number of corners of the specified polygon, or zero if no
+   *  such polygon exists.
+   */
+  unsigned int getCornerCount(uint32 polygonID) const;
+  /*! @return The geometry node this topology belongs to.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  typedef std::pair<uint32,uint32> VertexPair;
+  typedef std::multimap<VertexPair,uint32> EdgeMap;
+  typedef std::vector<uint32> IDList;
+  typedef std::vector<uint8> CountList;
+  typedef std::vector<VertexPair> PairList;
+  typedef std::set<uint32> IDSet;
+  GeometryTopology(GeometryNode& node);
+  void update(void);
+  void rebuild(void);
+  void detachPolygon(uint32 polygonID);
+  void attachPolygon(uint32 polygonID);
+  void resolvePairs(void);
+  void resolveVertices(void);
+  void resolveVertex(uint32 vertexID);
+  void reserve(uint32 polygonCount, uint32 vertexCount);
+  GeometryNode& mNode;
+  IDList mIndices;
+  CountList mCornerCounts;
+  IDList mTwins;
+  IDList mVertexEdges;
+  EdgeMap mEdges;
+  IDSet mDetached;
+  PairList mPendingPairs;
+  IDList mPendingVertices;
+  unsigned int mVertexStructureVersion;
+  unsigned int mVertexVersion;
+  unsigned int mPolygonVersion;
+  bool mValid;
+};
+
+//---------------------------------------------------------------------
+
+/*! Unique edge cache for geometry nodes. Each edge shared by any number of
+ *  polygons is listed once, along with its crease value.
+ *  @remarks The order of the edges is not preserved across changes.
+ */
+class GeometryEdges
+{
+  friend class GeometryNode;
+public:
+  /*! Unique edge of a geometry node.
+   */
+  class Edge
+  {
+  public:
+    /*! The IDs of the vertices of this edge, lowest first.
+     */
+    uint32 mVertices[2];
+    /*! The highest crease value of any polygon using this edge.
+     */
+    uint32 mCrease;
+    /*! A half-edge using this edge, with IDs as in GeometryTopology.
+     */
+    uint32 mFirstUse;
+    /*! The number of polygon corners using this edge.
+     */
+    uint32 mUseCount;
+  };
+  typedef std::vector<Edge> EdgeList;
+  /*! @return The unique edges of the geometry node.
+   */
+  const EdgeList& getEdges(void) const;
+  /*! @param first The ID of the first vertex.
+   *  @param second The ID of the second vertex.
+   *  @return The edge between the specified vertices, in any order, or @c
+   *  NULL if no such edge exists.
+   */
+  const Edge* findEdge(uint32 first, uint32 second) const;
+  /*! @param edgeID The ID of the desired half-edge.
+   *  @return The ID of the next half-edge using the same edge, or @c
+   *  INVALID_EDGE_ID if it is the last one.
+   */
+  uint32 getNextUse(uint32 edgeID) const;
+  /*! @return The geometry node these edges belong to.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  typedef std::vector<uint32> IDList;
+  typedef std::vector<uint8> CountList;
+  class Partition
+  {
+  public:
+    Partition(void);
+    IDList mSlots;
+    uint32 mCount;
+    EdgeList mEdges;
+  };
+  typedef std::vector<Partition> PartitionList;
+  GeometryEdges(GeometryNode& node);
+  void update(void);
+  void rebuild(void);
+  void detachPolygon(uint32 polygonID);
+  void attachPolygon(uint32 polygonID);
+  void addUse(uint32 edgeID, uint32 first, uint32 second);
+  void removeUse(uint32 edgeID, uint32 first, uint32 second);
+  void insertEdge(Partition& partition, uint32 index, uint32 hash);
+  void eraseEdge(Partition& partition, uint32 slot);
+  uint32 findSlot(uint32 first, uint32 second, uint32 hash) const;
+  void updateCrease(Edge& edge) const;
+  void updateCreases(uint32 polygonID);
+  uint32 getCrease(uint32 edgeID) const;
+  unsigned int readPolygon(uint32 polygonID, uint32* indices, bool& detached) const;
+  static uint32 hashPair(uint32 first, uint32 second);
+  static void hashRange(void* data, uint32 first, uint32 count);
+  static void partitionRange(void* data, uint32 first, uint32 count);
+  static void offsetRange(void* data, uint32 first, uint32 count);
+  static void creaseRange(void* data, uint32 first, uint32 count);
+  GeometryNode& mNode;
+  EdgeList mEdges;
+  PartitionList mPartitions;
+  IDList mIndices;
+  CountList mCornerCounts;
+  IDList mNextUses;
+  IDList mHashes;
+  IDList mOrder;
+  IDList mOrderStarts;
+  IDList mOffsets;
+  std::set<uint32> mDetached;
+  const uint32* mCreases;
+  uint32 mCreaseCount;
+  uint32 mDefaultCrease;
+  const GeometryLayer* mCreaseLayer;
+  unsigned int mNodeVersion;
+  unsigned int mVertexStructureVersion;
+  unsigned int mVertexVersion;
+  unsigned int mPolygonVersion;
+  unsigned int mCreaseVersion;
+  bool mValid;
+};
+
+//---------------------------------------------------------------------
+
+/*! Catmull-Clark subdivision cache for geometry nodes, honoring the edge and
+ *  vertex crease layers.
+ *  @remarks Crease values are scaled to weights between zero and one, which
+ *  blend between the smooth and sharp subdivision rules, and are inherited
+ *  unchanged by the refined edges and vertices. Boundary edges are always
+ *  sharp.
+ *  @remarks Each refined vertex is kept as a stencil of weights over the base
+ *  vertices, so moving vertices only requires a single pass over the
+ *  stencils.
+ */
+class GeometrySubdivision
+{
+  friend class GeometryNode;
+public:
+  typedef std::vector<Vector3d> PointList;
+  typedef std::vector<uint32> IndexList;
+  /*! @return The refined vertex positions.
+   */
+  const PointList& getPoints(void) const;
+  /*! @return The refined faces, as four indices into the refined vertices
+   *  per face.
+   *  @remarks With zero levels, the faces are the base polygons and any
+   *  triangles have @c INVALID_VERTEX_ID as their last index.
+   */
+  const IndexList& getFaces(void) const;
+  /*! @return The number of subdivision levels.
+   */
+  unsigned int getLevelCount(void) const;
+  /*! Sets the number of subdivision levels.
+   *  @param count The desired number of levels.
+   *  @remarks This takes effect the next time the subdivision is updated.
+   */
+  void setLevelCount(unsigned int count);
+  /*! @return The geometry node this subdivision belongs to.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  typedef std::vector<real64> WeightList;
+  GeometrySubdivision(GeometryNode& node);
+  void update(void);
+  void rebuild(void);
+  void evaluate(void);
+  static void evaluateRange(void* data, uint32 first, uint32 count);
+  GeometryNode& mNode;
+  PointList mPoints;
+  IndexList mFaces;
+  IndexList mStencilStarts;
+  IndexList mStencilIndices;
+  WeightList mStencilWeights;
+  Block mVertices;
+  unsigned int mLevelCount;
+  const GeometryLayer* mEdgeCreaseLayer;
+  const GeometryLayer* mVertexCreaseLayer;
+  unsigned int mNodeVersion;
+  unsigned int mStructureVersion;
+  unsigned int mVertexVersion;
+  unsigned int mPolygonVersion;
+  unsigned int mEdgeCreaseVersion;
+  unsigned int mVertexCreaseVersion;
+  bool mLevelsChanged;
+  bool mValid;
+};
+
+//---------------------------------------------------------------------
+
+/*! Linear blend skinning for geometry nodes. Deforms the base vertex layer
+ *  by the bones of its node, each moved from its rest transform into a
+ *  locally set pose.
+ *  @remarks The influences on each vertex are normalized, and vertices
+ *  without any influences keep their rest position.
+ */
+class GeometrySkinning
+{
+  friend class GeometryNode;
+public:
+  /*! Sets the pose of the specified bone.
+   *  @param boneID The ID of the desired bone.
+   *  @param position The posed position of the bone, relative to its parent.
+   *  @param rotation The posed rotation of the bone, relative to its parent.
+   *  @remarks The pose is only kept locally, and is never sent to the server.
+   */
+  void setPose(uint16 boneID, const Vector3d& position, const Quaternion64& rotation);
+  /*! Returns the specified bone to its rest transform.
+   *  @param boneID The ID of the desired bone.
+   */
+  void resetPose(uint16 boneID);
+  /*! Returns all bones to their rest transforms.
+   */
+  void resetPoses(void);
+  /*! Writes the deformed positions of a range of vertices as three 32-bit
+   *  floats each, ready for upload to a vertex buffer.
+   *  @param target The buffer to receive the positions.
+   *  @param firstID The ID of the first vertex to deform.
+   *  @param count The number of vertices to deform.
+   *  @return @c true if successful, or @c false if there is no base vertex
+   *  layer.
+   *  @remarks Slots of invalid vertices are written as zeroes.
+   */
+  bool deform(real32* target, uint32 firstID, uint32 count) const;
+  /*! @return The number of bone influences currently gathered.
+   */
+  size_t getInfluenceCount(void) const;
+  /*! @return The geometry node this skinning belongs to.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  class Pose
+  {
+  public:
+    Vector3d mPosition;
+    Quaternion64 mRotation;
+  };
+  typedef std::map<uint16,Pose> PoseMap;
+  typedef std::vector<uint32> IndexList;
+  typedef std::vector<real64> WeightList;
+  typedef std::vector<const GeometryLayer*> LayerList;
+  typedef std::vector<unsigned int> VersionList;
+  GeometrySkinning(GeometryNode& node);
+  void update(void);
+  void rebuild(void);
+  void getMatrices(WeightList& matrices) const;
+  static void deformRange(void* data, uint32 first, uint32 count);
+  GeometryNode& mNode;
+  PoseMap mPoses;
+  IndexList mStarts;
+  IndexList mBones;
+  WeightList mWeights;
+  LayerList mLayers;
+  VersionList mVersions;
+  unsigned int mNodeVersion;
+  unsigned int mStructureVersion;
+  unsigned int mVertexVersion;
+  bool mValid;
+};
+
+//---------------------------------------------------------------------
+
+/*! Level of detail chain for geometry nodes. Holds successively coarser
+ *  triangle meshes made from the base layers by quadric error metric edge
+ *  collapses.
+ *  @remarks The levels are made on a worker thread from a copy of the base
+ *  layers, so changes received while it runs only take effect in the next
+ *  regeneration.
+ */
+class GeometrySimplification
+{
+  friend class GeometryNode;
+public:
+  /*! @return The number of available levels.
+   */
+  unsigned int getLevelCount(void) const;
+  /*! @param index The index of the desired level, where zero is the most
+   *  detailed.
+   *  @return The desired level.
+   */
+  const BaseMesh& getLevel(unsigned int index) const;
+  /*! @param maxPolygons The largest acceptable number of polygons.
+   *  @return The most detailed available level with at most the specified
+   *  number of polygons, the coarsest level if none is small enough, or @c
+   *  NULL if no levels are available.
+   */
+  const BaseMesh* findLevel(size_t maxPolygons) const;
+  /*! @return @c true if the available levels were made from the current
+   *  base layers, otherwise @c false.
+   */
+  bool isCurrent(void) const;
+  /*! @return @c true if a regeneration is running, otherwise @c false.
+   */
+  bool isPending(void) const;
+  /*! Waits for any running regeneration to finish, and makes its levels
+   *  available.
+   */
+  void wait(void);
+  /*! @return The number of levels to make.
+   */
+  unsigned int getTargetLevelCount(void) const;
+  /*! Sets the number of levels to make.
+   *  @param count The desired number of levels.
+   *  @remarks This takes effect at the next regeneration.
+   */
+  void setTargetLevelCount(unsigned int count);
+  /*! @return The fraction of the triangles of each level kept in the next.
+   */
+  real64 getReduction(void) const;
+  /*! Sets the fraction of the triangles of each level kept in the next.
+   *  @param reduction The desired fraction, between zero and one.
+   *  @remarks This takes effect at the next regeneration.
+   */
+  void setReduction(real64 reduction);
+  /*! @return The geometry node this simplification belongs to.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  class Job;
+  typedef std::vector<BaseMesh> LevelList;
+  GeometrySimplification(GeometryNode& node);
+  ~GeometrySimplification(void);
+  void update(void);
+  void start(void);
+  void finish(void);
+  static void run(void* data);
+  GeometryNode& mNode;
+  LevelList mLevels;
+  unsigned int mTargetLevelCount;
+  real64 mReduction;
+  Job* mJob;
+  Thread* mThread;
+  unsigned int mVertexVersion;
+  unsigned int mPolygonVersion;
+  unsigned int mRequestedVertexVersion;
+  unsigned int mRequestedPolygonVersion;
+  bool mSettingsChanged;
+  bool mRequested;
+  bool mValid;
+};
+
+//---------------------------------------------------------------------
+
+/*! Compact storage of the base vertex layer of a geometry node, used in
+ *  place of full precision positions once enabled with
+ *  GeometryNode::setCompactVertexBits. Each coordinate is stored as a
+ *  fixed-point offset within a box enclosing the vertices, as three 16-bit
+ *  values per vertex for up to 16 bits, or packed into two 32-bit words for
+ *  up to 21 bits.
+ *  @remarks The box is padded beyond the vertices, so vertices moving
+ *  slightly outwards are quantized in place. A vertex arriving outside it
+ *  grows the box, which requantizes all vertices.
+ */
+class GeometryQuantization
+{
+  friend class GeometryLayer;
+  friend class GeometryNode;
+public:
+  /*! @param vertexID The ID of the desired vertex.
+   *  @return @c true if the specified vertex exists, otherwise @c false.
+   */
+  bool isVertex(uint32 vertexID) const;
+  /*! Dequantizes a single vertex.
+   *  @param vertexID The ID of the desired vertex.
+   *  @param vertex The location to store the vertex.
+   *  @return @c true if the specified vertex exists, otherwise @c false.
+   */
+  bool getVertex(uint32 vertexID, BaseVertex& vertex) const;
+  /*! Dequantizes a range of vertices into a single precision buffer.
+   *  @param target The buffer to receive three coordinates per vertex.
+   *  @param firstID The ID of the first vertex to dequantize.
+   *  @param count The number of vertices to dequantize.
+   *  @remarks Deleted or missing vertices are stored as zero, as in
+   *  GeometryLayer::packSlots.
+   */
+  void dequantize(real32* target, uint32 firstID, uint32 count) const;
+  /*! @return The number of vertex slots stored.
+   */
+  uint32 getSlotCount(void) const;
+  /*! @return The number of bits used per coordinate.
+   */
+  unsigned int getBits(void) const;
+  /*! @return The box within which the vertices are quantized.
+   */
+  const Box3d& getBounds(void) const;
+  /*! @return The distance between adjacent quantized values along each
+   *  axis.
+   *  @remarks A quantized coordinate is dequantized as its value times the
+   *  step plus the minimum of the bounds.
+   */
+  const Vector3d& getStep(void) const;
+  /*! @return The number of bytes used by the quantized vertices.
+   */
+  size_t getSize(void) const;
+private:
+  GeometryQuantization(unsigned int bits);
+  void resize(size_t slotCount);
+  bool setVertex(uint32 vertexID, const BaseVertex& vertex);
+  void fit(const BaseVertex* vertices, size_t count);
+  void quantize(const BaseVertex* source, uint32 firstID, uint32 count);
+  void expand(BaseVertex* target, uint32 firstID, uint32 count) const;
+  void setBounds(const Box3d& bounds);
+  void grow(const Box3d& bounds);
+  uint32 getInvalidCode(void) const;
+  static void quantizeRange(void* data, uint32 first, uint32 count);
+  static void expandRange(void* data, uint32 first, uint32 count);
+  static void dequantizeRange(void* data, uint32 first, uint32 count);
+  static void requantizeRange(void* data, uint32 first, uint32 count);
+  Block mCodes;
+  unsigned int mBits;
+  Box3d mBounds;
+  Vector3d mStep;
+};
+
+//---------------------------------------------------------------------
+
+/*! Static batch of geometry nodes. Merges the base meshes of a set of
+ *  geometry nodes, each optionally transformed by an object node, into
+ *  shared vertex and index buffers, so that many small nodes can be drawn
+ *  with a single submission.
+ *  @remarks Each entry owns a range of the buffers with some room to grow,
+ *  so a change to one node only rewrites the range of that node. Unused
+ *  parts of the index buffer are filled with degenerate triangles.
+ */
+class GeometryBatch
+{
+public:
+  /*! Range of the shared buffers belonging to a single entry.
+   */
+  class Range
+  {
+  public:
+    Range(void);
+    uint32 mFirstVertex;
+    uint32 mVertexCount;
+    uint32 mFirstIndex;
+    uint32 mIndexCount;
+  };
+  typedef std::vector<real32> VertexList;
+  typedef std::vector<uint32> IndexList;
+  /*! Constructor.
+   *  @param session The session containing the nodes to batch.
+   */
+  GeometryBatch(Session& session);
+  /*! Adds a geometry node to this batch.
+   *  @param geometryID The ID of the geometry node to add.
+   *  @param objectID The ID of the object node whose transform to apply to
+   *  the geometry, or @c ~0 to use the geometry as is.
+   *  @return @c true if successful, or @c false if the specified pair is
+   *  already in this batch.
+   *  @remarks The nodes need not exist yet. The geometry is extracted at the
+   *  next call to update.
+   */
+  bool addNode(VNodeID geometryID, VNodeID objectID = (VNodeID) ~0);
+  /*! Removes a geometry node from this batch.
+   *  @param geometryID The ID of the geometry node to remove.
+   *  @param objectID The ID of the object node it was added with.
+   *  @return @c true if successful, or @c false if the specified pair is not
+   *  in this batch.
+   */
+  bool removeNode(VNodeID geometryID, VNodeID objectID = (VNodeID) ~0);
+  /*! Removes all nodes from this batch and releases its buffers.
+   */
+  void clear(void);
+  /*! Extracts the geometry of all entries whose nodes have changed since the
+   *  last update, and patches their ranges of the shared buffers.
+   *  @return @c true if any part of the buffers changed, otherwise @c false.
+   */
+  bool update(void);
+  /*! @return The shared vertex buffer, as tightly packed triplets of
+   *  coordinates.
+   */
+  const VertexList& getVertices(void) const;
+  /*! @return The shared index buffer, as triangles.
+   */
+  const IndexList& getIndices(void) const;
+  /*! @param geometryID The ID of the desired geometry node.
+   *  @param objectID The ID of the object node it was added with.
+   *  @return The range of the buffers belonging to the specified pair, or @c
+   *  NULL if it is not in this batch.
+   */
+  const Range* getRange(VNodeID geometryID, VNodeID objectID = (VNodeID) ~0) const;
+  /*! @return The set of vertices written by the last update.
+   */
+  const IDRangeSet& getChangedVertices(void) const;
+  /*! @return The set of indices written by the last update.
+   */
+  const IDRangeSet& getChangedIndices(void) const;
+  /*! @return The number of entries in this batch.
+   */
+  unsigned int getNodeCount(void) const;
+  /*! @return The session containing the batched nodes.
+   */
+  Session& getSession(void) const;
+private:
+  class Entry
+  {
+  public:
+    Entry(VNodeID geometryID, VNodeID objectID);
+    VNodeID mGeometryID;
+    VNodeID mObjectID;
+    Range mRange;
+    uint32 mVertexCapacity;
+    uint32 mIndexCapacity;
+    unsigned int mStructureVersion;
+    unsigned int mVertexVersion;
+    unsigned int mPolygonVersion;
+    unsigned int mObjectVersion;
+    bool mExtracted;
+  };
+  class Job;
+  typedef std::vector<Entry> EntryList;
+  typedef std::vector<Range> RangeList;
+  Entry* findEntry(VNodeID geometryID, VNodeID objectID);
+  void place(Entry& entry, const VertexList& vertices, const IndexList& indices);
+  void release(const Range& range);
+  void compact(void);
+  static void extractRange(void* data, uint32 first, uint32 count);
+  Session& mSession;
+  EntryList mEntries;
+  RangeList mReleased;
+  VertexList mVertices;
+  IndexList mIndices;
+  IDRangeSet mChangedVertices;
+  IDRangeSet mChangedIndices;
+};
+
+//---------------------------------------------------------------------
+
+/*! Background extraction of the base meshes of a set of geometry nodes.
+ *  Small nodes are extracted concurrently, while the polygons of each large
+ *  node are split across all available processors.
+ *  @remarks Starting an extraction only shares the storage of the base
+ *  layers, which is copied on write, so the session can keep receiving
+ *  changes while the worker threads run. Those changes only show up in the
+ *  next extraction.
+ *  @remarks Unlike GeometryNode::getBaseMesh, the vertices of each mesh are
+ *  in the order of their IDs, which is what allows a single node to be
+ *  split across threads.
+ */
+class GeometryExtraction
+{
+public:
+  /*! Constructor.
+   *  @param session The session containing the nodes to extract.
+   */
+  GeometryExtraction(Session& session);
+  /*! Destructor. Waits for any running extraction to finish.
+   */
+  ~GeometryExtraction(void);
+  /*! Adds a geometry node to this extraction.
+   *  @param nodeID The ID of the geometry node to add.
+   *  @return @c true if successful, or @c false if the specified node is
+   *  already in this extraction.
+   *  @remarks This takes effect at the next call to start.
+   */
+  bool addNode(VNodeID nodeID);
+  /*! Removes a geometry node from this extraction.
+   *  @param nodeID The ID of the geometry node to remove.
+   *  @return @c true if successful, or @c false if the specified node is
+   *  not in this extraction.
+   *  @remarks This takes effect at the next call to start.
+   */
+  bool removeNode(VNodeID nodeID);
+  /*! Removes all nodes from this extraction.
+   */
+  void clear(void);
+  /*! Starts extracting the current base meshes of all nodes in this
+   *  extraction on worker threads.
+   *  @return @c true if successful, or @c false if an extraction is already
+   *  running.
+   */
+  bool start(void);
+  /*! Makes the meshes of the running extraction available if it has
+   *  finished. This never blocks.
+   *  @return @c true if new meshes became available, otherwise @c false.
+   */
+  bool update(void);
+  /*! Waits for any running extraction to finish, and makes its meshes
+   *  available.
+   */
+  void wait(void);
+  /*! @return @c true if an extraction is running, otherwise @c false.
+   */
+  bool isPending(void) const;
+  /*! @param nodeID The ID of the desired geometry node.
+   *  @return The base mesh of the specified node from the last finished
+   *  extraction, or @c NULL if it was not extracted or had no polygons.
+   */
+  const BaseMesh* getMesh(VNodeID nodeID) const;
+  /*! @return The number of nodes in this extraction.
+   */
+  unsigned int getNodeCount(void) const;
+  /*! @return The session containing the extracted nodes.
+   */
+  Session& getSession(void) const;
+private:
+  class Source;
+  class Job;
+  typedef std::vector<VNodeID> NodeIDList;
+  typedef std::vector<BaseMesh> MeshList;
+  GeometryExtraction(const GeometryExtraction& source);
+  GeometryExtraction& operator = (const GeometryExtraction& source);
+  void finish(void);
+  static void run(void* data);
+  static void extractNodes(void* data, uint32 first, uint32 count);
+  static void extract(const Source& source, BaseMesh& mesh, bool parallel);
+  static void countPolygons(void* data, uint32 first, uint32 count);
+  static void countVertices(void* data, uint32 first, uint32 count);
+  static void copyVertices(void* data, uint32 first, uint32 count);
+  static void copyPolygons(void* data, uint32 first, uint32 count);
+  Session& mSession;
+  NodeIDList mNodeIDs;
+  NodeIDList mExtractedIDs;
+  MeshList mMeshes;
+  Job* mJob;
+  Thread* mThread;
+};
+
+//---------------------------------------------------------------------
+
+/*! Streaming import of a mesh file into a geometry node. The file is parsed
+ *  on a worker thread, in batches handed over through a short queue, while
+ *  the thread running the session sends the parsed elements.
+ *  @remarks Binary PLY files and OBJ files are supported. The properties of
+ *  PLY vertices and faces other than the positions and vertex indices are
+ *  imported into geometry layers named after them, which are created if
+ *  missing. Properties named with the suffixes @c _x, @c _y and @c _z, or
+ *  @c _0 to @c _3, are combined into XYZ and corner layers, respectively.
+ *  @remarks The imported vertices and polygons are given the lowest free
+ *  IDs, so the file is added to any existing geometry. Polygons with more
+ *  than four corners are split into triangles.
+ *  @remarks The node must exist for as long as the import is running.
+ */
+class GeometryImport
+{
+public:
+  /*! Constructor.
+   *  @param node The geometry node to import into.
+   */
+  GeometryImport(GeometryNode& node);
+  /*! Destructor. Stops any running import.
+   */
+  ~GeometryImport(void);
+  /*! Starts importing the specified file.
+   *  @param path The path of the file to import.
+   *  @return @c true if successful, or @c false if an import is already
+   *  running, or if the file could not be opened or has an unsupported
+   *  format.
+   *  @remarks Any missing geometry layers are created here, but nothing
+   *  else is sent until they exist.
+   */
+  bool start(const std::string& path);
+  /*! Sends the elements parsed so far. This never waits for the parser.
+   *  @param maxCommands The largest number of commands to send in this call,
+   *  which bounds the amount of data queued for the network between calls to
+   *  Session::update.
+   *  @return @c true if the import has finished, otherwise @c false.
+   *  @remarks Layers created by start that still do not exist ten seconds
+   *  later are given up on, and the import goes on without their values.
+   */
+  bool update(uint32 maxCommands = 65536);
+  /*! Stops any running import, discarding any elements not yet sent.
+   */
+  void cancel(void);
+  /*! @return @c true if an import is running, otherwise @c false.
+   */
+  bool isPending(void) const;
+  /*! @return @c true if the last import stopped at malformed data, or had
+   *  to drop the values of a layer that could not be created, otherwise
+   *  @c false.
+   *  @remarks The elements before the malformed data are still imported.
+   */
+  bool isFailed(void) const;
+  /*! @return The number of vertices sent by the last import.
+   */
+  uint32 getVertexCount(void) const;
+  /*! @return The number of polygons sent by the last import.
+   */
+  uint32 getPolygonCount(void) const;
+  /*! @return The geometry node imported into.
+   */
+  GeometryNode& getNode(void) const;
+private:
+  class Target;
+  class Batch;
+  class Parser;
+  class Job;
+  typedef std::vector<Target> TargetList;
+  typedef std::vector<uint32> IDList;
+  GeometryImport(const GeometryImport& source);
+  GeometryImport& operator = (const GeometryImport& source);
+  bool sendBatch(Batch& batch, const std::vector<GeometryLayer*>& layers, uint32& budget);
+  void finish(void);
+  static void run(void* data);
+  GeometryNode& mNode;
+  TargetList mTargets;
+  IDList mVertexIDs;
+  uint32 mNextVertexID;
+  uint32 mNextPolygonID;
+  uint32 mPolygonCount;
+  Batch* mBatch;
+  Job* mJob;
+  Thread* mThread;
+  bool mFailed;
 };
 
 //---------------------------------------------------------------------
@@ -1684,8 +3666,17 @@ public:
    */
   void setScale(const Vector3d& scale);
 private:
+  enum StagedField
+  {
+    STAGED_TIME = 1,
+    STAGED_VALUE = 2,
+    STAGED_SPEED = 4,
+    STAGED_ACCEL = 8,
+    STAGED_DRAG = 16,
+  };
   ObjectNode(VNodeID ID, VNodeOwner owner, Session& session);
   ~ObjectNode(void);
+  void update(void);
   void sendTranslation(void);
   void sendRotation(void);
   static void initialize(void);
@@ -1711,6 +3702,13 @@ private:
   Rotation mRotationCache;
   Vector3d mScale;
   ColorRGB mIntensity;
+  Translation mStagedTranslation;
+  Rotation mStagedRotation;
+  Vector3d mStagedScale;
+  unsigned int mStagedTranslationFields;
+  unsigned int mStagedRotationFields;
+  bool mStagedScaleField;
+  bool mReplaying;
 };
 
 //---------------------------------------------------------------------
@@ -2038,6 +4036,18 @@ public:
   /*! @return The address of the verse server for this session.
    */
   const std::string& getAddress(void) const;
+  /*! @return @c true if incoming changes are coalesced, otherwise @c false.
+   */
+  bool isCoalescing(void) const;
+  /*! Controls whether incoming changes to existing geometry slots and
+   *  object transforms are coalesced. When enabled, only the last value
+   *  received for each slot or transform during an update pass is applied
+   *  and announced to observers, at the end of that pass.
+   *  @param enabled @c true to enable coalescing.
+   *  @remarks Creation and deletion of vertices and polygons are never
+   *  coalesced.
+   */
+  void setCoalescing(bool enabled);
   /*! Creates a session with the specified verse server.
    *  @param address The address of the desired verse server.
    *  @param username The desired user name for the session.
@@ -2103,6 +4113,7 @@ private:
   VNodeID mAvatarID;
   State mState;
   uint32 mTypeMask;
+  bool mCoalescing;
   static SessionList msSessions;
   static SessionStack msStack;
   static Session* msCurrent;
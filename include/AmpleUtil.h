@@ -28,6 +28,8 @@
 
 #include <math.h>
 
+#include <limits>
+
 #ifdef _WIN32
 
 #undef min
@@ -96,6 +98,33 @@ typedef Vector3<real64> Vector3d;
 
 //---------------------------------------------------------------------
 
+template <typename T>
+class Box3
+{
+public:
+  inline Box3(void);
+  inline Box3(const Vector3<T>& sminimum, const Vector3<T>& smaximum);
+  inline bool contains(const Vector3<T>& point) const;
+  inline bool contains(const Box3<T>& box) const;
+  inline bool intersects(const Box3<T>& box) const;
+  inline void envelop(const Vector3<T>& point);
+  inline void envelop(const Box3<T>& box);
+  inline bool isEmpty(void) const;
+  inline Vector3<T> getCenter(void) const;
+  inline Vector3<T> getSize(void) const;
+  inline void set(const Vector3<T>& sminimum, const Vector3<T>& smaximum);
+  inline void setEmpty(void);
+  Vector3<T> minimum;
+  Vector3<T> maximum;
+};
+
+//---------------------------------------------------------------------
+
+typedef Box3<real32> Box3f;
+typedef Box3<real64> Box3d;
+
+//---------------------------------------------------------------------
+
 class ColorRGB
 {
 public:
@@ -381,6 +410,105 @@ inline void Vector3<T>::set(T sx, T sy, T sz)
 
 //---------------------------------------------------------------------
 
+template <typename T>
+inline Box3<T>::Box3(void)
+{
+  setEmpty();
+}
+
+template <typename T>
+inline Box3<T>::Box3(const Vector3<T>& sminimum, const Vector3<T>& smaximum):
+  minimum(sminimum),
+  maximum(smaximum)
+{
+}
+
+template <typename T>
+inline bool Box3<T>::contains(const Vector3<T>& point) const
+{
+  return point.x >= minimum.x && point.x <= maximum.x &&
+         point.y >= minimum.y && point.y <= maximum.y &&
+         point.z >= minimum.z && point.z <= maximum.z;
+}
+
+template <typename T>
+inline bool Box3<T>::contains(const Box3<T>& box) const
+{
+  return contains(box.minimum) && contains(box.maximum);
+}
+
+template <typename T>
+inline bool Box3<T>::intersects(const Box3<T>& box) const
+{
+  return box.minimum.x <= maximum.x && box.maximum.x >= minimum.x &&
+         box.minimum.y <= maximum.y && box.maximum.y >= minimum.y &&
+         box.minimum.z <= maximum.z && box.maximum.z >= minimum.z;
+}
+
+template <typename T>
+inline void Box3<T>::envelop(const Vector3<T>& point)
+{
+  if (point.x < minimum.x)
+    minimum.x = point.x;
+  if (point.y < minimum.y)
+    minimum.y = point.y;
+  if (point.z < minimum.z)
+    minimum.z = point.z;
+
+  if (point.x > maximum.x)
+    maximum.x = point.x;
+  if (point.y > maximum.y)
+    maximum.y = point.y;
+  if (point.z > maximum.z)
+    maximum.z = point.z;
+}
+
+template <typename T>
+inline void Box3<T>::envelop(const Box3<T>& box)
+{
+  if (box.isEmpty())
+    return;
+
+  envelop(box.minimum);
+  envelop(box.maximum);
+}
+
+template <typename T>
+inline bool Box3<T>::isEmpty(void) const
+{
+  return minimum.x > maximum.x || minimum.y > maximum.y || minimum.z > maximum.z;
+}
+
+template <typename T>
+inline Vector3<T> Box3<T>::getCenter(void) const
+{
+  return (minimum + maximum) / 2;
+}
+
+template <typename T>
+inline Vector3<T> Box3<T>::getSize(void) const
+{
+  return maximum - minimum;
+}
+
+template <typename T>
+inline void Box3<T>::set(const Vector3<T>& sminimum, const Vector3<T>& smaximum)
+{
+  minimum = sminimum;
+  maximum = smaximum;
+}
+
+template <typename T>
+inline void Box3<T>::setEmpty(void)
+{
+  const T huge = std::numeric_limits<T>::max();
+
+  minimum.set(huge, huge, huge);
+  maximum.set(-huge, -huge, -huge);
+}
+
+//---------------------------------------------------------------------
+
 inline ColorRGB::ColorRGB(void)
 {
 }
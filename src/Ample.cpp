@@ -10,6 +10,15 @@
 
 #include <cstring>
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
 namespace verse
 {
   namespace ample
@@ -17,6 +26,149 @@ namespace verse
 
 //---------------------------------------------------------------------
 
+namespace
+{
+
+// Maps a new temporary file of the specified size in the specified
+// directory. The file is deleted as soon as it's unmapped, or immediately
+// where the file system allows it.
+uint8* mapFile(const std::string& directory, size_t size)
+{
+#ifdef _WIN32
+  char path[MAX_PATH];
+
+  if (!GetTempFileNameA(directory.c_str(), "amp", 0, path))
+    return NULL;
+
+  HANDLE file = CreateFileA(path,
+                            GENERIC_READ | GENERIC_WRITE,
+                            0,
+                            NULL,
+                            CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                            NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return NULL;
+
+  // The view keeps both the mapping and the file open after the handles
+  // are closed.
+
+  HANDLE mapping = CreateFileMappingA(file,
+                                      NULL,
+                                      PAGE_READWRITE,
+                                      (DWORD) ((size >> 16) >> 16),
+                                      (DWORD) size,
+                                      NULL);
+
+  void* data = NULL;
+
+  if (mapping)
+  {
+    data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    CloseHandle(mapping);
+  }
+
+  CloseHandle(file);
+  return reinterpret_cast<uint8*>(data);
+#else
+  std::string pattern = directory + "/ampleXXXXXX";
+
+  std::vector<char> path(pattern.begin(), pattern.end());
+  path.push_back('\0');
+
+  const int file = mkstemp(&path[0]);
+  if (file == -1)
+    return NULL;
+
+  unlink(&path[0]);
+
+  void* data = MAP_FAILED;
+
+  if (ftruncate(file, size) == 0)
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+  close(file);
+
+  if (data == MAP_FAILED)
+    return NULL;
+
+  return reinterpret_cast<uint8*>(data);
+#endif
+}
+
+void unmapFile(uint8* data, size_t size)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(data, size);
+#endif
+}
+
+// The share counts of blocks are updated atomically, as blocks sharing
+// storage may be owned by different threads.
+
+long readShares(volatile long* shares)
+{
+#ifdef _WIN32
+  return InterlockedCompareExchange(shares, 0, 0);
+#else
+  return __sync_add_and_fetch(shares, 0);
+#endif
+}
+
+long incrementShares(volatile long* shares)
+{
+#ifdef _WIN32
+  return InterlockedIncrement(shares);
+#else
+  return __sync_add_and_fetch(shares, 1);
+#endif
+}
+
+long decrementShares(volatile long* shares)
+{
+#ifdef _WIN32
+  return InterlockedDecrement(shares);
+#else
+  return __sync_sub_and_fetch(shares, 1);
+#endif
+}
+
+// Replaces the share count pointer of a block if it holds the expected
+// value, returning its previous value.
+volatile long* swapShares(volatile long** target, volatile long* expected, volatile long* value)
+{
+#ifdef _WIN32
+  return (volatile long*) InterlockedCompareExchangePointer((void* volatile*) target, (void*) value, (void*) expected);
+#else
+  return __sync_val_compare_and_swap(target, expected, value);
+#endif
+}
+
+// Returns the share count of a block, creating it if necessary. Threads
+// reading the same block may race to create it, in which case only the
+// first count created is kept.
+volatile long* createShares(volatile long** target)
+{
+  if (volatile long* shares = swapShares(target, NULL, NULL))
+    return shares;
+
+  volatile long* shares = new long(1);
+
+  if (volatile long* previous = swapShares(target, NULL, shares))
+  {
+    delete shares;
+    return previous;
+  }
+
+  return shares;
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
 BaseVertex::BaseVertex(void)
 {
   setInvalid();
@@ -139,7 +291,10 @@ Block::Block(void):
   mItemCount(0),
   mItemSize(1),
   mGrain(0),
-  mData(NULL)
+  mData(NULL),
+  mShares(NULL),
+  mMapThreshold(0),
+  mMapSize(0)
 {
 }
 
@@ -147,9 +302,12 @@ Block::Block(const Block& source):
   mItemCount(0),
   mItemSize(1),
   mGrain(0),
-  mData(NULL)
+  mData(NULL),
+  mShares(NULL),
+  mMapThreshold(0),
+  mMapSize(0)
 {
-  operator = (source);
+  share(source);
 }
 
 Block::~Block(void)
@@ -161,23 +319,36 @@ void Block::resize(size_t count)
 {
   if (count > 0)
   {
-    size_t size;
-
     if (mGrain != 0)
       count = mGrain * ((count + mGrain - 1) / mGrain);
 
-    if (mData)
+    // Mapped storage is allocated with room to spare, so it can usually
+    // grow in place.
+
+    if (count > mItemCount && count * mItemSize <= mMapSize && !isShared())
     {
-      uint8* data = new uint8 [count * mItemSize];
+      mItemCount = count;
+      return;
+    }
 
-      std::memcpy(data, mData, std::min(count, mItemCount) * mItemSize);
+    // Growing storage at least doubles its capacity, so that repeated
+    // growth of mapped storage does not remap the file every time.
+
+    size_t capacity = count;
+    if (count > mItemCount)
+      capacity = std::max(count, mItemCount * 2);
 
-      delete [] mData;
-      mData = data;
+    size_t mapSize;
+    uint8* data = allocate(count, capacity, mapSize);
+
+    if (mData)
+    {
+      std::memcpy(data, mData, std::min(count, mItemCount) * mItemSize);
+      drop();
     }
-    else
-      mData = new uint8 [count * mItemSize];
 
+    mData = data;
+    mMapSize = mapSize;
     mItemCount = count;
   }
   else
@@ -192,13 +363,63 @@ void Block::reserve(size_t count)
 
 void Block::release(void)
 {
-  delete [] mData;
+  drop();
   mData = NULL;
+  mMapSize = 0;
   mItemCount = 0;
 }
 
+void Block::share(const Block& source)
+{
+  // The share count is only created once storage is first shared, which may
+  // be by a copy of a const block.
+
+  if (source.mData != mData)
+  {
+    release();
+
+    if (source.mData)
+    {
+      mData = source.mData;
+      mMapSize = source.mMapSize;
+      mItemCount = source.mItemCount;
+      mShares = createShares(&source.mShares);
+      incrementShares(mShares);
+    }
+  }
+
+  mItemSize = source.mItemSize;
+  mGrain = source.mGrain;
+}
+
+bool Block::isShared(void) const
+{
+  return mShares && readShares(mShares) > 1;
+}
+
+void Block::setMapping(const std::string& directory, size_t threshold)
+{
+  mMapDirectory = directory;
+  mMapThreshold = threshold;
+
+  // Move any existing items to the newly selected kind of storage.
+
+  if (mData)
+  {
+    bool mapped = !mMapDirectory.empty() && mItemCount * mItemSize >= mMapThreshold;
+    if (mapped != isMapped())
+      resize(mItemCount);
+  }
+}
+
+bool Block::isMapped(void) const
+{
+  return mMapSize != 0;
+}
+
 Block::operator void* (void)
 {
+  detach();
   return mData;
 }
 
@@ -209,19 +430,10 @@ Block::operator const void* (void) const
 
 Block& Block::operator = (const Block& source)
 {
-  delete mData;
-
-  mGrain = source.mGrain;
-  mItemSize = source.mItemSize;
-
-  release();
-
-  if (source.mItemCount)
-  {
-    resize(source.mItemCount);
-    std::memcpy(mData, source.mData, mItemCount * mItemSize);
-  }
+  // Copies share storage until either side is written, at which point the
+  // writer gets its own copy.
 
+  share(source);
   return *this;
 }
 
@@ -230,6 +442,7 @@ void* Block::getItem(size_t index)
   if (index >= mItemCount)
     return NULL;
 
+  detach();
   return mData + index * mItemSize;
 }
 
@@ -243,6 +456,7 @@ const void* Block::getItem(size_t index) const
 
 void* Block::getItems(void)
 {
+  detach();
   return mData;
 }
 
@@ -254,6 +468,7 @@ const void* Block::getitems(void) const
 void Block::setItem(void* item, size_t index)
 {
   reserve(index + 1);
+  detach();
   std::memcpy(mData + index * mItemSize, item, mItemSize);
 }
 
@@ -284,6 +499,203 @@ void Block::setGranularity(size_t grain)
   reserve(mItemCount);
 }
 
+void Block::detach(void)
+{
+  // Gives this block its own copy of shared storage before it is written.
+  // All of it is copied, not just the part being written, as the layer
+  // kernels and GeometryLayerView rely on the items being contiguous.
+  // A count of one cannot grow meanwhile, as only this block refers to the
+  // storage, and a block being written must not be read by other threads.
+
+  if (!mShares)
+    return;
+
+  if (readShares(mShares) > 1)
+  {
+    size_t mapSize;
+    uint8* data = allocate(mItemCount, mItemCount, mapSize);
+    std::memcpy(data, mData, mItemCount * mItemSize);
+
+    // The other blocks may have let go of the storage in the meantime, in
+    // which case it is freed here.
+
+    drop();
+    mData = data;
+    mMapSize = mapSize;
+  }
+  else
+  {
+    delete mShares;
+    mShares = NULL;
+  }
+}
+
+void Block::drop(void)
+{
+  // Lets go of the current storage, only freeing it if it isn't shared.
+
+  if (mShares)
+  {
+    if (decrementShares(mShares) == 0)
+    {
+      delete mShares;
+      mShares = NULL;
+    }
+    else
+    {
+      mShares = NULL;
+      return;
+    }
+  }
+
+  if (mMapSize)
+    unmapFile(mData, mMapSize);
+  else
+    delete [] mData;
+}
+
+uint8* Block::allocate(size_t count, size_t capacity, size_t& mapSize) const
+{
+  // Only mapped storage is given the requested capacity, as the unused
+  // part of the file is never touched and so costs neither memory nor
+  // disk space on most systems. Falls back to the heap if the file cannot
+  // be mapped.
+
+  const size_t size = count * mItemSize;
+
+  if (!mMapDirectory.empty() && size >= mMapThreshold)
+  {
+    const size_t mappedSize = capacity * mItemSize;
+
+    if (uint8* data = mapFile(mMapDirectory, mappedSize))
+    {
+      mapSize = mappedSize;
+      return data;
+    }
+  }
+
+  mapSize = 0;
+  return new uint8 [size];
+}
+
+//---------------------------------------------------------------------
+
+IDRange::IDRange(void):
+  mFirst(0),
+  mCount(0)
+{
+}
+
+IDRange::IDRange(uint32 first, uint32 count):
+  mFirst(first),
+  mCount(count)
+{
+}
+
+uint32 IDRange::getEnd(void) const
+{
+  return mFirst + mCount;
+}
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+bool compareRangeEnd(const IDRange& range, uint32 ID)
+{
+  return range.getEnd() < ID;
+}
+
+}
+
+void IDRangeSet::addID(uint32 ID)
+{
+  addRange(ID, 1);
+}
+
+void IDRangeSet::addRange(uint32 first, uint32 count)
+{
+  if (!count)
+    return;
+
+  const uint32 end = first + count;
+
+  // Fast path for the common case of IDs arriving in ascending order.
+
+  if (mRanges.empty() || mRanges.back().getEnd() < first)
+  {
+    mRanges.push_back(IDRange(first, count));
+    return;
+  }
+
+  // Find the first range that overlaps or touches the new one.
+
+  RangeList::iterator start = std::lower_bound(mRanges.begin(), mRanges.end(), first, compareRangeEnd);
+
+  if (start == mRanges.end() || (*start).mFirst > end)
+  {
+    mRanges.insert(start, IDRange(first, count));
+    return;
+  }
+
+  // Merge all ranges that overlap or touch the new one.
+
+  RangeList::iterator stop = start;
+  uint32 mergedEnd = end;
+
+  while (stop != mRanges.end() && (*stop).mFirst <= end)
+  {
+    mergedEnd = std::max(mergedEnd, (*stop).getEnd());
+    stop++;
+  }
+
+  (*start).mFirst = std::min((*start).mFirst, first);
+  (*start).mCount = mergedEnd - (*start).mFirst;
+
+  mRanges.erase(start + 1, stop);
+}
+
+void IDRangeSet::addRanges(const IDRangeSet& other)
+{
+  for (RangeList::const_iterator i = other.mRanges.begin();  i != other.mRanges.end();  i++)
+    addRange((*i).mFirst, (*i).mCount);
+}
+
+void IDRangeSet::clear(void)
+{
+  mRanges.clear();
+}
+
+bool IDRangeSet::contains(uint32 ID) const
+{
+  RangeList::const_iterator i = std::lower_bound(mRanges.begin(), mRanges.end(), ID + 1, compareRangeEnd);
+  if (i == mRanges.end())
+    return false;
+
+  return ID >= (*i).mFirst && ID < (*i).getEnd();
+}
+
+bool IDRangeSet::isEmpty(void) const
+{
+  return mRanges.empty();
+}
+
+uint32 IDRangeSet::getIDCount(void) const
+{
+  uint32 count = 0;
+
+  for (RangeList::const_iterator i = mRanges.begin();  i != mRanges.end();  i++)
+    count += (*i).mCount;
+
+  return count;
+}
+
+const IDRangeSet::RangeList& IDRangeSet::getRanges(void) const
+{
+  return mRanges;
+}
+
 //---------------------------------------------------------------------
 
 Versioned::Versioned(void):
@@ -0,0 +1,456 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+const VNodeID NO_OBJECT_ID = (VNodeID) ~0;
+
+// Index used to fill unused parts of the index buffer, making degenerate
+// triangles that draw nothing.
+const uint32 DEGENERATE_INDEX = 0;
+
+uint32 getSlack(uint32 count)
+{
+  return count + count / 4;
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+class GeometryBatch::Job
+{
+public:
+  class Item
+  {
+  public:
+    Entry* mEntry;
+    GeometryNode* mGeometry;
+    const ObjectNode* mObject;
+    VertexList mVertices;
+    IndexList mIndices;
+  };
+  typedef std::vector<Item> ItemList;
+  ItemList mItems;
+};
+
+//---------------------------------------------------------------------
+
+GeometryBatch::Range::Range(void):
+  mFirstVertex(0),
+  mVertexCount(0),
+  mFirstIndex(0),
+  mIndexCount(0)
+{
+}
+
+//---------------------------------------------------------------------
+
+GeometryBatch::GeometryBatch(Session& session):
+  mSession(session)
+{
+}
+
+bool GeometryBatch::addNode(VNodeID geometryID, VNodeID objectID)
+{
+  if (findEntry(geometryID, objectID))
+    return false;
+
+  mEntries.push_back(Entry(geometryID, objectID));
+  return true;
+}
+
+bool GeometryBatch::removeNode(VNodeID geometryID, VNodeID objectID)
+{
+  for (EntryList::iterator i = mEntries.begin();  i != mEntries.end();  i++)
+  {
+    if ((*i).mGeometryID == geometryID && (*i).mObjectID == objectID)
+    {
+      // The range is cleared by the next update, so that the change shows
+      // up in the changed sets of that update.
+
+      mReleased.push_back((*i).mRange);
+      mEntries.erase(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void GeometryBatch::clear(void)
+{
+  mEntries.clear();
+  mReleased.clear();
+  mVertices.clear();
+  mIndices.clear();
+  mChangedVertices.clear();
+  mChangedIndices.clear();
+}
+
+bool GeometryBatch::update(void)
+{
+  mChangedVertices.clear();
+  mChangedIndices.clear();
+
+  for (RangeList::const_iterator i = mReleased.begin();  i != mReleased.end();  i++)
+    release(*i);
+
+  mReleased.clear();
+
+  // Find the entries whose nodes have changed since they were extracted.
+
+  Job job;
+
+  for (EntryList::iterator i = mEntries.begin();  i != mEntries.end();  i++)
+  {
+    Entry& entry = *i;
+
+    GeometryNode* geometry = dynamic_cast<GeometryNode*>(mSession.getNodeByID(entry.mGeometryID));
+
+    const ObjectNode* object = NULL;
+    if (entry.mObjectID != NO_OBJECT_ID)
+      object = dynamic_cast<const ObjectNode*>(mSession.getNodeByID(entry.mObjectID));
+
+    if (!geometry || !geometry->mBaseVertexLayer || !geometry->mBasePolygonLayer ||
+        (entry.mObjectID != NO_OBJECT_ID && !object))
+    {
+      if (entry.mExtracted)
+      {
+	place(entry, VertexList(), IndexList());
+	entry.mExtracted = false;
+      }
+
+      continue;
+    }
+
+    const unsigned int structureVersion = geometry->getStructureVersion();
+    const unsigned int vertexVersion = geometry->mBaseVertexLayer->getDataVersion();
+    const unsigned int polygonVersion = geometry->mBasePolygonLayer->getDataVersion();
+    const unsigned int objectVersion = object ? object->getDataVersion() : 0;
+
+    if (entry.mExtracted &&
+        entry.mStructureVersion == structureVersion &&
+        entry.mVertexVersion == vertexVersion &&
+        entry.mPolygonVersion == polygonVersion &&
+        entry.mObjectVersion == objectVersion)
+      continue;
+
+    entry.mStructureVersion = structureVersion;
+    entry.mVertexVersion = vertexVersion;
+    entry.mPolygonVersion = polygonVersion;
+    entry.mObjectVersion = objectVersion;
+    entry.mExtracted = true;
+
+    job.mItems.push_back(Job::Item());
+
+    Job::Item& item = job.mItems.back();
+    item.mEntry = &entry;
+    item.mGeometry = geometry;
+    item.mObject = object;
+  }
+
+  // Extract and transform the meshes in parallel, then patch the buffers
+  // serially.
+
+  if (!job.mItems.empty())
+    Thread::parallelFor(extractRange, &job, job.mItems.size(), 1);
+
+  for (Job::ItemList::const_iterator i = job.mItems.begin();  i != job.mItems.end();  i++)
+    place(*(*i).mEntry, (*i).mVertices, (*i).mIndices);
+
+  compact();
+
+  return !mChangedVertices.isEmpty() || !mChangedIndices.isEmpty();
+}
+
+const GeometryBatch::VertexList& GeometryBatch::getVertices(void) const
+{
+  return mVertices;
+}
+
+const GeometryBatch::IndexList& GeometryBatch::getIndices(void) const
+{
+  return mIndices;
+}
+
+const GeometryBatch::Range* GeometryBatch::getRange(VNodeID geometryID, VNodeID objectID) const
+{
+  for (EntryList::const_iterator i = mEntries.begin();  i != mEntries.end();  i++)
+  {
+    if ((*i).mGeometryID == geometryID && (*i).mObjectID == objectID)
+      return &((*i).mRange);
+  }
+
+  return NULL;
+}
+
+const IDRangeSet& GeometryBatch::getChangedVertices(void) const
+{
+  return mChangedVertices;
+}
+
+const IDRangeSet& GeometryBatch::getChangedIndices(void) const
+{
+  return mChangedIndices;
+}
+
+unsigned int GeometryBatch::getNodeCount(void) const
+{
+  return mEntries.size();
+}
+
+Session& GeometryBatch::getSession(void) const
+{
+  return mSession;
+}
+
+GeometryBatch::Entry::Entry(VNodeID geometryID, VNodeID objectID):
+  mGeometryID(geometryID),
+  mObjectID(objectID),
+  mVertexCapacity(0),
+  mIndexCapacity(0),
+  mStructureVersion(0),
+  mVertexVersion(0),
+  mPolygonVersion(0),
+  mObjectVersion(0),
+  mExtracted(false)
+{
+}
+
+GeometryBatch::Entry* GeometryBatch::findEntry(VNodeID geometryID, VNodeID objectID)
+{
+  for (EntryList::iterator i = mEntries.begin();  i != mEntries.end();  i++)
+  {
+    if ((*i).mGeometryID == geometryID && (*i).mObjectID == objectID)
+      return &(*i);
+  }
+
+  return NULL;
+}
+
+void GeometryBatch::place(Entry& entry, const VertexList& vertices, const IndexList& indices)
+{
+  const uint32 vertexCount = vertices.size() / 3;
+  const uint32 indexCount = indices.size();
+
+  uint32 previousIndexCount = entry.mRange.mIndexCount;
+
+  if (vertexCount > entry.mVertexCapacity || indexCount > entry.mIndexCapacity)
+  {
+    // The entry has outgrown its range, so move it to the end of the
+    // buffers, leaving a hole to be reclaimed by compaction.
+
+    release(entry.mRange);
+
+    entry.mVertexCapacity = getSlack(vertexCount);
+    entry.mIndexCapacity = (getSlack(indexCount) + 2) / 3 * 3;
+    entry.mRange.mFirstVertex = mVertices.size() / 3;
+    entry.mRange.mFirstIndex = mIndices.size();
+
+    mVertices.resize(mVertices.size() + entry.mVertexCapacity * 3, 0.f);
+    mIndices.resize(mIndices.size() + entry.mIndexCapacity, DEGENERATE_INDEX);
+
+    previousIndexCount = 0;
+  }
+
+  std::copy(vertices.begin(), vertices.end(), mVertices.begin() + entry.mRange.mFirstVertex * 3);
+
+  IndexList::iterator target = mIndices.begin() + entry.mRange.mFirstIndex;
+
+  for (IndexList::const_iterator i = indices.begin();  i != indices.end();  i++)
+    *target++ = *i + entry.mRange.mFirstVertex;
+
+  // Clear any indices left over from the previous contents of the range.
+
+  if (previousIndexCount > indexCount)
+    std::fill(target, target + (previousIndexCount - indexCount), DEGENERATE_INDEX);
+
+  if (vertexCount)
+    mChangedVertices.addRange(entry.mRange.mFirstVertex, vertexCount);
+
+  if (indexCount || previousIndexCount)
+    mChangedIndices.addRange(entry.mRange.mFirstIndex, std::max(indexCount, previousIndexCount));
+
+  entry.mRange.mVertexCount = vertexCount;
+  entry.mRange.mIndexCount = indexCount;
+}
+
+void GeometryBatch::release(const Range& range)
+{
+  if (!range.mIndexCount)
+    return;
+
+  std::fill(mIndices.begin() + range.mFirstIndex,
+            mIndices.begin() + range.mFirstIndex + range.mIndexCount,
+	    DEGENERATE_INDEX);
+
+  mChangedIndices.addRange(range.mFirstIndex, range.mIndexCount);
+}
+
+void GeometryBatch::compact(void)
+{
+  size_t vertexCapacity = 0, indexCapacity = 0;
+
+  for (EntryList::const_iterator i = mEntries.begin();  i != mEntries.end();  i++)
+  {
+    vertexCapacity += (*i).mVertexCapacity;
+    indexCapacity += (*i).mIndexCapacity;
+  }
+
+  // Only compact once at least half of either buffer is wasted, so that the
+  // cost of moving everything is amortized over many relocations.
+
+  if (mVertices.size() / 3 <= vertexCapacity * 2 && mIndices.size() <= indexCapacity * 2)
+    return;
+
+  VertexList vertices(vertexCapacity * 3, 0.f);
+  IndexList indices(indexCapacity, DEGENERATE_INDEX);
+
+  uint32 firstVertex = 0, firstIndex = 0;
+
+  for (EntryList::iterator i = mEntries.begin();  i != mEntries.end();  i++)
+  {
+    Range& range = (*i).mRange;
+
+    std::copy(mVertices.begin() + range.mFirstVertex * 3,
+              mVertices.begin() + (range.mFirstVertex + range.mVertexCount) * 3,
+	      vertices.begin() + firstVertex * 3);
+
+    for (uint32 j = 0;  j < range.mIndexCount;  j++)
+      indices[firstIndex + j] = mIndices[range.mFirstIndex + j] - range.mFirstVertex + firstVertex;
+
+    range.mFirstVertex = firstVertex;
+    range.mFirstIndex = firstIndex;
+
+    firstVertex += (*i).mVertexCapacity;
+    firstIndex += (*i).mIndexCapacity;
+  }
+
+  mVertices.swap(vertices);
+  mIndices.swap(indices);
+
+  // Everything has moved, so the whole of both buffers needs uploading.
+
+  mChangedVertices.clear();
+  mChangedIndices.clear();
+
+  if (!mVertices.empty())
+    mChangedVertices.addRange(0, mVertices.size() / 3);
+  if (!mIndices.empty())
+    mChangedIndices.addRange(0, mIndices.size());
+}
+
+void GeometryBatch::extractRange(void* data, uint32 first, uint32 count)
+{
+  Job& job = *reinterpret_cast<Job*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    Job::Item& item = job.mItems[i];
+
+    BaseMesh mesh;
+    if (!item.mGeometry->getBaseMesh(mesh))
+      continue;
+
+    // Build the object transform as a row-major rotation matrix with the
+    // scale folded in, followed by a translation.
+
+    real64 matrix[9] = { 1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+    Vector3d position(0.0, 0.0, 0.0);
+
+    if (item.mObject)
+    {
+      const Quaternion64& rotation = item.mObject->getRotation();
+      const Vector3d& scale = item.mObject->getScale();
+
+      real64 x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+
+      const real64 length = std::sqrt(x * x + y * y + z * z + w * w);
+      if (length == 0.0)
+      {
+	x = y = z = 0.0;
+	w = 1.0;
+      }
+      else
+      {
+	x /= length;
+	y /= length;
+	z /= length;
+	w /= length;
+      }
+
+      matrix[0] = (1.0 - 2.0 * (y * y + z * z)) * scale.x;
+      matrix[1] = 2.0 * (x * y - z * w) * scale.y;
+      matrix[2] = 2.0 * (x * z + y * w) * scale.z;
+      matrix[3] = 2.0 * (x * y + z * w) * scale.x;
+      matrix[4] = (1.0 - 2.0 * (x * x + z * z)) * scale.y;
+      matrix[5] = 2.0 * (y * z - x * w) * scale.z;
+      matrix[6] = 2.0 * (x * z - y * w) * scale.x;
+      matrix[7] = 2.0 * (y * z + x * w) * scale.y;
+      matrix[8] = (1.0 - 2.0 * (x * x + y * y)) * scale.z;
+
+      position = item.mObject->getPosition();
+    }
+
+    item.mVertices.resize(mesh.mVertices.size() * 3);
+
+    for (size_t j = 0;  j < mesh.mVertices.size();  j++)
+    {
+      const BaseVertex& vertex = mesh.mVertices[j];
+      real32* target = &item.mVertices[j * 3];
+
+      for (unsigned int row = 0;  row < 3;  row++)
+      {
+	target[row] = (real32) (matrix[row * 3] * vertex.x +
+	                        matrix[row * 3 + 1] * vertex.y +
+	                        matrix[row * 3 + 2] * vertex.z +
+	                        position[row]);
+      }
+    }
+
+    // Split quads along their first diagonal.
+
+    item.mIndices.reserve(mesh.mPolygons.size() * 6);
+
+    for (BaseMesh::PolygonList::const_iterator p = mesh.mPolygons.begin();  p != mesh.mPolygons.end();  p++)
+    {
+      const uint32* corners = (*p).mIndices;
+
+      item.mIndices.push_back(corners[0]);
+      item.mIndices.push_back(corners[1]);
+      item.mIndices.push_back(corners[2]);
+
+      if (corners[3] != INVALID_VERTEX_ID)
+      {
+	item.mIndices.push_back(corners[0]);
+	item.mIndices.push_back(corners[2]);
+	item.mIndices.push_back(corners[3]);
+      }
+    }
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
@@ -0,0 +1,866 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <algorithm>
+#include <functional>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// The largest number of polygons in a single leaf.
+const uint32 LEAF_SIZE = 4;
+
+// Deep enough for any tree built by halving a 32-bit polygon count.
+const unsigned int MAX_DEPTH = 64;
+
+const Box3d EMPTY_BOUNDS;
+
+class CentroidLess
+{
+public:
+  CentroidLess(const std::vector<Vector3d>& centroids, unsigned int axis):
+    mCentroids(centroids),
+    mAxis(axis)
+  {
+  }
+  bool operator () (uint32 first, uint32 second) const
+  {
+    return mCentroids[first][mAxis] < mCentroids[second][mAxis];
+  }
+private:
+  const std::vector<Vector3d>& mCentroids;
+  unsigned int mAxis;
+};
+
+Vector3d toVector(const BaseVertex& vertex)
+{
+  return Vector3d(vertex.x, vertex.y, vertex.z);
+}
+
+bool intersectBox(const Box3d& box,
+                  const Vector3d& origin,
+		  const Vector3d& inverse,
+		  real64 limit,
+		  real64& entry)
+{
+  real64 near = 0.0, far = limit;
+
+  for (unsigned int i = 0;  i < 3;  i++)
+  {
+    real64 first = (box.minimum[i] - origin[i]) * inverse[i];
+    real64 second = (box.maximum[i] - origin[i]) * inverse[i];
+
+    if (first > second)
+      std::swap(first, second);
+
+    // Written so that the NaN of a ray lying in a slab plane is ignored.
+    if (first > near)
+      near = first;
+    if (second < far)
+      far = second;
+
+    if (near > far)
+      return false;
+  }
+
+  entry = near;
+  return true;
+}
+
+bool intersectTriangle(const Vector3d& origin,
+                       const Vector3d& direction,
+		       const Vector3d& a,
+		       const Vector3d& b,
+		       const Vector3d& c,
+		       real64& distance)
+{
+  const Vector3d ab = b - a;
+  const Vector3d ac = c - a;
+  const Vector3d p = direction.crossProduct(ac);
+
+  const real64 determinant = ab.dotProduct(p);
+  if (determinant == 0.0)
+    return false;
+
+  const real64 inverse = 1.0 / determinant;
+
+  const Vector3d t = origin - a;
+  const real64 u = t.dotProduct(p) * inverse;
+  if (u < 0.0 || u > 1.0)
+    return false;
+
+  const Vector3d q = t.crossProduct(ab);
+  const real64 v = direction.dotProduct(q) * inverse;
+  if (v < 0.0 || u + v > 1.0)
+    return false;
+
+  distance = ac.dotProduct(q) * inverse;
+  return distance >= 0.0;
+}
+
+Vector3d findNearestOnSegment(const Vector3d& point,
+                              const Vector3d& a,
+			      const Vector3d& b)
+{
+  const Vector3d ab = b - a;
+
+  const real64 length = ab.lengthSquared();
+  if (length == 0.0)
+    return a;
+
+  const real64 t = ab.dotProduct(point - a) / length;
+  return a + ab * std::max(0.0, std::min(t, 1.0));
+}
+
+Vector3d findNearestOnTriangle(const Vector3d& point,
+                               const Vector3d& a,
+			       const Vector3d& b,
+			       const Vector3d& c)
+{
+  const Vector3d ab = b - a;
+  const Vector3d ac = c - a;
+
+  // A triangle without area, i.e. with coincident or collinear corners, has
+  // no interior, and the divisions below would yield NaN. Its nearest point
+  // is on one of its edges.
+
+  if (ab.crossProduct(ac).lengthSquared() <=
+      std::numeric_limits<real64>::epsilon() * ab.lengthSquared() * ac.lengthSquared())
+  {
+    Vector3d nearest = findNearestOnSegment(point, a, b);
+    real64 closest = (nearest - point).lengthSquared();
+
+    const Vector3d candidates[] =
+    {
+      findNearestOnSegment(point, b, c),
+      findNearestOnSegment(point, c, a)
+    };
+
+    for (unsigned int i = 0;  i < 2;  i++)
+    {
+      const real64 distance = (candidates[i] - point).lengthSquared();
+      if (distance < closest)
+      {
+	closest = distance;
+	nearest = candidates[i];
+      }
+    }
+
+    return nearest;
+  }
+
+  // Classifies the point against the Voronoi regions of the triangle.
+
+  const Vector3d ap = point - a;
+
+  const real64 d1 = ab.dotProduct(ap);
+  const real64 d2 = ac.dotProduct(ap);
+  if (d1 <= 0.0 && d2 <= 0.0)
+    return a;
+
+  const Vector3d bp = point - b;
+  const real64 d3 = ab.dotProduct(bp);
+  const real64 d4 = ac.dotProduct(bp);
+  if (d3 >= 0.0 && d4 <= d3)
+    return b;
+
+  const real64 vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+    return a + ab * (d1 / (d1 - d3));
+
+  const Vector3d cp = point - c;
+  const real64 d5 = ab.dotProduct(cp);
+  const real64 d6 = ac.dotProduct(cp);
+  if (d6 >= 0.0 && d5 <= d6)
+    return c;
+
+  const real64 vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+    return a + ac * (d2 / (d2 - d6));
+
+  const real64 va = d3 * d6 - d5 * d4;
+  if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+  const real64 denominator = 1.0 / (va + vb + vc);
+  return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+real64 getSquaredDistance(const Box3d& box, const Vector3d& point)
+{
+  real64 result = 0.0;
+
+  for (unsigned int i = 0;  i < 3;  i++)
+  {
+    if (point[i] < box.minimum[i])
+      result += (box.minimum[i] - point[i]) * (box.minimum[i] - point[i]);
+    else if (point[i] > box.maximum[i])
+      result += (point[i] - box.maximum[i]) * (point[i] - box.maximum[i]);
+  }
+
+  return result;
+}
+
+}
+
+//---------------------------------------------------------------------
+
+bool GeometryBoundsTree::castRay(const Vector3d& origin,
+                                 const Vector3d& direction,
+				 uint32& polygonID,
+				 real64& distance) const
+{
+  if (mBranches.empty())
+    return false;
+
+  const Vector3d inverse(1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z);
+
+  real64 closest = std::numeric_limits<real64>::max();
+  bool found = false;
+
+  uint32 stack[MAX_DEPTH];
+  unsigned int top = 0;
+  real64 entry;
+
+  if (!intersectBox(mBranches[0].mBounds, origin, inverse, closest, entry))
+    return false;
+
+  stack[top++] = 0;
+
+  while (top)
+  {
+    const Branch& branch = mBranches[stack[--top]];
+
+    if (!intersectBox(branch.mBounds, origin, inverse, closest, entry))
+      continue;
+
+    if (branch.mCount)
+    {
+      for (uint32 i = branch.mFirst;  i < branch.mFirst + branch.mCount;  i++)
+      {
+	const uint32 ID = mPrimitives[i];
+	const BasePolygon& polygon = mPolygons[ID];
+
+	const Vector3d a = getPosition(polygon.mIndices[0]);
+	const Vector3d c = getPosition(polygon.mIndices[2]);
+
+	real64 hit;
+
+	if (intersectTriangle(origin, direction, a, getPosition(polygon.mIndices[1]), c, hit) && hit < closest)
+	{
+	  closest = hit;
+	  polygonID = ID;
+	  found = true;
+	}
+
+	if (getCornerCount(ID) == 4)
+	{
+	  if (intersectTriangle(origin, direction, a, c, getPosition(polygon.mIndices[3]), hit) && hit < closest)
+	  {
+	    closest = hit;
+	    polygonID = ID;
+	    found = true;
+	  }
+	}
+      }
+    }
+    else
+    {
+      // Visit the nearer child first, so that the farther one can be culled
+      // by any hit found in it.
+
+      const uint32 left = &branch - &mBranches[0] + 1;
+      const uint32 right = branch.mFirst;
+
+      real64 leftEntry, rightEntry;
+      const bool leftHit = intersectBox(mBranches[left].mBounds, origin, inverse, closest, leftEntry);
+      const bool rightHit = intersectBox(mBranches[right].mBounds, origin, inverse, closest, rightEntry);
+
+      if (leftHit && rightHit)
+      {
+	if (leftEntry < rightEntry)
+	{
+	  stack[top++] = right;
+	  stack[top++] = left;
+	}
+	else
+	{
+	  stack[top++] = left;
+	  stack[top++] = right;
+	}
+      }
+      else if (leftHit)
+	stack[top++] = left;
+      else if (rightHit)
+	stack[top++] = right;
+    }
+  }
+
+  if (found)
+    distance = closest;
+
+  return found;
+}
+
+bool GeometryBoundsTree::findNearestPoint(const Vector3d& point,
+                                          uint32& polygonID,
+					  Vector3d& nearest) const
+{
+  if (mBranches.empty())
+    return false;
+
+  real64 closest = std::numeric_limits<real64>::max();
+  bool found = false;
+
+  uint32 stack[MAX_DEPTH];
+  unsigned int top = 0;
+
+  stack[top++] = 0;
+
+  while (top)
+  {
+    const Branch& branch = mBranches[stack[--top]];
+
+    if (getSquaredDistance(branch.mBounds, point) > closest)
+      continue;
+
+    if (branch.mCount)
+    {
+      for (uint32 i = branch.mFirst;  i < branch.mFirst + branch.mCount;  i++)
+      {
+	const uint32 ID = mPrimitives[i];
+	const BasePolygon& polygon = mPolygons[ID];
+
+	const Vector3d a = getPosition(polygon.mIndices[0]);
+	const Vector3d c = getPosition(polygon.mIndices[2]);
+
+	Vector3d candidate = findNearestOnTriangle(point, a, getPosition(polygon.mIndices[1]), c);
+	real64 distance = (candidate - point).lengthSquared();
+
+	if (distance < closest)
+	{
+	  closest = distance;
+	  nearest = candidate;
+	  polygonID = ID;
+	  found = true;
+	}
+
+	if (getCornerCount(ID) == 4)
+	{
+	  candidate = findNearestOnTriangle(point, a, c, getPosition(polygon.mIndices[3]));
+	  distance = (candidate - point).lengthSquared();
+
+	  if (distance < closest)
+	  {
+	    closest = distance;
+	    nearest = candidate;
+	    polygonID = ID;
+	    found = true;
+	  }
+	}
+      }
+    }
+    else
+    {
+      const uint32 left = &branch - &mBranches[0] + 1;
+      const uint32 right = branch.mFirst;
+
+      const real64 leftDistance = getSquaredDistance(mBranches[left].mBounds, point);
+      const real64 rightDistance = getSquaredDistance(mBranches[right].mBounds, point);
+
+      if (leftDistance < rightDistance)
+      {
+	stack[top++] = right;
+	stack[top++] = left;
+      }
+      else
+      {
+	stack[top++] = left;
+	stack[top++] = right;
+      }
+    }
+  }
+
+  return found;
+}
+
+void GeometryBoundsTree::findOverlaps(const Box3d& box, PolygonIDList& polygons) const
+{
+  polygons.clear();
+
+  if (mBranches.empty())
+    return;
+
+  uint32 stack[MAX_DEPTH];
+  unsigned int top = 0;
+
+  stack[top++] = 0;
+
+  while (top)
+  {
+    const uint32 index = stack[--top];
+    const Branch& branch = mBranches[index];
+
+    if (!branch.mBounds.intersects(box))
+      continue;
+
+    if (branch.mCount)
+    {
+      for (uint32 i = branch.mFirst;  i < branch.mFirst + branch.mCount;  i++)
+      {
+	const uint32 ID = mPrimitives[i];
+	const BasePolygon& polygon = mPolygons[ID];
+	const unsigned int cornerCount = getCornerCount(ID);
+
+	Box3d bounds;
+
+	for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+	  bounds.envelop(getPosition(polygon.mIndices[corner]));
+
+	if (bounds.intersects(box))
+	  polygons.push_back(ID);
+      }
+    }
+    else
+    {
+      stack[top++] = branch.mFirst;
+      stack[top++] = index + 1;
+    }
+  }
+}
+
+const Box3d& GeometryBoundsTree::getBounds(void) const
+{
+  if (mBranches.empty())
+    return EMPTY_BOUNDS;
+
+  return mBranches[0].mBounds;
+}
+
+GeometryNode& GeometryBoundsTree::getNode(void) const
+{
+  return mNode;
+}
+
+GeometryBoundsTree::GeometryBoundsTree(GeometryNode& node):
+  mNode(node),
+  mVertices(NULL),
+  mPolygons(NULL),
+  mVertexCount(0),
+  mPolygonCount(0),
+  mStructureVersion(0),
+  mVertexVersion(0),
+  mPolygonVersion(0),
+  mValid(false)
+{
+}
+
+void GeometryBoundsTree::update(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (!vertexLayer || !polygonLayer)
+  {
+    mBranches.clear();
+    mPrimitives.clear();
+    mLeaves.clear();
+    mValid = false;
+    return;
+  }
+
+  mVertices = reinterpret_cast<const BaseVertex*>(vertexLayer->mData.getitems());
+  mPolygons = reinterpret_cast<const BasePolygon*>(polygonLayer->mData.getitems());
+
+  // Moving vertices leaves the hierarchy valid, although less tight, so
+  // only changes to the polygons or the set of vertices force a rebuild.
+
+  if (!mValid ||
+      vertexLayer->getStructureVersion() != mStructureVersion ||
+      polygonLayer->getDataVersion() != mPolygonVersion)
+  {
+    rebuild();
+  }
+  else if (vertexLayer->getDataVersion() != mVertexVersion)
+  {
+    IDRangeSet vertices;
+
+    if (vertexLayer->getChangedSlots(mVertexVersion, vertices))
+      refit(&vertices);
+    else
+      refit(NULL);
+  }
+
+  mStructureVersion = vertexLayer->getStructureVersion();
+  mVertexVersion = vertexLayer->getDataVersion();
+  mPolygonVersion = polygonLayer->getDataVersion();
+  mValid = true;
+}
+
+void GeometryBoundsTree::rebuild(void)
+{
+  mVertexCount = mNode.getHighestVertexID();
+  if (mVertexCount == INVALID_VERTEX_ID)
+    mVertexCount = 0;
+  else
+    mVertexCount++;
+
+  mPolygonCount = mNode.getHighestPolygonID();
+  if (mPolygonCount == INVALID_POLYGON_ID)
+    mPolygonCount = 0;
+  else
+    mPolygonCount++;
+
+  mPrimitives.clear();
+  for (uint32 polygonID = 0;  polygonID < mPolygonCount;  polygonID++)
+  {
+    if (getCornerCount(polygonID))
+      mPrimitives.push_back(polygonID);
+  }
+
+  mBranches.clear();
+  mLeaves.clear();
+
+  if (mPrimitives.empty())
+  {
+    mCentroids.clear();
+    mParents.clear();
+    mVertexLeafOffsets.clear();
+    mVertexLeaves.clear();
+    mDirty.clear();
+    return;
+  }
+
+  mCentroids.resize(mPolygonCount);
+  Thread::parallelFor(computeCentroidRange, this, mPrimitives.size(), 1024);
+
+  mBranches.resize(getBranchCount(mPrimitives.size()));
+
+  // The top levels are split here, and the subtrees below them are then
+  // built in parallel. As the shape of the tree only depends on the number
+  // of polygons, each subtree knows where its branches go in advance.
+
+  unsigned int levels = 0;
+  while ((1u << levels) < Thread::getProcessorCount() * 4 && levels < 16)
+    levels++;
+
+  mTasks.clear();
+  split(0, 0, mPrimitives.size(), levels);
+  Thread::parallelFor(splitRange, this, mTasks.size(), 1);
+
+  mParents.assign(mBranches.size(), 0);
+
+  for (uint32 index = 0;  index < mBranches.size();  index++)
+  {
+    const Branch& branch = mBranches[index];
+
+    if (branch.mCount)
+      mLeaves.push_back(index);
+    else
+    {
+      mParents[index + 1] = index;
+      mParents[branch.mFirst] = index;
+    }
+  }
+
+  mDirty.assign(mBranches.size(), 0);
+
+  indexVertices();
+  refit(NULL);
+}
+
+void GeometryBoundsTree::refit(const IDRangeSet* vertices)
+{
+  if (mBranches.empty())
+    return;
+
+  // Moving many vertices touches most leaves anyway, so the whole tree is
+  // then refit without looking up the leaves of each vertex.
+
+  if (vertices && vertices->getIDCount() > mVertexCount / 4)
+    vertices = NULL;
+
+  mRefitLeaves.clear();
+  mRefitBranches.clear();
+
+  if (vertices)
+  {
+    const IDRangeSet::RangeList& ranges = vertices->getRanges();
+    for (IDRangeSet::RangeList::const_iterator i = ranges.begin();  i != ranges.end();  i++)
+    {
+      const uint32 end = std::min((*i).getEnd(), mVertexCount);
+
+      for (uint32 vertexID = (*i).mFirst;  vertexID < end;  vertexID++)
+      {
+	for (uint32 j = mVertexLeafOffsets[vertexID];  j < mVertexLeafOffsets[vertexID + 1];  j++)
+	{
+	  const uint32 leaf = mVertexLeaves[j];
+
+	  if (!mDirty[leaf])
+	  {
+	    mDirty[leaf] = 1;
+	    mRefitLeaves.push_back(leaf);
+	  }
+	}
+      }
+    }
+  }
+  else
+    mRefitLeaves = mLeaves;
+
+  if (mRefitLeaves.empty())
+    return;
+
+  Thread::parallelFor(refitRange, this, mRefitLeaves.size(), 256);
+
+  // Only the ancestors of the refit leaves are then updated. Children always
+  // come after their parent, so visiting the ancestors in descending order
+  // updates each one after both of its children.
+
+  if (vertices)
+  {
+    for (IndexList::const_iterator i = mRefitLeaves.begin();  i != mRefitLeaves.end();  i++)
+    {
+      for (uint32 index = *i;  index != 0;  )
+      {
+	index = mParents[index];
+	if (mDirty[index])
+	  break;
+
+	mDirty[index] = 1;
+	mRefitBranches.push_back(index);
+      }
+    }
+
+    std::sort(mRefitBranches.begin(), mRefitBranches.end(), std::greater<uint32>());
+  }
+  else
+  {
+    for (uint32 index = mBranches.size();  index-- > 0;  )
+    {
+      if (!mBranches[index].mCount)
+	mRefitBranches.push_back(index);
+    }
+  }
+
+  for (IndexList::const_iterator i = mRefitBranches.begin();  i != mRefitBranches.end();  i++)
+  {
+    Branch& branch = mBranches[*i];
+    branch.mBounds = mBranches[*i + 1].mBounds;
+    branch.mBounds.envelop(mBranches[branch.mFirst].mBounds);
+    mDirty[*i] = 0;
+  }
+
+  for (IndexList::const_iterator i = mRefitLeaves.begin();  i != mRefitLeaves.end();  i++)
+    mDirty[*i] = 0;
+}
+
+void GeometryBoundsTree::indexVertices(void)
+{
+  // Lists the leaves using each vertex, one entry per corner, so that moving
+  // a vertex only refits the leaves containing its polygons.
+
+  mVertexLeafOffsets.assign(mVertexCount + 1, 0);
+
+  for (IndexList::const_iterator i = mLeaves.begin();  i != mLeaves.end();  i++)
+  {
+    const Branch& branch = mBranches[*i];
+
+    for (uint32 j = branch.mFirst;  j < branch.mFirst + branch.mCount;  j++)
+    {
+      const BasePolygon& polygon = mPolygons[mPrimitives[j]];
+      const unsigned int cornerCount = getCornerCount(mPrimitives[j]);
+
+      for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+	mVertexLeafOffsets[polygon.mIndices[corner] + 1]++;
+    }
+  }
+
+  for (uint32 vertexID = 0;  vertexID < mVertexCount;  vertexID++)
+    mVertexLeafOffsets[vertexID + 1] += mVertexLeafOffsets[vertexID];
+
+  mVertexLeaves.resize(mVertexLeafOffsets[mVertexCount]);
+
+  IndexList next(mVertexLeafOffsets.begin(), mVertexLeafOffsets.end() - 1);
+
+  for (IndexList::const_iterator i = mLeaves.begin();  i != mLeaves.end();  i++)
+  {
+    const Branch& branch = mBranches[*i];
+
+    for (uint32 j = branch.mFirst;  j < branch.mFirst + branch.mCount;  j++)
+    {
+      const BasePolygon& polygon = mPolygons[mPrimitives[j]];
+      const unsigned int cornerCount = getCornerCount(mPrimitives[j]);
+
+      for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+	mVertexLeaves[next[polygon.mIndices[corner]]++] = *i;
+    }
+  }
+}
+
+void GeometryBoundsTree::split(uint32 index, uint32 first, uint32 count, unsigned int levels)
+{
+  Branch& branch = mBranches[index];
+
+  if (count <= LEAF_SIZE)
+  {
+    branch.mFirst = first;
+    branch.mCount = count;
+    return;
+  }
+
+  if (!levels)
+  {
+    Task task;
+    task.mIndex = index;
+    task.mFirst = first;
+    task.mCount = count;
+    mTasks.push_back(task);
+    return;
+  }
+
+  // Split at the median centroid along the longest axis of the centroids.
+
+  Box3d bounds;
+
+  for (uint32 i = first;  i < first + count;  i++)
+    bounds.envelop(mCentroids[mPrimitives[i]]);
+
+  const Vector3d size = bounds.getSize();
+
+  unsigned int axis = 0;
+  if (size.y > size[axis])
+    axis = 1;
+  if (size.z > size[axis])
+    axis = 2;
+
+  const uint32 half = count / 2;
+
+  std::nth_element(mPrimitives.begin() + first,
+                   mPrimitives.begin() + first + half,
+		   mPrimitives.begin() + first + count,
+		   CentroidLess(mCentroids, axis));
+
+  const uint32 right = index + 1 + getBranchCount(half);
+
+  branch.mFirst = right;
+  branch.mCount = 0;
+
+  split(index + 1, first, half, levels - 1);
+  split(right, first + half, count - half, levels - 1);
+}
+
+unsigned int GeometryBoundsTree::getCornerCount(uint32 polygonID) const
+{
+  if (polygonID >= mPolygonCount)
+    return 0;
+
+  const BasePolygon& polygon = mPolygons[polygonID];
+
+  for (unsigned int i = 0;  i < 3;  i++)
+  {
+    const uint32 vertexID = polygon.mIndices[i];
+    if (vertexID >= mVertexCount || !mNode.isVertex(vertexID))
+      return 0;
+  }
+
+  const uint32 vertexID = polygon.mIndices[3];
+  if (vertexID >= mVertexCount || !mNode.isVertex(vertexID))
+    return 3;
+
+  return 4;
+}
+
+Vector3d GeometryBoundsTree::getPosition(uint32 vertexID) const
+{
+  // Compact vertices are dequantized on each access, as the tree is kept
+  // between updates and a full precision copy would defeat their purpose.
+
+  if (const GeometryQuantization* quantization = mNode.getQuantization())
+  {
+    BaseVertex vertex;
+    quantization->getVertex(vertexID, vertex);
+    return toVector(vertex);
+  }
+
+  return toVector(mVertices[vertexID]);
+}
+
+uint32 GeometryBoundsTree::getBranchCount(uint32 count)
+{
+  if (count <= LEAF_SIZE)
+    return 1;
+
+  return 1 + getBranchCount(count / 2) + getBranchCount(count - count / 2);
+}
+
+void GeometryBoundsTree::computeCentroidRange(void* data, uint32 first, uint32 count)
+{
+  GeometryBoundsTree& tree = *reinterpret_cast<GeometryBoundsTree*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const uint32 polygonID = tree.mPrimitives[i];
+    const BasePolygon& polygon = tree.mPolygons[polygonID];
+    const unsigned int cornerCount = tree.getCornerCount(polygonID);
+
+    Vector3d centroid(0.0, 0.0, 0.0);
+
+    for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+      centroid += tree.getPosition(polygon.mIndices[corner]);
+
+    tree.mCentroids[polygonID] = centroid / (real64) cornerCount;
+  }
+}
+
+void GeometryBoundsTree::splitRange(void* data, uint32 first, uint32 count)
+{
+  GeometryBoundsTree& tree = *reinterpret_cast<GeometryBoundsTree*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const Task& task = tree.mTasks[i];
+    tree.split(task.mIndex, task.mFirst, task.mCount, MAX_DEPTH);
+  }
+}
+
+void GeometryBoundsTree::refitRange(void* data, uint32 first, uint32 count)
+{
+  GeometryBoundsTree& tree = *reinterpret_cast<GeometryBoundsTree*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    Branch& branch = tree.mBranches[tree.mRefitLeaves[i]];
+
+    branch.mBounds.setEmpty();
+
+    for (uint32 j = branch.mFirst;  j < branch.mFirst + branch.mCount;  j++)
+    {
+      const BasePolygon& polygon = tree.mPolygons[tree.mPrimitives[j]];
+      const unsigned int cornerCount = tree.getCornerCount(tree.mPrimitives[j]);
+
+      for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+	branch.mBounds.envelop(tree.getPosition(polygon.mIndices[corner]));
+    }
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
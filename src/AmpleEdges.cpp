@@ -0,0 +1,744 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// The edge hash table is split on the top bits of the hash, so that each
+// partition can be built by its own thread.
+const unsigned int PARTITION_BITS = 4;
+const unsigned int PARTITION_COUNT = 1 << PARTITION_BITS;
+
+const uint32 EMPTY_SLOT = ((uint32) ~0);
+
+const uint32 MIN_SLOT_COUNT = 16;
+
+}
+
+//---------------------------------------------------------------------
+
+const GeometryEdges::EdgeList& GeometryEdges::getEdges(void) const
+{
+  return mEdges;
+}
+
+const GeometryEdges::Edge* GeometryEdges::findEdge(uint32 first, uint32 second) const
+{
+  if (first > second)
+    std::swap(first, second);
+
+  const uint32 hash = hashPair(first, second);
+
+  const uint32 slot = findSlot(first, second, hash);
+  if (slot == EMPTY_SLOT)
+    return NULL;
+
+  return &mEdges[mPartitions[hash >> (32 - PARTITION_BITS)].mSlots[slot]];
+}
+
+uint32 GeometryEdges::getNextUse(uint32 edgeID) const
+{
+  if (edgeID >= mNextUses.size())
+    return INVALID_EDGE_ID;
+
+  return mNextUses[edgeID];
+}
+
+GeometryNode& GeometryEdges::getNode(void) const
+{
+  return mNode;
+}
+
+GeometryEdges::Partition::Partition(void):
+  mCount(0)
+{
+}
+
+GeometryEdges::GeometryEdges(GeometryNode& node):
+  mNode(node),
+  mPartitions(PARTITION_COUNT),
+  mCreases(NULL),
+  mCreaseCount(0),
+  mDefaultCrease(0),
+  mCreaseLayer(NULL),
+  mNodeVersion(0),
+  mVertexStructureVersion(0),
+  mVertexVersion(0),
+  mPolygonVersion(0),
+  mCreaseVersion(0),
+  mValid(false)
+{
+}
+
+void GeometryEdges::update(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (!vertexLayer || !polygonLayer)
+  {
+    mEdges.clear();
+    mPartitions.assign(PARTITION_COUNT, Partition());
+    mIndices.clear();
+    mCornerCounts.clear();
+    mNextUses.clear();
+    mDetached.clear();
+    mValid = false;
+    return;
+  }
+
+  const GeometryLayer* creaseLayer = mNode.getEdgeCreaseLayer();
+
+  if (creaseLayer)
+  {
+    const CornerUint32View creases(*creaseLayer);
+    mCreases = creases.getElements();
+    mCreaseCount = creases.getSlotCount();
+    mDefaultCrease = creaseLayer->getDefaultInt();
+  }
+  else
+  {
+    mCreases = NULL;
+    mCreaseCount = 0;
+    mDefaultCrease = mNode.getEdgeDefaultCrease();
+  }
+
+  bool full = !mValid;
+
+  IDRangeSet polygons;
+
+  if (!full && polygonLayer->getDataVersion() != mPolygonVersion)
+  {
+    if (!polygonLayer->getChangedSlots(mPolygonVersion, polygons))
+      full = true;
+    else if (polygons.getIDCount() > mCornerCounts.size() / 2)
+      full = true;
+  }
+
+  // Created vertices may complete polygons that were missing them, while
+  // deleted vertices may remove any number of edges, and force a rebuild.
+
+  bool created = false;
+
+  if (!full && vertexLayer->getStructureVersion() != mVertexStructureVersion)
+  {
+    IDRangeSet vertices;
+
+    if (!vertexLayer->getChangedSlots(mVertexVersion, vertices))
+      full = true;
+    else
+    {
+      uint32 vertexCount = mNode.getHighestVertexID();
+      if (vertexCount == INVALID_VERTEX_ID)
+	vertexCount = 0;
+      else
+	vertexCount++;
+
+      const IDRangeSet::RangeList& ranges = vertices.getRanges();
+      for (IDRangeSet::RangeList::const_iterator i = ranges.begin();  !full && i != ranges.end();  i++)
+      {
+	for (uint32 vertexID = (*i).mFirst;  vertexID < (*i).getEnd();  vertexID++)
+	{
+	  if (vertexID < vertexCount && mNode.isVertex(vertexID))
+	    created = true;
+	  else
+	  {
+	    full = true;
+	    break;
+	  }
+	}
+      }
+    }
+  }
+
+  // Changes to the crease layer are tracked per polygon, while anything
+  // else affecting creases causes them all to be recalculated.
+
+  bool creases = creaseLayer != mCreaseLayer || mNode.getDataVersion() != mNodeVersion;
+
+  IDRangeSet creasePolygons;
+
+  if (!creases && creaseLayer && creaseLayer->getDataVersion() != mCreaseVersion)
+  {
+    if (!creaseLayer->getChangedSlots(mCreaseVersion, creasePolygons))
+      creases = true;
+  }
+
+  if (full)
+    rebuild();
+  else
+  {
+    uint32 polygonCount = mNode.getHighestPolygonID();
+    if (polygonCount == INVALID_POLYGON_ID)
+      polygonCount = 0;
+    else
+      polygonCount++;
+
+    if (polygonCount > mCornerCounts.size())
+    {
+      mIndices.resize(polygonCount * 4, INVALID_VERTEX_ID);
+      mNextUses.resize(polygonCount * 4, INVALID_EDGE_ID);
+      mCornerCounts.resize(polygonCount, 0);
+    }
+
+    IDList changed;
+
+    const IDRangeSet::RangeList& ranges = polygons.getRanges();
+    for (IDRangeSet::RangeList::const_iterator i = ranges.begin();  i != ranges.end();  i++)
+    {
+      for (uint32 polygonID = (*i).mFirst;  polygonID < (*i).getEnd();  polygonID++)
+	changed.push_back(polygonID);
+    }
+
+    if (created)
+    {
+      changed.insert(changed.end(), mDetached.begin(), mDetached.end());
+
+      std::sort(changed.begin(), changed.end());
+      changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    }
+
+    for (IDList::const_iterator i = changed.begin();  i != changed.end();  i++)
+      detachPolygon(*i);
+
+    for (IDList::const_iterator i = changed.begin();  i != changed.end();  i++)
+      attachPolygon(*i);
+
+    if (creases)
+      Thread::parallelFor(creaseRange, this, mEdges.size(), 4096);
+    else
+    {
+      for (IDList::const_iterator i = changed.begin();  i != changed.end();  i++)
+	updateCreases(*i);
+
+      const IDRangeSet::RangeList& creaseRanges = creasePolygons.getRanges();
+      for (IDRangeSet::RangeList::const_iterator i = creaseRanges.begin();  i != creaseRanges.end();  i++)
+      {
+	for (uint32 polygonID = (*i).mFirst;  polygonID < (*i).getEnd();  polygonID++)
+	  updateCreases(polygonID);
+      }
+    }
+  }
+
+  mCreaseLayer = creaseLayer;
+  if (creaseLayer)
+    mCreaseVersion = creaseLayer->getDataVersion();
+  mNodeVersion = mNode.getDataVersion();
+  mVertexStructureVersion = vertexLayer->getStructureVersion();
+  mVertexVersion = vertexLayer->getDataVersion();
+  mPolygonVersion = polygonLayer->getDataVersion();
+  mValid = true;
+}
+
+void GeometryEdges::rebuild(void)
+{
+  uint32 polygonCount = mNode.getHighestPolygonID();
+  if (polygonCount == INVALID_POLYGON_ID)
+    polygonCount = 0;
+  else
+    polygonCount++;
+
+  mEdges.clear();
+  mPartitions.assign(PARTITION_COUNT, Partition());
+  mDetached.clear();
+
+  mIndices.assign(polygonCount * 4, INVALID_VERTEX_ID);
+  mNextUses.assign(polygonCount * 4, INVALID_EDGE_ID);
+  mCornerCounts.assign(polygonCount, 0);
+  mHashes.assign(polygonCount * 4, 0);
+
+  for (uint32 polygonID = 0;  polygonID < polygonCount;  polygonID++)
+  {
+    bool detached;
+    mCornerCounts[polygonID] = readPolygon(polygonID, &mIndices[polygonID * 4], detached);
+
+    if (detached)
+      mDetached.insert(polygonID);
+  }
+
+  Thread::parallelFor(hashRange, this, polygonCount, 4096);
+
+  // Sort the half-edges by partition, preserving their order within each.
+
+  mOrderStarts.assign(PARTITION_COUNT + 1, 0);
+
+  for (uint32 polygonID = 0;  polygonID < polygonCount;  polygonID++)
+  {
+    for (unsigned int corner = 0;  corner < mCornerCounts[polygonID];  corner++)
+      mOrderStarts[(mHashes[polygonID * 4 + corner] >> (32 - PARTITION_BITS)) + 1]++;
+  }
+
+  for (unsigned int i = 0;  i < PARTITION_COUNT;  i++)
+    mOrderStarts[i + 1] += mOrderStarts[i];
+
+  mOrder.resize(mOrderStarts[PARTITION_COUNT]);
+
+  IDList positions(mOrderStarts.begin(), mOrderStarts.end() - 1);
+
+  for (uint32 polygonID = 0;  polygonID < polygonCount;  polygonID++)
+  {
+    for (unsigned int corner = 0;  corner < mCornerCounts[polygonID];  corner++)
+    {
+      const uint32 edgeID = polygonID * 4 + corner;
+      mOrder[positions[mHashes[edgeID] >> (32 - PARTITION_BITS)]++] = edgeID;
+    }
+  }
+
+  Thread::parallelFor(partitionRange, this, PARTITION_COUNT, 1);
+
+  mOffsets.assign(PARTITION_COUNT, 0);
+
+  uint32 edgeCount = 0;
+
+  for (unsigned int i = 0;  i < PARTITION_COUNT;  i++)
+  {
+    mOffsets[i] = edgeCount;
+    edgeCount += mPartitions[i].mEdges.size();
+  }
+
+  mEdges.resize(edgeCount);
+
+  Thread::parallelFor(offsetRange, this, PARTITION_COUNT, 1);
+  Thread::parallelFor(creaseRange, this, mEdges.size(), 4096);
+
+  mHashes.clear();
+  mOrder.clear();
+}
+
+void GeometryEdges::detachPolygon(uint32 polygonID)
+{
+  mDetached.erase(polygonID);
+
+  if (polygonID >= mCornerCounts.size())
+    return;
+
+  const uint32* indices = &mIndices[polygonID * 4];
+  const unsigned int cornerCount = mCornerCounts[polygonID];
+
+  for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+  {
+    const uint32 first = indices[corner];
+    const uint32 second = indices[(corner + 1) % cornerCount];
+
+    removeUse(polygonID * 4 + corner, std::min(first, second), std::max(first, second));
+  }
+
+  for (unsigned int corner = 0;  corner < 4;  corner++)
+    mIndices[polygonID * 4 + corner] = INVALID_VERTEX_ID;
+
+  mCornerCounts[polygonID] = 0;
+}
+
+void GeometryEdges::attachPolygon(uint32 polygonID)
+{
+  if (polygonID >= mCornerCounts.size())
+    return;
+
+  uint32* indices = &mIndices[polygonID * 4];
+
+  bool detached;
+  const unsigned int cornerCount = readPolygon(polygonID, indices, detached);
+
+  if (detached)
+    mDetached.insert(polygonID);
+
+  mCornerCounts[polygonID] = cornerCount;
+
+  for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+  {
+    const uint32 first = indices[corner];
+    const uint32 second = indices[(corner + 1) % cornerCount];
+
+    addUse(polygonID * 4 + corner, std::min(first, second), std::max(first, second));
+  }
+}
+
+void GeometryEdges::addUse(uint32 edgeID, uint32 first, uint32 second)
+{
+  const uint32 hash = hashPair(first, second);
+  Partition& partition = mPartitions[hash >> (32 - PARTITION_BITS)];
+
+  const uint32 slot = findSlot(first, second, hash);
+  if (slot != EMPTY_SLOT)
+  {
+    Edge& edge = mEdges[partition.mSlots[slot]];
+    mNextUses[edgeID] = edge.mFirstUse;
+    edge.mFirstUse = edgeID;
+    edge.mUseCount++;
+    return;
+  }
+
+  Edge edge;
+  edge.mVertices[0] = first;
+  edge.mVertices[1] = second;
+  edge.mCrease = 0;
+  edge.mFirstUse = edgeID;
+  edge.mUseCount = 1;
+
+  mNextUses[edgeID] = INVALID_EDGE_ID;
+
+  mEdges.push_back(edge);
+  insertEdge(partition, mEdges.size() - 1, hash);
+}
+
+void GeometryEdges::removeUse(uint32 edgeID, uint32 first, uint32 second)
+{
+  const uint32 hash = hashPair(first, second);
+  Partition& partition = mPartitions[hash >> (32 - PARTITION_BITS)];
+
+  const uint32 slot = findSlot(first, second, hash);
+  if (slot == EMPTY_SLOT)
+    return;
+
+  const uint32 index = partition.mSlots[slot];
+  Edge& edge = mEdges[index];
+
+  if (edge.mFirstUse == edgeID)
+    edge.mFirstUse = mNextUses[edgeID];
+  else
+  {
+    uint32 use = edge.mFirstUse;
+    while (mNextUses[use] != edgeID)
+      use = mNextUses[use];
+
+    mNextUses[use] = mNextUses[edgeID];
+  }
+
+  mNextUses[edgeID] = INVALID_EDGE_ID;
+
+  if (--edge.mUseCount)
+  {
+    updateCrease(edge);
+    return;
+  }
+
+  eraseEdge(partition, slot);
+
+  // Move the last edge into the hole, and point its slot at the new index.
+
+  const uint32 last = mEdges.size() - 1;
+
+  if (index != last)
+  {
+    const Edge& moved = mEdges[last];
+    const uint32 movedHash = hashPair(moved.mVertices[0], moved.mVertices[1]);
+    const uint32 movedSlot = findSlot(moved.mVertices[0], moved.mVertices[1], movedHash);
+
+    mPartitions[movedHash >> (32 - PARTITION_BITS)].mSlots[movedSlot] = index;
+    mEdges[index] = moved;
+  }
+
+  mEdges.pop_back();
+}
+
+void GeometryEdges::insertEdge(Partition& partition, uint32 index, uint32 hash)
+{
+  if ((partition.mCount + 1) * 2 > partition.mSlots.size())
+  {
+    IDList slots(std::max(MIN_SLOT_COUNT, (uint32) partition.mSlots.size() * 2), EMPTY_SLOT);
+    const uint32 mask = slots.size() - 1;
+
+    for (IDList::const_iterator i = partition.mSlots.begin();  i != partition.mSlots.end();  i++)
+    {
+      if (*i == EMPTY_SLOT)
+	continue;
+
+      const Edge& edge = mEdges[*i];
+
+      uint32 slot = hashPair(edge.mVertices[0], edge.mVertices[1]) & mask;
+      while (slots[slot] != EMPTY_SLOT)
+	slot = (slot + 1) & mask;
+
+      slots[slot] = *i;
+    }
+
+    partition.mSlots.swap(slots);
+  }
+
+  const uint32 mask = partition.mSlots.size() - 1;
+
+  uint32 slot = hash & mask;
+  while (partition.mSlots[slot] != EMPTY_SLOT)
+    slot = (slot + 1) & mask;
+
+  partition.mSlots[slot] = index;
+  partition.mCount++;
+}
+
+void GeometryEdges::eraseEdge(Partition& partition, uint32 slot)
+{
+  // Shift back any following entries that would otherwise become
+  // unreachable by linear probing.
+
+  const uint32 mask = partition.mSlots.size() - 1;
+
+  uint32 hole = slot;
+  uint32 next = (hole + 1) & mask;
+
+  while (partition.mSlots[next] != EMPTY_SLOT)
+  {
+    const Edge& edge = mEdges[partition.mSlots[next]];
+    const uint32 home = hashPair(edge.mVertices[0], edge.mVertices[1]) & mask;
+
+    if (((next - home) & mask) >= ((next - hole) & mask))
+    {
+      partition.mSlots[hole] = partition.mSlots[next];
+      hole = next;
+    }
+
+    next = (next + 1) & mask;
+  }
+
+  partition.mSlots[hole] = EMPTY_SLOT;
+  partition.mCount--;
+}
+
+uint32 GeometryEdges::findSlot(uint32 first, uint32 second, uint32 hash) const
+{
+  const Partition& partition = mPartitions[hash >> (32 - PARTITION_BITS)];
+  if (partition.mSlots.empty())
+    return EMPTY_SLOT;
+
+  const uint32 mask = partition.mSlots.size() - 1;
+
+  for (uint32 slot = hash & mask;  partition.mSlots[slot] != EMPTY_SLOT;  slot = (slot + 1) & mask)
+  {
+    const Edge& edge = mEdges[partition.mSlots[slot]];
+    if (edge.mVertices[0] == first && edge.mVertices[1] == second)
+      return slot;
+  }
+
+  return EMPTY_SLOT;
+}
+
+void GeometryEdges::updateCrease(Edge& edge) const
+{
+  edge.mCrease = 0;
+
+  for (uint32 use = edge.mFirstUse;  use != INVALID_EDGE_ID;  use = mNextUses[use])
+    edge.mCrease = std::max(edge.mCrease, getCrease(use));
+}
+
+void GeometryEdges::updateCreases(uint32 polygonID)
+{
+  if (polygonID >= mCornerCounts.size())
+    return;
+
+  const uint32* indices = &mIndices[polygonID * 4];
+  const unsigned int cornerCount = mCornerCounts[polygonID];
+
+  for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+  {
+    const uint32 first = std::min(indices[corner], indices[(corner + 1) % cornerCount]);
+    const uint32 second = std::max(indices[corner], indices[(corner + 1) % cornerCount]);
+    const uint32 hash = hashPair(first, second);
+
+    const uint32 slot = findSlot(first, second, hash);
+    if (slot != EMPTY_SLOT)
+      updateCrease(mEdges[mPartitions[hash >> (32 - PARTITION_BITS)].mSlots[slot]]);
+  }
+}
+
+uint32 GeometryEdges::getCrease(uint32 edgeID) const
+{
+  // The crease of corner i applies to the edge from corner i to corner i + 1.
+
+  if (!mCreases || edgeID / 4 >= mCreaseCount)
+    return mDefaultCrease;
+
+  return mCreases[edgeID];
+}
+
+unsigned int GeometryEdges::readPolygon(uint32 polygonID, uint32* indices, bool& detached) const
+{
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  detached = false;
+
+  if (polygonID >= polygonLayer->mData.getItemCount())
+    return 0;
+
+  const BasePolygon& polygon = reinterpret_cast<const BasePolygon*>(polygonLayer->mData.getitems())[polygonID];
+  if (!polygon.isValid())
+    return 0;
+
+  uint32 vertexCount = mNode.getHighestVertexID();
+  if (vertexCount == INVALID_VERTEX_ID)
+    vertexCount = 0;
+  else
+    vertexCount++;
+
+  unsigned int cornerCount = 0;
+
+  while (cornerCount < 4)
+  {
+    const uint32 vertexID = polygon.mIndices[cornerCount];
+    if (vertexID >= vertexCount || !mNode.isVertex(vertexID))
+      break;
+
+    indices[cornerCount] = vertexID;
+    cornerCount++;
+  }
+
+  // Polygons using missing vertices are remembered, so that they can be
+  // brought back if those vertices are created.
+
+  if (cornerCount < 4 && polygon.mIndices[cornerCount] != INVALID_VERTEX_ID)
+    detached = true;
+
+  if (cornerCount < 3)
+    return 0;
+
+  return cornerCount;
+}
+
+uint32 GeometryEdges::hashPair(uint32 first, uint32 second)
+{
+  uint32 hash = first * 0x9e3779b1 ^ (second + 0x7f4a7c15) * 0x85ebca77;
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+void GeometryEdges::hashRange(void* data, uint32 first, uint32 count)
+{
+  GeometryEdges& edges = *reinterpret_cast<GeometryEdges*>(data);
+
+  for (uint32 polygonID = first;  polygonID < first + count;  polygonID++)
+  {
+    const uint32* indices = &edges.mIndices[polygonID * 4];
+    const unsigned int cornerCount = edges.mCornerCounts[polygonID];
+
+    for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+    {
+      const uint32 a = indices[corner];
+      const uint32 b = indices[(corner + 1) % cornerCount];
+
+      edges.mHashes[polygonID * 4 + corner] = hashPair(std::min(a, b), std::max(a, b));
+    }
+  }
+}
+
+void GeometryEdges::partitionRange(void* data, uint32 first, uint32 count)
+{
+  GeometryEdges& edges = *reinterpret_cast<GeometryEdges*>(data);
+
+  // Each partition is built with indices into its own edge list, which are
+  // then offset once all partitions are done.
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    Partition& partition = edges.mPartitions[i];
+    const uint32 start = edges.mOrderStarts[i];
+    const uint32 end = edges.mOrderStarts[i + 1];
+
+    uint32 slotCount = MIN_SLOT_COUNT;
+    while (slotCount < (end - start) * 2)
+      slotCount *= 2;
+
+    partition.mSlots.assign(slotCount, EMPTY_SLOT);
+    partition.mCount = 0;
+
+    const uint32 mask = slotCount - 1;
+
+    for (uint32 j = start;  j < end;  j++)
+    {
+      const uint32 edgeID = edges.mOrder[j];
+      const uint32 polygonID = edgeID / 4;
+      const unsigned int corner = edgeID % 4;
+      const unsigned int cornerCount = edges.mCornerCounts[polygonID];
+
+      const uint32 a = edges.mIndices[edgeID];
+      const uint32 b = edges.mIndices[polygonID * 4 + (corner + 1) % cornerCount];
+      const uint32 lower = std::min(a, b);
+      const uint32 upper = std::max(a, b);
+
+      uint32 slot = edges.mHashes[edgeID] & mask;
+
+      for (;;)
+      {
+	const uint32 index = partition.mSlots[slot];
+
+	if (index == EMPTY_SLOT)
+	{
+	  Edge edge;
+	  edge.mVertices[0] = lower;
+	  edge.mVertices[1] = upper;
+	  edge.mCrease = 0;
+	  edge.mFirstUse = edgeID;
+	  edge.mUseCount = 1;
+
+	  partition.mSlots[slot] = partition.mEdges.size();
+	  partition.mEdges.push_back(edge);
+	  partition.mCount++;
+	  break;
+	}
+
+	Edge& edge = partition.mEdges[index];
+
+	if (edge.mVertices[0] == lower && edge.mVertices[1] == upper)
+	{
+	  edges.mNextUses[edgeID] = edge.mFirstUse;
+	  edge.mFirstUse = edgeID;
+	  edge.mUseCount++;
+	  break;
+	}
+
+	slot = (slot + 1) & mask;
+      }
+    }
+  }
+}
+
+void GeometryEdges::offsetRange(void* data, uint32 first, uint32 count)
+{
+  GeometryEdges& edges = *reinterpret_cast<GeometryEdges*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    Partition& partition = edges.mPartitions[i];
+    const uint32 offset = edges.mOffsets[i];
+
+    std::copy(partition.mEdges.begin(), partition.mEdges.end(), edges.mEdges.begin() + offset);
+    EdgeList().swap(partition.mEdges);
+
+    for (IDList::iterator slot = partition.mSlots.begin();  slot != partition.mSlots.end();  slot++)
+    {
+      if (*slot != EMPTY_SLOT)
+	*slot += offset;
+    }
+  }
+}
+
+void GeometryEdges::creaseRange(void* data, uint32 first, uint32 count)
+{
+  GeometryEdges& edges = *reinterpret_cast<GeometryEdges*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+    edges.updateCrease(edges.mEdges[i]);
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
@@ -0,0 +1,384 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// Size of the buffer collecting small writes into large ones.
+const size_t BUFFER_SIZE = 1 << 20;
+
+class Writer
+{
+public:
+  Writer(std::FILE* file);
+  void write(const void* data, size_t size);
+  void write(const std::string& text);
+  bool flush(void);
+private:
+  std::FILE* mFile;
+  std::vector<uint8> mBuffer;
+  size_t mSize;
+  bool mFailed;
+};
+
+Writer::Writer(std::FILE* file):
+  mFile(file),
+  mBuffer(BUFFER_SIZE),
+  mSize(0),
+  mFailed(false)
+{
+}
+
+void Writer::write(const void* data, size_t size)
+{
+  if (mSize + size > mBuffer.size())
+  {
+    flush();
+
+    if (size > mBuffer.size())
+    {
+      if (std::fwrite(data, 1, size, mFile) != size)
+	mFailed = true;
+
+      return;
+    }
+  }
+
+  std::memcpy(&mBuffer[mSize], data, size);
+  mSize += size;
+}
+
+void Writer::write(const std::string& text)
+{
+  write(text.data(), text.size());
+}
+
+bool Writer::flush(void)
+{
+  if (mSize && std::fwrite(&mBuffer[0], 1, mSize, mFile) != mSize)
+    mFailed = true;
+
+  mSize = 0;
+  return !mFailed;
+}
+
+bool isLittleEndian(void)
+{
+  const uint16 value = 1;
+  return *reinterpret_cast<const uint8*>(&value) == 1;
+}
+
+std::string getCount(uint32 count)
+{
+  char text[16];
+  std::sprintf(text, "%u", (unsigned int) count);
+  return text;
+}
+
+std::string getPropertyName(const std::string& name)
+{
+  // PLY header lines are split on whitespace, so anything but printable
+  // characters would break the property line.
+
+  if (name.empty())
+    return "_";
+
+  std::string result = name;
+
+  for (std::string::iterator i = result.begin();  i != result.end();  i++)
+  {
+    if (!std::isgraph((unsigned char) *i))
+      *i = '_';
+  }
+
+  return result;
+}
+
+std::string getComment(const std::string& text)
+{
+  // Comments may contain spaces, but must stay on a single line.
+
+  std::string result = text;
+
+  for (std::string::iterator i = result.begin();  i != result.end();  i++)
+  {
+    if (std::iscntrl((unsigned char) *i))
+      *i = ' ';
+  }
+
+  return result;
+}
+
+typedef std::set<std::string> NameSet;
+
+std::string getProperties(const GeometryLayer& layer, NameSet& names)
+{
+  // Layers with several elements per slot get one property per element,
+  // with the same layout as the slots themselves.
+
+  const char* type;
+  const char* const* suffixes = NULL;
+  unsigned int count = 1;
+
+  static const char* const xyz[] = { "_x", "_y", "_z" };
+  static const char* const corners[] = { "_0", "_1", "_2", "_3" };
+
+  switch (layer.getType())
+  {
+    case VN_G_LAYER_VERTEX_XYZ:
+      type = "double";
+      suffixes = xyz;
+      count = 3;
+      break;
+    case VN_G_LAYER_VERTEX_UINT32:
+    case VN_G_LAYER_POLYGON_FACE_UINT32:
+      type = "uint";
+      break;
+    case VN_G_LAYER_VERTEX_REAL:
+    case VN_G_LAYER_POLYGON_FACE_REAL:
+      type = "double";
+      break;
+    case VN_G_LAYER_POLYGON_CORNER_UINT32:
+      type = "uint";
+      suffixes = corners;
+      count = 4;
+      break;
+    case VN_G_LAYER_POLYGON_CORNER_REAL:
+      type = "double";
+      suffixes = corners;
+      count = 4;
+      break;
+    case VN_G_LAYER_POLYGON_FACE_UINT8:
+      type = "uchar";
+      break;
+    default:
+      return std::string();
+  }
+
+  // Property names must be unique within an element, so a name colliding
+  // with one already written, including after sanitizing, is given a
+  // numeric suffix.
+
+  const std::string base = getPropertyName(layer.getName());
+  std::string name = base;
+
+  for (uint32 index = 1;  ;  index++)
+  {
+    bool unique = true;
+
+    for (unsigned int i = 0;  i < count;  i++)
+    {
+      if (names.count(suffixes ? name + suffixes[i] : name))
+      {
+	unique = false;
+	break;
+      }
+    }
+
+    if (unique)
+      break;
+
+    name = base + '_' + getCount(index);
+  }
+
+  std::string result;
+
+  for (unsigned int i = 0;  i < count;  i++)
+  {
+    result += "property ";
+    result += type;
+    result += ' ';
+    result += name;
+    if (suffixes)
+      result += suffixes[i];
+    result += '\n';
+
+    names.insert(suffixes ? name + suffixes[i] : name);
+  }
+
+  return result;
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+bool GeometryNode::exportPLY(const std::string& path) const
+{
+  if (!mBaseVertexLayer || !mBasePolygonLayer)
+    return false;
+
+  typedef std::vector<const GeometryLayer*> LayerList;
+
+  LayerList vertexLayers;
+  LayerList polygonLayers;
+
+  for (GeometryNode::LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
+  {
+    if (*i == mBaseVertexLayer || *i == mBasePolygonLayer)
+      continue;
+
+    if ((*i)->getStack() == GeometryLayer::VERTEX)
+      vertexLayers.push_back(*i);
+    else
+      polygonLayers.push_back(*i);
+  }
+
+  // Number the valid vertices, as the file has no room for gaps. This is the
+  // only per-vertex state kept.
+
+  Block vertexData;
+  mBaseVertexLayer->getSnapshot(vertexData);
+
+  const uint32 vertexLimit = vertexData.getItemCount();
+  const uint32 polygonLimit = mBasePolygonLayer->mData.getItemCount();
+
+  const BaseVertex* vertices = reinterpret_cast<const BaseVertex*>(vertexData.getitems());
+  const BasePolygon* polygons = reinterpret_cast<const BasePolygon*>(mBasePolygonLayer->mData.getitems());
+
+  std::vector<uint32> indices(vertexLimit, INVALID_VERTEX_ID);
+  uint32 vertexCount = 0;
+
+  for (uint32 vertexID = 0;  vertexID < vertexLimit;  vertexID++)
+  {
+    if (vertices[vertexID].isValid())
+      indices[vertexID] = vertexCount++;
+  }
+
+  uint32 polygonCount = 0;
+
+  for (uint32 polygonID = 0;  polygonID < polygonLimit;  polygonID++)
+  {
+    if (isPolygon(polygonID))
+      polygonCount++;
+  }
+
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+
+  Writer writer(file);
+
+  writer.write("ply\n");
+  if (isLittleEndian())
+    writer.write("format binary_little_endian 1.0\n");
+  else
+    writer.write("format binary_big_endian 1.0\n");
+  if (!getName().empty())
+    writer.write("comment " + getComment(getName()) + "\n");
+
+  writer.write("element vertex " + getCount(vertexCount) + "\n");
+  writer.write("property double x\n");
+  writer.write("property double y\n");
+  writer.write("property double z\n");
+
+  NameSet names;
+  names.insert("x");
+  names.insert("y");
+  names.insert("z");
+
+  for (LayerList::const_iterator i = vertexLayers.begin();  i != vertexLayers.end();  i++)
+    writer.write(getProperties(**i, names));
+
+  writer.write("element face " + getCount(polygonCount) + "\n");
+  writer.write("property list uchar uint vertex_indices\n");
+
+  names.clear();
+  names.insert("vertex_indices");
+
+  for (LayerList::const_iterator i = polygonLayers.begin();  i != polygonLayers.end();  i++)
+    writer.write(getProperties(**i, names));
+
+  writer.write("end_header\n");
+
+  // The slots are stored the same way the properties are laid out, so they
+  // can be written as is. Slots past the end of a layer hold its defaults.
+
+  uint8 slot[sizeof(real64) * 4];
+
+  for (uint32 vertexID = 0;  vertexID < vertexLimit;  vertexID++)
+  {
+    if (indices[vertexID] == INVALID_VERTEX_ID)
+      continue;
+
+    writer.write(vertices + vertexID, sizeof(BaseVertex));
+
+    for (LayerList::const_iterator i = vertexLayers.begin();  i != vertexLayers.end();  i++)
+    {
+      const GeometryLayer& layer = **i;
+
+      if (const void* data = layer.mData.getItem(vertexID))
+	writer.write(data, layer.getSlotSize());
+      else
+      {
+	layer.readSlot(vertexID, slot);
+	writer.write(slot, layer.getSlotSize());
+      }
+    }
+  }
+
+  for (uint32 polygonID = 0;  polygonID < polygonLimit;  polygonID++)
+  {
+    if (!isPolygon(polygonID))
+      continue;
+
+    const BasePolygon& polygon = polygons[polygonID];
+
+    uint32 corners[4];
+    uint8 count = 3;
+
+    corners[0] = indices[polygon.mIndices[0]];
+    corners[1] = indices[polygon.mIndices[1]];
+    corners[2] = indices[polygon.mIndices[2]];
+
+    if (isVertex(polygon.mIndices[3]))
+      corners[count++] = indices[polygon.mIndices[3]];
+
+    writer.write(&count, sizeof(count));
+    writer.write(corners, count * sizeof(uint32));
+
+    for (LayerList::const_iterator i = polygonLayers.begin();  i != polygonLayers.end();  i++)
+    {
+      const GeometryLayer& layer = **i;
+
+      if (const void* data = layer.mData.getItem(polygonID))
+	writer.write(data, layer.getSlotSize());
+      else
+      {
+	layer.readSlot(polygonID, slot);
+	writer.write(slot, layer.getSlotSize());
+      }
+    }
+  }
+
+  const bool result = writer.flush();
+
+  if (std::fclose(file) != 0)
+    return false;
+
+  return result;
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
@@ -0,0 +1,439 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// Nodes with at least this many polygon slots are split across threads.
+// Smaller nodes are each extracted whole by a single thread.
+const uint32 SPLIT_THRESHOLD = 65536;
+
+// Number of slots handled by each task when a node is split.
+const uint32 CHUNK_SIZE = 16384;
+
+// Marks a vertex as used. Polygon chunks sharing a vertex may mark it at
+// the same time, so the store is atomic.
+void markUsed(uint8& flag)
+{
+#ifdef _WIN32
+  _InterlockedExchange8(reinterpret_cast<volatile char*>(&flag), 1);
+#else
+  __sync_lock_test_and_set(&flag, 1);
+#endif
+}
+
+uint32 getChunkCount(uint32 count)
+{
+  return (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// State shared by the passes extracting a single node. Each pass works on
+// disjoint chunks of slots, and the offsets between the passes are made by
+// a prefix sum over the per-chunk counts.
+class Split
+{
+public:
+  bool isVertex(uint32 vertexID) const;
+  const BaseVertex* mVertices;
+  uint32 mVertexCount;
+  const BasePolygon* mPolygons;
+  uint32 mPolygonCount;
+  std::vector<uint8> mUsed;
+  std::vector<uint32> mIndices;
+  std::vector<uint32> mVertexOffsets;
+  std::vector<uint32> mPolygonOffsets;
+  BaseMesh* mMesh;
+};
+
+bool Split::isVertex(uint32 vertexID) const
+{
+  return vertexID < mVertexCount && mVertices[vertexID].isValid();
+}
+
+void dispatch(Thread::RangeFunction function, Split& split, uint32 count, bool parallel)
+{
+  if (parallel)
+    Thread::parallelFor(function, &split, count, 1);
+  else
+    function(&split, 0, count);
+}
+
+uint32 sumOffsets(std::vector<uint32>& offsets)
+{
+  // Turns per-chunk counts into the index of the first item of each chunk.
+
+  uint32 total = 0;
+
+  for (std::vector<uint32>::iterator i = offsets.begin();  i != offsets.end();  i++)
+  {
+    const uint32 count = *i;
+    *i = total;
+    total += count;
+  }
+
+  return total;
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+class GeometryExtraction::Source
+{
+public:
+  Block mVertices;
+  Block mPolygons;
+};
+
+//---------------------------------------------------------------------
+
+class GeometryExtraction::Job
+{
+public:
+  typedef std::vector<Source> SourceList;
+  SourceList mSources;
+  MeshList mMeshes;
+  NodeIDList mNodeIDs;
+  std::vector<uint32> mWhole;
+  Mutex mMutex;
+  bool mFinished;
+};
+
+//---------------------------------------------------------------------
+
+GeometryExtraction::GeometryExtraction(Session& session):
+  mSession(session),
+  mJob(NULL),
+  mThread(NULL)
+{
+}
+
+GeometryExtraction::~GeometryExtraction(void)
+{
+  wait();
+}
+
+bool GeometryExtraction::addNode(VNodeID nodeID)
+{
+  if (std::find(mNodeIDs.begin(), mNodeIDs.end(), nodeID) != mNodeIDs.end())
+    return false;
+
+  mNodeIDs.push_back(nodeID);
+  return true;
+}
+
+bool GeometryExtraction::removeNode(VNodeID nodeID)
+{
+  NodeIDList::iterator i = std::find(mNodeIDs.begin(), mNodeIDs.end(), nodeID);
+  if (i == mNodeIDs.end())
+    return false;
+
+  mNodeIDs.erase(i);
+  return true;
+}
+
+void GeometryExtraction::clear(void)
+{
+  mNodeIDs.clear();
+}
+
+bool GeometryExtraction::start(void)
+{
+  if (mJob)
+    return false;
+
+  // Only the storage of the base layers is shared here. The workers never
+  // touch the nodes themselves, and all changes to the share counts are made
+  // on this thread.
+
+  mJob = new Job;
+  mJob->mSources.resize(mNodeIDs.size());
+  mJob->mMeshes.resize(mNodeIDs.size());
+  mJob->mNodeIDs = mNodeIDs;
+  mJob->mFinished = false;
+
+  for (uint32 i = 0;  i < mNodeIDs.size();  i++)
+  {
+    GeometryNode* node = dynamic_cast<GeometryNode*>(mSession.getNodeByID(mNodeIDs[i]));
+    if (!node || !node->mBaseVertexLayer || !node->mBasePolygonLayer)
+      continue;
+
+    Source& source = mJob->mSources[i];
+    node->mBaseVertexLayer->getSnapshot(source.mVertices);
+    source.mPolygons.share(node->mBasePolygonLayer->mData);
+
+    if (source.mPolygons.getItemCount() < SPLIT_THRESHOLD)
+      mJob->mWhole.push_back(i);
+  }
+
+  mThread = Thread::create(run, mJob);
+  if (!mThread)
+  {
+    run(mJob);
+    finish();
+  }
+
+  return true;
+}
+
+bool GeometryExtraction::update(void)
+{
+  if (!mJob)
+    return false;
+
+  mJob->mMutex.lock();
+  const bool finished = mJob->mFinished;
+  mJob->mMutex.unlock();
+
+  if (!finished)
+    return false;
+
+  finish();
+  return true;
+}
+
+void GeometryExtraction::wait(void)
+{
+  if (mJob)
+    finish();
+}
+
+bool GeometryExtraction::isPending(void) const
+{
+  return mJob != NULL;
+}
+
+const BaseMesh* GeometryExtraction::getMesh(VNodeID nodeID) const
+{
+  for (uint32 i = 0;  i < mExtractedIDs.size();  i++)
+  {
+    if (mExtractedIDs[i] == nodeID)
+    {
+      if (mMeshes[i].mPolygons.empty())
+	return NULL;
+
+      return &mMeshes[i];
+    }
+  }
+
+  return NULL;
+}
+
+unsigned int GeometryExtraction::getNodeCount(void) const
+{
+  return mNodeIDs.size();
+}
+
+Session& GeometryExtraction::getSession(void) const
+{
+  return mSession;
+}
+
+void GeometryExtraction::finish(void)
+{
+  delete mThread;
+  mThread = NULL;
+
+  mMeshes.swap(mJob->mMeshes);
+  mExtractedIDs.swap(mJob->mNodeIDs);
+
+  delete mJob;
+  mJob = NULL;
+}
+
+void GeometryExtraction::run(void* data)
+{
+  Job& job = *reinterpret_cast<Job*>(data);
+
+  // Small nodes are extracted concurrently, one per task, after which each
+  // large node gets all processors to itself.
+
+  Thread::parallelFor(extractNodes, &job, job.mWhole.size(), 1);
+
+  for (uint32 i = 0;  i < job.mSources.size();  i++)
+  {
+    if (job.mSources[i].mPolygons.getItemCount() >= SPLIT_THRESHOLD)
+      extract(job.mSources[i], job.mMeshes[i], true);
+  }
+
+  job.mMutex.lock();
+  job.mFinished = true;
+  job.mMutex.unlock();
+}
+
+void GeometryExtraction::extractNodes(void* data, uint32 first, uint32 count)
+{
+  Job& job = *reinterpret_cast<Job*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const uint32 index = job.mWhole[i];
+    extract(job.mSources[index], job.mMeshes[index], false);
+  }
+}
+
+void GeometryExtraction::extract(const Source& source, BaseMesh& mesh, bool parallel)
+{
+  Split split;
+  split.mVertices = reinterpret_cast<const BaseVertex*>(source.mVertices.getitems());
+  split.mVertexCount = source.mVertices.getItemCount();
+  split.mPolygons = reinterpret_cast<const BasePolygon*>(source.mPolygons.getitems());
+  split.mPolygonCount = source.mPolygons.getItemCount();
+  split.mMesh = &mesh;
+
+  if (!split.mVertexCount || !split.mPolygonCount)
+    return;
+
+  const uint32 vertexChunks = getChunkCount(split.mVertexCount);
+  const uint32 polygonChunks = getChunkCount(split.mPolygonCount);
+
+  split.mUsed.resize(split.mVertexCount, 0);
+  split.mIndices.resize(split.mVertexCount, INVALID_VERTEX_ID);
+  split.mVertexOffsets.resize(vertexChunks);
+  split.mPolygonOffsets.resize(polygonChunks);
+
+  dispatch(countPolygons, split, polygonChunks, parallel);
+  mesh.mPolygons.resize(sumOffsets(split.mPolygonOffsets));
+
+  if (mesh.mPolygons.empty())
+    return;
+
+  dispatch(countVertices, split, vertexChunks, parallel);
+  mesh.mVertices.resize(sumOffsets(split.mVertexOffsets));
+
+  dispatch(copyVertices, split, vertexChunks, parallel);
+  dispatch(copyPolygons, split, polygonChunks, parallel);
+}
+
+void GeometryExtraction::countPolygons(void* data, uint32 first, uint32 count)
+{
+  Split& split = *reinterpret_cast<Split*>(data);
+
+  for (uint32 chunk = first;  chunk < first + count;  chunk++)
+  {
+    const uint32 start = chunk * CHUNK_SIZE;
+    const uint32 end = std::min(start + CHUNK_SIZE, split.mPolygonCount);
+
+    uint32 valid = 0;
+
+    for (uint32 polygonID = start;  polygonID < end;  polygonID++)
+    {
+      const BasePolygon& polygon = split.mPolygons[polygonID];
+
+      if (!split.isVertex(polygon.mIndices[0]) ||
+          !split.isVertex(polygon.mIndices[1]) ||
+          !split.isVertex(polygon.mIndices[2]))
+	continue;
+
+      for (unsigned int i = 0;  i < 4;  i++)
+      {
+	if (split.isVertex(polygon.mIndices[i]))
+	  markUsed(split.mUsed[polygon.mIndices[i]]);
+      }
+
+      valid++;
+    }
+
+    split.mPolygonOffsets[chunk] = valid;
+  }
+}
+
+void GeometryExtraction::countVertices(void* data, uint32 first, uint32 count)
+{
+  Split& split = *reinterpret_cast<Split*>(data);
+
+  for (uint32 chunk = first;  chunk < first + count;  chunk++)
+  {
+    const uint32 start = chunk * CHUNK_SIZE;
+    const uint32 end = std::min(start + CHUNK_SIZE, split.mVertexCount);
+
+    uint32 used = 0;
+
+    for (uint32 vertexID = start;  vertexID < end;  vertexID++)
+      used += split.mUsed[vertexID];
+
+    split.mVertexOffsets[chunk] = used;
+  }
+}
+
+void GeometryExtraction::copyVertices(void* data, uint32 first, uint32 count)
+{
+  Split& split = *reinterpret_cast<Split*>(data);
+
+  for (uint32 chunk = first;  chunk < first + count;  chunk++)
+  {
+    const uint32 start = chunk * CHUNK_SIZE;
+    const uint32 end = std::min(start + CHUNK_SIZE, split.mVertexCount);
+
+    uint32 index = split.mVertexOffsets[chunk];
+
+    for (uint32 vertexID = start;  vertexID < end;  vertexID++)
+    {
+      if (!split.mUsed[vertexID])
+	continue;
+
+      split.mIndices[vertexID] = index;
+      split.mMesh->mVertices[index] = split.mVertices[vertexID];
+      index++;
+    }
+  }
+}
+
+void GeometryExtraction::copyPolygons(void* data, uint32 first, uint32 count)
+{
+  Split& split = *reinterpret_cast<Split*>(data);
+
+  for (uint32 chunk = first;  chunk < first + count;  chunk++)
+  {
+    const uint32 start = chunk * CHUNK_SIZE;
+    const uint32 end = std::min(start + CHUNK_SIZE, split.mPolygonCount);
+
+    uint32 index = split.mPolygonOffsets[chunk];
+
+    for (uint32 polygonID = start;  polygonID < end;  polygonID++)
+    {
+      const BasePolygon& polygon = split.mPolygons[polygonID];
+
+      if (!split.isVertex(polygon.mIndices[0]) ||
+          !split.isVertex(polygon.mIndices[1]) ||
+          !split.isVertex(polygon.mIndices[2]))
+	continue;
+
+      BasePolygon& result = split.mMesh->mPolygons[index++];
+
+      for (unsigned int i = 0;  i < 4;  i++)
+      {
+	if (split.isVertex(polygon.mIndices[i]))
+	  result.mIndices[i] = split.mIndices[polygon.mIndices[i]];
+	else
+	  result.mIndices[i] = INVALID_VERTEX_ID;
+      }
+    }
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
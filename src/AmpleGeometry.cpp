@@ -8,6 +8,8 @@
 
 #include <Ample.h>
 
+#include <cstring>
+
 namespace verse
 {
   namespace ample
@@ -22,6 +24,11 @@ namespace verse
 namespace
 {
 
+// The smallest number of slot change ranges kept per layer before the
+// oldest changes are discarded. Larger layers keep up to a quarter as many
+// ranges as they have slots.
+const size_t MIN_SLOT_CHANGES = 1024;
+
 struct Slot
 {
   union
@@ -44,6 +51,63 @@ inline void copySlot(T* target, const T* source, size_t count, T defaultValue =
   }
 }
 
+bool compareRangeFirst(const IDRange& first, const IDRange& second)
+{
+  return first.mFirst < second.mFirst;
+}
+
+// Orders vertices by their exact bit pattern, which stays a strict weak
+// ordering even for non-finite coordinates.
+struct VertexLess
+{
+  bool operator () (const BaseVertex& first, const BaseVertex& second) const
+  {
+    return std::memcmp(&first, &second, sizeof(BaseVertex)) < 0;
+  }
+};
+
+struct PolygonLess
+{
+  bool operator () (const BasePolygon& first, const BasePolygon& second) const
+  {
+    return std::memcmp(&first, &second, sizeof(BasePolygon)) < 0;
+  }
+};
+
+typedef std::vector<uint32> IDList;
+
+// Gives each element that has no ID yet the current ID at the same index,
+// if nothing else has claimed it, and then the remaining unclaimed current
+// IDs in order. Elements left over after that need new IDs.
+void assignUnclaimedIDs(IDList& targetIDs, const IDList& currentIDs, std::vector<bool>& claimed)
+{
+  for (uint32 i = 0;  i < targetIDs.size() && i < currentIDs.size();  i++)
+  {
+    if (targetIDs[i] == INVALID_VERTEX_ID && !claimed[currentIDs[i]])
+    {
+      targetIDs[i] = currentIDs[i];
+      claimed[currentIDs[i]] = true;
+    }
+  }
+
+  IDList::const_iterator next = currentIDs.begin();
+
+  for (IDList::iterator i = targetIDs.begin();  i != targetIDs.end();  i++)
+  {
+    if (*i != INVALID_VERTEX_ID)
+      continue;
+
+    while (next != currentIDs.end() && claimed[*next])
+      next++;
+
+    if (next == currentIDs.end())
+      break;
+
+    *i = *next;
+    claimed[*next] = true;
+  }
+}
+
 }
 
 //---------------------------------------------------------------------
@@ -105,6 +169,18 @@ bool GeometryLayer::getSlot(uint32 slotID, void* data) const
       return false;
   }
 
+  readSlot(slotID, data);
+  return true;
+}
+
+void GeometryLayer::readSlot(uint32 slotID, void* data) const
+{
+  if (mQuantization && slotID < mQuantization->getSlotCount())
+  {
+    mQuantization->expand(reinterpret_cast<BaseVertex*>(data), slotID, 1);
+    return;
+  }
+
   bool defaults = (slotID >= mData.getItemCount());
 
   Slot* targetSlot = reinterpret_cast<Slot*>(data);
@@ -147,10 +223,47 @@ bool GeometryLayer::getSlot(uint32 slotID, void* data) const
       break;
     }
   }
+}
 
+bool GeometryLayer::cloneSlot(uint32 sourceID, uint32 targetID)
+{
+  // Sends the value of the source slot to the target slot, unless the
+  // target already holds it.
+
+  Slot source;
+  if (!getSlot(sourceID, &source))
+    return false;
+
+  Slot target;
+  readSlot(targetID, &target);
+
+  if (std::memcmp(&source, &target, getSlotSize()) == 0)
+    return false;
+
+  setSlot(targetID, &source);
   return true;
 }
 
+void GeometryLayer::shrink(void)
+{
+  // Releases the storage above the highest used slot once it makes up
+  // most of this layer, such as after the IDs have been compacted.
+
+  const size_t limit = getSlotLimit();
+
+  if (getStoredSlotCount() <= limit * 2 + mData.getGranularity())
+    return;
+
+  if (mQuantization)
+    mQuantization->resize(limit);
+  else if (limit)
+    mData.resize(limit);
+  else
+    mData.release();
+
+  updateStructureVersion();
+}
+
 void GeometryLayer::setSlot(uint32 slotID, const void* data)
 {
   mNode.getSession().push();
@@ -258,16 +371,117 @@ GeometryNode& GeometryLayer::getNode(void) const
   return mNode;
 }
 
+bool GeometryLayer::getChangedSlots(unsigned int version, IDRangeSet& slots) const
+{
+  if (version < mChangeBase)
+  {
+    // The history has been truncated past the requested version, so
+    // report everything.
+
+    slots.addRange(0, getSlotLimit());
+    return false;
+  }
+
+  // Changes recorded after this start a new entry, so that the next poll
+  // only gets what changed since this one.
+
+  mChangesPolled = true;
+
+  // Changes are stored in ascending version order, so walk backwards until
+  // reaching the first one the caller already knows about. The ranges are
+  // recorded in arrival order, and are sorted so they can be added to the
+  // set in ascending order.
+
+  SlotChange::RangeList ranges;
+
+  for (ChangeList::const_reverse_iterator i = mChanges.rbegin();  i != mChanges.rend();  i++)
+  {
+    if ((*i).mVersion <= version)
+      break;
+
+    ranges.insert(ranges.end(), (*i).mRanges.begin(), (*i).mRanges.end());
+  }
+
+  std::sort(ranges.begin(), ranges.end(), compareRangeFirst);
+
+  for (SlotChange::RangeList::const_iterator i = ranges.begin();  i != ranges.end();  i++)
+    slots.addRange((*i).mFirst, (*i).mCount);
+
+  return true;
+}
+
+bool GeometryLayer::share(GeometryLayer& source)
+{
+  if (mType != source.mType ||
+      mDefaultInt != source.mDefaultInt ||
+      mDefaultReal != source.mDefaultReal)
+    return false;
+
+  // Compact storage is never shared, as the quantization box of each node
+  // follows its own vertices.
+
+  if (mQuantization || source.mQuantization)
+    return false;
+
+  if (mData.getitems() == source.mData.getitems())
+    return true;
+
+  if (mData.getItemCount() != source.mData.getItemCount())
+    return false;
+
+  // The hashes rule out most mismatches without touching all the slots.
+
+  if (getContentHash() != source.getContentHash())
+    return false;
+
+  if (std::memcmp(mData.getitems(), source.mData.getitems(), mData.getItemCount() * getSlotSize()) != 0)
+    return false;
+
+  mData.share(source.mData);
+  return true;
+}
+
+bool GeometryLayer::isShared(void) const
+{
+  return mData.isShared();
+}
+
+bool GeometryLayer::isMapped(void) const
+{
+  if (mQuantization)
+    return mQuantization->mCodes.isMapped();
+
+  return mData.isMapped();
+}
+
+const GeometryQuantization* GeometryLayer::getQuantization(void) const
+{
+  return mQuantization;
+}
+
 GeometryLayer::GeometryLayer(VLayerID ID, const std::string& name, VNGLayerType type, GeometryNode& node, uint32 defaultInt, real64 defaultReal):
   mID(ID),
   mName(name),
   mType(type),
   mNode(node),
   mDefaultInt(defaultInt),
-  mDefaultReal(defaultReal)
+  mDefaultReal(defaultReal),
+  mChangeBase(0),
+  mChangeRangeCount(0),
+  mChangesPolled(false),
+  mStagedCount(0),
+  mReplaying(false),
+  mHashVersion(0),
+  mHashLimit(0),
+  mHashValid(false),
+  mQuantization(NULL)
 {
   mData.setItemSize(getTypeSize(mType));
   mData.setGranularity(1024);
+  mData.setMapping(node.getStorageDirectory(), node.getStorageThreshold());
+
+  mStagedData.setItemSize(getTypeSize(mType));
+  mStagedData.setGranularity(64);
 
   switch (mType)
   {
@@ -287,10 +501,21 @@ GeometryLayer::GeometryLayer(VLayerID ID, const std::string& name, VNGLayerType
   }
 }
 
+GeometryLayer::~GeometryLayer(void)
+{
+  delete mQuantization;
+}
+
 void GeometryLayer::reserve(size_t slotCount)
 {
-  if (slotCount <= mData.getItemCount())
+  if (slotCount <= getStoredSlotCount())
+    return;
+
+  if (mQuantization)
+  {
+    mQuantization->resize(slotCount);
     return;
+  }
 
   // TODO: Sanity checks?
 
@@ -351,172 +576,555 @@ void GeometryLayer::reserve(size_t slotCount)
   }
 }
 
-unsigned int GeometryLayer::getTypeSize(VNGLayerType type)
+void GeometryLayer::notifySetSlot(uint32 slotID, const void* data)
 {
-  switch (type)
-  {
-    case VN_G_LAYER_VERTEX_XYZ:
-      return sizeof(real64) * 3;
-    case VN_G_LAYER_VERTEX_UINT32:
-      return sizeof(uint32);
-    case VN_G_LAYER_VERTEX_REAL:
-      return sizeof(real64);
-    case VN_G_LAYER_POLYGON_CORNER_UINT32:
-      return sizeof(uint32) * 4;
-    case VN_G_LAYER_POLYGON_CORNER_REAL:
-      return sizeof(real64) * 4;
-    case VN_G_LAYER_POLYGON_FACE_UINT8:
-      return sizeof(uint8);
-    case VN_G_LAYER_POLYGON_FACE_UINT32:
-      return sizeof(uint32);
-    case VN_G_LAYER_POLYGON_FACE_REAL:
-      return sizeof(real64);
-  }
-}
+  bool batched = false;
 
-unsigned int GeometryLayer::getTypeElementCount(VNGLayerType type)
-{
-  switch (type)
+  const ObserverList& observers = getObservers();
+  for (ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
   {
-    case VN_G_LAYER_VERTEX_UINT32:
-    case VN_G_LAYER_VERTEX_REAL:
-    case VN_G_LAYER_POLYGON_FACE_UINT8:
-    case VN_G_LAYER_POLYGON_FACE_UINT32:
-    case VN_G_LAYER_POLYGON_FACE_REAL:
-      return 1;
-    case VN_G_LAYER_VERTEX_XYZ:
-      return 3;
-    case VN_G_LAYER_POLYGON_CORNER_UINT32:
-    case VN_G_LAYER_POLYGON_CORNER_REAL:
-      return 4;
+    if ((*i)->isBatched())
+      batched = true;
+    else
+      (*i)->onSetSlot(*this, slotID, data);
   }
-}
 
-void GeometryLayer::initialize(void)
-{
-  verse_callback_set((void*) verse_send_g_vertex_set_xyz_real32,
-                     (void*) receiveVertexSetXyzReal32,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_vertex_delete_real32,
-                     (void*) receiveVertexDeleteReal32,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_vertex_set_xyz_real64,
-                     (void*) receiveVertexSetXyzReal64,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_vertex_delete_real64,
-                     (void*) receiveVertexDeleteReal64,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_vertex_set_uint32,
-                     (void*) receiveVertexSetUint32,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_vertex_set_real64,
-                     (void*) receiveVertexSetReal64,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_vertex_set_real32,
-                     (void*) receiveVertexSetReal32,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_set_corner_uint32,
-                     (void*) receivePolygonSetCornerUint32,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_delete,
-                     (void*) receivePolygonDelete,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_set_corner_real64,
-                     (void*) receivePolygonSetCornerReal64,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_set_corner_real32,
-                     (void*) receivePolygonSetCornerReal32,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_set_face_uint8,
-                     (void*) receivePolygonSetFaceUint8,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_set_face_uint32,
-                     (void*) receivePolygonSetFaceUint32,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_set_face_real64,
-                     (void*) receivePolygonSetFaceReal64,
-                     NULL);
-  verse_callback_set((void*) verse_send_g_polygon_set_face_real32,
-                     (void*) receivePolygonSetFaceReal32,
-                     NULL);
+  if (batched)
+    mChangedSlots.addID(slotID);
 }
 
-void GeometryLayer::receiveVertexSetXyzReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real32 x, real32 y, real32 z)
+void GeometryLayer::flushSlots(void)
 {
-  // TODO: Support 32-bit layers.
-}
+  if (mChangedSlots.isEmpty())
+    return;
 
-void GeometryLayer::receiveVertexDeleteReal32(void* user, VNodeID nodeID, uint32 vertexID)
-{
-  // TODO: Support 32-bit layers.
-}
+  IDRangeSet slots;
+  std::swap(slots, mChangedSlots);
 
-void GeometryLayer::receiveVertexSetXyzReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real64 x, real64 y, real64 z)
-{
-  Session* session = Session::getCurrent();
+  const IDRangeSet::RangeList& ranges = slots.getRanges();
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+  const ObserverList& observers = getObservers();
+  for (ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+  {
+    if (!(*i)->isBatched())
+      continue;
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_XYZ)
-    return;
+    for (IDRangeSet::RangeList::const_iterator range = ranges.begin();  range != ranges.end();  range++)
+      (*i)->onSetSlots(*this, (*range).mFirst, (*range).mCount);
+  }
+}
 
-  BaseVertex vertex(x, y, z);
+void GeometryLayer::recordSlotChange(uint32 slotID)
+{
+  // All changes between two polls go into the same entry, as no consumer
+  // can tell them apart anyway.
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, vertexID, &vertex);
+  if (mChanges.empty() || mChangesPolled)
+  {
+    mChanges.push_back(SlotChange(getDataVersion()));
+    mChangesPolled = false;
+  }
 
-  bool created = (layerID == BASE_VERTEX_LAYER_ID && !node->isVertex(vertexID));
+  SlotChange& last = mChanges.back();
+  last.mVersion = getDataVersion();
 
-  if (!created)
+  // Extend the most recent range if this slot directly follows it, which
+  // covers the common case of slots being set in sequence.
+
+  if (!last.mRanges.empty())
   {
-    const GeometryNode::ObserverList& observers = node->getObservers();
-    for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+    IDRange& range = last.mRanges.back();
+
+    if (slotID == range.getEnd())
     {
-      if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
-	observer->onChangeBaseVertex(*node, vertexID, vertex);
+      range.mCount++;
+      return;
     }
+
+    if (slotID >= range.mFirst && slotID < range.getEnd())
+      return;
   }
 
-  layer->reserve(vertexID + 1);
+  last.mRanges.push_back(IDRange(slotID, 1));
+  mChangeRangeCount++;
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(vertexID));
-  targetSlot.real[0] = vertex.x;
-  targetSlot.real[1] = vertex.y;
-  targetSlot.real[2] = vertex.z;
+  // Discard the oldest changes once the history is large enough that
+  // reporting everything would cost about the same.
 
-  if (created)
+  const size_t limit = std::max(MIN_SLOT_CHANGES, getStoredSlotCount() / 4);
+
+  while (mChangeRangeCount > limit)
   {
-    node->mVertexCount++;
-    if (node->mHighestVertexID == INVALID_VERTEX_ID || vertexID > node->mHighestVertexID)
-      node->mHighestVertexID = vertexID;
+    mChangeBase = mChanges.front().mVersion;
+    mChangeRangeCount -= mChanges.front().mRanges.size();
+    mChanges.pop_front();
+  }
+}
 
-    if (vertexID == node->mFirstFreeVertexID)
-    {
-      for (uint32 i = vertexID;  i <= node->mHighestVertexID;  i++)
-      {
-	if (!node->isVertex(i))
-	{
-	  node->mFirstFreeVertexID = i;
-	  break;
-	}
-      }
-    }
+bool GeometryLayer::stageSlot(uint32 slotID, const void* data)
+{
+  if (mReplaying || !mNode.getSession().isCoalescing())
+    return false;
 
-    layer->updateStructureVersion();
+  // Only the last value staged for a given slot is kept.
 
-    const GeometryNode::ObserverList& observers = node->getObservers();
-    for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    {
-      if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
-	observer->onCreateVertex(*node, vertexID, vertex);
-    }
+  StagedSlotMap::iterator i = mStagedSlots.find(slotID);
+  if (i == mStagedSlots.end())
+    i = mStagedSlots.insert(std::make_pair(slotID, mStagedCount++)).first;
 
-    for (uint32 polygonID = 0;  polygonID < node->mHighestPolygonID;  polygonID++)
-    {
+  mStagedData.setItem(const_cast<void*>(data), (*i).second);
+  return true;
+}
+
+void GeometryLayer::flushStagedSlots(void)
+{
+  if (mStagedSlots.empty())
+    return;
+
+  StagedSlotMap slots;
+  std::swap(slots, mStagedSlots);
+
+  // Replay the staged values through the regular receive path, so that they
+  // are stored, versioned and announced exactly as unstaged values are.
+
+  mReplaying = true;
+
+  for (StagedSlotMap::const_iterator i = slots.begin();  i != slots.end();  i++)
+  {
+    const uint32 slotID = (*i).first;
+    const Slot& slot = *reinterpret_cast<const Slot*>(mStagedData.getItem((*i).second));
+
+    switch (mType)
+    {
+      case VN_G_LAYER_VERTEX_XYZ:
+	receiveVertexSetXyzReal64(NULL, mNode.getID(), mID, slotID, slot.real[0], slot.real[1], slot.real[2]);
+	break;
+      case VN_G_LAYER_VERTEX_UINT32:
+	receiveVertexSetUint32(NULL, mNode.getID(), mID, slotID, slot.uint[0]);
+	break;
+      case VN_G_LAYER_VERTEX_REAL:
+	receiveVertexSetReal64(NULL, mNode.getID(), mID, slotID, slot.real[0]);
+	break;
+      case VN_G_LAYER_POLYGON_CORNER_UINT32:
+	receivePolygonSetCornerUint32(NULL, mNode.getID(), mID, slotID, slot.uint[0], slot.uint[1], slot.uint[2], slot.uint[3]);
+	break;
+      case VN_G_LAYER_POLYGON_CORNER_REAL:
+	receivePolygonSetCornerReal64(NULL, mNode.getID(), mID, slotID, slot.real[0], slot.real[1], slot.real[2], slot.real[3]);
+	break;
+      case VN_G_LAYER_POLYGON_FACE_UINT8:
+	receivePolygonSetFaceUint8(NULL, mNode.getID(), mID, slotID, slot.byte[0]);
+	break;
+      case VN_G_LAYER_POLYGON_FACE_UINT32:
+	receivePolygonSetFaceUint32(NULL, mNode.getID(), mID, slotID, slot.uint[0]);
+	break;
+      case VN_G_LAYER_POLYGON_FACE_REAL:
+	receivePolygonSetFaceReal64(NULL, mNode.getID(), mID, slotID, slot.real[0]);
+	break;
+    }
+  }
+
+  mReplaying = false;
+  mStagedCount = 0;
+}
+
+uint32 GeometryLayer::getSlotLimit(void) const
+{
+  uint32 highestID;
+
+  if (mStack == VERTEX)
+    highestID = mNode.getHighestVertexID();
+  else
+    highestID = mNode.getHighestPolygonID();
+
+  if (highestID == INVALID_VERTEX_ID)
+    return 0;
+
+  return highestID + 1;
+}
+
+size_t GeometryLayer::getStoredSlotCount(void) const
+{
+  if (mQuantization)
+    return mQuantization->getSlotCount();
+
+  return mData.getItemCount();
+}
+
+const real64* GeometryLayer::getRealSlots(Block& expanded, uint32 firstID, uint32 count) const
+{
+  // Points directly into the slots where they are kept at full precision,
+  // or otherwise into a copy of the requested range expanded into the
+  // specified block.
+
+  if (!mQuantization)
+    return reinterpret_cast<const real64*>(mData.getitems()) + firstID * getTypeElementCount(mType);
+
+  expanded.setItemSize(sizeof(BaseVertex));
+  expanded.resize(count);
+
+  BaseVertex* vertices = reinterpret_cast<BaseVertex*>(expanded.getItems());
+  mQuantization->expand(vertices, firstID, count);
+
+  return reinterpret_cast<const real64*>(vertices);
+}
+
+void GeometryLayer::setCompactBits(unsigned int bits)
+{
+  if (!mQuantization && !bits)
+    return;
+
+  if (mQuantization)
+  {
+    if (bits && mQuantization->getBits() == bits)
+      return;
+
+    // Return to full precision first, which is also where a change of
+    // precision starts from.
+
+    mData.resize(mQuantization->getSlotCount());
+    if (mData.getItemCount())
+      mQuantization->expand(reinterpret_cast<BaseVertex*>(mData.getItems()), 0, mData.getItemCount());
+
+    delete mQuantization;
+    mQuantization = NULL;
+  }
+
+  if (bits)
+  {
+    mQuantization = new GeometryQuantization(bits);
+    mQuantization->mCodes.setMapping(mNode.getStorageDirectory(), mNode.getStorageThreshold());
+
+    const BaseVertex* vertices = reinterpret_cast<const BaseVertex*>(mData.getitems());
+
+    mQuantization->fit(vertices, mData.getItemCount());
+    mQuantization->resize(mData.getItemCount());
+    mQuantization->quantize(vertices, 0, mData.getItemCount());
+
+    mData.release();
+  }
+
+  discardChanges();
+}
+
+void GeometryLayer::discardChanges(void)
+{
+  // Consumers of the change history need to start over, as do the chunk
+  // hashes.
+
+  updateStructureVersion();
+  mChanges.clear();
+  mChangeBase = getDataVersion();
+  mChangeRangeCount = 0;
+  mHashValid = false;
+}
+
+unsigned int GeometryLayer::getTypeSize(VNGLayerType type)
+{
+  switch (type)
+  {
+    case VN_G_LAYER_VERTEX_XYZ:
+      return sizeof(real64) * 3;
+    case VN_G_LAYER_VERTEX_UINT32:
+      return sizeof(uint32);
+    case VN_G_LAYER_VERTEX_REAL:
+      return sizeof(real64);
+    case VN_G_LAYER_POLYGON_CORNER_UINT32:
+      return sizeof(uint32) * 4;
+    case VN_G_LAYER_POLYGON_CORNER_REAL:
+      return sizeof(real64) * 4;
+    case VN_G_LAYER_POLYGON_FACE_UINT8:
+      return sizeof(uint8);
+    case VN_G_LAYER_POLYGON_FACE_UINT32:
+      return sizeof(uint32);
+    case VN_G_LAYER_POLYGON_FACE_REAL:
+      return sizeof(real64);
+  }
+}
+
+bool GeometryLayer::isConvertible(VNGLayerType type) const
+{
+  // Only integer and real slots of the same stack can be converted, with
+  // face values broadcast to all corners and corners collapsed to their
+  // first value. The base layers must keep their types.
+
+  if (mID == BASE_VERTEX_LAYER_ID || mID == BASE_POLYGON_LAYER_ID)
+    return false;
+
+  if (mType == VN_G_LAYER_VERTEX_XYZ || type == VN_G_LAYER_VERTEX_XYZ)
+    return false;
+
+  Stack stack;
+
+  if (type == VN_G_LAYER_VERTEX_UINT32 || type == VN_G_LAYER_VERTEX_REAL)
+    stack = VERTEX;
+  else
+    stack = POLYGON;
+
+  return stack == mStack;
+}
+
+void GeometryLayer::convert(VNGLayerType type)
+{
+  Block data;
+  data.setItemSize(getTypeSize(type));
+  data.setGranularity(mData.getGranularity());
+  data.setMapping(mNode.getStorageDirectory(), mNode.getStorageThreshold());
+  convertSlots(mData, data, type);
+
+  Block stagedData;
+  stagedData.setItemSize(getTypeSize(type));
+  stagedData.setGranularity(mStagedData.getGranularity());
+  convertSlots(mStagedData, stagedData, type);
+
+  // Take over the converted storage, which is then only referenced by
+  // this layer once the temporary blocks go away. The new slot size is set
+  // explicitly, as there is no converted storage to share for empty blocks.
+
+  mData.setItemSize(data.getItemSize());
+  mStagedData.setItemSize(stagedData.getItemSize());
+
+  mData.share(data);
+  mStagedData.share(stagedData);
+  mType = type;
+
+  discardChanges();
+}
+
+void GeometryLayer::convertSlots(const Block& source, Block& target, VNGLayerType type) const
+{
+  const size_t count = source.getItemCount();
+  if (!count)
+    return;
+
+  target.resize(count);
+
+  const unsigned int sourceCount = getTypeElementCount(mType);
+  const unsigned int targetCount = getTypeElementCount(type);
+
+  for (size_t i = 0;  i < count;  i++)
+  {
+    const Slot& sourceSlot = *reinterpret_cast<const Slot*>(source.getItem(i));
+    Slot& targetSlot = *reinterpret_cast<Slot*>(target.getItem(i));
+
+    real64 values[4];
+
+    for (unsigned int j = 0;  j < sourceCount;  j++)
+    {
+      switch (mType)
+      {
+	case VN_G_LAYER_VERTEX_UINT32:
+	case VN_G_LAYER_POLYGON_CORNER_UINT32:
+	case VN_G_LAYER_POLYGON_FACE_UINT32:
+	  values[j] = sourceSlot.uint[j];
+	  break;
+	case VN_G_LAYER_POLYGON_FACE_UINT8:
+	  values[j] = sourceSlot.byte[j];
+	  break;
+	default:
+	  values[j] = sourceSlot.real[j];
+	  break;
+      }
+    }
+
+    for (unsigned int j = 0;  j < targetCount;  j++)
+    {
+      const real64 value = values[j < sourceCount ? j : 0];
+
+      switch (type)
+      {
+	case VN_G_LAYER_VERTEX_UINT32:
+	case VN_G_LAYER_POLYGON_CORNER_UINT32:
+	case VN_G_LAYER_POLYGON_FACE_UINT32:
+	  targetSlot.uint[j] = (uint32) std::max(0.0, std::min(value, 4294967295.0));
+	  break;
+	case VN_G_LAYER_POLYGON_FACE_UINT8:
+	  targetSlot.byte[j] = (uint8) std::max(0.0, std::min(value, 255.0));
+	  break;
+	default:
+	  targetSlot.real[j] = value;
+	  break;
+      }
+    }
+  }
+}
+
+unsigned int GeometryLayer::getTypeElementCount(VNGLayerType type)
+{
+  switch (type)
+  {
+    case VN_G_LAYER_VERTEX_UINT32:
+    case VN_G_LAYER_VERTEX_REAL:
+    case VN_G_LAYER_POLYGON_FACE_UINT8:
+    case VN_G_LAYER_POLYGON_FACE_UINT32:
+    case VN_G_LAYER_POLYGON_FACE_REAL:
+      return 1;
+    case VN_G_LAYER_VERTEX_XYZ:
+      return 3;
+    case VN_G_LAYER_POLYGON_CORNER_UINT32:
+    case VN_G_LAYER_POLYGON_CORNER_REAL:
+      return 4;
+  }
+}
+
+void GeometryLayer::initialize(void)
+{
+  verse_callback_set((void*) verse_send_g_vertex_set_xyz_real32,
+                     (void*) receiveVertexSetXyzReal32,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_vertex_delete_real32,
+                     (void*) receiveVertexDeleteReal32,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_vertex_set_xyz_real64,
+                     (void*) receiveVertexSetXyzReal64,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_vertex_delete_real64,
+                     (void*) receiveVertexDeleteReal64,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_vertex_set_uint32,
+                     (void*) receiveVertexSetUint32,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_vertex_set_real64,
+                     (void*) receiveVertexSetReal64,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_vertex_set_real32,
+                     (void*) receiveVertexSetReal32,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_set_corner_uint32,
+                     (void*) receivePolygonSetCornerUint32,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_delete,
+                     (void*) receivePolygonDelete,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_set_corner_real64,
+                     (void*) receivePolygonSetCornerReal64,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_set_corner_real32,
+                     (void*) receivePolygonSetCornerReal32,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_set_face_uint8,
+                     (void*) receivePolygonSetFaceUint8,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_set_face_uint32,
+                     (void*) receivePolygonSetFaceUint32,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_set_face_real64,
+                     (void*) receivePolygonSetFaceReal64,
+                     NULL);
+  verse_callback_set((void*) verse_send_g_polygon_set_face_real32,
+                     (void*) receivePolygonSetFaceReal32,
+                     NULL);
+}
+
+void GeometryLayer::receiveVertexSetXyzReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real32 x, real32 y, real32 z)
+{
+  // TODO: Support 32-bit layers.
+}
+
+void GeometryLayer::receiveVertexDeleteReal32(void* user, VNodeID nodeID, uint32 vertexID)
+{
+  // TODO: Support 32-bit layers.
+}
+
+void GeometryLayer::receiveVertexSetXyzReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real64 x, real64 y, real64 z)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_XYZ)
+    return;
+
+  BaseVertex vertex(x, y, z);
+
+  bool created = (layerID == BASE_VERTEX_LAYER_ID && !node->isVertex(vertexID));
+
+  if (!created && layer->stageSlot(vertexID, &vertex))
+    return;
+
+  layer->notifySetSlot(vertexID, &vertex);
+
+  if (!created && layerID == BASE_VERTEX_LAYER_ID)
+    node->notifyChangeBaseVertex(vertexID, vertex);
+
+  layer->reserve(vertexID + 1);
+
+  if (GeometryQuantization* quantization = layer->mQuantization)
+  {
+    // Compact layers only keep the quantized value, so the bounds are
+    // updated from what was stored rather than what was sent.
+
+    BaseVertex previous;
+    quantization->expand(&previous, vertexID, 1);
+
+    if (quantization->setVertex(vertexID, vertex))
+    {
+      // Growing the box moves every stored vertex by up to one step.
+
+      layer->discardChanges();
+      node->mBoundsDirty = true;
+    }
+    else
+    {
+      BaseVertex stored;
+      quantization->expand(&stored, vertexID, 1);
+
+      node->changeBounds(previous.isValid() ? &previous : NULL,
+			 stored.isValid() ? &stored : NULL);
+    }
+  }
+  else
+  {
+    Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(vertexID));
+
+    if (layerID == BASE_VERTEX_LAYER_ID)
+    {
+      BaseVertex previous(targetSlot.real[0], targetSlot.real[1], targetSlot.real[2]);
+
+      node->changeBounds(previous.isValid() ? &previous : NULL,
+			 vertex.isValid() ? &vertex : NULL);
+    }
+
+    targetSlot.real[0] = vertex.x;
+    targetSlot.real[1] = vertex.y;
+    targetSlot.real[2] = vertex.z;
+  }
+
+  if (created)
+  {
+    node->mVertexCount++;
+    if (node->mHighestVertexID == INVALID_VERTEX_ID || vertexID > node->mHighestVertexID)
+      node->mHighestVertexID = vertexID;
+
+    if (vertexID == node->mFirstFreeVertexID)
+    {
+      for (uint32 i = vertexID;  i <= node->mHighestVertexID;  i++)
+      {
+	if (!node->isVertex(i))
+	{
+	  node->mFirstFreeVertexID = i;
+	  break;
+	}
+      }
+    }
+
+    layer->updateStructureVersion();
+
+    const GeometryNode::ObserverList& observers = node->getObservers();
+    for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+    {
+      if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+	observer->onCreateVertex(*node, vertexID, vertex);
+    }
+
+    uint32 polygonCount = 0;
+    if (node->mHighestPolygonID != INVALID_POLYGON_ID)
+      polygonCount = node->mHighestPolygonID + 1;
+
+    for (uint32 polygonID = 0;  polygonID < polygonCount;  polygonID++)
+    {
       // TODO: Implement.
       // for each polygon
       //   if polygon is invalid
@@ -526,493 +1134,1220 @@ void GeometryLayer::receiveVertexSetXyzReal64(void* user, VNodeID nodeID, VLayer
   }
   else
     layer->updateDataVersion();
+
+  layer->recordSlotChange(vertexID);
+}
+
+void GeometryLayer::receiveVertexDeleteReal64(void* user, VNodeID nodeID, uint32 vertexID)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node || !node->mBaseVertexLayer)
+    return;
+
+  // Staged values set before this delete must take effect before it, or
+  // they would be replayed onto the deleted vertex and its polygons.
+
+  node->flushStagedSlots();
+
+  BaseVertex vertex;
+  if (!node->getBaseVertex(vertexID, vertex))
+    return;
+
+  // TODO: Add polygon change notification. (quad to triangle or back)
+  // NOTE: This piece of code is a good argument for cacheing the
+  // polygon validity state.
+
+  uint32 polygonCount = 0;
+  if (node->mHighestPolygonID != INVALID_POLYGON_ID)
+    polygonCount = node->mHighestPolygonID + 1;
+
+  for (uint32 polygonID = 0;  polygonID < polygonCount;  polygonID++)
+  {
+    BasePolygon polygon;
+    if (node->getBasePolygon(polygonID, polygon))
+    {
+      for (unsigned int i = 0;  i < 4;  i++)
+      {
+	if (polygon.mIndices[i] == vertexID)
+	{
+	  const GeometryNode::ObserverList& observers = node->getObservers();
+	  for (GeometryNode::ObserverList::const_iterator j = observers.begin();  j != observers.end();  j++)
+	  {
+	    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*j))
+	    {
+	      if (i < 3)
+		observer->onDeletePolygon(*node, polygonID);
+	      else
+		observer->onChangeBasePolygon(*node, polygonID, polygon);
+	    }
+	  }
+
+	  break;
+	}
+      }
+    }
+  }
+
+  const GeometryNode::ObserverList& observers = node->getObservers();
+  for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+  {
+    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+      observer->onDeleteVertex(*node, vertexID);
+  }
+
+  node->changeBounds(&vertex, NULL);
+
+  GeometryLayer* layer = node->mBaseVertexLayer;
+
+  vertex.setInvalid();
+
+  if (layer->mQuantization)
+    layer->mQuantization->setVertex(vertexID, vertex);
+  else
+    *reinterpret_cast<BaseVertex*>(layer->mData.getItem(vertexID)) = vertex;
+
+  if (vertexID == node->mHighestVertexID)
+  {
+    uint32 index = vertexID;
+    while (index--)
+    {
+      if (node->isVertex(index))
+      {
+	node->mHighestVertexID = index;
+	break;
+      }
+    }
+
+    if (node->mHighestVertexID != index)
+      node->mHighestVertexID = INVALID_VERTEX_ID;
+  }
+
+  if (vertexID < node->mFirstFreeVertexID)
+    node->mFirstFreeVertexID = vertexID;
+
+  node->mVertexCount--;
+  layer->updateStructureVersion();
+  layer->recordSlotChange(vertexID);
+}
+
+void GeometryLayer::receiveVertexSetUint32(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, uint32 value)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_UINT32)
+    return;
+
+  if (layer->stageSlot(vertexID, &value))
+    return;
+
+  layer->notifySetSlot(vertexID, &value);
+
+  layer->reserve(vertexID + 1);
+  layer->updateDataVersion();
+  layer->recordSlotChange(vertexID);
+
+  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(vertexID));
+  targetSlot.uint[0] = value;
+}
+
+void GeometryLayer::receiveVertexSetReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real64 value)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_REAL)
+    return;
+
+  if (layer->stageSlot(vertexID, &value))
+    return;
+
+  layer->notifySetSlot(vertexID, &value);
+
+  layer->reserve(vertexID + 1);
+  layer->updateDataVersion();
+  layer->recordSlotChange(vertexID);
+
+  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(vertexID));
+  targetSlot.real[0] = value;
+}
+
+void GeometryLayer::receiveVertexSetReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real32 value)
+{
+  // TODO: Support 32-bit layers.
+}
+
+void GeometryLayer::receivePolygonSetCornerUint32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, uint32 v0, uint32 v1, uint32 v2, uint32 v3)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_CORNER_UINT32)
+    return;
+
+  BasePolygon polygon(v0, v1, v2, v3);
+
+  bool created = (layerID == BASE_POLYGON_LAYER_ID && !node->isPolygon(polygonID));
+
+  if (!created && layer->stageSlot(polygonID, &polygon))
+    return;
+
+  layer->notifySetSlot(polygonID, &polygon);
+
+  if (created)
+  {
+    // Check if the new polygon really is valid.
+
+    for (uint32 i = 0;  i < 3;  i++)
+    {
+      if (!node->isVertex(polygon.mIndices[i]))
+      {
+	created = false;
+	break;
+      }
+    }
+  }
+
+  if (!created && layerID == BASE_POLYGON_LAYER_ID)
+    node->notifyChangeBasePolygon(polygonID, polygon);
+
+  layer->reserve(polygonID + 1);
+
+  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
+  copySlot(targetSlot.uint, polygon.mIndices, 4);
+
+  if (created)
+  {
+    node->mPolygonCount++;
+    if (node->mHighestPolygonID == INVALID_POLYGON_ID || polygonID > node->mHighestPolygonID)
+      node->mHighestPolygonID = polygonID;
+
+    if (polygonID == node->mFirstFreePolygonID)
+    {
+      for (uint32 i = polygonID;  i <= node->mHighestPolygonID;  i++)
+      {
+	if (!node->isPolygon(i))
+	{
+	  node->mFirstFreePolygonID = i;
+	  break;
+	}
+      }
+    }
+
+    layer->updateStructureVersion();
+
+    const GeometryNode::ObserverList& observers = node->getObservers();
+    for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+    {
+      if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+	observer->onCreatePolygon(*node, polygonID, polygon);
+    }
+  }
+  else
+    layer->updateDataVersion();
+
+  layer->recordSlotChange(polygonID);
+}
+
+void GeometryLayer::receivePolygonDelete(void* user, VNodeID nodeID, uint32 polygonID)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node || !node->mBasePolygonLayer)
+    return;
+
+  node->flushStagedSlots();
+
+  BasePolygon* polygon = reinterpret_cast<BasePolygon*>(node->mBasePolygonLayer->mData.getItem(polygonID));
+  if (!polygon)
+    return;
+
+  const GeometryNode::ObserverList& observers = node->getObservers();
+  for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+  {
+    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+      observer->onDeletePolygon(*node, polygonID);
+  }
+
+  polygon->setInvalid();
+
+  if (polygonID == node->mHighestPolygonID)
+  {
+    BasePolygon* polygons = reinterpret_cast<BasePolygon*>(node->mBasePolygonLayer->mData.getItems());
+
+    uint32 index = polygonID;
+    while (index--)
+    {
+      if (polygons[index].isValid())
+      {
+	node->mHighestPolygonID = index;
+	break;
+      }
+    }
+
+    if (node->mHighestPolygonID != index)
+      node->mHighestPolygonID = INVALID_POLYGON_ID;
+  }
+
+  if (polygonID < node->mFirstFreePolygonID)
+    node->mFirstFreePolygonID = polygonID;
+
+  node->mPolygonCount--;
+  node->mBasePolygonLayer->updateStructureVersion();
+  node->mBasePolygonLayer->recordSlotChange(polygonID);
+}
+
+void GeometryLayer::receivePolygonSetCornerReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real64 v0, real64 v1, real64 v2, real64 v3)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_CORNER_REAL)
+    return;
+
+  Slot sourceSlot;
+  sourceSlot.real[0] = v0;
+  sourceSlot.real[1] = v1;
+  sourceSlot.real[2] = v2;
+  sourceSlot.real[3] = v3;
+
+  if (layer->stageSlot(polygonID, &sourceSlot))
+    return;
+
+  layer->notifySetSlot(polygonID, &sourceSlot);
+
+  layer->reserve(polygonID + 1);
+  layer->updateDataVersion();
+  layer->recordSlotChange(polygonID);
+
+  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
+  copySlot(targetSlot.real, sourceSlot.real, 4);
+}
+
+void GeometryLayer::receivePolygonSetCornerReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real32 v0, real32 v1, real32 v2, real32 v3)
+{
+  // TODO: Support 32-bit layers.
+}
+
+void GeometryLayer::receivePolygonSetFaceUint8(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, uint8 value)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_FACE_UINT8)
+    return;
+
+  if (layer->stageSlot(polygonID, &value))
+    return;
+
+  layer->notifySetSlot(polygonID, &value);
+
+  layer->reserve(polygonID + 1);
+  layer->updateDataVersion();
+  layer->recordSlotChange(polygonID);
+
+  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
+  targetSlot.byte[0] = value;
+}
+
+void GeometryLayer::receivePolygonSetFaceUint32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, uint32 value)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_FACE_UINT32)
+    return;
+
+  if (layer->stageSlot(polygonID, &value))
+    return;
+
+  layer->notifySetSlot(polygonID, &value);
+
+  layer->reserve(polygonID + 1);
+  layer->updateDataVersion();
+  layer->recordSlotChange(polygonID);
+
+  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
+  targetSlot.uint[0] = value;
+}
+
+void GeometryLayer::receivePolygonSetFaceReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real64 value)
+{
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  GeometryLayer* layer = node->getLayerByID(layerID);
+  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_FACE_REAL)
+    return;
+
+  if (layer->stageSlot(polygonID, &value))
+    return;
+
+  layer->notifySetSlot(polygonID, &value);
+
+  layer->reserve(polygonID + 1);
+  layer->updateDataVersion();
+  layer->recordSlotChange(polygonID);
+
+  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
+  targetSlot.real[0] = value;
+}
+
+void GeometryLayer::receivePolygonSetFaceReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real32 value)
+{
+  // TODO: Support 32-bit layers.
+}
+
+//---------------------------------------------------------------------
+
+GeometryLayer::SlotChange::SlotChange(unsigned int version):
+  mVersion(version)
+{
+}
+
+//---------------------------------------------------------------------
+
+GeometryLayerObserver::GeometryLayerObserver(void):
+  mBatched(false)
+{
+}
+
+void GeometryLayerObserver::onSetSlot(GeometryLayer& layer, uint32 slotID, const void* data)
+{
+}
+
+void GeometryLayerObserver::onSetSlots(GeometryLayer& layer, uint32 firstID, uint32 count)
+{
+}
+
+void GeometryLayerObserver::onSetName(GeometryLayer& layer, const std::string& name)
+{
+}
+
+void GeometryLayerObserver::onSetType(GeometryLayer& layer, VNGLayerType type)
+{
+}
+
+void GeometryLayerObserver::onDestroy(GeometryLayer& layer)
+{
+}
+
+bool GeometryLayerObserver::isBatched(void) const
+{
+  return mBatched;
+}
+
+void GeometryLayerObserver::setBatched(bool enabled)
+{
+  mBatched = enabled;
+}
+
+//---------------------------------------------------------------------
+
+void Bone::destroy(void)
+{
+  mNode.getSession().push();
+  verse_send_g_bone_destroy(mNode.getID(), mID);
+  mNode.getSession().pop();
 }
 
-void GeometryLayer::receiveVertexDeleteReal64(void* user, VNodeID nodeID, uint32 vertexID)
+uint16 Bone::getID(void) const
 {
-  Session* session = Session::getCurrent();
+  return mID;
+}
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node || !node->mBaseVertexLayer)
-    return;
+uint16 Bone::getParentID(void) const
+{
+  return mState.mParentID;
+}
 
-  BaseVertex* vertex = reinterpret_cast<BaseVertex*>(node->mBaseVertexLayer->mData.getItem(vertexID));
-  if (!vertex || !vertex->isValid())
-    return;
+Bone* Bone::getParent(void) const
+{
+  if (mState.mParentID == INVALID_BONE_ID)
+    return NULL;
 
-  // TODO: Add polygon change notification. (quad to triangle or back)
-  // NOTE: This piece of code is a good argument for cacheing the
-  // polygon validity state.
+  return mNode.getBoneByID(mState.mParentID);
+}
 
-  for (uint32 polygonID = 0;  polygonID < node->mHighestPolygonID;  polygonID++)
-  {
-    BasePolygon polygon;
-    if (node->getBasePolygon(polygonID, polygon))
-    {
-      for (unsigned int i = 0;  i < 4;  i++)
-      {
-	if (polygon.mIndices[i] == vertexID)
-	{
-	  const GeometryNode::ObserverList& observers = node->getObservers();
-	  for (GeometryNode::ObserverList::const_iterator j = observers.begin();  j != observers.end();  i++)
-	  {
-	    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*j))
-	    {
-	      if (i < 3)
-		observer->onDeletePolygon(*node, polygonID);
-	      else
-		observer->onChangeBasePolygon(*node, polygonID, polygon);
-	    }
-	  }
+void Bone::setParent(uint16 parentID)
+{
+  mCache.mParentID = parentID;
+  sendData();
+}
 
-	  break;
-	}
-      }
-    }
-  }
+const std::string& Bone::getWeightLayerName(void) const
+{
+  return mState.mWeight;
+}
 
-  const GeometryNode::ObserverList& observers = node->getObservers();
-  for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-  {
-    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
-      observer->onDeleteVertex(*node, vertexID);
-  }
+GeometryLayer* Bone::getWeightLayer(void) const
+{
+  GeometryLayer* layer = mNode.getLayerByName(mState.mWeight);
+  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_REAL)
+    return NULL;
 
-  vertex->setInvalid();
+  return layer;
+}
 
-  if (vertexID == node->mHighestVertexID)
-  {
-    BaseVertex* vertices = reinterpret_cast<BaseVertex*>(node->mBaseVertexLayer->mData.getItems());
+void Bone::setWeightLayer(const std::string& name)
+{
+  mCache.mWeight = name;
+  sendData();
+}
 
-    uint32 index = vertexID;
-    while (index--)
-    {
-      if (vertices[index].isValid())
-      {
-	node->mHighestVertexID = index;
-	break;
-      }
-    }
+const std::string& Bone::getReferenceLayerName(void) const
+{
+  return mState.mReference;
+}
 
-    if (node->mHighestVertexID != index)
-      node->mHighestVertexID = INVALID_VERTEX_ID;
-  }
+GeometryLayer* Bone::getReferenceLayer(void) const
+{
+  GeometryLayer* layer = mNode.getLayerByName(mState.mReference);
+  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_UINT32)
+    return NULL;
 
-  if (vertexID < node->mFirstFreeVertexID)
-    node->mFirstFreeVertexID = vertexID;
+  return layer;
+}
 
-  node->mVertexCount--;
-  node->mBaseVertexLayer->updateStructureVersion();
+void Bone::setReferenceLayer(const std::string& name)
+{
+  mCache.mReference = name;
+  sendData();
 }
 
-void GeometryLayer::receiveVertexSetUint32(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, uint32 value)
+const Vector3d Bone::getPosition(void) const
 {
-  Session* session = Session::getCurrent();
+  return mState.mPosition;
+}
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+void Bone::setPosition(const Vector3d& position)
+{
+  mCache.mPosition = position;
+  sendData();
+}
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_UINT32)
-    return;
+const Quaternion64 Bone::getRotation(void) const
+{
+  return mState.mRotation;
+}
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, vertexID, &value);
+void Bone::setRotation(const Quaternion64& rotation)
+{
+  mCache.mRotation = rotation;
+  sendData();
+}
 
-  layer->reserve(vertexID + 1);
-  layer->updateDataVersion();
+const std::string& Bone::getCurveLabel(void) const
+{
+  return mCurveLabel;
+}
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(vertexID));
-  targetSlot.uint[0] = value;
+void Bone::setCurveLabel(const std::string& label)
+{
+  mCurveLabel = label;
 }
 
-void GeometryLayer::receiveVertexSetReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real64 value)
+GeometryNode& Bone::getNode(void) const
 {
-  Session* session = Session::getCurrent();
+  return mNode;
+}
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+Bone::Bone(uint16 ID, GeometryNode& node):
+  mID(ID),
+  mNode(node)
+{
+}
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_VERTEX_REAL)
-    return;
+void Bone::sendData(void)
+{
+  mNode.getSession().push();
+  verse_send_g_bone_create(mNode.getID(),
+                           mID,
+			   mCache.mWeight.c_str(),
+			   mCache.mReference.c_str(),
+			   mCache.mParentID,
+			   mCache.mPosition.x,
+			   mCache.mPosition.y,
+			   mCache.mPosition.z,
+			   mCache.mRotation.x,
+			   mCache.mRotation.y,
+			   mCache.mRotation.z,
+			   mCache.mRotation.w);
+  mNode.getSession().pop();
+}
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, vertexID, &value);
+//---------------------------------------------------------------------
 
-  layer->reserve(vertexID + 1);
-  layer->updateDataVersion();
+void BoneObserver::onChange(Bone& bone)
+{
+}
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(vertexID));
-  targetSlot.real[0] = value;
+void BoneObserver::onDestroy(Bone& bone)
+{
 }
 
-void GeometryLayer::receiveVertexSetReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 vertexID, real32 value)
+//---------------------------------------------------------------------
+
+void GeometryNode::createLayer(const std::string& name, VNGLayerType type, uint32 defaultInt, real64 defaultReal)
 {
-  // TODO: Support 32-bit layers.
+  getSession().push();
+  verse_send_g_layer_create(getID(), ~0, name.c_str(), type, defaultInt, defaultReal);
+  getSession().pop();
 }
 
-void GeometryLayer::receivePolygonSetCornerUint32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, uint32 v0, uint32 v1, uint32 v2, uint32 v3)
+void GeometryNode::createBone(uint16 parentID,
+                              const std::string& weight,
+                              const std::string& reference,
+                              const Vector3d& position,
+                              const Quaternion64& rotation)
 {
-  Session* session = Session::getCurrent();
+  getSession().push();
+  verse_send_g_bone_create(getID(),
+                           ~0,
+			   weight.c_str(),
+			   reference.c_str(),
+			   parentID,
+			   position.x,
+			   position.y,
+			   position.z,
+			   rotation.x,
+			   rotation.y,
+			   rotation.z,
+			   rotation.w);
+  getSession().pop();
+}
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+bool GeometryNode::getBaseMesh(BaseMesh& mesh)
+{
+  if (!mBaseVertexLayer || !mBasePolygonLayer)
+    return false;
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_CORNER_UINT32)
-    return;
+  // Retrieve all valid polygons.
 
-  BasePolygon polygon(v0, v1, v2, v3);
+  for (uint32 i = 0;  i < mBasePolygonLayer->mData.getItemCount();  i++)
+  {
+    BasePolygon polygon;
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, polygonID, &polygon);
+    if (getBasePolygon(i, polygon))
+    {
+      if (!isVertex(polygon.mIndices[3]))
+	polygon.mIndices[3] = INVALID_VERTEX_ID;
+      mesh.mPolygons.push_back(polygon);
+    }
+  }
 
-  bool created = (layerID == BASE_POLYGON_LAYER_ID && !node->isPolygon(polygonID));
+  if (!mesh.mPolygons.size())
+    return false;
 
-  if (created)
-  {
-    // Check if the new polygon really is valid.
+  // Remap vertex indices.
 
-    for (uint32 i = 0;  i < 3;  i++)
+  VertexIndexMap indices;
+
+  for (BaseMesh::PolygonList::iterator polygon = mesh.mPolygons.begin();  polygon != mesh.mPolygons.end();  polygon++)
+  {
+    for (unsigned int i = 0;  i < 4;  i++)
     {
-      if (!node->isVertex(polygon.mIndices[i]))
-      {
-	created = false;
+      uint32 index = (*polygon).mIndices[i];
+      if (index == INVALID_VERTEX_ID)
 	break;
+
+      VertexIndexMap::iterator mapper = indices.find(index);
+      if (mapper == indices.end())
+      {
+	const uint32 value = indices.size();
+	indices[index] = value;
+	mapper = indices.find(index);
       }
+
+      (*polygon).mIndices[i] = (*mapper).second;
     }
   }
 
-  if (!created)
+  // Copy vertices into new indices.
+
+  mesh.mVertices.resize(indices.size());
+
+  for (VertexIndexMap::const_iterator i = indices.begin();  i != indices.end();  i++)
+    getBaseVertex((*i).first, mesh.mVertices[(*i).second]);
+
+  return true;
+}
+
+bool GeometryNode::setBaseMesh(const BaseMesh& mesh, bool keepLooseVertices, ProgressFunction function, void* data)
+{
+  if (!mBaseVertexLayer || !mBasePolygonLayer)
+    return false;
+
+  const uint32 vertexCount = mesh.mVertices.size();
+  const uint32 polygonCount = mesh.mPolygons.size();
+
+  for (BaseMesh::PolygonList::const_iterator polygon = mesh.mPolygons.begin();  polygon != mesh.mPolygons.end();  polygon++)
   {
-    const GeometryNode::ObserverList& observers = node->getObservers();
-    for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+    for (unsigned int i = 0;  i < 4;  i++)
     {
-      if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
-	observer->onChangeBasePolygon(*node, polygonID, polygon);
+      const uint32 index = (*polygon).mIndices[i];
+
+      if (index >= vertexCount && (i < 3 || index != INVALID_VERTEX_ID))
+	return false;
     }
   }
 
-  layer->reserve(polygonID + 1);
+  // Order the current elements the way getBaseMesh does. Vertices not used
+  // by any polygon come after those, and are only included if they may be
+  // deleted.
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
-  copySlot(targetSlot.uint, polygon.mIndices, 4);
+  typedef std::multimap<BaseVertex, uint32, VertexLess> VertexIDMap;
+  typedef std::multimap<BasePolygon, uint32, PolygonLess> PolygonIDMap;
 
-  if (created)
+  const uint32 vertexLimit = mBaseVertexLayer->getSlotLimit();
+  const uint32 polygonLimit = mBasePolygonLayer->getSlotLimit();
+
+  IDList polygonIDs;
+  IDList vertexIDs;
+  ValidityMap used(vertexLimit, false);
+  PolygonIDMap currentPolygons;
+
+  for (uint32 polygonID = 0;  polygonID < polygonLimit;  polygonID++)
+  {
+    BasePolygon polygon;
+    if (!getBasePolygon(polygonID, polygon))
+      continue;
+
+    if (!isVertex(polygon.mIndices[3]))
+      polygon.mIndices[3] = INVALID_VERTEX_ID;
+
+    polygonIDs.push_back(polygonID);
+    currentPolygons.insert(std::make_pair(polygon, polygonID));
+
+    for (unsigned int i = 0;  i < 4;  i++)
+    {
+      const uint32 vertexID = polygon.mIndices[i];
+      if (!isVertex(vertexID))
+	break;
+
+      if (!used[vertexID])
+      {
+	used[vertexID] = true;
+	vertexIDs.push_back(vertexID);
+      }
+    }
+  }
+
+  VertexIDMap currentVertices;
+
+  for (uint32 vertexID = 0;  vertexID < vertexLimit;  vertexID++)
+  {
+    if (!isVertex(vertexID))
+      continue;
+
+    if (!used[vertexID] && !keepLooseVertices)
+      vertexIDs.push_back(vertexID);
+
+    BaseVertex vertex;
+    getBaseVertex(vertexID, vertex);
+    currentVertices.insert(std::make_pair(vertex, vertexID));
+  }
+
+  // Match vertices by exact position first, so that inserting or removing
+  // an element doesn't shift all the elements after it. Vertices without a
+  // match then reuse the IDs of unmatched current vertices, as moving a
+  // vertex costs less than creating one and deleting another, and are only
+  // given new IDs once those run out.
+
+  IDList vertexTargets(vertexCount, INVALID_VERTEX_ID);
+  ValidityMap claimedVertices(vertexLimit, false);
+
+  for (uint32 i = 0;  i < vertexCount;  i++)
+  {
+    VertexIDMap::iterator match = currentVertices.find(mesh.mVertices[i]);
+    if (match == currentVertices.end())
+      continue;
+
+    vertexTargets[i] = (*match).second;
+    claimedVertices[(*match).second] = true;
+    currentVertices.erase(match);
+  }
+
+  assignUnclaimedIDs(vertexTargets, vertexIDs, claimedVertices);
+
+  uint32 freeID = 0;
+
+  for (IDList::iterator i = vertexTargets.begin();  i != vertexTargets.end();  i++)
+  {
+    if (*i != INVALID_VERTEX_ID)
+      continue;
+
+    while (isVertex(freeID))
+      freeID++;
+
+    *i = freeID++;
+  }
+
+  // Polygons are matched the same way, by their corners once those have
+  // been remapped to the vertex IDs chosen above.
+
+  BaseMesh::PolygonList polygons(mesh.mPolygons);
+  IDList polygonTargets(polygonCount, INVALID_POLYGON_ID);
+  ValidityMap claimedPolygons(polygonLimit, false);
+
+  for (uint32 i = 0;  i < polygonCount;  i++)
   {
-    node->mPolygonCount++;
-    if (node->mHighestPolygonID == INVALID_POLYGON_ID || polygonID > node->mHighestPolygonID)
-      node->mHighestPolygonID = polygonID;
+    BasePolygon& polygon = polygons[i];
 
-    if (polygonID == node->mFirstFreePolygonID)
+    for (unsigned int j = 0;  j < 4;  j++)
     {
-      for (uint32 i = polygonID;  i <= node->mHighestPolygonID;  i++)
-      {
-	if (!node->isPolygon(i))
-	{
-	  node->mFirstFreePolygonID = i;
-	  break;
-	}
-      }
+      if (polygon.mIndices[j] != INVALID_VERTEX_ID)
+	polygon.mIndices[j] = vertexTargets[polygon.mIndices[j]];
     }
 
-    layer->updateStructureVersion();
+    PolygonIDMap::iterator match = currentPolygons.find(polygon);
+    if (match == currentPolygons.end())
+      continue;
 
-    const GeometryNode::ObserverList& observers = node->getObservers();
-    for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    {
-      if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
-	observer->onCreatePolygon(*node, polygonID, polygon);
-    }
+    polygonTargets[i] = (*match).second;
+    claimedPolygons[(*match).second] = true;
+    currentPolygons.erase(match);
   }
-  else
-    layer->updateDataVersion();
-}
 
-void GeometryLayer::receivePolygonDelete(void* user, VNodeID nodeID, uint32 polygonID)
-{
-  Session* session = Session::getCurrent();
+  assignUnclaimedIDs(polygonTargets, polygonIDs, claimedPolygons);
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node || !node->mBasePolygonLayer)
-    return;
+  uint32 total = vertexCount + polygonCount;
 
-  BasePolygon* polygon = reinterpret_cast<BasePolygon*>(node->mBasePolygonLayer->mData.getItem(polygonID));
-  if (!polygon)
-    return;
+  for (IDList::const_iterator i = vertexIDs.begin();  i != vertexIDs.end();  i++)
+  {
+    if (!claimedVertices[*i])
+      total++;
+  }
 
-  const GeometryNode::ObserverList& observers = node->getObservers();
-  for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+  for (IDList::const_iterator i = polygonIDs.begin();  i != polygonIDs.end();  i++)
   {
-    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
-      observer->onDeletePolygon(*node, polygonID);
+    if (!claimedPolygons[*i])
+      total++;
   }
 
-  polygon->setInvalid();
+  uint32 done = 0;
 
-  if (polygonID == node->mHighestPolygonID)
+  getSession().push();
+
+  // Send the vertices first, so the polygons have something to refer to.
+
+  for (uint32 i = 0;  i < vertexCount;  i++)
   {
-    BasePolygon* polygons = reinterpret_cast<BasePolygon*>(node->mBasePolygonLayer->mData.getItems());
+    const BaseVertex& vertex = mesh.mVertices[i];
 
-    uint32 index = polygonID;
-    while (index--)
+    if (isVertex(vertexTargets[i]))
     {
-      if (polygons[index].isValid())
-      {
-	node->mHighestPolygonID = index;
-	break;
-      }
+      BaseVertex current;
+      getBaseVertex(vertexTargets[i], current);
+
+      if (std::memcmp(&current, &vertex, sizeof(BaseVertex)) != 0)
+	setBaseVertex(vertexTargets[i], vertex);
     }
+    else
+      setBaseVertex(vertexTargets[i], vertex);
 
-    if (node->mHighestPolygonID != index)
-      node->mHighestPolygonID = INVALID_POLYGON_ID;
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
   }
 
-  if (polygonID < node->mFirstFreePolygonID)
-    node->mFirstFreePolygonID = polygonID;
+  freeID = 0;
 
-  node->mPolygonCount--;
-  node->mBasePolygonLayer->updateStructureVersion();
-}
+  for (uint32 i = 0;  i < polygonCount;  i++)
+  {
+    const BasePolygon& polygon = polygons[i];
 
-void GeometryLayer::receivePolygonSetCornerReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real64 v0, real64 v1, real64 v2, real64 v3)
-{
-  Session* session = Session::getCurrent();
+    if (polygonTargets[i] == INVALID_POLYGON_ID)
+    {
+      while (freeID < polygonLimit && isPolygon(freeID))
+	freeID++;
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+      setBasePolygon(freeID++, polygon);
+    }
+    else
+    {
+      BasePolygon current;
+      getBasePolygon(polygonTargets[i], current);
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_CORNER_REAL)
-    return;
+      if (!isVertex(current.mIndices[3]))
+	current.mIndices[3] = INVALID_VERTEX_ID;
 
-  Slot sourceSlot;
-  sourceSlot.real[0] = v0;
-  sourceSlot.real[1] = v1;
-  sourceSlot.real[2] = v2;
-  sourceSlot.real[3] = v3;
+      if (std::memcmp(&current, &polygon, sizeof(BasePolygon)) != 0)
+	setBasePolygon(polygonTargets[i], polygon);
+    }
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, polygonID, &sourceSlot);
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
+  }
 
-  layer->reserve(polygonID + 1);
-  layer->updateDataVersion();
+  // Delete the leftover polygons before the leftover vertices, since the
+  // remaining polygons no longer use any of those vertices.
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
-  copySlot(targetSlot.real, sourceSlot.real, 4);
-}
+  for (IDList::const_iterator i = polygonIDs.begin();  i != polygonIDs.end();  i++)
+  {
+    if (claimedPolygons[*i])
+      continue;
 
-void GeometryLayer::receivePolygonSetCornerReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real32 v0, real32 v1, real32 v2, real32 v3)
-{
-  // TODO: Support 32-bit layers.
-}
+    deletePolygon(*i);
 
-void GeometryLayer::receivePolygonSetFaceUint8(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, uint8 value)
-{
-  Session* session = Session::getCurrent();
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
+  }
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+  for (IDList::const_iterator i = vertexIDs.begin();  i != vertexIDs.end();  i++)
+  {
+    if (claimedVertices[*i])
+      continue;
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_FACE_UINT8)
-    return;
+    deleteVertex(*i);
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, polygonID, &value);
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
+  }
 
-  layer->reserve(polygonID + 1);
-  layer->updateDataVersion();
+  getSession().pop();
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
-  targetSlot.byte[0] = value;
+  if (function)
+    function(data, total, total);
+
+  return true;
 }
 
-void GeometryLayer::receivePolygonSetFaceUint32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, uint32 value)
+GeometryLayer* GeometryNode::getLayerByID(VLayerID ID)
 {
-  Session* session = Session::getCurrent();
+  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
+    if ((*i)->getID() == ID)
+      return *i;
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+  return NULL;
+}
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_FACE_UINT32)
-    return;
+const GeometryLayer* GeometryNode::getLayerByID(VLayerID ID) const
+{
+  for (LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
+    if ((*i)->getID() == ID)
+      return *i;
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, polygonID, &value);
+  return NULL;
+}
 
-  layer->reserve(polygonID + 1);
-  layer->updateDataVersion();
+GeometryLayer* GeometryNode::getLayerByIndex(unsigned int index)
+{
+  return mLayers[index];
+}
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
-  targetSlot.uint[0] = value;
+const GeometryLayer* GeometryNode::getLayerByIndex(unsigned int index) const
+{
+  return mLayers[index];
 }
 
-void GeometryLayer::receivePolygonSetFaceReal64(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real64 value)
+GeometryLayer* GeometryNode::getLayerByName(const std::string& name)
 {
-  Session* session = Session::getCurrent();
+  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
+    if ((*i)->getName() == name)
+      return *i;
 
-  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
-  if (!node)
-    return;
+  return NULL;
+}
 
-  GeometryLayer* layer = node->getLayerByID(layerID);
-  if (!layer || layer->getType() != VN_G_LAYER_POLYGON_FACE_REAL)
-    return;
+const GeometryLayer* GeometryNode::getLayerByName(const std::string& name) const
+{
+  for (LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
+    if ((*i)->getName() == name)
+      return *i;
 
-  const GeometryLayer::ObserverList& observers = layer->getObservers();
-  for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
-    (*i)->onSetSlot(*layer, polygonID, &value);
+  return NULL;
+}
 
-  layer->reserve(polygonID + 1);
-  layer->updateDataVersion();
+Bone* GeometryNode::getBoneByID(uint16 ID)
+{
+  for (BoneList::iterator i = mBones.begin();  i != mBones.end();  i++)
+    if ((*i)->getID() == ID)
+      return *i;
 
-  Slot& targetSlot = *reinterpret_cast<Slot*>(layer->mData.getItem(polygonID));
-  targetSlot.real[0] = value;
+  return NULL;
 }
 
-void GeometryLayer::receivePolygonSetFaceReal32(void* user, VNodeID nodeID, VLayerID layerID, uint32 polygonID, real32 value)
+const Bone* GeometryNode::getBoneByID(uint16 ID) const
 {
-  // TODO: Support 32-bit layers.
-}
+  for (BoneList::const_iterator i = mBones.begin();  i != mBones.end();  i++)
+    if ((*i)->getID() == ID)
+      return *i;
 
-//---------------------------------------------------------------------
+  return NULL;
+}
 
-void GeometryLayerObserver::onSetSlot(GeometryLayer& layer, uint32 slotID, const void* data)
+Bone* GeometryNode::getBoneByIndex(unsigned int index)
 {
+  if (index >= mBones.size())
+    return NULL;
+
+  return mBones[index];
 }
 
-void GeometryLayerObserver::onSetName(GeometryLayer& layer, const std::string& name)
+const Bone* GeometryNode::getBoneByIndex(unsigned int index) const
 {
+  if (index >= mBones.size())
+    return NULL;
+
+  return mBones[index];
 }
 
-void GeometryLayerObserver::onDestroy(GeometryLayer& layer)
+unsigned int GeometryNode::getBoneCount(void) const
 {
+  return mBones.size();
 }
 
-//---------------------------------------------------------------------
-
-void GeometryNode::createLayer(const std::string& name, VNGLayerType type, uint32 defaultInt, real64 defaultReal)
+unsigned int GeometryNode::shareLayers(GeometryNode& source)
 {
-  getSession().push();
-  verse_send_g_layer_create(getID(), ~0, name.c_str(), type, defaultInt, defaultReal);
-  getSession().pop();
+  unsigned int count = 0;
+
+  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
+  {
+    GeometryLayer* other = source.getLayerByID((*i)->getID());
+    if (other && (*i)->share(*other))
+      count++;
+  }
+
+  return count;
 }
 
-bool GeometryNode::getBaseMesh(BaseMesh& mesh)
+uint32 GeometryNode::compactIDs(ProgressFunction function, void* data)
 {
   if (!mBaseVertexLayer || !mBasePolygonLayer)
-    return false;
+    return 0;
 
-  // Retrieve all valid polygons.
+  // Move each element above the dense range into the lowest free ID below
+  // it, leaving all other elements where they are.
 
-  for (uint32 i = 0;  i < mBasePolygonLayer->mData.getItemCount();  i++)
+  VertexIndexMap vertexIDs;
+  VertexIndexMap polygonIDs;
+
+  const uint32 vertexLimit = mBaseVertexLayer->getSlotLimit();
+  const uint32 polygonLimit = mBasePolygonLayer->getSlotLimit();
+
+  uint32 freeID = 0;
+
+  for (uint32 vertexID = mVertexCount;  vertexID < vertexLimit;  vertexID++)
   {
-    BasePolygon polygon;
+    if (!isVertex(vertexID))
+      continue;
 
-    if (getBasePolygon(i, polygon))
-    {
-      if (!isVertex(polygon.mIndices[3]))
-	polygon.mIndices[3] = INVALID_VERTEX_ID;
-      mesh.mPolygons.push_back(polygon);
-    }
+    while (isVertex(freeID))
+      freeID++;
+
+    vertexIDs[vertexID] = freeID++;
   }
 
-  if (!mesh.mPolygons.size())
-    return false;
+  // Polygons referencing a deleted vertex are not valid, so the polygon
+  // count can't be used to find the dense range.
 
-  // Remap vertex indices.
+  uint32 polygonCount = 0;
 
-  VertexIndexMap indices;
+  for (uint32 polygonID = 0;  polygonID < polygonLimit;  polygonID++)
+  {
+    if (isPolygon(polygonID))
+      polygonCount++;
+  }
 
-  for (BaseMesh::PolygonList::iterator polygon = mesh.mPolygons.begin();  polygon != mesh.mPolygons.end();  polygon++)
+  freeID = 0;
+
+  for (uint32 polygonID = polygonCount;  polygonID < polygonLimit;  polygonID++)
   {
-    for (unsigned int i = 0;  i < 4;  i++)
+    if (!isPolygon(polygonID))
+      continue;
+
+    while (isPolygon(freeID))
+      freeID++;
+
+    polygonIDs[polygonID] = freeID++;
+  }
+
+  const uint32 total = vertexIDs.size() * 2 + polygonLimit + polygonIDs.size();
+
+  uint32 done = 0;
+  uint32 commandCount = 0;
+
+  getSession().push();
+
+  // Copy the moved vertices to their new IDs, base layer first as that
+  // creates them.
+
+  for (VertexIndexMap::const_iterator i = vertexIDs.begin();  i != vertexIDs.end();  i++)
+  {
+    for (LayerList::iterator layer = mLayers.begin();  layer != mLayers.end();  layer++)
     {
-      uint32 index = (*polygon).mIndices[i];
-      if (index == INVALID_VERTEX_ID)
-	break;
+      if ((*layer)->getStack() == GeometryLayer::VERTEX)
+      {
+	if ((*layer)->cloneSlot((*i).first, (*i).second))
+	  commandCount++;
+      }
+    }
 
-      VertexIndexMap::iterator mapper = indices.find(index);
-      if (mapper == indices.end())
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
+  }
+
+  // Point all polygons at the new vertex IDs, and copy the moved polygons
+  // to their new IDs along with the rest of their layers.
+
+  for (uint32 polygonID = 0;  polygonID < polygonLimit;  polygonID++)
+  {
+    BasePolygon polygon;
+
+    if (getBasePolygon(polygonID, polygon))
+    {
+      BasePolygon remapped = polygon;
+
+      for (unsigned int i = 0;  i < 4;  i++)
+      {
+	VertexIndexMap::const_iterator j = vertexIDs.find(polygon.mIndices[i]);
+	if (j != vertexIDs.end())
+	  remapped.mIndices[i] = (*j).second;
+      }
+
+      VertexIndexMap::const_iterator target = polygonIDs.find(polygonID);
+
+      if (target != polygonIDs.end())
+      {
+	setBasePolygon((*target).second, remapped);
+	commandCount++;
+
+	for (LayerList::iterator layer = mLayers.begin();  layer != mLayers.end();  layer++)
+	{
+	  if ((*layer)->getStack() == GeometryLayer::POLYGON && *layer != mBasePolygonLayer)
+	  {
+	    if ((*layer)->cloneSlot(polygonID, (*target).second))
+	      commandCount++;
+	  }
+	}
+      }
+      else if (std::memcmp(&remapped, &polygon, sizeof(BasePolygon)) != 0)
       {
-	const uint32 value = indices.size();
-	indices[index] = value;
-	mapper = indices.find(index);
+	setBasePolygon(polygonID, remapped);
+	commandCount++;
       }
-
-      (*polygon).mIndices[i] = (*mapper).second;
     }
+
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
   }
 
-  // Copy vertices into new indices.
+  // Delete the polygons and then the vertices at the old IDs. No polygon
+  // references the old vertices anymore, so no other polygons go with them.
 
-  mesh.mVertices.resize(indices.size());
+  for (VertexIndexMap::const_iterator i = polygonIDs.begin();  i != polygonIDs.end();  i++)
+  {
+    deletePolygon((*i).first);
+    commandCount++;
 
-  for (VertexIndexMap::const_iterator i = indices.begin();  i != indices.end();  i++)
-    getBaseVertex((*i).first, mesh.mVertices[(*i).second]);
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
+  }
 
-  return true;
+  for (VertexIndexMap::const_iterator i = vertexIDs.begin();  i != vertexIDs.end();  i++)
+  {
+    deleteVertex((*i).first);
+    commandCount++;
+
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
+  }
+
+  getSession().pop();
+
+  if (function)
+    function(data, total, total);
+
+  return commandCount;
 }
 
-GeometryLayer* GeometryNode::getLayerByID(VLayerID ID)
+const std::string& GeometryNode::getStorageDirectory(void) const
 {
-  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
-    if ((*i)->getID() == ID)
-      return *i;
+  return mStorageDirectory;
+}
 
-  return NULL;
+size_t GeometryNode::getStorageThreshold(void) const
+{
+  return mStorageThreshold;
 }
 
-const GeometryLayer* GeometryNode::getLayerByID(VLayerID ID) const
+void GeometryNode::setStorage(const std::string& directory, size_t threshold)
 {
-  for (LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
-    if ((*i)->getID() == ID)
-      return *i;
+  mStorageDirectory = directory;
+  mStorageThreshold = threshold;
 
-  return NULL;
+  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
+  {
+    (*i)->mData.setMapping(directory, threshold);
+
+    if (GeometryQuantization* quantization = (*i)->mQuantization)
+      quantization->mCodes.setMapping(directory, threshold);
+  }
 }
 
-GeometryLayer* GeometryNode::getLayerByIndex(unsigned int index)
+void GeometryNode::setDefaultStorage(const std::string& directory, size_t threshold)
 {
-  return mLayers[index];
+  msStorageDirectory = directory;
+  msStorageThreshold = threshold;
 }
 
-const GeometryLayer* GeometryNode::getLayerByIndex(unsigned int index) const
+unsigned int GeometryNode::getCompactVertexBits(void) const
 {
-  return mLayers[index];
+  return mCompactVertexBits;
 }
 
-GeometryLayer* GeometryNode::getLayerByName(const std::string& name)
+void GeometryNode::setCompactVertexBits(unsigned int bits)
 {
-  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
-    if ((*i)->getName() == name)
-      return *i;
+  mCompactVertexBits = bits;
 
-  return NULL;
+  if (mBaseVertexLayer)
+  {
+    mBaseVertexLayer->setCompactBits(bits);
+    mBoundsDirty = true;
+  }
 }
 
-const GeometryLayer* GeometryNode::getLayerByName(const std::string& name) const
+void GeometryNode::setDefaultCompactVertexBits(unsigned int bits)
 {
-  for (LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
-    if ((*i)->getName() == name)
-      return *i;
+  msCompactVertexBits = bits;
+}
 
-  return NULL;
+const GeometryQuantization* GeometryNode::getQuantization(void) const
+{
+  if (!mBaseVertexLayer)
+    return NULL;
+
+  return mBaseVertexLayer->mQuantization;
 }
 
 bool GeometryNode::isVertex(uint32 vertexID) const
@@ -1020,7 +2355,12 @@ bool GeometryNode::isVertex(uint32 vertexID) const
   if (!mBaseVertexLayer)
     return false;
 
-  const BaseVertex* vertex = reinterpret_cast<BaseVertex*>(mBaseVertexLayer->mData.getItem(vertexID));
+  if (const GeometryQuantization* quantization = mBaseVertexLayer->mQuantization)
+    return quantization->isVertex(vertexID);
+
+  const Block& data = mBaseVertexLayer->mData;
+
+  const BaseVertex* vertex = reinterpret_cast<const BaseVertex*>(data.getItem(vertexID));
   if (!vertex || !vertex->isValid())
     return false;
 
@@ -1032,7 +2372,9 @@ bool GeometryNode::isPolygon(uint32 polygonID) const
   if (!mBasePolygonLayer)
     return false;
 
-  const BasePolygon* polygon = reinterpret_cast<BasePolygon*>(mBasePolygonLayer->mData.getItem(polygonID));
+  const Block& data = mBasePolygonLayer->mData;
+
+  const BasePolygon* polygon = reinterpret_cast<const BasePolygon*>(data.getItem(polygonID));
   if (!polygon)
     return false;
 
@@ -1050,7 +2392,12 @@ bool GeometryNode::getBaseVertex(uint32 vertexID, BaseVertex& vertex) const
   if (!mBaseVertexLayer)
     return false;
 
-  const BaseVertex* result = reinterpret_cast<BaseVertex*>(mBaseVertexLayer->mData.getItem(vertexID));
+  if (const GeometryQuantization* quantization = mBaseVertexLayer->mQuantization)
+    return quantization->getVertex(vertexID, vertex);
+
+  const Block& data = mBaseVertexLayer->mData;
+
+  const BaseVertex* result = reinterpret_cast<const BaseVertex*>(data.getItem(vertexID));
   if (!result || !result->isValid())
     return false;
 
@@ -1063,7 +2410,9 @@ bool GeometryNode::getBasePolygon(uint32 polygonID, BasePolygon& polygon) const
   if (!mBasePolygonLayer)
     return false;
 
-  const BasePolygon* result = reinterpret_cast<BasePolygon*>(mBasePolygonLayer->mData.getItem(polygonID));
+  const Block& data = mBasePolygonLayer->mData;
+
+  const BasePolygon* result = reinterpret_cast<const BasePolygon*>(data.getItem(polygonID));
   if (!result)
     return false;
 
@@ -1224,6 +2573,93 @@ uint32 GeometryNode::getPolygonCount(void) const
   return mPolygonCount;
 }
 
+const Box3d& GeometryNode::getBounds(void)
+{
+  if (mBoundsDirty)
+  {
+    mBounds.setEmpty();
+
+    if (mBaseVertexLayer && mHighestVertexID != INVALID_VERTEX_ID)
+    {
+      Block expanded;
+      const BaseVertex* vertices = reinterpret_cast<const BaseVertex*>(mBaseVertexLayer->getRealSlots(expanded, 0, mHighestVertexID + 1));
+
+      for (uint32 i = 0;  i <= mHighestVertexID;  i++)
+      {
+	if (vertices[i].isValid())
+	  mBounds.envelop(Vector3d(vertices[i].x, vertices[i].y, vertices[i].z));
+      }
+    }
+
+    mBoundsDirty = false;
+  }
+
+  return mBounds;
+}
+
+const GeometryNormals& GeometryNode::getNormals(void)
+{
+  if (!mNormals)
+    mNormals = new GeometryNormals(*this);
+
+  mNormals->update();
+  return *mNormals;
+}
+
+const GeometryBoundsTree& GeometryNode::getBoundsTree(void)
+{
+  if (!mBoundsTree)
+    mBoundsTree = new GeometryBoundsTree(*this);
+
+  mBoundsTree->update();
+  return *mBoundsTree;
+}
+
+const GeometryTopology& GeometryNode::getTopology(void)
+{
+  if (!mTopology)
+    mTopology = new GeometryTopology(*this);
+
+  mTopology->update();
+  return *mTopology;
+}
+
+const GeometryEdges& GeometryNode::getEdges(void)
+{
+  if (!mEdges)
+    mEdges = new GeometryEdges(*this);
+
+  mEdges->update();
+  return *mEdges;
+}
+
+const GeometrySubdivision& GeometryNode::getSubdivision(void)
+{
+  if (!mSubdivision)
+    mSubdivision = new GeometrySubdivision(*this);
+
+  mSubdivision->update();
+  return *mSubdivision;
+}
+
+GeometrySkinning& GeometryNode::getSkinning(void)
+{
+  if (!mSkinning)
+    mSkinning = new GeometrySkinning(*this);
+
+  mSkinning->update();
+  return *mSkinning;
+}
+
+GeometrySimplification& GeometryNode::getSimplification(void)
+{
+  if (!mSimplification)
+    mSimplification = new GeometrySimplification(*this);
+
+  mSimplification->update();
+  return *mSimplification;
+}
+
 GeometryNode::GeometryNode(VNodeID ID, VNodeOwner owner, Session& session):
   Node(ID, V_NT_GEOMETRY, owner, session),
   mBaseVertexLayer(NULL),
@@ -1235,12 +2671,37 @@ GeometryNode::GeometryNode(VNodeID ID, VNodeOwner owner, Session& session):
   mFirstFreeVertexID(0),
   mFirstFreePolygonID(0),
   mVertexCount(0),
-  mPolygonCount(0)
+  mPolygonCount(0),
+  mBoundsDirty(false),
+  mNormals(NULL),
+  mBoundsTree(NULL),
+  mTopology(NULL),
+  mEdges(NULL),
+  mSubdivision(NULL),
+  mSkinning(NULL),
+  mSimplification(NULL),
+  mStorageDirectory(msStorageDirectory),
+  mStorageThreshold(msStorageThreshold),
+  mCompactVertexBits(msCompactVertexBits)
 {
 }
 
 GeometryNode::~GeometryNode(void)
 {
+  delete mNormals;
+  delete mBoundsTree;
+  delete mTopology;
+  delete mEdges;
+  delete mSubdivision;
+  delete mSkinning;
+  delete mSimplification;
+
+  while (mBones.size())
+  {
+    delete mBones.back();
+    mBones.pop_back();
+  }
+
   while (mLayers.size())
   {
     delete mLayers.back();
@@ -1248,6 +2709,132 @@ GeometryNode::~GeometryNode(void)
   }
 }
 
+void GeometryNode::update(void)
+{
+  flushStagedSlots();
+
+  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
+  {
+    (*i)->flushSlots();
+    (*i)->shrink();
+  }
+
+  if (mChangedVertices.isEmpty() && mChangedPolygons.isEmpty())
+    return;
+
+  IDRangeSet vertices;
+  std::swap(vertices, mChangedVertices);
+
+  IDRangeSet polygons;
+  std::swap(polygons, mChangedPolygons);
+
+  const IDRangeSet::RangeList& vertexRanges = vertices.getRanges();
+  const IDRangeSet::RangeList& polygonRanges = polygons.getRanges();
+
+  const ObserverList& observers = getObservers();
+  for (ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+  {
+    GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i);
+    if (!observer || !observer->isBatched())
+      continue;
+
+    for (IDRangeSet::RangeList::const_iterator range = vertexRanges.begin();  range != vertexRanges.end();  range++)
+      observer->onChangeBaseVertices(*this, (*range).mFirst, (*range).mCount);
+
+    for (IDRangeSet::RangeList::const_iterator range = polygonRanges.begin();  range != polygonRanges.end();  range++)
+      observer->onChangeBasePolygons(*this, (*range).mFirst, (*range).mCount);
+  }
+}
+
+void GeometryNode::flushStagedSlots(void)
+{
+  // This is also done before each vertex or polygon delete, so staged values
+  // always land before the deletes that followed them.
+
+  for (LayerList::iterator i = mLayers.begin();  i != mLayers.end();  i++)
+    (*i)->flushStagedSlots();
+}
+
+void GeometryNode::notifyChangeBaseVertex(uint32 vertexID, const BaseVertex& vertex)
+{
+  bool batched = false;
+
+  const ObserverList& observers = getObservers();
+  for (ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+  {
+    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+    {
+      if (observer->isBatched())
+        batched = true;
+      else
+        observer->onChangeBaseVertex(*this, vertexID, vertex);
+    }
+  }
+
+  if (batched)
+    mChangedVertices.addID(vertexID);
+}
+
+void GeometryNode::notifyChangeBasePolygon(uint32 polygonID, const BasePolygon& polygon)
+{
+  bool batched = false;
+
+  const ObserverList& observers = getObservers();
+  for (ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+  {
+    if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+    {
+      if (observer->isBatched())
+        batched = true;
+      else
+        observer->onChangeBasePolygon(*this, polygonID, polygon);
+    }
+  }
+
+  if (batched)
+    mChangedPolygons.addID(polygonID);
+}
+
+void GeometryNode::changeBounds(const BaseVertex* previous, const BaseVertex* vertex)
+{
+  if (mBoundsDirty)
+    return;
+
+  if (previous)
+  {
+    // If the previous position was on the boundary and is moving inwards,
+    // or going away, the bounds may shrink and must be recalculated.
+
+    const real64 before[3] = { previous->x, previous->y, previous->z };
+    const real64* minimum = mBounds.minimum;
+    const real64* maximum = mBounds.maximum;
+
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      if (before[i] != minimum[i] && before[i] != maximum[i])
+	continue;
+
+      if (!vertex)
+      {
+	mBoundsDirty = true;
+	return;
+      }
+
+      const real64 after[3] = { vertex->x, vertex->y, vertex->z };
+
+      if ((before[i] == minimum[i] && after[i] > minimum[i]) ||
+          (before[i] == maximum[i] && after[i] < maximum[i]))
+      {
+	mBoundsDirty = true;
+	return;
+      }
+    }
+  }
+
+  if (vertex)
+    mBounds.envelop(Vector3d(vertex->x, vertex->y, vertex->z));
+}
+
 void GeometryNode::initialize(void)
 {
   GeometryLayer::initialize();
@@ -1299,9 +2886,29 @@ void GeometryNode::receiveGeometryLayerCreate(void* data, VNodeID ID, VLayerID l
       layer->mName = name;
       layer->updateDataVersion();
     }
+    else if (layer->isConvertible(type))
+    {
+      // This was a "change type" command between compatible types, so
+      // convert the slots in place rather than downloading them again.
+
+      const GeometryLayer::ObserverList& observers = layer->getObservers();
+      for (GeometryLayer::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+      {
+	(*i)->onSetType(*layer, type);
+
+	if (layer->mName != name)
+	  (*i)->onSetName(*layer, name);
+      }
+
+      layer->convert(type);
+      layer->mDefaultInt = defaultInt;
+      layer->mDefaultReal = defaultReal;
+      layer->mName = name;
+      node->updateStructureVersion();
+    }
     else
     {
-      // This was a "change type" command
+      // This was a "change type" command between incompatible types.
       // Discard the current layer and re-subscribe.
 
       // NOTE: This is bad. Don't do this.
@@ -1320,7 +2927,12 @@ void GeometryNode::receiveGeometryLayerCreate(void* data, VNodeID ID, VLayerID l
     node->updateStructureVersion();
 
     if (layer->getID() == BASE_VERTEX_LAYER_ID)
+    {
       node->mBaseVertexLayer = layer;
+
+      if (node->mCompactVertexBits && type == VN_G_LAYER_VERTEX_XYZ)
+	layer->setCompactBits(node->mCompactVertexBits);
+    }
     else if (layer->getID() == BASE_POLYGON_LAYER_ID)
       node->mBasePolygonLayer = layer;
 
@@ -1364,6 +2976,14 @@ void GeometryNode::receiveGeometryLayerDestroy(void* data, VNodeID ID, VLayerID
 	  observer->onDestroyLayer(*node, *(*layer));
       }
 
+      if (*layer == node->mBaseVertexLayer)
+      {
+	node->mBaseVertexLayer = NULL;
+	node->mBoundsDirty = true;
+      }
+      else if (*layer == node->mBasePolygonLayer)
+	node->mBasePolygonLayer = NULL;
+
       delete *layer;
       layers.erase(layer);
 
@@ -1383,6 +3003,7 @@ void GeometryNode::receiveCreaseSetVertex(void* user, VNodeID nodeID, const char
 
   node->mVertexCreases = layer;
   node->mVertexDefaultCrease = def_crease;
+  node->updateDataVersion();
 }
 
 void GeometryNode::receiveCreaseSetEdge(void* user, VNodeID nodeID, const char *layer, uint32 def_crease)
@@ -1395,20 +3016,102 @@ void GeometryNode::receiveCreaseSetEdge(void* user, VNodeID nodeID, const char *
 
   node->mEdgeCreases = layer;
   node->mEdgeDefaultCrease = def_crease;
+  node->updateDataVersion();
 }
 
 void GeometryNode::receiveBoneCreate(void* user, VNodeID nodeID, uint16 bone_id, const char *weight, const char *reference, uint32 parent, real64 pos_x, real64 pos_y, real64 pos_z, real64 rot_x, real64 rot_y, real64 rot_z, real64 rot_w)
 {
-  // TODO: Design bone management.
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  Bone::Data data;
+  data.mWeight = weight;
+  data.mReference = reference;
+  data.mParentID = (uint16) parent;
+  data.mPosition.set(pos_x, pos_y, pos_z);
+  data.mRotation.set(rot_x, rot_y, rot_z, rot_w);
+
+  Bone* bone = node->getBoneByID(bone_id);
+  if (bone)
+  {
+    // This was a "change bone" command.
+
+    bone->mState = bone->mCache = data;
+    node->updateDataVersion();
+
+    const Bone::ObserverList& observers = bone->getObservers();
+    for (Bone::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+      (*i)->onChange(*bone);
+  }
+  else
+  {
+    bone = new Bone(bone_id, *node);
+    bone->mState = bone->mCache = data;
+    node->mBones.push_back(bone);
+    node->updateDataVersion();
+
+    const Node::ObserverList& observers = node->getObservers();
+    for (Node::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+    {
+      if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+	observer->onCreateBone(*node, *bone);
+    }
+  }
 }
 
 void GeometryNode::receiveBoneDestroy(void* user, VNodeID nodeID, uint16 bone_id)
 {
-  // TODO: Design bone management.
+  Session* session = Session::getCurrent();
+
+  GeometryNode* node = dynamic_cast<GeometryNode*>(session->getNodeByID(nodeID));
+  if (!node)
+    return;
+
+  BoneList& bones = node->mBones;
+  for (BoneList::iterator bone = bones.begin();  bone != bones.end();  bone++)
+  {
+    if ((*bone)->getID() == bone_id)
+    {
+      // Notify bone observers.
+      {
+        const Bone::ObserverList& observers = (*bone)->getObservers();
+        for (Bone::ObserverList::const_iterator observer = observers.begin();  observer != observers.end();  observer++)
+          (*observer)->onDestroy(*(*bone));
+      }
+
+      // Notify geometry node observers.
+      const GeometryNode::ObserverList& observers = node->getObservers();
+      for (GeometryNode::ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
+      {
+	if (GeometryNodeObserver* observer = dynamic_cast<GeometryNodeObserver*>(*i))
+	  observer->onDestroyBone(*node, *(*bone));
+      }
+
+      delete *bone;
+      bones.erase(bone);
+
+      node->updateDataVersion();
+      break;
+    }
+  }
 }
 
+std::string GeometryNode::msStorageDirectory;
+
+size_t GeometryNode::msStorageThreshold = 0;
+
+unsigned int GeometryNode::msCompactVertexBits = 0;
+
 //---------------------------------------------------------------------
 
+GeometryNodeObserver::GeometryNodeObserver(void):
+  mBatched(false)
+{
+}
+
 void GeometryNodeObserver::onCreateVertex(GeometryNode& node, uint32 vertexID, const BaseVertex& vertex)
 {
 }
@@ -1417,6 +3120,10 @@ void GeometryNodeObserver::onChangeBaseVertex(GeometryNode& node, uint32 vertexI
 {
 }
 
+void GeometryNodeObserver::onChangeBaseVertices(GeometryNode& node, uint32 firstID, uint32 count)
+{
+}
+
 void GeometryNodeObserver::onDeleteVertex(GeometryNode& node, uint32 vertexID)
 {
 }
@@ -1429,6 +3136,10 @@ void GeometryNodeObserver::onChangeBasePolygon(GeometryNode& node, uint32 polygo
 {
 }
 
+void GeometryNodeObserver::onChangeBasePolygons(GeometryNode& node, uint32 firstID, uint32 count)
+{
+}
+
 void GeometryNodeObserver::onDeletePolygon(GeometryNode& node, uint32 polygonID)
 {
 }
@@ -1441,6 +3152,24 @@ void GeometryNodeObserver::onDestroyLayer(GeometryNode& node, GeometryLayer& lay
 {
 }
 
+void GeometryNodeObserver::onCreateBone(GeometryNode& node, Bone& bone)
+{
+}
+
+void GeometryNodeObserver::onDestroyBone(GeometryNode& node, Bone& bone)
+{
+}
+
+bool GeometryNodeObserver::isBatched(void) const
+{
+  return mBatched;
+}
+
+void GeometryNodeObserver::setBatched(bool enabled)
+{
+  mBatched = enabled;
+}
+
 //---------------------------------------------------------------------
 
   } /*namespace ample*/
@@ -0,0 +1,1225 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// Number of elements parsed into each batch.
+const size_t BATCH_SIZE = 16384;
+
+// Number of parsed batches that may wait to be sent. Together with the
+// batch size, this bounds the memory used by a running import.
+const size_t QUEUE_SIZE = 4;
+
+// Size of the buffer collecting small reads into large ones.
+const size_t BUFFER_SIZE = 1 << 20;
+
+// Number of seconds to wait for the layers created by an import to appear
+// before their values are dropped.
+const double LAYER_TIMEOUT = 10.0;
+
+enum ScalarType
+{
+  INT8,
+  UINT8,
+  INT16,
+  UINT16,
+  INT32,
+  UINT32,
+  REAL32,
+  REAL64,
+  INVALID_SCALAR,
+};
+
+enum ElementKind
+{
+  VERTEX_ELEMENT,
+  FACE_ELEMENT,
+  OTHER_ELEMENT,
+};
+
+enum PropertyRole
+{
+  SKIP_ROLE,
+  POSITION_ROLE,
+  INDICES_ROLE,
+  VALUE_ROLE,
+};
+
+ScalarType getScalarType(const std::string& name)
+{
+  if (name == "char" || name == "int8")
+    return INT8;
+  if (name == "uchar" || name == "uint8")
+    return UINT8;
+  if (name == "short" || name == "int16")
+    return INT16;
+  if (name == "ushort" || name == "uint16")
+    return UINT16;
+  if (name == "int" || name == "int32")
+    return INT32;
+  if (name == "uint" || name == "uint32")
+    return UINT32;
+  if (name == "float" || name == "float32")
+    return REAL32;
+  if (name == "double" || name == "float64")
+    return REAL64;
+
+  return INVALID_SCALAR;
+}
+
+size_t getScalarSize(ScalarType type)
+{
+  switch (type)
+  {
+    case INT8:
+    case UINT8:
+      return 1;
+    case INT16:
+    case UINT16:
+      return 2;
+    case INT32:
+    case UINT32:
+    case REAL32:
+      return 4;
+    case REAL64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+bool isLittleEndian(void)
+{
+  const uint16 value = 1;
+  return *reinterpret_cast<const uint8*>(&value) == 1;
+}
+
+bool hasSuffix(const std::string& name, const char* suffix)
+{
+  const size_t length = std::strlen(suffix);
+  return name.size() > length && name.compare(name.size() - length, length, suffix) == 0;
+}
+
+class Reader
+{
+public:
+  Reader(void);
+  ~Reader(void);
+  bool open(const std::string& path);
+  void rewind(void);
+  bool read(void* data, size_t size);
+  bool readLine(std::string& line);
+private:
+  bool fill(void);
+  std::FILE* mFile;
+  std::vector<char> mBuffer;
+  size_t mStart;
+  size_t mEnd;
+};
+
+Reader::Reader(void):
+  mFile(NULL),
+  mBuffer(BUFFER_SIZE),
+  mStart(0),
+  mEnd(0)
+{
+}
+
+Reader::~Reader(void)
+{
+  if (mFile)
+    std::fclose(mFile);
+}
+
+bool Reader::open(const std::string& path)
+{
+  mFile = std::fopen(path.c_str(), "rb");
+  return mFile != NULL;
+}
+
+void Reader::rewind(void)
+{
+  std::rewind(mFile);
+  mStart = mEnd = 0;
+}
+
+bool Reader::read(void* data, size_t size)
+{
+  while (mEnd - mStart < size)
+  {
+    if (!fill())
+      return false;
+  }
+
+  std::memcpy(data, &mBuffer[mStart], size);
+  mStart += size;
+  return true;
+}
+
+bool Reader::readLine(std::string& line)
+{
+  line.clear();
+
+  for (;;)
+  {
+    const char* start = &mBuffer[0] + mStart;
+    const char* end = &mBuffer[0] + mEnd;
+    const char* newline = std::find(start, end, '\n');
+
+    line.append(start, newline);
+
+    if (newline != end)
+    {
+      mStart += newline - start + 1;
+      break;
+    }
+
+    mStart = mEnd;
+
+    if (!fill())
+    {
+      if (line.empty())
+	return false;
+
+      break;
+    }
+  }
+
+  if (!line.empty() && line[line.size() - 1] == '\r')
+    line.erase(line.size() - 1);
+
+  return true;
+}
+
+bool Reader::fill(void)
+{
+  // Moves any unread bytes to the start of the buffer and reads more after
+  // them.
+
+  if (mStart)
+  {
+    std::memmove(&mBuffer[0], &mBuffer[mStart], mEnd - mStart);
+    mEnd -= mStart;
+    mStart = 0;
+  }
+
+  const size_t count = std::fread(&mBuffer[mEnd], 1, mBuffer.size() - mEnd, mFile);
+  mEnd += count;
+  return count > 0;
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+class GeometryImport::Target
+{
+public:
+  std::string mName;
+  VNGLayerType mType;
+  GeometryLayer::Stack mStack;
+  unsigned int mOffset;
+  bool mEnabled;
+};
+
+//---------------------------------------------------------------------
+
+class GeometryImport::Batch
+{
+public:
+  Batch(void);
+  size_t getSize(void) const;
+  BaseMesh::VertexList mVertices;
+  BaseMesh::PolygonList mPolygons;
+  std::vector<uint8> mVertexValues;
+  std::vector<uint8> mPolygonValues;
+  size_t mSentVertices;
+  size_t mSentPolygons;
+};
+
+GeometryImport::Batch::Batch(void):
+  mSentVertices(0),
+  mSentPolygons(0)
+{
+}
+
+size_t GeometryImport::Batch::getSize(void) const
+{
+  return mVertices.size() + mPolygons.size();
+}
+
+//---------------------------------------------------------------------
+
+class GeometryImport::Parser
+{
+public:
+  class Property
+  {
+  public:
+    std::string mName;
+    ScalarType mType;
+    ScalarType mCountType;
+    bool mList;
+    PropertyRole mRole;
+    unsigned int mTarget;
+    unsigned int mIndex;
+  };
+  class Element
+  {
+  public:
+    std::string mName;
+    uint32 mCount;
+    ElementKind mKind;
+    std::vector<Property> mProperties;
+  };
+  Parser(void);
+  bool open(const std::string& path);
+  void setTargets(const TargetList& targets, unsigned int vertexStride, unsigned int polygonStride);
+  bool parse(Batch& batch);
+  TargetList mTargets;
+  bool mFailed;
+private:
+  bool readHeader(void);
+  void addTargets(Element& element);
+  bool parsePLY(Batch& batch);
+  bool parseOBJ(Batch& batch);
+  bool readScalar(ScalarType type, real64& value);
+  void storeValue(uint8* record, const Property& property, real64 value) const;
+  void addPolygon(Batch& batch, const std::vector<uint32>& corners, const uint8* record);
+  Reader mReader;
+  bool mPLY;
+  bool mSwap;
+  std::vector<Element> mElements;
+  size_t mElement;
+  uint32 mRemaining;
+  unsigned int mVertexStride;
+  unsigned int mPolygonStride;
+  uint32 mVertexCount;
+  std::vector<uint32> mCorners;
+  std::vector<uint8> mRecord;
+};
+
+GeometryImport::Parser::Parser(void):
+  mFailed(false),
+  mPLY(false),
+  mSwap(false),
+  mElement(0),
+  mRemaining(0),
+  mVertexStride(0),
+  mPolygonStride(0),
+  mVertexCount(0)
+{
+}
+
+bool GeometryImport::Parser::open(const std::string& path)
+{
+  if (!mReader.open(path))
+    return false;
+
+  // PLY files are recognized by their signature. Anything else is parsed as
+  // an OBJ file, which has none.
+
+  char signature[4];
+  if (!mReader.read(signature, sizeof(signature)))
+    return false;
+
+  if (std::memcmp(signature, "ply\n", 4) == 0 || std::memcmp(signature, "ply\r", 4) == 0)
+  {
+    mPLY = true;
+    return readHeader();
+  }
+
+  mReader.rewind();
+  return true;
+}
+
+void GeometryImport::Parser::setTargets(const TargetList& targets, unsigned int vertexStride, unsigned int polygonStride)
+{
+  mTargets = targets;
+  mVertexStride = vertexStride;
+  mPolygonStride = polygonStride;
+
+  for (std::vector<Element>::iterator element = mElements.begin();  element != mElements.end();  element++)
+  {
+    for (std::vector<Property>::iterator property = (*element).mProperties.begin();  property != (*element).mProperties.end();  property++)
+    {
+      if ((*property).mRole == VALUE_ROLE && !mTargets[(*property).mTarget].mEnabled)
+	(*property).mRole = SKIP_ROLE;
+    }
+  }
+}
+
+bool GeometryImport::Parser::parse(Batch& batch)
+{
+  if (mPLY)
+    return parsePLY(batch);
+  else
+    return parseOBJ(batch);
+}
+
+bool GeometryImport::Parser::readHeader(void)
+{
+  std::string line;
+
+  while (mReader.readLine(line))
+  {
+    char first[64], second[64], third[64], fourth[64];
+    unsigned int count;
+
+    if (line == "end_header")
+    {
+      for (std::vector<Element>::iterator element = mElements.begin();  element != mElements.end();  element++)
+	addTargets(*element);
+
+      mRemaining = mElements.empty() ? 0 : mElements.front().mCount;
+      return true;
+    }
+
+    if (std::sscanf(line.c_str(), "format %63s", first) == 1)
+    {
+      if (std::strcmp(first, "binary_little_endian") == 0)
+	mSwap = !isLittleEndian();
+      else if (std::strcmp(first, "binary_big_endian") == 0)
+	mSwap = isLittleEndian();
+      else
+	return false;
+    }
+    else if (std::sscanf(line.c_str(), "element %63s %u", first, &count) == 2)
+    {
+      mElements.push_back(Element());
+
+      Element& element = mElements.back();
+      element.mName = first;
+      element.mCount = count;
+
+      if (element.mName == "vertex")
+	element.mKind = VERTEX_ELEMENT;
+      else if (element.mName == "face")
+	element.mKind = FACE_ELEMENT;
+      else
+	element.mKind = OTHER_ELEMENT;
+    }
+    else if (std::sscanf(line.c_str(), "property list %63s %63s %63s", first, second, third) == 3)
+    {
+      if (mElements.empty())
+	return false;
+
+      Property property;
+      property.mName = third;
+      property.mCountType = getScalarType(first);
+      property.mType = getScalarType(second);
+      property.mList = true;
+      property.mRole = SKIP_ROLE;
+
+      if (property.mCountType == INVALID_SCALAR || property.mType == INVALID_SCALAR)
+	return false;
+
+      if (mElements.back().mKind == FACE_ELEMENT &&
+          (property.mName == "vertex_indices" || property.mName == "vertex_index"))
+      {
+	property.mRole = INDICES_ROLE;
+      }
+
+      mElements.back().mProperties.push_back(property);
+    }
+    else if (std::sscanf(line.c_str(), "property %63s %63s %63s", first, second, fourth) == 2)
+    {
+      if (mElements.empty())
+	return false;
+
+      Property property;
+      property.mName = second;
+      property.mType = getScalarType(first);
+      property.mCountType = INVALID_SCALAR;
+      property.mList = false;
+      property.mRole = SKIP_ROLE;
+
+      if (property.mType == INVALID_SCALAR)
+	return false;
+
+      mElements.back().mProperties.push_back(property);
+    }
+  }
+
+  return false;
+}
+
+void GeometryImport::Parser::addTargets(Element& element)
+{
+  // Properties sharing a name apart from the suffixes of an XYZ or corner
+  // layer become a single target, while all other scalar properties become a
+  // target each.
+
+  static const char* const xyz[] = { "_x", "_y", "_z" };
+  static const char* const corners[] = { "_0", "_1", "_2", "_3" };
+
+  if (element.mKind == OTHER_ELEMENT)
+    return;
+
+  std::vector<Property>& properties = element.mProperties;
+
+  for (size_t i = 0;  i < properties.size();  i++)
+  {
+    Property& property = properties[i];
+
+    if (property.mList)
+      continue;
+
+    if (element.mKind == VERTEX_ELEMENT)
+    {
+      if (property.mName == "x" || property.mName == "y" || property.mName == "z")
+      {
+	property.mRole = POSITION_ROLE;
+	property.mIndex = property.mName[0] - 'x';
+	continue;
+      }
+    }
+
+    const char* const* suffixes = NULL;
+    unsigned int count = 1;
+
+    if (element.mKind == VERTEX_ELEMENT && hasSuffix(property.mName, xyz[0]))
+    {
+      suffixes = xyz;
+      count = 3;
+    }
+    else if (element.mKind == FACE_ELEMENT && hasSuffix(property.mName, corners[0]))
+    {
+      suffixes = corners;
+      count = 4;
+    }
+
+    const std::string base = property.mName.substr(0, property.mName.size() - (suffixes ? 2 : 0));
+
+    if (suffixes)
+    {
+      for (unsigned int j = 1;  j < count;  j++)
+      {
+	if (i + j >= properties.size() ||
+	    properties[i + j].mList ||
+	    properties[i + j].mName != base + suffixes[j])
+	{
+	  suffixes = NULL;
+	  count = 1;
+	  break;
+	}
+      }
+    }
+
+    Target target;
+    target.mName = suffixes ? base : property.mName;
+    target.mOffset = 0;
+    target.mEnabled = true;
+
+    const bool real = property.mType == REAL32 || property.mType == REAL64;
+
+    if (element.mKind == VERTEX_ELEMENT)
+    {
+      target.mStack = GeometryLayer::VERTEX;
+
+      if (count == 3)
+	target.mType = VN_G_LAYER_VERTEX_XYZ;
+      else if (real)
+	target.mType = VN_G_LAYER_VERTEX_REAL;
+      else
+	target.mType = VN_G_LAYER_VERTEX_UINT32;
+    }
+    else
+    {
+      target.mStack = GeometryLayer::POLYGON;
+
+      if (count == 4)
+	target.mType = real ? VN_G_LAYER_POLYGON_CORNER_REAL : VN_G_LAYER_POLYGON_CORNER_UINT32;
+      else if (real)
+	target.mType = VN_G_LAYER_POLYGON_FACE_REAL;
+      else if (property.mType == INT8 || property.mType == UINT8)
+	target.mType = VN_G_LAYER_POLYGON_FACE_UINT8;
+      else
+	target.mType = VN_G_LAYER_POLYGON_FACE_UINT32;
+    }
+
+    for (unsigned int j = 0;  j < count;  j++)
+    {
+      properties[i + j].mRole = VALUE_ROLE;
+      properties[i + j].mTarget = mTargets.size();
+      properties[i + j].mIndex = j;
+    }
+
+    mTargets.push_back(target);
+    i += count - 1;
+  }
+}
+
+bool GeometryImport::Parser::parsePLY(Batch& batch)
+{
+  BaseVertex vertex;
+
+  while (batch.getSize() < BATCH_SIZE)
+  {
+    while (!mRemaining)
+    {
+      if (++mElement >= mElements.size())
+	return false;
+
+      mRemaining = mElements[mElement].mCount;
+    }
+
+    const Element& element = mElements[mElement];
+
+    // Coordinates and values missing from an element are read as zero.
+
+    if (element.mKind == VERTEX_ELEMENT)
+    {
+      vertex.set(0.0, 0.0, 0.0);
+      mRecord.assign(mVertexStride, 0);
+    }
+    else if (element.mKind == FACE_ELEMENT)
+      mRecord.assign(mPolygonStride, 0);
+
+    mCorners.clear();
+
+    for (std::vector<Property>::const_iterator property = element.mProperties.begin();  property != element.mProperties.end();  property++)
+    {
+      real64 value;
+
+      if ((*property).mList)
+      {
+	if (!readScalar((*property).mCountType, value) || value < 0.0)
+	{
+	  mFailed = true;
+	  return false;
+	}
+
+	const uint32 count = (uint32) value;
+
+	for (uint32 i = 0;  i < count;  i++)
+	{
+	  if (!readScalar((*property).mType, value))
+	  {
+	    mFailed = true;
+	    return false;
+	  }
+
+	  if ((*property).mRole == INDICES_ROLE)
+	    mCorners.push_back(value < 0.0 ? INVALID_VERTEX_ID : (uint32) value);
+	}
+      }
+      else
+      {
+	if (!readScalar((*property).mType, value))
+	{
+	  mFailed = true;
+	  return false;
+	}
+
+	if ((*property).mRole == POSITION_ROLE)
+	  (&vertex.x)[(*property).mIndex] = value;
+	else if ((*property).mRole == VALUE_ROLE)
+	  storeValue(mRecord.empty() ? NULL : &mRecord[0], *property, value);
+      }
+    }
+
+    if (element.mKind == VERTEX_ELEMENT)
+    {
+      batch.mVertices.push_back(vertex);
+      batch.mVertexValues.insert(batch.mVertexValues.end(), mRecord.begin(), mRecord.end());
+    }
+    else if (element.mKind == FACE_ELEMENT)
+      addPolygon(batch, mCorners, mRecord.empty() ? NULL : &mRecord[0]);
+
+    mRemaining--;
+  }
+
+  return true;
+}
+
+bool GeometryImport::Parser::parseOBJ(Batch& batch)
+{
+  std::string line;
+
+  while (batch.getSize() < BATCH_SIZE)
+  {
+    if (!mReader.readLine(line))
+      return false;
+
+    if (line.size() < 2 || (line[1] != ' ' && line[1] != '\t'))
+      continue;
+
+    const char* start = line.c_str() + 2;
+    char* end;
+
+    if (line[0] == 'v')
+    {
+      BaseVertex vertex;
+      vertex.x = std::strtod(start, &end);
+      vertex.y = std::strtod(end, &end);
+      vertex.z = std::strtod(end, &end);
+
+      batch.mVertices.push_back(vertex);
+      mVertexCount++;
+    }
+    else if (line[0] == 'f')
+    {
+      // Each corner may have texture coordinate and normal indices after its
+      // vertex index, which are ignored. Negative indices are relative to the
+      // latest vertex.
+
+      mCorners.clear();
+
+      for (;;)
+      {
+	const long index = std::strtol(start, &end, 10);
+	if (end == start)
+	  break;
+
+	if (index > 0)
+	  mCorners.push_back((uint32) (index - 1));
+	else if (index < 0 && (uint32) -index <= mVertexCount)
+	  mCorners.push_back(mVertexCount + index);
+	else
+	  mCorners.push_back(INVALID_VERTEX_ID);
+
+	start = end;
+	while (*start && *start != ' ' && *start != '\t')
+	  start++;
+      }
+
+      addPolygon(batch, mCorners, NULL);
+    }
+  }
+
+  return true;
+}
+
+bool GeometryImport::Parser::readScalar(ScalarType type, real64& value)
+{
+  uint8 data[8];
+  const size_t size = getScalarSize(type);
+
+  if (!mReader.read(data, size))
+    return false;
+
+  if (mSwap)
+    std::reverse(data, data + size);
+
+  switch (type)
+  {
+    case INT8:
+      value = *reinterpret_cast<const int8*>(data);
+      break;
+    case UINT8:
+      value = *reinterpret_cast<const uint8*>(data);
+      break;
+    case INT16:
+      value = *reinterpret_cast<const int16*>(data);
+      break;
+    case UINT16:
+      value = *reinterpret_cast<const uint16*>(data);
+      break;
+    case INT32:
+      value = *reinterpret_cast<const int32*>(data);
+      break;
+    case UINT32:
+      value = *reinterpret_cast<const uint32*>(data);
+      break;
+    case REAL32:
+      value = *reinterpret_cast<const real32*>(data);
+      break;
+    case REAL64:
+      value = *reinterpret_cast<const real64*>(data);
+      break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+void GeometryImport::Parser::storeValue(uint8* record, const Property& property, real64 value) const
+{
+  const Target& target = mTargets[property.mTarget];
+  uint8* slot = record + target.mOffset;
+
+  switch (target.mType)
+  {
+    case VN_G_LAYER_VERTEX_XYZ:
+    case VN_G_LAYER_VERTEX_REAL:
+    case VN_G_LAYER_POLYGON_CORNER_REAL:
+    case VN_G_LAYER_POLYGON_FACE_REAL:
+    {
+      std::memcpy(slot + property.mIndex * sizeof(real64), &value, sizeof(real64));
+      break;
+    }
+
+    case VN_G_LAYER_VERTEX_UINT32:
+    case VN_G_LAYER_POLYGON_CORNER_UINT32:
+    case VN_G_LAYER_POLYGON_FACE_UINT32:
+    {
+      const uint32 result = (uint32) std::max(0.0, std::min(value, 4294967295.0));
+      std::memcpy(slot + property.mIndex * sizeof(uint32), &result, sizeof(uint32));
+      break;
+    }
+
+    case VN_G_LAYER_POLYGON_FACE_UINT8:
+    {
+      *slot = (uint8) std::max(0.0, std::min(value, 255.0));
+      break;
+    }
+  }
+}
+
+void GeometryImport::Parser::addPolygon(Batch& batch, const std::vector<uint32>& corners, const uint8* record)
+{
+  // Polygons with more than four corners are split into a fan of triangles,
+  // each of which gets the same layer values.
+
+  if (corners.size() < 3)
+    return;
+
+  if (corners.size() <= 4)
+  {
+    BasePolygon polygon(corners[0], corners[1], corners[2], INVALID_VERTEX_ID);
+    if (corners.size() == 4)
+      polygon.mIndices[3] = corners[3];
+
+    batch.mPolygons.push_back(polygon);
+    if (record)
+      batch.mPolygonValues.insert(batch.mPolygonValues.end(), record, record + mPolygonStride);
+
+    return;
+  }
+
+  for (size_t i = 2;  i < corners.size();  i++)
+  {
+    batch.mPolygons.push_back(BasePolygon(corners[0], corners[i - 1], corners[i], INVALID_VERTEX_ID));
+    if (record)
+      batch.mPolygonValues.insert(batch.mPolygonValues.end(), record, record + mPolygonStride);
+  }
+}
+
+//---------------------------------------------------------------------
+
+class GeometryImport::Job
+{
+public:
+  typedef std::deque<Batch*> BatchQueue;
+  Parser mParser;
+  BatchQueue mQueue;
+  Mutex mMutex;
+  Condition mCondition;
+  std::time_t mStartTime;
+  bool mFinished;
+  bool mCancelled;
+};
+
+//---------------------------------------------------------------------
+
+GeometryImport::GeometryImport(GeometryNode& node):
+  mNode(node),
+  mNextVertexID(0),
+  mNextPolygonID(0),
+  mPolygonCount(0),
+  mBatch(NULL),
+  mJob(NULL),
+  mThread(NULL),
+  mFailed(false)
+{
+}
+
+GeometryImport::~GeometryImport(void)
+{
+  cancel();
+}
+
+bool GeometryImport::start(const std::string& path)
+{
+  if (mJob)
+    return false;
+
+  Job* job = new Job;
+  job->mStartTime = std::time(NULL);
+  job->mFinished = false;
+  job->mCancelled = false;
+
+  if (!job->mParser.open(path))
+  {
+    delete job;
+    return false;
+  }
+
+  // Properties are only imported into existing layers of the right type, or
+  // into new layers created here.
+
+  mTargets = job->mParser.mTargets;
+
+  for (TargetList::iterator target = mTargets.begin();  target != mTargets.end();  target++)
+  {
+    if (GeometryLayer* layer = mNode.getLayerByName((*target).mName))
+    {
+      if (layer->getType() != (*target).mType)
+	(*target).mEnabled = false;
+    }
+    else
+      mNode.createLayer((*target).mName, (*target).mType);
+  }
+
+  // The slots of the enabled targets are packed one after another into a
+  // record per element.
+
+  unsigned int vertexStride = 0;
+  unsigned int polygonStride = 0;
+
+  for (TargetList::iterator target = mTargets.begin();  target != mTargets.end();  target++)
+  {
+    if (!(*target).mEnabled)
+      continue;
+
+    const unsigned int size = GeometryLayer::getTypeSize((*target).mType);
+
+    if ((*target).mStack == GeometryLayer::VERTEX)
+    {
+      (*target).mOffset = vertexStride;
+      vertexStride += size;
+    }
+    else
+    {
+      (*target).mOffset = polygonStride;
+      polygonStride += size;
+    }
+  }
+
+  job->mParser.setTargets(mTargets, vertexStride, polygonStride);
+
+  mVertexIDs.clear();
+  mNextVertexID = 0;
+  mNextPolygonID = 0;
+  mPolygonCount = 0;
+  mFailed = false;
+
+  mJob = job;
+
+  // Without a worker thread, the file is parsed a batch at a time by update
+  // instead.
+
+  mThread = Thread::create(run, mJob);
+  return true;
+}
+
+bool GeometryImport::update(uint32 maxCommands)
+{
+  if (!mJob)
+    return true;
+
+  // Nothing is sent until every layer to import into exists, so that the
+  // values of each element are sent along with it.
+
+  std::vector<GeometryLayer*> layers(mTargets.size(), (GeometryLayer*) NULL);
+  bool missing = false;
+
+  for (size_t i = 0;  i < mTargets.size();  i++)
+  {
+    if (!mTargets[i].mEnabled)
+      continue;
+
+    layers[i] = mNode.getLayerByName(mTargets[i].mName);
+    if (!layers[i])
+    {
+      missing = true;
+      continue;
+    }
+
+    if (layers[i]->getType() != mTargets[i].mType)
+      layers[i] = NULL;
+  }
+
+  if (missing)
+  {
+    // A layer that has not appeared by now was most likely refused by the
+    // server. Its values are dropped so that the import, and the parser
+    // waiting on the full queue, can go on.
+
+    if (std::difftime(std::time(NULL), mJob->mStartTime) < LAYER_TIMEOUT)
+      return false;
+
+    for (size_t i = 0;  i < mTargets.size();  i++)
+    {
+      if (mTargets[i].mEnabled && !mNode.getLayerByName(mTargets[i].mName))
+      {
+	mTargets[i].mEnabled = false;
+	mFailed = true;
+      }
+    }
+  }
+
+  uint32 budget = maxCommands;
+  bool finished = false;
+
+  mNode.getSession().push();
+
+  while (budget)
+  {
+    if (!mBatch)
+    {
+      if (!mThread && !mJob->mFinished)
+      {
+	Batch* batch = new Batch;
+	mJob->mFinished = !mJob->mParser.parse(*batch);
+	mJob->mQueue.push_back(batch);
+      }
+
+      mJob->mMutex.lock();
+
+      if (!mJob->mQueue.empty())
+      {
+	mBatch = mJob->mQueue.front();
+	mJob->mQueue.pop_front();
+	mJob->mCondition.signal();
+      }
+      else
+	finished = mJob->mFinished;
+
+      mJob->mMutex.unlock();
+
+      if (!mBatch)
+	break;
+    }
+
+    if (!sendBatch(*mBatch, layers, budget))
+      break;
+
+    delete mBatch;
+    mBatch = NULL;
+  }
+
+  mNode.getSession().pop();
+
+  if (!finished)
+    return false;
+
+  finish();
+  return true;
+}
+
+void GeometryImport::cancel(void)
+{
+  if (!mJob)
+    return;
+
+  mJob->mMutex.lock();
+  mJob->mCancelled = true;
+  mJob->mCondition.signal();
+  mJob->mMutex.unlock();
+
+  finish();
+}
+
+bool GeometryImport::isPending(void) const
+{
+  return mJob != NULL;
+}
+
+bool GeometryImport::isFailed(void) const
+{
+  return mFailed;
+}
+
+uint32 GeometryImport::getVertexCount(void) const
+{
+  return mVertexIDs.size();
+}
+
+uint32 GeometryImport::getPolygonCount(void) const
+{
+  return mPolygonCount;
+}
+
+GeometryNode& GeometryImport::getNode(void) const
+{
+  return mNode;
+}
+
+bool GeometryImport::sendBatch(Batch& batch, const std::vector<GeometryLayer*>& layers, uint32& budget)
+{
+  // Each element is sent whole, along with those of its layer values that
+  // differ from the current ones, so the budget may be slightly exceeded.
+  // The slots are read directly, as the new elements aren't valid until the
+  // server has echoed them.
+
+  uint8 current[sizeof(real64) * 4];
+
+  while (batch.mSentVertices < batch.mVertices.size())
+  {
+    if (!budget)
+      return false;
+
+    const size_t index = batch.mSentVertices++;
+
+    while (mNode.isVertex(mNextVertexID))
+      mNextVertexID++;
+
+    const uint32 vertexID = mNextVertexID++;
+    uint32 count = 1;
+
+    mNode.setBaseVertex(vertexID, batch.mVertices[index]);
+    mVertexIDs.push_back(vertexID);
+
+    const size_t stride = batch.mVertexValues.size() / batch.mVertices.size();
+
+    for (size_t i = 0;  i < mTargets.size();  i++)
+    {
+      if (!layers[i] || mTargets[i].mStack != GeometryLayer::VERTEX)
+	continue;
+
+      const uint8* value = &batch.mVertexValues[index * stride + mTargets[i].mOffset];
+
+      layers[i]->readSlot(vertexID, current);
+      if (std::memcmp(current, value, layers[i]->getSlotSize()) != 0)
+      {
+	layers[i]->setSlot(vertexID, value);
+	count++;
+      }
+    }
+
+    budget -= std::min(budget, count);
+  }
+
+  while (batch.mSentPolygons < batch.mPolygons.size())
+  {
+    if (!budget)
+      return false;
+
+    const size_t index = batch.mSentPolygons++;
+
+    BasePolygon polygon = batch.mPolygons[index];
+    bool valid = true;
+
+    for (unsigned int i = 0;  i < 4;  i++)
+    {
+      if (i == 3 && polygon.mIndices[i] == INVALID_VERTEX_ID)
+	break;
+
+      if (polygon.mIndices[i] >= mVertexIDs.size())
+      {
+	valid = false;
+	break;
+      }
+
+      polygon.mIndices[i] = mVertexIDs[polygon.mIndices[i]];
+    }
+
+    if (!valid)
+    {
+      mFailed = true;
+      continue;
+    }
+
+    while (mNode.isPolygon(mNextPolygonID))
+      mNextPolygonID++;
+
+    const uint32 polygonID = mNextPolygonID++;
+    uint32 count = 1;
+
+    mNode.setBasePolygon(polygonID, polygon);
+    mPolygonCount++;
+
+    const size_t stride = batch.mPolygonValues.size() / batch.mPolygons.size();
+
+    for (size_t i = 0;  i < mTargets.size();  i++)
+    {
+      if (!layers[i] || mTargets[i].mStack != GeometryLayer::POLYGON)
+	continue;
+
+      const uint8* value = &batch.mPolygonValues[index * stride + mTargets[i].mOffset];
+
+      layers[i]->readSlot(polygonID, current);
+      if (std::memcmp(current, value, layers[i]->getSlotSize()) != 0)
+      {
+	layers[i]->setSlot(polygonID, value);
+	count++;
+      }
+    }
+
+    budget -= std::min(budget, count);
+  }
+
+  return true;
+}
+
+void GeometryImport::finish(void)
+{
+  delete mThread;
+  mThread = NULL;
+
+  while (!mJob->mQueue.empty())
+  {
+    delete mJob->mQueue.front();
+    mJob->mQueue.pop_front();
+  }
+
+  delete mBatch;
+  mBatch = NULL;
+
+  if (mJob->mParser.mFailed)
+    mFailed = true;
+
+  delete mJob;
+  mJob = NULL;
+}
+
+void GeometryImport::run(void* data)
+{
+  Job& job = *reinterpret_cast<Job*>(data);
+
+  for (;;)
+  {
+    Batch* batch = new Batch;
+    const bool more = job.mParser.parse(*batch);
+
+    job.mMutex.lock();
+
+    while (job.mQueue.size() >= QUEUE_SIZE && !job.mCancelled)
+      job.mCondition.wait(job.mMutex);
+
+    if (job.mCancelled)
+    {
+      job.mMutex.unlock();
+      delete batch;
+      break;
+    }
+
+    job.mQueue.push_back(batch);
+    job.mFinished = !more;
+
+    job.mMutex.unlock();
+
+    if (!more)
+      break;
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
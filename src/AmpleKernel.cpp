@@ -0,0 +1,1187 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AMPLE_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// Tells whether a slot belongs to a valid vertex or polygon, by looking
+// directly at the base layer of its stack.
+class SlotMask
+{
+public:
+  inline SlotMask(const GeometryLayer::Stack stack, const void* base, size_t count,
+                  const GeometryQuantization* quantization = NULL);
+  inline bool isValid(size_t index) const;
+private:
+  GeometryLayer::Stack mStack;
+  const real64* mVertices;
+  const uint32* mPolygons;
+  const GeometryQuantization* mQuantization;
+  size_t mCount;
+};
+
+inline SlotMask::SlotMask(const GeometryLayer::Stack stack, const void* base, size_t count,
+                          const GeometryQuantization* quantization):
+  mStack(stack),
+  mVertices(reinterpret_cast<const real64*>(base)),
+  mPolygons(reinterpret_cast<const uint32*>(base)),
+  mQuantization(quantization),
+  mCount(count)
+{
+}
+
+inline bool SlotMask::isValid(size_t index) const
+{
+  if (mQuantization)
+    return mQuantization->isVertex(index);
+
+  if (index >= mCount)
+    return false;
+
+  if (mStack == GeometryLayer::VERTEX)
+    return mVertices[index * 3] != V_REAL64_MAX;
+  else
+    return mPolygons[index * 4] != INVALID_VERTEX_ID;
+}
+
+bool isRealType(VNGLayerType type)
+{
+  switch (type)
+  {
+    case VN_G_LAYER_VERTEX_XYZ:
+    case VN_G_LAYER_VERTEX_REAL:
+    case VN_G_LAYER_POLYGON_CORNER_REAL:
+    case VN_G_LAYER_POLYGON_FACE_REAL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void compareBytes(const uint8* current, const uint8* previous, size_t slotCount, size_t slotSize, IDRangeSet& slots)
+{
+  const size_t size = slotCount * slotSize;
+  size_t lastSlot = (size_t) -1;
+  size_t offset = 0;
+
+#if AMPLE_USE_SSE2
+  for (;  offset + 16 <= size;  offset += 16)
+  {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + offset));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + offset));
+
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+    if (mask == 0xffff)
+      continue;
+
+    for (unsigned int i = 0;  i < 16;  i++)
+    {
+      if (mask & (1 << i))
+	continue;
+
+      const size_t slot = (offset + i) / slotSize;
+      if (slot != lastSlot)
+      {
+	slots.addID(slot);
+	lastSlot = slot;
+      }
+    }
+  }
+#endif /*AMPLE_USE_SSE2*/
+
+  for (;  offset < size;  offset++)
+  {
+    if (current[offset] == previous[offset])
+      continue;
+
+    const size_t slot = offset / slotSize;
+    if (slot != lastSlot)
+    {
+      slots.addID(slot);
+      lastSlot = slot;
+    }
+  }
+}
+
+// Number of slots covered by each content hash of a geometry layer.
+const uint32 HASH_CHUNK_SIZE = 1024;
+
+// One round of the 32-bit MurmurHash3 mixing function.
+inline uint32 mixHash(uint32 hash, uint32 value)
+{
+  value *= 0xcc9e2d51;
+  value = (value << 15) | (value >> 17);
+  value *= 0x1b873593;
+
+  hash ^= value;
+  hash = (hash << 13) | (hash >> 19);
+  return hash * 5 + 0xe6546b64;
+}
+
+inline uint32 finishHash(uint32 hash, uint32 length)
+{
+  hash ^= length;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+uint32 hashBytes(const uint8* data, size_t size, uint32 seed)
+{
+  uint32 hash = seed;
+  size_t offset = 0;
+
+  for (;  offset + 4 <= size;  offset += 4)
+  {
+    uint32 value;
+    std::memcpy(&value, data + offset, 4);
+    hash = mixHash(hash, value);
+  }
+
+  if (offset < size)
+  {
+    uint32 value = 0;
+    std::memcpy(&value, data + offset, size - offset);
+    hash = mixHash(hash, value);
+  }
+
+  return finishHash(hash, (uint32) size);
+}
+
+uint32 hashReal(uint32 hash, real64 value)
+{
+  uint32 words[2];
+  std::memcpy(words, &value, sizeof(words));
+
+  hash = mixHash(hash, words[0]);
+  return mixHash(hash, words[1]);
+}
+
+class ChunkHash
+{
+public:
+  const uint8* mData;
+  size_t mSlotSize;
+  size_t mSlotCount;
+  const std::vector<uint32>* mChunks;
+  std::vector<uint32>* mHashes;
+};
+
+}
+
+//---------------------------------------------------------------------
+
+bool GeometryLayer::getValueRange(real64* minimum, real64* maximum) const
+{
+  if (!isRealType(mType))
+    return false;
+
+  const GeometryLayer* base;
+
+  if (mStack == VERTEX)
+    base = mNode.mBaseVertexLayer;
+  else
+    base = mNode.mBasePolygonLayer;
+
+  if (!base)
+    return false;
+
+  const unsigned int elementCount = getTypeElementCount(mType);
+  const size_t count = std::min((size_t) getSlotLimit(), getStoredSlotCount());
+
+  Block expanded;
+  const real64* values = getRealSlots(expanded, 0, count);
+
+  SlotMask mask(mStack, base->mData.getitems(), base->mData.getItemCount(), base->mQuantization);
+
+  real64 lows[4];
+  real64 highs[4];
+  bool found = false;
+
+#if AMPLE_USE_SSE2
+  const real64 huge = std::numeric_limits<real64>::max();
+
+  __m128d lowA = _mm_set1_pd(huge);
+  __m128d lowB = _mm_set1_pd(huge);
+  __m128d highA = _mm_set1_pd(-huge);
+  __m128d highB = _mm_set1_pd(-huge);
+
+  if (elementCount == 1)
+  {
+    // Process pairs of slots, with both lanes holding the same element.
+
+    size_t i = 0;
+
+    for (;  i + 2 <= count;  i += 2)
+    {
+      const bool first = mask.isValid(i);
+      const bool second = mask.isValid(i + 1);
+
+      if (first && second)
+      {
+	const __m128d value = _mm_loadu_pd(values + i);
+	lowA = _mm_min_pd(lowA, value);
+	highA = _mm_max_pd(highA, value);
+	found = true;
+      }
+      else if (first || second)
+      {
+	const __m128d value = _mm_set1_pd(values[first ? i : i + 1]);
+	lowA = _mm_min_pd(lowA, value);
+	highA = _mm_max_pd(highA, value);
+	found = true;
+      }
+    }
+
+    if (i < count && mask.isValid(i))
+    {
+      const __m128d value = _mm_set1_pd(values[i]);
+      lowA = _mm_min_pd(lowA, value);
+      highA = _mm_max_pd(highA, value);
+      found = true;
+    }
+
+    lowA = _mm_min_sd(lowA, _mm_unpackhi_pd(lowA, lowA));
+    highA = _mm_max_sd(highA, _mm_unpackhi_pd(highA, highA));
+  }
+  else
+  {
+    // Elements 0 and 1 go in the first register, elements 2 and 3 in the
+    // second. Lanes beyond the element count are ignored.
+
+    for (size_t i = 0;  i < count;  i++)
+    {
+      if (!mask.isValid(i))
+	continue;
+
+      const real64* slot = values + i * elementCount;
+
+      const __m128d a = _mm_loadu_pd(slot);
+      lowA = _mm_min_pd(lowA, a);
+      highA = _mm_max_pd(highA, a);
+
+      const __m128d b = (elementCount == 4) ? _mm_loadu_pd(slot + 2) : _mm_load_sd(slot + 2);
+      lowB = _mm_min_pd(lowB, b);
+      highB = _mm_max_pd(highB, b);
+
+      found = true;
+    }
+  }
+
+  _mm_storeu_pd(lows, lowA);
+  _mm_storeu_pd(lows + 2, lowB);
+  _mm_storeu_pd(highs, highA);
+  _mm_storeu_pd(highs + 2, highB);
+#else
+  for (unsigned int e = 0;  e < elementCount;  e++)
+  {
+    lows[e] = std::numeric_limits<real64>::max();
+    highs[e] = -std::numeric_limits<real64>::max();
+  }
+
+  for (size_t i = 0;  i < count;  i++)
+  {
+    if (!mask.isValid(i))
+      continue;
+
+    const real64* slot = values + i * elementCount;
+
+    for (unsigned int e = 0;  e < elementCount;  e++)
+    {
+      lows[e] = std::min(lows[e], slot[e]);
+      highs[e] = std::max(highs[e], slot[e]);
+    }
+
+    found = true;
+  }
+#endif /*AMPLE_USE_SSE2*/
+
+  if (!found)
+    return false;
+
+  for (unsigned int e = 0;  e < elementCount;  e++)
+  {
+    minimum[e] = lows[e];
+    maximum[e] = highs[e];
+  }
+
+  return true;
+}
+
+bool GeometryLayer::packSlots(real32* target, uint32 firstID, uint32 count) const
+{
+  if (!isRealType(mType))
+    return false;
+
+  // Compact vertices are dequantized straight into single precision.
+
+  if (mQuantization)
+  {
+    mQuantization->dequantize(target, firstID, count);
+    return true;
+  }
+
+  const unsigned int elementCount = getTypeElementCount(mType);
+
+  size_t stored = 0;
+  if (firstID < mData.getItemCount())
+    stored = std::min((size_t) count, mData.getItemCount() - firstID);
+
+  const real64* source = reinterpret_cast<const real64*>(mData.getitems()) + firstID * elementCount;
+  const size_t total = stored * elementCount;
+  size_t i = 0;
+
+#if AMPLE_USE_SSE2
+  for (;  i + 4 <= total;  i += 4)
+  {
+    const __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(source + i));
+    const __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(source + i + 2));
+    _mm_storeu_ps(target + i, _mm_movelh_ps(low, high));
+  }
+#endif /*AMPLE_USE_SSE2*/
+
+  for (;  i < total;  i++)
+    target[i] = (real32) source[i];
+
+  // Deleted base vertices are zeroed, as in transformSlots, instead of being
+  // left as the marker value rounded to infinity.
+
+  if (mID == BASE_VERTEX_LAYER_ID)
+  {
+    SlotMask mask(mStack, mData.getitems(), mData.getItemCount());
+
+    for (size_t j = 0;  j < stored;  j++)
+    {
+      if (!mask.isValid(firstID + j))
+	target[j * 3] = target[j * 3 + 1] = target[j * 3 + 2] = 0.f;
+    }
+  }
+
+  // Slots beyond the stored range have never been set.
+
+  real32 fill = (real32) mDefaultReal;
+  if (mID == BASE_VERTEX_LAYER_ID)
+    fill = 0.f;
+
+  for (;  i < count * elementCount;  i++)
+    target[i] = fill;
+
+  return true;
+}
+
+bool GeometryLayer::transformSlots(real32* target, const real64* matrix, uint32 firstID, uint32 count) const
+{
+  if (mType != VN_G_LAYER_VERTEX_XYZ || !mNode.mBaseVertexLayer)
+    return false;
+
+  const GeometryLayer* base = mNode.mBaseVertexLayer;
+
+  SlotMask mask(mStack, base->mData.getitems(), base->mData.getItemCount(), base->mQuantization);
+
+  size_t stored = 0;
+  if (firstID < getStoredSlotCount())
+    stored = std::min((size_t) count, getStoredSlotCount() - firstID);
+
+  Block expanded;
+  const real64* source = getRealSlots(expanded, firstID, stored);
+
+#if AMPLE_USE_SSE2
+  // The first register of each pair holds rows 0 and 1 of a column, the
+  // second holds row 2.
+
+  const __m128d c0 = _mm_loadu_pd(matrix);
+  const __m128d c1 = _mm_loadu_pd(matrix + 4);
+  const __m128d c2 = _mm_loadu_pd(matrix + 8);
+  const __m128d c3 = _mm_loadu_pd(matrix + 12);
+  const __m128d d0 = _mm_load_sd(matrix + 2);
+  const __m128d d1 = _mm_load_sd(matrix + 6);
+  const __m128d d2 = _mm_load_sd(matrix + 10);
+  const __m128d d3 = _mm_load_sd(matrix + 14);
+#endif /*AMPLE_USE_SSE2*/
+
+  for (size_t i = 0;  i < stored;  i++)
+  {
+    real32* result = target + i * 3;
+
+    if (!mask.isValid(firstID + i))
+    {
+      result[0] = result[1] = result[2] = 0.f;
+      continue;
+    }
+
+    const real64* point = source + i * 3;
+
+#if AMPLE_USE_SSE2
+    const __m128d x = _mm_set1_pd(point[0]);
+    const __m128d y = _mm_set1_pd(point[1]);
+    const __m128d z = _mm_set1_pd(point[2]);
+
+    __m128d xy = _mm_add_pd(c3, _mm_mul_pd(c0, x));
+    xy = _mm_add_pd(xy, _mm_mul_pd(c1, y));
+    xy = _mm_add_pd(xy, _mm_mul_pd(c2, z));
+
+    __m128d w = _mm_add_sd(d3, _mm_mul_sd(d0, x));
+    w = _mm_add_sd(w, _mm_mul_sd(d1, y));
+    w = _mm_add_sd(w, _mm_mul_sd(d2, z));
+
+    _mm_storel_pi(reinterpret_cast<__m64*>(result), _mm_cvtpd_ps(xy));
+    result[2] = (real32) _mm_cvtsd_f64(w);
+#else
+    for (unsigned int row = 0;  row < 3;  row++)
+    {
+      result[row] = (real32) (matrix[row] * point[0] +
+                              matrix[row + 4] * point[1] +
+                              matrix[row + 8] * point[2] +
+                              matrix[row + 12]);
+    }
+#endif /*AMPLE_USE_SSE2*/
+  }
+
+  for (size_t i = stored * 3;  i < count * 3;  i++)
+    target[i] = 0.f;
+
+  return true;
+}
+
+void GeometryLayer::getSnapshot(Block& snapshot) const
+{
+  if (mQuantization)
+  {
+    const uint32 count = mQuantization->getSlotCount();
+
+    snapshot.setItemSize(sizeof(BaseVertex));
+    snapshot.resize(count);
+
+    if (count)
+      mQuantization->expand(reinterpret_cast<BaseVertex*>(snapshot.getItems()), 0, snapshot.getItemCount());
+  }
+  else
+    snapshot = mData;
+}
+
+void GeometryLayer::compareSnapshot(const Block& snapshot, IDRangeSet& slots) const
+{
+  // Compact vertices are compared at full precision, as the snapshot holds.
+
+  Block expanded;
+  if (mQuantization)
+    getSnapshot(expanded);
+
+  const Block& data = mQuantization ? expanded : mData;
+
+  const size_t limit = std::min((size_t) getSlotLimit(), data.getItemCount());
+
+  if (snapshot.getItemSize() != getSlotSize())
+  {
+    slots.addRange(0, limit);
+    return;
+  }
+
+  const size_t common = std::min(limit, snapshot.getItemCount());
+
+  // A snapshot still sharing the storage of this layer cannot differ from it.
+
+  if (snapshot.getitems() != data.getitems())
+  {
+    compareBytes(reinterpret_cast<const uint8*>(data.getitems()),
+		 reinterpret_cast<const uint8*>(snapshot.getitems()),
+		 common,
+		 getSlotSize(),
+		 slots);
+  }
+
+  if (limit > common)
+    slots.addRange(common, limit - common);
+}
+
+uint32 GeometryLayer::getContentHash(void)
+{
+  // Compact vertices are hashed at full precision, as they read back.
+
+  Block expanded;
+  if (mQuantization)
+    getSnapshot(expanded);
+
+  const Block& data = mQuantization ? expanded : mData;
+
+  const uint32 limit = std::min((size_t) getSlotLimit(), data.getItemCount());
+  const uint32 chunkCount = (limit + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE;
+
+  // Find the chunks touched by changes since the last call, along with the
+  // chunks whose extent changed with the slot limit.
+
+  std::vector<uint32> chunks;
+
+  if (!mHashValid)
+  {
+    for (uint32 i = 0;  i < chunkCount;  i++)
+      chunks.push_back(i);
+  }
+  else
+  {
+    std::vector<bool> dirty(chunkCount, false);
+
+    if (getDataVersion() != mHashVersion)
+    {
+      IDRangeSet slots;
+      getChangedSlots(mHashVersion, slots);
+
+      const IDRangeSet::RangeList& ranges = slots.getRanges();
+      for (IDRangeSet::RangeList::const_iterator r = ranges.begin();  r != ranges.end();  r++)
+      {
+	const uint32 first = (*r).mFirst / HASH_CHUNK_SIZE;
+	const uint32 last = std::min(((*r).getEnd() + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE, chunkCount);
+
+	for (uint32 i = first;  i < last;  i++)
+	  dirty[i] = true;
+      }
+    }
+
+    if (limit != mHashLimit)
+    {
+      for (uint32 i = std::min(limit, mHashLimit) / HASH_CHUNK_SIZE;  i < chunkCount;  i++)
+	dirty[i] = true;
+    }
+
+    for (uint32 i = 0;  i < chunkCount;  i++)
+    {
+      if (dirty[i])
+	chunks.push_back(i);
+    }
+  }
+
+  mChunkHashes.resize(chunkCount);
+
+  ChunkHash job;
+  job.mData = reinterpret_cast<const uint8*>(data.getitems());
+  job.mSlotSize = getSlotSize();
+  job.mSlotCount = limit;
+  job.mChunks = &chunks;
+  job.mHashes = &mChunkHashes;
+
+  Thread::parallelFor(hashChunks, &job, chunks.size(), 16);
+
+  mHashVersion = getDataVersion();
+  mHashLimit = limit;
+  mHashValid = true;
+
+  uint32 hash = mixHash(0, mType);
+  hash = mixHash(hash, mDefaultInt);
+  hash = hashReal(hash, mDefaultReal);
+  hash = mixHash(hash, limit);
+
+  for (HashList::const_iterator i = mChunkHashes.begin();  i != mChunkHashes.end();  i++)
+    hash = mixHash(hash, *i);
+
+  return finishHash(hash, chunkCount);
+}
+
+void GeometryLayer::hashChunks(void* data, uint32 first, uint32 count)
+{
+  const ChunkHash& job = *reinterpret_cast<const ChunkHash*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const uint32 chunk = (*job.mChunks)[i];
+    const size_t firstSlot = chunk * HASH_CHUNK_SIZE;
+    const size_t slotCount = std::min((size_t) HASH_CHUNK_SIZE, job.mSlotCount - firstSlot);
+
+    (*job.mHashes)[chunk] = hashBytes(job.mData + firstSlot * job.mSlotSize,
+                                      slotCount * job.mSlotSize,
+				      chunk);
+  }
+}
+
+uint32 GeometryNode::getContentHash(void)
+{
+  // Layers are visited in ID order, so that the order in which they were
+  // created doesn't matter.
+
+  std::vector<std::pair<VLayerID,GeometryLayer*> > layers;
+
+  for (LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
+    layers.push_back(std::make_pair((*i)->getID(), *i));
+
+  std::sort(layers.begin(), layers.end());
+
+  uint32 hash = 0;
+
+  for (size_t i = 0;  i < layers.size();  i++)
+  {
+    const std::string& name = layers[i].second->getName();
+
+    hash = mixHash(hash, layers[i].first);
+    hash = mixHash(hash, hashBytes(reinterpret_cast<const uint8*>(name.data()), name.size(), 0));
+    hash = mixHash(hash, layers[i].second->getContentHash());
+  }
+
+  hash = mixHash(hash, hashBytes(reinterpret_cast<const uint8*>(mVertexCreases.data()), mVertexCreases.size(), 0));
+  hash = mixHash(hash, mVertexDefaultCrease);
+  hash = mixHash(hash, hashBytes(reinterpret_cast<const uint8*>(mEdgeCreases.data()), mEdgeCreases.size(), 0));
+  hash = mixHash(hash, mEdgeDefaultCrease);
+
+  return finishHash(hash, layers.size());
+}
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+class Skin
+{
+public:
+  const real64* mVertices;
+  size_t mVertexCount;
+  const uint32* mStarts;
+  size_t mStartCount;
+  const uint32* mBones;
+  const real64* mWeights;
+  const real64* mMatrices;
+  size_t mMatrixCount;
+  real32* mTarget;
+  uint32 mFirstID;
+};
+
+} /*namespace*/
+
+bool GeometrySkinning::deform(real32* target, uint32 firstID, uint32 count) const
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  if (!vertexLayer)
+    return false;
+
+  WeightList matrices;
+  getMatrices(matrices);
+
+  // Only the requested range of compact vertices is expanded, so vertices
+  // are addressed relative to the first one.
+
+  size_t stored = 0;
+  if (firstID < vertexLayer->getStoredSlotCount())
+    stored = std::min((size_t) count, vertexLayer->getStoredSlotCount() - firstID);
+
+  Block expanded;
+
+  Skin skin;
+  skin.mVertices = vertexLayer->getRealSlots(expanded, firstID, stored);
+  skin.mVertexCount = stored;
+  skin.mStarts = mStarts.empty() ? NULL : &mStarts[0];
+  skin.mStartCount = mStarts.size();
+  skin.mBones = mBones.empty() ? NULL : &mBones[0];
+  skin.mWeights = mWeights.empty() ? NULL : &mWeights[0];
+  skin.mMatrices = matrices.empty() ? NULL : &matrices[0];
+  skin.mMatrixCount = matrices.size() / 16;
+  skin.mTarget = target;
+  skin.mFirstID = firstID;
+
+  Thread::parallelFor(deformRange, &skin, count, 1024);
+  return true;
+}
+
+void GeometrySkinning::deformRange(void* data, uint32 first, uint32 count)
+{
+  const Skin& skin = *reinterpret_cast<const Skin*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const uint32 vertexID = skin.mFirstID + i;
+    real32* result = skin.mTarget + i * 3;
+
+    if (i >= skin.mVertexCount || skin.mVertices[i * 3] == V_REAL64_MAX)
+    {
+      result[0] = result[1] = result[2] = 0.f;
+      continue;
+    }
+
+    const real64* point = skin.mVertices + i * 3;
+
+    uint32 start = 0, end = 0;
+    if (vertexID + 1 < skin.mStartCount)
+    {
+      start = skin.mStarts[vertexID];
+      end = skin.mStarts[vertexID + 1];
+    }
+
+    // Blend the matrices of the influencing bones and transform the point
+    // once, instead of transforming it once per bone.
+
+#if AMPLE_USE_SSE2
+    // As in transformSlots, the first register of each pair holds rows 0
+    // and 1 of a column, while the second holds rows 2 and 3.
+
+    __m128d c0 = _mm_setzero_pd(), d0 = _mm_setzero_pd();
+    __m128d c1 = _mm_setzero_pd(), d1 = _mm_setzero_pd();
+    __m128d c2 = _mm_setzero_pd(), d2 = _mm_setzero_pd();
+    __m128d c3 = _mm_setzero_pd(), d3 = _mm_setzero_pd();
+    real64 total = 0.0;
+
+    for (uint32 j = start;  j < end;  j++)
+    {
+      if (skin.mBones[j] >= skin.mMatrixCount)
+	continue;
+
+      const real64* matrix = skin.mMatrices + skin.mBones[j] * 16;
+      const __m128d weight = _mm_set1_pd(skin.mWeights[j]);
+
+      c0 = _mm_add_pd(c0, _mm_mul_pd(weight, _mm_loadu_pd(matrix)));
+      d0 = _mm_add_pd(d0, _mm_mul_pd(weight, _mm_loadu_pd(matrix + 2)));
+      c1 = _mm_add_pd(c1, _mm_mul_pd(weight, _mm_loadu_pd(matrix + 4)));
+      d1 = _mm_add_pd(d1, _mm_mul_pd(weight, _mm_loadu_pd(matrix + 6)));
+      c2 = _mm_add_pd(c2, _mm_mul_pd(weight, _mm_loadu_pd(matrix + 8)));
+      d2 = _mm_add_pd(d2, _mm_mul_pd(weight, _mm_loadu_pd(matrix + 10)));
+      c3 = _mm_add_pd(c3, _mm_mul_pd(weight, _mm_loadu_pd(matrix + 12)));
+      d3 = _mm_add_pd(d3, _mm_mul_pd(weight, _mm_loadu_pd(matrix + 14)));
+      total += skin.mWeights[j];
+    }
+
+    if (total == 0.0)
+    {
+      result[0] = (real32) point[0];
+      result[1] = (real32) point[1];
+      result[2] = (real32) point[2];
+      continue;
+    }
+
+    const __m128d x = _mm_set1_pd(point[0]);
+    const __m128d y = _mm_set1_pd(point[1]);
+    const __m128d z = _mm_set1_pd(point[2]);
+
+    __m128d xy = _mm_add_pd(c3, _mm_mul_pd(c0, x));
+    xy = _mm_add_pd(xy, _mm_mul_pd(c1, y));
+    xy = _mm_add_pd(xy, _mm_mul_pd(c2, z));
+
+    __m128d w = _mm_add_sd(d3, _mm_mul_sd(d0, x));
+    w = _mm_add_sd(w, _mm_mul_sd(d1, y));
+    w = _mm_add_sd(w, _mm_mul_sd(d2, z));
+
+    _mm_storel_pi(reinterpret_cast<__m64*>(result), _mm_cvtpd_ps(xy));
+    result[2] = (real32) _mm_cvtsd_f64(w);
+#else
+    real64 blended[12] = { 0.0 };
+    real64 total = 0.0;
+
+    for (uint32 j = start;  j < end;  j++)
+    {
+      if (skin.mBones[j] >= skin.mMatrixCount)
+	continue;
+
+      const real64* matrix = skin.mMatrices + skin.mBones[j] * 16;
+      const real64 weight = skin.mWeights[j];
+
+      for (unsigned int column = 0;  column < 4;  column++)
+      {
+	for (unsigned int row = 0;  row < 3;  row++)
+	  blended[column * 3 + row] += weight * matrix[column * 4 + row];
+      }
+
+      total += weight;
+    }
+
+    if (total == 0.0)
+    {
+      result[0] = (real32) point[0];
+      result[1] = (real32) point[1];
+      result[2] = (real32) point[2];
+      continue;
+    }
+
+    for (unsigned int row = 0;  row < 3;  row++)
+    {
+      result[row] = (real32) (blended[row] * point[0] +
+                              blended[row + 3] * point[1] +
+                              blended[row + 6] * point[2] +
+                              blended[row + 9]);
+    }
+#endif /*AMPLE_USE_SSE2*/
+  }
+}
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+class Quantize
+{
+public:
+  const BaseVertex* mVertices;
+  uint16* mShortCodes;
+  uint32* mWideCodes;
+  uint32 mFirstID;
+  uint32 mInvalidCode;
+  real64 mMinimum[3];
+  real64 mScale[3];
+};
+
+class Expand
+{
+public:
+  const uint16* mShortCodes;
+  const uint32* mWideCodes;
+  uint32 mSlotCount;
+  uint32 mInvalidCode;
+  real64 mMinimum[3];
+  real64 mStep[3];
+  BaseVertex* mTarget;
+  uint32 mFirstID;
+};
+
+class Dequantize
+{
+public:
+  const uint16* mShortCodes;
+  const uint32* mWideCodes;
+  uint32 mSlotCount;
+  uint32 mInvalidCode;
+  real32 mMinimum[3];
+  real32 mStep[3];
+  real32* mTarget;
+  uint32 mFirstID;
+};
+
+class Requantize
+{
+public:
+  uint16* mShortCodes;
+  uint32* mWideCodes;
+  uint32 mInvalidCode;
+  real64 mPreviousMinimum[3];
+  real64 mPreviousStep[3];
+  real64 mMinimum[3];
+  real64 mScale[3];
+};
+
+// Wide codes are 21-bit fields packed into two words, with the second
+// field straddling them.
+
+const uint32 WIDE_CODE_MASK = 0x1fffff;
+
+inline void packWide(const uint32* codes, uint32* words)
+{
+  words[0] = codes[0] | (codes[1] << 21);
+  words[1] = (codes[1] >> 11) | (codes[2] << 10);
+}
+
+inline void unpackWide(const uint32* words, uint32* codes)
+{
+  codes[0] = words[0] & WIDE_CODE_MASK;
+  codes[1] = (words[0] >> 21) | ((words[1] & 0x3ff) << 11);
+  codes[2] = words[1] >> 10;
+}
+
+inline void readCodes(const uint16* shortCodes, const uint32* wideCodes, uint32 vertexID, uint32* codes)
+{
+  if (shortCodes)
+  {
+    codes[0] = shortCodes[vertexID * 3];
+    codes[1] = shortCodes[vertexID * 3 + 1];
+    codes[2] = shortCodes[vertexID * 3 + 2];
+  }
+  else
+    unpackWide(wideCodes + vertexID * 2, codes);
+}
+
+inline void writeCodes(uint16* shortCodes, uint32* wideCodes, uint32 vertexID, const uint32* codes)
+{
+  if (shortCodes)
+  {
+    shortCodes[vertexID * 3] = (uint16) codes[0];
+    shortCodes[vertexID * 3 + 1] = (uint16) codes[1];
+    shortCodes[vertexID * 3 + 2] = (uint16) codes[2];
+  }
+  else
+    packWide(codes, wideCodes + vertexID * 2);
+}
+
+// Values outside the box, including non-finite ones, are clamped to it.
+inline uint32 quantizeValue(real64 value, real64 minimum, real64 scale, uint32 invalidCode)
+{
+  const real64 code = (value - minimum) * scale + 0.5;
+  return (uint32) std::max(0.0, std::min(code, (real64) (invalidCode - 1)));
+}
+
+} /*namespace*/
+
+void GeometryQuantization::dequantize(real32* target, uint32 firstID, uint32 count) const
+{
+  const bool wide = mCodes.getItemSize() != sizeof(uint16) * 3;
+
+  Dequantize job;
+  job.mShortCodes = wide ? NULL : reinterpret_cast<const uint16*>(mCodes.getitems());
+  job.mWideCodes = wide ? reinterpret_cast<const uint32*>(mCodes.getitems()) : NULL;
+  job.mSlotCount = mCodes.getItemCount();
+  job.mInvalidCode = getInvalidCode();
+  job.mTarget = target;
+  job.mFirstID = firstID;
+
+  for (unsigned int axis = 0;  axis < 3;  axis++)
+  {
+    job.mMinimum[axis] = (real32) mBounds.minimum[axis];
+    job.mStep[axis] = (real32) mStep[axis];
+  }
+
+  Thread::parallelFor(dequantizeRange, &job, count, 4096);
+}
+
+void GeometryQuantization::quantize(const BaseVertex* source, uint32 firstID, uint32 count)
+{
+  const bool wide = mCodes.getItemSize() != sizeof(uint16) * 3;
+
+  Quantize job;
+  job.mVertices = source;
+  job.mShortCodes = wide ? NULL : reinterpret_cast<uint16*>(mCodes.getItems());
+  job.mWideCodes = wide ? reinterpret_cast<uint32*>(mCodes.getItems()) : NULL;
+  job.mFirstID = firstID;
+  job.mInvalidCode = getInvalidCode();
+
+  for (unsigned int axis = 0;  axis < 3;  axis++)
+  {
+    job.mMinimum[axis] = mBounds.minimum[axis];
+    job.mScale[axis] = 1.0 / mStep[axis];
+  }
+
+  Thread::parallelFor(quantizeRange, &job, count, 4096);
+}
+
+void GeometryQuantization::expand(BaseVertex* target, uint32 firstID, uint32 count) const
+{
+  const bool wide = mCodes.getItemSize() != sizeof(uint16) * 3;
+
+  Expand job;
+  job.mShortCodes = wide ? NULL : reinterpret_cast<const uint16*>(mCodes.getitems());
+  job.mWideCodes = wide ? reinterpret_cast<const uint32*>(mCodes.getitems()) : NULL;
+  job.mSlotCount = mCodes.getItemCount();
+  job.mInvalidCode = getInvalidCode();
+  job.mTarget = target;
+  job.mFirstID = firstID;
+
+  for (unsigned int axis = 0;  axis < 3;  axis++)
+  {
+    job.mMinimum[axis] = mBounds.minimum[axis];
+    job.mStep[axis] = mStep[axis];
+  }
+
+  Thread::parallelFor(expandRange, &job, count, 4096);
+}
+
+void GeometryQuantization::grow(const Box3d& bounds)
+{
+  const Box3d previousBounds = mBounds;
+  const Vector3d previousStep = mStep;
+
+  setBounds(bounds);
+
+  // Nothing can have been quantized within an empty box.
+
+  if (previousBounds.isEmpty())
+    return;
+
+  const bool wide = mCodes.getItemSize() != sizeof(uint16) * 3;
+
+  Requantize job;
+  job.mShortCodes = wide ? NULL : reinterpret_cast<uint16*>(mCodes.getItems());
+  job.mWideCodes = wide ? reinterpret_cast<uint32*>(mCodes.getItems()) : NULL;
+  job.mInvalidCode = getInvalidCode();
+
+  for (unsigned int axis = 0;  axis < 3;  axis++)
+  {
+    job.mPreviousMinimum[axis] = previousBounds.minimum[axis];
+    job.mPreviousStep[axis] = previousStep[axis];
+    job.mMinimum[axis] = mBounds.minimum[axis];
+    job.mScale[axis] = 1.0 / mStep[axis];
+  }
+
+  Thread::parallelFor(requantizeRange, &job, mCodes.getItemCount(), 4096);
+}
+
+void GeometryQuantization::quantizeRange(void* data, uint32 first, uint32 count)
+{
+  const Quantize& job = *reinterpret_cast<const Quantize*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const BaseVertex& vertex = job.mVertices[i];
+
+    uint32 codes[3];
+
+    if (vertex.isValid())
+    {
+      codes[0] = quantizeValue(vertex.x, job.mMinimum[0], job.mScale[0], job.mInvalidCode);
+      codes[1] = quantizeValue(vertex.y, job.mMinimum[1], job.mScale[1], job.mInvalidCode);
+      codes[2] = quantizeValue(vertex.z, job.mMinimum[2], job.mScale[2], job.mInvalidCode);
+    }
+    else
+      codes[0] = codes[1] = codes[2] = job.mInvalidCode;
+
+    writeCodes(job.mShortCodes, job.mWideCodes, job.mFirstID + i, codes);
+  }
+}
+
+void GeometryQuantization::expandRange(void* data, uint32 first, uint32 count)
+{
+  const Expand& job = *reinterpret_cast<const Expand*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const uint32 vertexID = job.mFirstID + i;
+    BaseVertex& vertex = job.mTarget[i];
+
+    if (vertexID >= job.mSlotCount)
+    {
+      vertex.setInvalid();
+      continue;
+    }
+
+    uint32 codes[3];
+    readCodes(job.mShortCodes, job.mWideCodes, vertexID, codes);
+
+    if (codes[0] == job.mInvalidCode)
+    {
+      vertex.setInvalid();
+      continue;
+    }
+
+    vertex.x = job.mMinimum[0] + codes[0] * job.mStep[0];
+    vertex.y = job.mMinimum[1] + codes[1] * job.mStep[1];
+    vertex.z = job.mMinimum[2] + codes[2] * job.mStep[2];
+  }
+}
+
+void GeometryQuantization::dequantizeRange(void* data, uint32 first, uint32 count)
+{
+  const Dequantize& job = *reinterpret_cast<const Dequantize*>(data);
+
+  const uint32 end = first + count;
+  uint32 i = first;
+
+#if AMPLE_USE_SSE2
+  // Four vertices make twelve coordinates, or three full registers. The
+  // step and minimum are rotated to match the axis of each lane.
+
+  const real32* s = job.mStep;
+  const real32* m = job.mMinimum;
+
+  const __m128 step0 = _mm_setr_ps(s[0], s[1], s[2], s[0]);
+  const __m128 step1 = _mm_setr_ps(s[1], s[2], s[0], s[1]);
+  const __m128 step2 = _mm_setr_ps(s[2], s[0], s[1], s[2]);
+  const __m128 minimum0 = _mm_setr_ps(m[0], m[1], m[2], m[0]);
+  const __m128 minimum1 = _mm_setr_ps(m[1], m[2], m[0], m[1]);
+  const __m128 minimum2 = _mm_setr_ps(m[2], m[0], m[1], m[2]);
+
+  for (;  i + 4 <= end && job.mFirstID + i + 4 <= job.mSlotCount;  i += 4)
+  {
+    const uint32 vertexID = job.mFirstID + i;
+
+    __m128i codes0, codes1, codes2;
+    uint32 codes[12];
+
+    if (job.mShortCodes)
+    {
+      const uint16* source = job.mShortCodes + vertexID * 3;
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+      const __m128i high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + 8));
+
+      codes0 = _mm_unpacklo_epi16(low, zero);
+      codes1 = _mm_unpackhi_epi16(low, zero);
+      codes2 = _mm_unpacklo_epi16(high, zero);
+
+      for (unsigned int j = 0;  j < 4;  j++)
+	codes[j * 3] = source[j * 3];
+    }
+    else
+    {
+      for (unsigned int j = 0;  j < 4;  j++)
+	unpackWide(job.mWideCodes + (vertexID + j) * 2, codes + j * 3);
+
+      codes0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes));
+      codes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + 4));
+      codes2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + 8));
+    }
+
+    real32* result = job.mTarget + i * 3;
+
+    _mm_storeu_ps(result, _mm_add_ps(minimum0, _mm_mul_ps(_mm_cvtepi32_ps(codes0), step0)));
+    _mm_storeu_ps(result + 4, _mm_add_ps(minimum1, _mm_mul_ps(_mm_cvtepi32_ps(codes1), step1)));
+    _mm_storeu_ps(result + 8, _mm_add_ps(minimum2, _mm_mul_ps(_mm_cvtepi32_ps(codes2), step2)));
+
+    for (unsigned int j = 0;  j < 4;  j++)
+    {
+      if (codes[j * 3] == job.mInvalidCode)
+	result[j * 3] = result[j * 3 + 1] = result[j * 3 + 2] = 0.f;
+    }
+  }
+#endif /*AMPLE_USE_SSE2*/
+
+  for (;  i < end;  i++)
+  {
+    const uint32 vertexID = job.mFirstID + i;
+    real32* result = job.mTarget + i * 3;
+
+    uint32 codes[3];
+
+    if (vertexID < job.mSlotCount)
+      readCodes(job.mShortCodes, job.mWideCodes, vertexID, codes);
+
+    if (vertexID >= job.mSlotCount || codes[0] == job.mInvalidCode)
+    {
+      result[0] = result[1] = result[2] = 0.f;
+      continue;
+    }
+
+    for (unsigned int axis = 0;  axis < 3;  axis++)
+      result[axis] = job.mMinimum[axis] + (real32) codes[axis] * job.mStep[axis];
+  }
+}
+
+void GeometryQuantization::requantizeRange(void* data, uint32 first, uint32 count)
+{
+  const Requantize& job = *reinterpret_cast<const Requantize*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    uint32 codes[3];
+    readCodes(job.mShortCodes, job.mWideCodes, i, codes);
+
+    if (codes[0] == job.mInvalidCode)
+      continue;
+
+    for (unsigned int axis = 0;  axis < 3;  axis++)
+    {
+      const real64 value = job.mPreviousMinimum[axis] + codes[axis] * job.mPreviousStep[axis];
+      codes[axis] = quantizeValue(value, job.mMinimum[axis], job.mScale[axis], job.mInvalidCode);
+    }
+
+    writeCodes(job.mShortCodes, job.mWideCodes, i, codes);
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
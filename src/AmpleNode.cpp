@@ -147,6 +147,10 @@ Node::~Node(void)
   }
 }
 
+void Node::update(void)
+{
+}
+
 void Node::initialize(void)
 {
   TagGroup::initialize();
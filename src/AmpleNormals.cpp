@@ -0,0 +1,485 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// Vertices with more corners than this always get smooth corner normals.
+const unsigned int MAX_CREASE_VALENCE = 32;
+
+const Vector3d ZERO_NORMAL(0.0, 0.0, 0.0);
+
+Vector3d normalize(const Vector3d& vector)
+{
+  const real64 length = sqrt(vector.lengthSquared());
+  if (length == 0.0)
+    return ZERO_NORMAL;
+
+  return vector / length;
+}
+
+}
+
+//---------------------------------------------------------------------
+
+const Vector3d& GeometryNormals::getFaceNormal(uint32 polygonID) const
+{
+  if (polygonID >= mFaceNormals.size())
+    return ZERO_NORMAL;
+
+  return mFaceNormals[polygonID];
+}
+
+const Vector3d& GeometryNormals::getVertexNormal(uint32 vertexID) const
+{
+  if (vertexID >= mVertexNormals.size())
+    return ZERO_NORMAL;
+
+  return mVertexNormals[vertexID];
+}
+
+const Vector3d& GeometryNormals::getCornerNormal(uint32 polygonID, unsigned int corner) const
+{
+  if (corner >= 4 || polygonID >= mFaceNormals.size())
+    return ZERO_NORMAL;
+
+  return mCornerNormals[polygonID * 4 + corner];
+}
+
+uint32 GeometryNormals::getHardCreaseThreshold(void) const
+{
+  return mThreshold;
+}
+
+void GeometryNormals::setHardCreaseThreshold(uint32 threshold)
+{
+  if (threshold != mThreshold)
+  {
+    mThreshold = threshold;
+    mThresholdChanged = true;
+  }
+}
+
+GeometryNode& GeometryNormals::getNode(void) const
+{
+  return mNode;
+}
+
+GeometryNormals::GeometryNormals(GeometryNode& node):
+  mNode(node),
+  mVertices(NULL),
+  mPolygons(NULL),
+  mCreases(NULL),
+  mCreaseCount(0),
+  mDefaultCrease(0),
+  mVertexCount(0),
+  mPolygonCount(0),
+  mThreshold(0xffffffff),
+  mThresholdChanged(false),
+  mCreaseLayer(NULL),
+  mNodeVersion(0),
+  mStructureVersion(0),
+  mVertexVersion(0),
+  mPolygonVersion(0),
+  mCreaseVersion(0),
+  mValid(false)
+{
+}
+
+void GeometryNormals::update(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (!vertexLayer || !polygonLayer)
+  {
+    mFaceAreas.clear();
+    mFaceNormals.clear();
+    mVertexNormals.clear();
+    mCornerNormals.clear();
+    mIncidenceStarts.clear();
+    mIncidence.clear();
+    mValid = false;
+    return;
+  }
+
+  const GeometryLayer* creaseLayer = mNode.getEdgeCreaseLayer();
+
+  // Anything but moved vertices changes the topology or the hard edges, and
+  // requires a full rebuild.
+
+  bool full = !mValid ||
+              mThresholdChanged ||
+              creaseLayer != mCreaseLayer ||
+              mNode.getDataVersion() != mNodeVersion ||
+              vertexLayer->getStructureVersion() != mStructureVersion ||
+	      polygonLayer->getDataVersion() != mPolygonVersion ||
+	      (creaseLayer && creaseLayer->getDataVersion() != mCreaseVersion);
+
+  IDRangeSet vertices;
+
+  if (!full && vertexLayer->getDataVersion() != mVertexVersion)
+  {
+    if (!vertexLayer->getChangedSlots(mVertexVersion, vertices))
+      full = true;
+    else if (vertices.getIDCount() > mVertexCount / 4)
+      full = true;
+  }
+
+  // The snapshot expands compact vertices, and is only kept until the
+  // normals are up to date, so that it never holds on to shared storage.
+
+  vertexLayer->getSnapshot(mVertexData);
+
+  mVertices = reinterpret_cast<const BaseVertex*>(mVertexData.getitems());
+  mPolygons = reinterpret_cast<const BasePolygon*>(polygonLayer->mData.getitems());
+
+  if (creaseLayer)
+  {
+    const CornerUint32View creases(*creaseLayer);
+    mCreases = creases.getElements();
+    mCreaseCount = creases.getSlotCount();
+    mDefaultCrease = creaseLayer->getDefaultInt();
+  }
+  else
+  {
+    mCreases = NULL;
+    mCreaseCount = 0;
+    mDefaultCrease = mNode.getEdgeDefaultCrease();
+  }
+
+  if (full)
+    rebuild();
+  else if (!vertices.isEmpty())
+    refresh(vertices);
+
+  mCreaseLayer = creaseLayer;
+  mNodeVersion = mNode.getDataVersion();
+  mStructureVersion = vertexLayer->getStructureVersion();
+  mVertexVersion = vertexLayer->getDataVersion();
+  mPolygonVersion = polygonLayer->getDataVersion();
+  if (creaseLayer)
+    mCreaseVersion = creaseLayer->getDataVersion();
+  mThresholdChanged = false;
+  mValid = true;
+
+  mVertexData.release();
+}
+
+void GeometryNormals::rebuild(void)
+{
+  mVertexCount = mNode.getHighestVertexID();
+  if (mVertexCount == INVALID_VERTEX_ID)
+    mVertexCount = 0;
+  else
+    mVertexCount++;
+
+  mPolygonCount = mNode.getHighestPolygonID();
+  if (mPolygonCount == INVALID_POLYGON_ID)
+    mPolygonCount = 0;
+  else
+    mPolygonCount++;
+
+  mFaceAreas.assign(mPolygonCount, ZERO_NORMAL);
+  mFaceNormals.assign(mPolygonCount, ZERO_NORMAL);
+  mCornerNormals.assign(mPolygonCount * 4, ZERO_NORMAL);
+  mVertexNormals.assign(mVertexCount, ZERO_NORMAL);
+
+  buildIncidence();
+
+  mFaceQueue.clear();
+  for (uint32 polygonID = 0;  polygonID < mPolygonCount;  polygonID++)
+  {
+    if (getCornerCount(polygonID))
+      mFaceQueue.push_back(polygonID);
+  }
+
+  mVertexQueue.clear();
+  for (uint32 vertexID = 0;  vertexID < mVertexCount;  vertexID++)
+  {
+    if (mVertices[vertexID].isValid())
+      mVertexQueue.push_back(vertexID);
+  }
+
+  computeFaces();
+  computeVertices();
+}
+
+void GeometryNormals::refresh(const IDRangeSet& vertices)
+{
+  // Recompute the faces around the moved vertices, then the normals of
+  // every vertex of those faces.
+
+  mFaceQueue.clear();
+
+  const IDRangeSet::RangeList& ranges = vertices.getRanges();
+  for (IDRangeSet::RangeList::const_iterator i = ranges.begin();  i != ranges.end();  i++)
+  {
+    const uint32 end = std::min((*i).getEnd(), mVertexCount);
+
+    for (uint32 vertexID = (*i).mFirst;  vertexID < end;  vertexID++)
+    {
+      for (uint32 k = mIncidenceStarts[vertexID];  k < mIncidenceStarts[vertexID + 1];  k++)
+	mFaceQueue.push_back(mIncidence[k] / 4);
+    }
+  }
+
+  std::sort(mFaceQueue.begin(), mFaceQueue.end());
+  mFaceQueue.erase(std::unique(mFaceQueue.begin(), mFaceQueue.end()), mFaceQueue.end());
+
+  mVertexQueue.clear();
+
+  for (IDList::const_iterator i = mFaceQueue.begin();  i != mFaceQueue.end();  i++)
+  {
+    const unsigned int cornerCount = getCornerCount(*i);
+
+    for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+      mVertexQueue.push_back(mPolygons[*i].mIndices[corner]);
+  }
+
+  std::sort(mVertexQueue.begin(), mVertexQueue.end());
+  mVertexQueue.erase(std::unique(mVertexQueue.begin(), mVertexQueue.end()), mVertexQueue.end());
+
+  computeFaces();
+  computeVertices();
+}
+
+void GeometryNormals::buildIncidence(void)
+{
+  // Build a compact list of the polygon corners using each vertex, with
+  // corners encoded as polygon ID * 4 + corner index.
+
+  mIncidenceStarts.assign(mVertexCount + 1, 0);
+
+  for (uint32 polygonID = 0;  polygonID < mPolygonCount;  polygonID++)
+  {
+    const unsigned int cornerCount = getCornerCount(polygonID);
+
+    for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+      mIncidenceStarts[mPolygons[polygonID].mIndices[corner] + 1]++;
+  }
+
+  for (uint32 vertexID = 0;  vertexID < mVertexCount;  vertexID++)
+    mIncidenceStarts[vertexID + 1] += mIncidenceStarts[vertexID];
+
+  mIncidence.resize(mIncidenceStarts[mVertexCount]);
+
+  IDList positions(mIncidenceStarts.begin(), mIncidenceStarts.end() - 1);
+
+  for (uint32 polygonID = 0;  polygonID < mPolygonCount;  polygonID++)
+  {
+    const unsigned int cornerCount = getCornerCount(polygonID);
+
+    for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+      mIncidence[positions[mPolygons[polygonID].mIndices[corner]]++] = polygonID * 4 + corner;
+  }
+}
+
+void GeometryNormals::computeFaces(void)
+{
+  Thread::parallelFor(computeFaceRange, this, mFaceQueue.size(), 512);
+}
+
+void GeometryNormals::computeVertices(void)
+{
+  Thread::parallelFor(computeVertexRange, this, mVertexQueue.size(), 512);
+}
+
+unsigned int GeometryNormals::getCornerCount(uint32 polygonID) const
+{
+  if (polygonID >= mPolygonCount)
+    return 0;
+
+  const BasePolygon& polygon = mPolygons[polygonID];
+
+  for (unsigned int i = 0;  i < 3;  i++)
+  {
+    const uint32 vertexID = polygon.mIndices[i];
+    if (vertexID >= mVertexCount || !mVertices[vertexID].isValid())
+      return 0;
+  }
+
+  const uint32 vertexID = polygon.mIndices[3];
+  if (vertexID >= mVertexCount || !mVertices[vertexID].isValid())
+    return 3;
+
+  return 4;
+}
+
+uint32 GeometryNormals::getCrease(uint32 polygonID, unsigned int corner) const
+{
+  // The crease of corner i applies to the edge from corner i to corner i + 1.
+
+  if (!mCreases || polygonID >= mCreaseCount)
+    return mDefaultCrease;
+
+  return mCreases[polygonID * 4 + corner];
+}
+
+void GeometryNormals::computeFaceRange(void* data, uint32 first, uint32 count)
+{
+  GeometryNormals& normals = *reinterpret_cast<GeometryNormals*>(data);
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const uint32 polygonID = normals.mFaceQueue[i];
+    const BasePolygon& polygon = normals.mPolygons[polygonID];
+    const BaseVertex* vertices = normals.mVertices;
+
+    const BaseVertex& a = vertices[polygon.mIndices[0]];
+    const BaseVertex& b = vertices[polygon.mIndices[1]];
+    const BaseVertex& c = vertices[polygon.mIndices[2]];
+
+    // The length of the cross product is twice the area of the polygon,
+    // which is what vertex normals are weighted by.
+
+    Vector3d area;
+
+    if (normals.getCornerCount(polygonID) == 4)
+    {
+      const BaseVertex& d = vertices[polygon.mIndices[3]];
+
+      const Vector3d first(c.x - a.x, c.y - a.y, c.z - a.z);
+      const Vector3d second(d.x - b.x, d.y - b.y, d.z - b.z);
+      area = first.crossProduct(second);
+    }
+    else
+    {
+      const Vector3d first(b.x - a.x, b.y - a.y, b.z - a.z);
+      const Vector3d second(c.x - a.x, c.y - a.y, c.z - a.z);
+      area = first.crossProduct(second);
+    }
+
+    normals.mFaceAreas[polygonID] = area;
+    normals.mFaceNormals[polygonID] = normalize(area);
+  }
+}
+
+void GeometryNormals::computeVertexRange(void* data, uint32 first, uint32 count)
+{
+  GeometryNormals& normals = *reinterpret_cast<GeometryNormals*>(data);
+
+  const IDList& incidence = normals.mIncidence;
+  const uint32 threshold = normals.mThreshold;
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    const uint32 vertexID = normals.mVertexQueue[i];
+    const uint32 start = normals.mIncidenceStarts[vertexID];
+    const uint32 end = normals.mIncidenceStarts[vertexID + 1];
+
+    Vector3d sum(0.0, 0.0, 0.0);
+    bool hard = false;
+
+    for (uint32 k = start;  k < end;  k++)
+    {
+      const uint32 polygonID = incidence[k] / 4;
+      const unsigned int corner = incidence[k] % 4;
+      const unsigned int cornerCount = normals.getCornerCount(polygonID);
+
+      sum += normals.mFaceAreas[polygonID];
+
+      if (normals.getCrease(polygonID, corner) >= threshold ||
+          normals.getCrease(polygonID, (corner + cornerCount - 1) % cornerCount) >= threshold)
+	hard = true;
+    }
+
+    const Vector3d smooth = normalize(sum);
+    normals.mVertexNormals[vertexID] = smooth;
+
+    if (!hard || end - start > MAX_CREASE_VALENCE)
+    {
+      for (uint32 k = start;  k < end;  k++)
+	normals.mCornerNormals[incidence[k]] = smooth;
+
+      continue;
+    }
+
+    // Group the corners around this vertex into fans of faces connected
+    // through smooth edges, identified by the vertex at the far end.
+
+    const unsigned int cornerCount = end - start;
+
+    uint32 labels[MAX_CREASE_VALENCE];
+    uint32 nexts[MAX_CREASE_VALENCE];
+    uint32 previous[MAX_CREASE_VALENCE];
+    bool nextHard[MAX_CREASE_VALENCE];
+    bool previousHard[MAX_CREASE_VALENCE];
+
+    for (unsigned int j = 0;  j < cornerCount;  j++)
+    {
+      const uint32 polygonID = incidence[start + j] / 4;
+      const unsigned int corner = incidence[start + j] % 4;
+      const unsigned int polygonSize = normals.getCornerCount(polygonID);
+      const unsigned int prior = (corner + polygonSize - 1) % polygonSize;
+      const BasePolygon& polygon = normals.mPolygons[polygonID];
+
+      labels[j] = j;
+      nexts[j] = polygon.mIndices[(corner + 1) % polygonSize];
+      previous[j] = polygon.mIndices[prior];
+      nextHard[j] = normals.getCrease(polygonID, corner) >= threshold;
+      previousHard[j] = normals.getCrease(polygonID, prior) >= threshold;
+    }
+
+    bool changed = true;
+
+    while (changed)
+    {
+      changed = false;
+
+      for (unsigned int a = 0;  a < cornerCount;  a++)
+      {
+	for (unsigned int b = a + 1;  b < cornerCount;  b++)
+	{
+	  if (labels[a] == labels[b])
+	    continue;
+
+	  const bool connected =
+	    (!nextHard[a] && ((nexts[a] == previous[b] && !previousHard[b]) ||
+	                      (nexts[a] == nexts[b] && !nextHard[b]))) ||
+	    (!previousHard[a] && ((previous[a] == nexts[b] && !nextHard[b]) ||
+	                          (previous[a] == previous[b] && !previousHard[b])));
+
+	  if (connected)
+	  {
+	    labels[a] = labels[b] = std::min(labels[a], labels[b]);
+	    changed = true;
+	  }
+	}
+      }
+    }
+
+    for (unsigned int a = 0;  a < cornerCount;  a++)
+    {
+      Vector3d group(0.0, 0.0, 0.0);
+
+      for (unsigned int b = 0;  b < cornerCount;  b++)
+      {
+	if (labels[b] == labels[a])
+	  group += normals.mFaceAreas[incidence[start + b] / 4];
+      }
+
+      normals.mCornerNormals[incidence[start + a]] = normalize(group);
+    }
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
@@ -778,8 +778,17 @@ void ObjectNode::setScale(const Vector3d& scale)
 }
 
 ObjectNode::ObjectNode(VNodeID ID, VNodeOwner owner, Session& session):
-  Node(ID, V_NT_OBJECT, owner, session)
+  Node(ID, V_NT_OBJECT, owner, session),
+  mStagedTranslationFields(0),
+  mStagedRotationFields(0),
+  mStagedScaleField(false),
+  mReplaying(false)
 {
+  mTranslation.mPosition.set(0.0, 0.0, 0.0);
+  mTranslationCache.mPosition = mTranslation.mPosition;
+  mRotation.mRotation.set(0.0, 0.0, 0.0, 1.0);
+  mRotationCache.mRotation = mRotation.mRotation;
+  mScale.set(1.0, 1.0, 1.0);
 }
 
 ObjectNode::~ObjectNode(void)
@@ -797,6 +806,54 @@ ObjectNode::~ObjectNode(void)
   }
 }
 
+void ObjectNode::update(void)
+{
+  // Replay the staged transform values through the regular receive path.
+
+  mReplaying = true;
+
+  if (mStagedTranslationFields)
+  {
+    const Translation& staged = mStagedTranslation;
+
+    real64 position[3] = { staged.mPosition.x, staged.mPosition.y, staged.mPosition.z };
+    real64 speed[3] = { staged.mSpeed.x, staged.mSpeed.y, staged.mSpeed.z };
+    real64 accel[3] = { staged.mAccel.x, staged.mAccel.y, staged.mAccel.z };
+    real64 dragNormal[3] = { staged.mDragNormal.x, staged.mDragNormal.y, staged.mDragNormal.z };
+
+    receiveTransformPosReal64(NULL, getID(), staged.mSeconds, staged.mFraction,
+                              (mStagedTranslationFields & STAGED_VALUE) ? position : NULL,
+                              (mStagedTranslationFields & STAGED_SPEED) ? speed : NULL,
+                              (mStagedTranslationFields & STAGED_ACCEL) ? accel : NULL,
+                              (mStagedTranslationFields & STAGED_DRAG) ? dragNormal : NULL,
+                              staged.mDrag);
+
+    mStagedTranslationFields = 0;
+  }
+
+  if (mStagedRotationFields)
+  {
+    const Rotation& staged = mStagedRotation;
+
+    receiveTransformRotReal64(NULL, getID(), staged.mSeconds, staged.mFraction,
+                              (mStagedRotationFields & STAGED_VALUE) ? &staged.mRotation : NULL,
+                              (mStagedRotationFields & STAGED_SPEED) ? &staged.mSpeed : NULL,
+                              (mStagedRotationFields & STAGED_ACCEL) ? &staged.mAccel : NULL,
+                              (mStagedRotationFields & STAGED_DRAG) ? &staged.mDragNormal : NULL,
+                              staged.mDrag);
+
+    mStagedRotationFields = 0;
+  }
+
+  if (mStagedScaleField)
+  {
+    receiveTransformScaleReal64(NULL, getID(), mStagedScale.x, mStagedScale.y, mStagedScale.z);
+    mStagedScaleField = false;
+  }
+
+  mReplaying = false;
+}
+
 void ObjectNode::sendTranslation(void)
 {
   getSession().push();
@@ -915,6 +972,44 @@ void ObjectNode::receiveTransformPosReal64(void* user,
   if (!node)
     return;
 
+  if (session->isCoalescing() && !node->mReplaying)
+  {
+    // Merge with any previously staged translation, keeping the latest
+    // value of each field.
+
+    Translation& staged = node->mStagedTranslation;
+
+    if (position)
+    {
+      staged.mPosition.set(position[0], position[1], position[2]);
+      node->mStagedTranslationFields |= STAGED_VALUE;
+    }
+
+    if (speed)
+    {
+      staged.mSpeed.set(speed[0], speed[1], speed[2]);
+      node->mStagedTranslationFields |= STAGED_SPEED;
+    }
+
+    if (accel)
+    {
+      staged.mAccel.set(accel[0], accel[1], accel[2]);
+      node->mStagedTranslationFields |= STAGED_ACCEL;
+    }
+
+    if (dragNormal)
+    {
+      staged.mDragNormal.set(dragNormal[0], dragNormal[1], dragNormal[2]);
+      staged.mDrag = drag;
+      node->mStagedTranslationFields |= STAGED_DRAG;
+    }
+
+    staged.mSeconds = seconds;
+    staged.mFraction = fraction;
+    node->mStagedTranslationFields |= STAGED_TIME;
+    return;
+  }
+
   // TODO: Add observer notifications.
 
   if (position)
@@ -972,6 +1067,44 @@ void ObjectNode::receiveTransformRotReal64(void* user,
   if (!node)
     return;
 
+  if (session->isCoalescing() && !node->mReplaying)
+  {
+    // Merge with any previously staged rotation, keeping the latest
+    // value of each field.
+
+    Rotation& staged = node->mStagedRotation;
+
+    if (rotation)
+    {
+      staged.mRotation = *rotation;
+      node->mStagedRotationFields |= STAGED_VALUE;
+    }
+
+    if (speed)
+    {
+      staged.mSpeed = *speed;
+      node->mStagedRotationFields |= STAGED_SPEED;
+    }
+
+    if (accel)
+    {
+      staged.mAccel = *accel;
+      node->mStagedRotationFields |= STAGED_ACCEL;
+    }
+
+    if (dragNormal)
+    {
+      staged.mDragNormal = *dragNormal;
+      staged.mDrag = drag;
+      node->mStagedRotationFields |= STAGED_DRAG;
+    }
+
+    staged.mSeconds = seconds;
+    staged.mFraction = fraction;
+    node->mStagedRotationFields |= STAGED_TIME;
+    return;
+  }
+
   // TODO: Add observer notifications.
 
   if (rotation)
@@ -1027,6 +1160,13 @@ void ObjectNode::receiveTransformScaleReal64(void* user,
 
   Vector3d scale(scaleX, scaleY, scaleZ);
 
+  if (session->isCoalescing() && !node->mReplaying)
+  {
+    node->mStagedScale = scale;
+    node->mStagedScaleField = true;
+    return;
+  }
+
   const ObserverList& observers = node->getObservers();
   for (ObserverList::const_iterator i = observers.begin();  i != observers.end();  i++)
   {
@@ -0,0 +1,204 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+const unsigned int MIN_BITS = 2;
+const unsigned int MAX_BITS = 21;
+const unsigned int MAX_SHORT_BITS = 16;
+
+// Fraction of the largest extent of the box added on each side when the
+// box grows to take in a vertex outside it. Growing by a good margin keeps
+// the number of times all vertices are requantized low.
+const real64 GROWTH_PADDING = 1.0 / 4.0;
+
+// Fraction of the largest extent added on each side of the box fitted to
+// the vertices of a layer when it is first made compact.
+const real64 FIT_PADDING = 1.0 / 16.0;
+
+// Smallest padding, keeping boxes around a single vertex or a flat set of
+// vertices from getting a zero step.
+const real64 MIN_PADDING = 1e-6;
+
+const uint32 WIDE_CODE_MASK = 0x1fffff;
+
+bool isFinite(real64 value)
+{
+  return value - value == 0.0;
+}
+
+Box3d padBounds(const Box3d& bounds, real64 fraction)
+{
+  // All axes are padded by the same amount, so that flat nodes get the
+  // same precision across their thin axis as along the others.
+
+  const Vector3d size = bounds.getSize();
+
+  real64 padding = std::max(size.x, std::max(size.y, size.z)) * fraction;
+  padding = std::max(padding, MIN_PADDING);
+
+  const Vector3d offset(padding, padding, padding);
+  return Box3d(bounds.minimum - offset, bounds.maximum + offset);
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+bool GeometryQuantization::isVertex(uint32 vertexID) const
+{
+  if (vertexID >= mCodes.getItemCount())
+    return false;
+
+  if (mBits <= MAX_SHORT_BITS)
+    return *reinterpret_cast<const uint16*>(mCodes.getItem(vertexID)) != getInvalidCode();
+  else
+    return (*reinterpret_cast<const uint32*>(mCodes.getItem(vertexID)) & WIDE_CODE_MASK) != getInvalidCode();
+}
+
+bool GeometryQuantization::getVertex(uint32 vertexID, BaseVertex& vertex) const
+{
+  if (!isVertex(vertexID))
+    return false;
+
+  expand(&vertex, vertexID, 1);
+  return true;
+}
+
+uint32 GeometryQuantization::getSlotCount(void) const
+{
+  return mCodes.getItemCount();
+}
+
+unsigned int GeometryQuantization::getBits(void) const
+{
+  return mBits;
+}
+
+const Box3d& GeometryQuantization::getBounds(void) const
+{
+  return mBounds;
+}
+
+const Vector3d& GeometryQuantization::getStep(void) const
+{
+  return mStep;
+}
+
+size_t GeometryQuantization::getSize(void) const
+{
+  return mCodes.getItemCount() * mCodes.getItemSize();
+}
+
+GeometryQuantization::GeometryQuantization(unsigned int bits):
+  mBits(std::max(MIN_BITS, std::min(bits, MAX_BITS))),
+  mStep(0.0, 0.0, 0.0)
+{
+  if (mBits <= MAX_SHORT_BITS)
+    mCodes.setItemSize(sizeof(uint16) * 3);
+  else
+    mCodes.setItemSize(sizeof(uint32) * 2);
+
+  mCodes.setGranularity(1024);
+  mBounds.setEmpty();
+}
+
+void GeometryQuantization::resize(size_t slotCount)
+{
+  const size_t previous = mCodes.getItemCount();
+
+  if (slotCount)
+    mCodes.resize(slotCount);
+  else
+    mCodes.release();
+
+  // New slots start out empty. The block may have rounded the count up.
+
+  if (mCodes.getItemCount() > previous)
+  {
+    BaseVertex empty;
+    empty.setInvalid();
+    quantize(&empty, previous, 1);
+
+    for (size_t i = previous + 1;  i < mCodes.getItemCount();  i++)
+      std::memcpy(mCodes.getItem(i), mCodes.getItem(previous), mCodes.getItemSize());
+  }
+}
+
+bool GeometryQuantization::setVertex(uint32 vertexID, const BaseVertex& vertex)
+{
+  bool grown = false;
+
+  if (vertex.isValid() && isFinite(vertex.x) && isFinite(vertex.y) && isFinite(vertex.z))
+  {
+    const Vector3d point(vertex.x, vertex.y, vertex.z);
+
+    if (mBounds.isEmpty() || !mBounds.contains(point))
+    {
+      Box3d bounds = mBounds;
+      bounds.envelop(point);
+      grow(padBounds(bounds, GROWTH_PADDING));
+      grown = true;
+    }
+  }
+
+  quantize(&vertex, vertexID, 1);
+  return grown;
+}
+
+void GeometryQuantization::fit(const BaseVertex* vertices, size_t count)
+{
+  // The initial box fits the vertices with a small margin, so that later
+  // edits rarely need it to grow.
+
+  Box3d bounds;
+  bounds.setEmpty();
+
+  for (size_t i = 0;  i < count;  i++)
+  {
+    const BaseVertex& vertex = vertices[i];
+
+    if (vertex.isValid() && isFinite(vertex.x) && isFinite(vertex.y) && isFinite(vertex.z))
+      bounds.envelop(Vector3d(vertex.x, vertex.y, vertex.z));
+  }
+
+  if (!bounds.isEmpty())
+    setBounds(padBounds(bounds, FIT_PADDING));
+}
+
+void GeometryQuantization::setBounds(const Box3d& bounds)
+{
+  // The largest code is reserved for empty slots.
+
+  mBounds = bounds;
+  mStep = mBounds.getSize() / (real64) (getInvalidCode() - 1);
+}
+
+uint32 GeometryQuantization::getInvalidCode(void) const
+{
+  return (1 << mBits) - 1;
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
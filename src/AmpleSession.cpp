@@ -129,6 +129,16 @@ const std::string& Session::getAddress(void) const
   return mAddress;
 }
 
+bool Session::isCoalescing(void) const
+{
+  return mCoalescing;
+}
+
+void Session::setCoalescing(bool enabled)
+{
+  mCoalescing = enabled;
+}
+
 Session* Session::create(const std::string& address,
                          const std::string& username,
 			 const std::string& password,
@@ -213,6 +223,11 @@ void Session::update(uint32 microseconds)
       {
         (*session)->push();
         verse_callback_update(microseconds);
+
+        NodeList& nodes = (*session)->mNodes;
+        for (NodeList::iterator node = nodes.begin();  node != nodes.end();  node++)
+          (*node)->update();
+
         (*session)->pop();
       }
 
@@ -263,7 +278,8 @@ Session::Session(const std::string& address, const std::string& username, VSessi
   mUserName(username),
   mInternal(internal),
   mAvatarID(0xffffffff),
-  mState(CONNECTING)
+  mState(CONNECTING),
+  mCoalescing(false)
 {
   msSessions.push_back(this);
 }
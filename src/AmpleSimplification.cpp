@@ -0,0 +1,787 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <queue>
+#include <cmath>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+typedef std::vector<uint32> IndexList;
+
+// Weight of the planes added along boundary edges, relative to the planes
+// of the faces, to keep open borders from shrinking.
+const real64 BOUNDARY_WEIGHT = 1000.0;
+
+// Symmetric 4x4 matrix of a quadric error metric, stored as its upper
+// triangle.
+class Quadric
+{
+public:
+  Quadric(void);
+  void addPlane(const Vector3d& normal, real64 distance, real64 weight);
+  real64 evaluate(const Vector3d& point) const;
+  bool solve(Vector3d& point) const;
+  Quadric& operator += (const Quadric& other);
+  real64 m[10];
+};
+
+Quadric::Quadric(void)
+{
+  std::fill(m, m + 10, 0.0);
+}
+
+void Quadric::addPlane(const Vector3d& normal, real64 distance, real64 weight)
+{
+  const real64 a = normal.x, b = normal.y, c = normal.z, d = distance;
+
+  m[0] += weight * a * a;
+  m[1] += weight * a * b;
+  m[2] += weight * a * c;
+  m[3] += weight * a * d;
+  m[4] += weight * b * b;
+  m[5] += weight * b * c;
+  m[6] += weight * b * d;
+  m[7] += weight * c * c;
+  m[8] += weight * c * d;
+  m[9] += weight * d * d;
+}
+
+real64 Quadric::evaluate(const Vector3d& p) const
+{
+  return m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x +
+         m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y +
+         m[7] * p.z * p.z + 2.0 * m[8] * p.z +
+         m[9];
+}
+
+bool Quadric::solve(Vector3d& point) const
+{
+  // Find the point of least error by solving the 3x3 system with Cramer's
+  // rule, giving up if it is close to singular.
+
+  const real64 a = m[0], b = m[1], c = m[2], e = m[4], f = m[5], h = m[7];
+
+  const real64 det = a * (e * h - f * f) - b * (b * h - f * c) + c * (b * f - e * c);
+
+  const real64 scale = std::fabs(a) + std::fabs(e) + std::fabs(h);
+  if (std::fabs(det) <= 1e-12 * scale * scale * scale || scale == 0.0)
+    return false;
+
+  const real64 x = -m[3], y = -m[6], z = -m[8];
+
+  point.set((x * (e * h - f * f) - b * (y * h - f * z) + c * (y * f - e * z)) / det,
+            (a * (y * h - z * f) - x * (b * h - f * c) + c * (b * z - y * c)) / det,
+            (a * (e * z - f * y) - b * (b * z - y * c) + x * (b * f - e * c)) / det);
+  return true;
+}
+
+Quadric& Quadric::operator += (const Quadric& other)
+{
+  for (unsigned int i = 0;  i < 10;  i++)
+    m[i] += other.m[i];
+
+  return *this;
+}
+
+class Collapse
+{
+public:
+  bool operator < (const Collapse& other) const;
+  real64 mCost;
+  uint32 mVertices[2];
+  uint32 mStamps[2];
+  Vector3d mTarget;
+};
+
+bool Collapse::operator < (const Collapse& other) const
+{
+  // Inverted, so that the queue yields the cheapest collapse first.
+  return mCost > other.mCost;
+}
+
+inline Vector3d getNormal(const Vector3d& p0, const Vector3d& p1, const Vector3d& p2)
+{
+  const Vector3d u = p1 - p0;
+  const Vector3d v = p2 - p0;
+
+  return Vector3d(u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x);
+}
+
+inline real64 dot(const Vector3d& a, const Vector3d& b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Edge collapse simplifier working on a triangulated copy of a base mesh.
+class Simplifier
+{
+public:
+  Simplifier(const BaseMesh& mesh);
+  bool reduce(size_t target, Mutex& mutex, const bool& cancelled);
+  void getMesh(BaseMesh& mesh) const;
+  size_t getTriangleCount(void) const;
+private:
+  void addCollapse(uint32 first, uint32 second);
+  bool isStale(const Collapse& collapse) const;
+  bool isAllowed(const Collapse& collapse) const;
+  bool flips(uint32 vertex, uint32 other, const Vector3d& target) const;
+  void apply(const Collapse& collapse);
+  std::vector<Vector3d> mPoints;
+  std::vector<Quadric> mQuadrics;
+  IndexList mStamps;
+  IndexList mTriangles;
+  std::vector<bool> mRemoved;
+  std::vector<IndexList> mVertexTriangles;
+  std::priority_queue<Collapse> mQueue;
+  std::vector<Collapse> mDeferred;
+  size_t mTriangleCount;
+};
+
+Simplifier::Simplifier(const BaseMesh& mesh):
+  mTriangleCount(0)
+{
+  const uint32 vertexCount = mesh.mVertices.size();
+
+  mPoints.resize(vertexCount);
+  for (uint32 i = 0;  i < vertexCount;  i++)
+    mPoints[i].set(mesh.mVertices[i].x, mesh.mVertices[i].y, mesh.mVertices[i].z);
+
+  for (BaseMesh::PolygonList::const_iterator p = mesh.mPolygons.begin();  p != mesh.mPolygons.end();  p++)
+  {
+    const uint32* indices = (*p).mIndices;
+
+    mTriangles.push_back(indices[0]);
+    mTriangles.push_back(indices[1]);
+    mTriangles.push_back(indices[2]);
+
+    if (indices[3] != INVALID_VERTEX_ID)
+    {
+      mTriangles.push_back(indices[0]);
+      mTriangles.push_back(indices[2]);
+      mTriangles.push_back(indices[3]);
+    }
+  }
+
+  mTriangleCount = mTriangles.size() / 3;
+  mRemoved.assign(mTriangleCount, false);
+  mQuadrics.resize(vertexCount);
+  mStamps.assign(vertexCount, 0);
+  mVertexTriangles.resize(vertexCount);
+
+  // Each vertex starts with the area-weighted planes of its triangles.
+
+  std::vector<std::pair<uint32,uint32> > edges;
+
+  for (uint32 t = 0;  t < mTriangleCount;  t++)
+  {
+    const uint32* indices = &mTriangles[t * 3];
+
+    Vector3d normal = getNormal(mPoints[indices[0]], mPoints[indices[1]], mPoints[indices[2]]);
+    const real64 length = std::sqrt(dot(normal, normal));
+
+    if (length > 0.0)
+    {
+      normal = normal / length;
+
+      Quadric quadric;
+      quadric.addPlane(normal, -dot(normal, mPoints[indices[0]]), length / 2.0);
+
+      for (unsigned int i = 0;  i < 3;  i++)
+	mQuadrics[indices[i]] += quadric;
+    }
+
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      mVertexTriangles[indices[i]].push_back(t);
+
+      const uint32 a = indices[i];
+      const uint32 b = indices[(i + 1) % 3];
+      edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    }
+  }
+
+  // Edges used by a single triangle get a plane through them, perpendicular
+  // to that triangle, to hold the boundary in place.
+
+  std::vector<std::pair<uint32,uint32> > sorted(edges);
+  std::sort(sorted.begin(), sorted.end());
+
+  for (uint32 t = 0;  t < mTriangleCount;  t++)
+  {
+    const uint32* indices = &mTriangles[t * 3];
+
+    const Vector3d normal = getNormal(mPoints[indices[0]], mPoints[indices[1]], mPoints[indices[2]]);
+
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      const std::pair<uint32,uint32>& edge = edges[t * 3 + i];
+
+      const size_t uses = std::upper_bound(sorted.begin(), sorted.end(), edge) -
+                          std::lower_bound(sorted.begin(), sorted.end(), edge);
+      if (uses != 1)
+	continue;
+
+      const Vector3d& p0 = mPoints[indices[i]];
+      const Vector3d& p1 = mPoints[indices[(i + 1) % 3]];
+      const Vector3d side = p1 - p0;
+
+      Vector3d perpendicular(side.y * normal.z - side.z * normal.y,
+                             side.z * normal.x - side.x * normal.z,
+                             side.x * normal.y - side.y * normal.x);
+
+      const real64 length = std::sqrt(dot(perpendicular, perpendicular));
+      if (length == 0.0)
+	continue;
+
+      perpendicular = perpendicular / length;
+
+      Quadric quadric;
+      quadric.addPlane(perpendicular, -dot(perpendicular, p0), BOUNDARY_WEIGHT * dot(side, side));
+
+      mQuadrics[edge.first] += quadric;
+      mQuadrics[edge.second] += quadric;
+    }
+  }
+
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+  for (size_t i = 0;  i < sorted.size();  i++)
+    addCollapse(sorted[i].first, sorted[i].second);
+}
+
+bool Simplifier::reduce(size_t target, Mutex& mutex, const bool& cancelled)
+{
+  unsigned int count = 0;
+  bool progress = false;
+
+  while (mTriangleCount > target && !mQueue.empty())
+  {
+    if (++count % 1024 == 0)
+    {
+      mutex.lock();
+      const bool stop = cancelled;
+      mutex.unlock();
+
+      if (stop)
+	return false;
+    }
+
+    const Collapse collapse = mQueue.top();
+    mQueue.pop();
+
+    if (isStale(collapse))
+      continue;
+
+    if (isAllowed(collapse))
+    {
+      apply(collapse);
+      progress = true;
+    }
+    else
+      mDeferred.push_back(collapse);
+
+    // Collapses refused earlier may be allowed once their neighbourhood has
+    // changed, so give them another chance before running out.
+
+    if (mQueue.empty() && progress)
+    {
+      for (std::vector<Collapse>::const_iterator i = mDeferred.begin();  i != mDeferred.end();  i++)
+      {
+	if (!isStale(*i))
+	  mQueue.push(*i);
+      }
+
+      mDeferred.clear();
+      progress = false;
+    }
+  }
+
+  return true;
+}
+
+void Simplifier::getMesh(BaseMesh& mesh) const
+{
+  IndexList remap(mPoints.size(), INVALID_VERTEX_ID);
+
+  mesh.mVertices.clear();
+  mesh.mPolygons.clear();
+
+  for (uint32 t = 0;  t < mRemoved.size();  t++)
+  {
+    if (mRemoved[t])
+      continue;
+
+    BasePolygon polygon;
+
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      const uint32 index = mTriangles[t * 3 + i];
+
+      if (remap[index] == INVALID_VERTEX_ID)
+      {
+	remap[index] = mesh.mVertices.size();
+	mesh.mVertices.push_back(BaseVertex(mPoints[index].x, mPoints[index].y, mPoints[index].z));
+      }
+
+      polygon.mIndices[i] = remap[index];
+    }
+
+    mesh.mPolygons.push_back(polygon);
+  }
+}
+
+size_t Simplifier::getTriangleCount(void) const
+{
+  return mTriangleCount;
+}
+
+void Simplifier::addCollapse(uint32 first, uint32 second)
+{
+  Quadric quadric = mQuadrics[first];
+  quadric += mQuadrics[second];
+
+  Collapse collapse;
+  collapse.mVertices[0] = first;
+  collapse.mVertices[1] = second;
+  collapse.mStamps[0] = mStamps[first];
+  collapse.mStamps[1] = mStamps[second];
+
+  if (quadric.solve(collapse.mTarget))
+    collapse.mCost = quadric.evaluate(collapse.mTarget);
+  else
+  {
+    // Fall back to the best of the endpoints and the midpoint.
+
+    const Vector3d candidates[3] =
+    {
+      mPoints[first],
+      mPoints[second],
+      (mPoints[first] + mPoints[second]) / 2.0
+    };
+
+    collapse.mTarget = candidates[0];
+    collapse.mCost = quadric.evaluate(candidates[0]);
+
+    for (unsigned int i = 1;  i < 3;  i++)
+    {
+      const real64 cost = quadric.evaluate(candidates[i]);
+      if (cost < collapse.mCost)
+      {
+	collapse.mCost = cost;
+	collapse.mTarget = candidates[i];
+      }
+    }
+  }
+
+  mQueue.push(collapse);
+}
+
+bool Simplifier::isStale(const Collapse& collapse) const
+{
+  // Collapses queued before either vertex last changed are stale.
+
+  return collapse.mStamps[0] != mStamps[collapse.mVertices[0]] ||
+         collapse.mStamps[1] != mStamps[collapse.mVertices[1]];
+}
+
+bool Simplifier::isAllowed(const Collapse& collapse) const
+{
+  const uint32 first = collapse.mVertices[0];
+  const uint32 second = collapse.mVertices[1];
+
+  // Only allow collapses where the vertices share at most two neighbours,
+  // to keep the surface from folding into non-manifold pieces.
+
+  IndexList neighbors;
+
+  for (IndexList::const_iterator t = mVertexTriangles[first].begin();  t != mVertexTriangles[first].end();  t++)
+  {
+    if (mRemoved[*t])
+      continue;
+
+    for (unsigned int i = 0;  i < 3;  i++)
+      neighbors.push_back(mTriangles[*t * 3 + i]);
+  }
+
+  std::sort(neighbors.begin(), neighbors.end());
+  neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+
+  IndexList shared;
+
+  for (IndexList::const_iterator t = mVertexTriangles[second].begin();  t != mVertexTriangles[second].end();  t++)
+  {
+    if (mRemoved[*t])
+      continue;
+
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      const uint32 index = mTriangles[*t * 3 + i];
+      if (index != first && index != second &&
+          std::binary_search(neighbors.begin(), neighbors.end(), index))
+	shared.push_back(index);
+    }
+  }
+
+  std::sort(shared.begin(), shared.end());
+  if (std::unique(shared.begin(), shared.end()) - shared.begin() > 2)
+    return false;
+
+  return !flips(first, second, collapse.mTarget) && !flips(second, first, collapse.mTarget);
+}
+
+bool Simplifier::flips(uint32 vertex, uint32 other, const Vector3d& target) const
+{
+  // Tells whether moving the vertex to the target turns any of its triangles
+  // that survive the collapse upside down.
+
+  for (IndexList::const_iterator t = mVertexTriangles[vertex].begin();  t != mVertexTriangles[vertex].end();  t++)
+  {
+    const uint32* indices = &mTriangles[*t * 3];
+
+    if (mRemoved[*t] || indices[0] == other || indices[1] == other || indices[2] == other)
+      continue;
+
+    Vector3d points[3];
+    for (unsigned int i = 0;  i < 3;  i++)
+      points[i] = mPoints[indices[i]];
+
+    const Vector3d before = getNormal(points[0], points[1], points[2]);
+
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      if (indices[i] == vertex)
+	points[i] = target;
+    }
+
+    const Vector3d after = getNormal(points[0], points[1], points[2]);
+
+    if (dot(before, after) <= 0.0)
+      return true;
+  }
+
+  return false;
+}
+
+void Simplifier::apply(const Collapse& collapse)
+{
+  const uint32 kept = collapse.mVertices[0];
+  const uint32 removed = collapse.mVertices[1];
+
+  mPoints[kept] = collapse.mTarget;
+  mQuadrics[kept] += mQuadrics[removed];
+
+  IndexList& triangles = mVertexTriangles[kept];
+
+  for (IndexList::const_iterator t = mVertexTriangles[removed].begin();  t != mVertexTriangles[removed].end();  t++)
+  {
+    if (mRemoved[*t])
+      continue;
+
+    uint32* indices = &mTriangles[*t * 3];
+
+    if (indices[0] == kept || indices[1] == kept || indices[2] == kept)
+    {
+      mRemoved[*t] = true;
+      mTriangleCount--;
+      continue;
+    }
+
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      if (indices[i] == removed)
+	indices[i] = kept;
+    }
+
+    triangles.push_back(*t);
+  }
+
+  mVertexTriangles[removed].clear();
+
+  IndexList::iterator end = triangles.begin();
+  for (IndexList::const_iterator t = triangles.begin();  t != triangles.end();  t++)
+  {
+    if (!mRemoved[*t])
+      *end++ = *t;
+  }
+
+  triangles.erase(end, triangles.end());
+
+  mStamps[kept]++;
+  mStamps[removed]++;
+
+  // Queue new collapses for every edge of the kept vertex.
+
+  IndexList neighbors;
+
+  for (IndexList::const_iterator t = triangles.begin();  t != triangles.end();  t++)
+  {
+    for (unsigned int i = 0;  i < 3;  i++)
+    {
+      if (mTriangles[*t * 3 + i] != kept)
+	neighbors.push_back(mTriangles[*t * 3 + i]);
+    }
+  }
+
+  std::sort(neighbors.begin(), neighbors.end());
+  neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+
+  for (IndexList::const_iterator n = neighbors.begin();  n != neighbors.end();  n++)
+    addCollapse(kept, *n);
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+class GeometrySimplification::Job
+{
+public:
+  BaseMesh mMesh;
+  unsigned int mLevelCount;
+  real64 mReduction;
+  LevelList mLevels;
+  unsigned int mVertexVersion;
+  unsigned int mPolygonVersion;
+  Mutex mMutex;
+  bool mFinished;
+  bool mCancelled;
+};
+
+//---------------------------------------------------------------------
+
+unsigned int GeometrySimplification::getLevelCount(void) const
+{
+  return mLevels.size();
+}
+
+const BaseMesh& GeometrySimplification::getLevel(unsigned int index) const
+{
+  return mLevels[index];
+}
+
+const BaseMesh* GeometrySimplification::findLevel(size_t maxPolygons) const
+{
+  for (LevelList::const_iterator i = mLevels.begin();  i != mLevels.end();  i++)
+  {
+    if ((*i).mPolygons.size() <= maxPolygons)
+      return &(*i);
+  }
+
+  if (mLevels.empty())
+    return NULL;
+
+  return &mLevels.back();
+}
+
+bool GeometrySimplification::isCurrent(void) const
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (!mValid || mSettingsChanged || !vertexLayer || !polygonLayer)
+    return false;
+
+  return vertexLayer->getDataVersion() == mVertexVersion &&
+         polygonLayer->getDataVersion() == mPolygonVersion;
+}
+
+bool GeometrySimplification::isPending(void) const
+{
+  return mJob != NULL;
+}
+
+void GeometrySimplification::wait(void)
+{
+  if (mJob)
+    finish();
+}
+
+unsigned int GeometrySimplification::getTargetLevelCount(void) const
+{
+  return mTargetLevelCount;
+}
+
+void GeometrySimplification::setTargetLevelCount(unsigned int count)
+{
+  if (count != mTargetLevelCount)
+  {
+    mTargetLevelCount = count;
+    mSettingsChanged = true;
+  }
+}
+
+real64 GeometrySimplification::getReduction(void) const
+{
+  return mReduction;
+}
+
+void GeometrySimplification::setReduction(real64 reduction)
+{
+  reduction = std::max(0.0, std::min(reduction, 1.0));
+
+  if (reduction != mReduction)
+  {
+    mReduction = reduction;
+    mSettingsChanged = true;
+  }
+}
+
+GeometryNode& GeometrySimplification::getNode(void) const
+{
+  return mNode;
+}
+
+GeometrySimplification::GeometrySimplification(GeometryNode& node):
+  mNode(node),
+  mTargetLevelCount(4),
+  mReduction(0.5),
+  mJob(NULL),
+  mThread(NULL),
+  mVertexVersion(0),
+  mPolygonVersion(0),
+  mRequestedVertexVersion(0),
+  mRequestedPolygonVersion(0),
+  mSettingsChanged(false),
+  mRequested(false),
+  mValid(false)
+{
+}
+
+GeometrySimplification::~GeometrySimplification(void)
+{
+  if (mJob)
+  {
+    mJob->mMutex.lock();
+    mJob->mCancelled = true;
+    mJob->mMutex.unlock();
+
+    finish();
+  }
+}
+
+void GeometrySimplification::update(void)
+{
+  if (mJob)
+  {
+    mJob->mMutex.lock();
+    const bool finished = mJob->mFinished;
+    mJob->mMutex.unlock();
+
+    if (!finished)
+      return;
+
+    finish();
+  }
+
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (!vertexLayer || !polygonLayer)
+  {
+    mLevels.clear();
+    mRequested = false;
+    mValid = false;
+    return;
+  }
+
+  if (!mRequested ||
+      mSettingsChanged ||
+      vertexLayer->getDataVersion() != mRequestedVertexVersion ||
+      polygonLayer->getDataVersion() != mRequestedPolygonVersion)
+  {
+    start();
+  }
+}
+
+void GeometrySimplification::start(void)
+{
+  // Only the copy of the base layers is made here. The worker never touches
+  // the node itself.
+
+  mJob = new Job;
+  mJob->mLevelCount = mTargetLevelCount;
+  mJob->mReduction = mReduction;
+  mJob->mVertexVersion = mNode.mBaseVertexLayer->getDataVersion();
+  mJob->mPolygonVersion = mNode.mBasePolygonLayer->getDataVersion();
+  mJob->mFinished = false;
+  mJob->mCancelled = false;
+
+  mNode.getBaseMesh(mJob->mMesh);
+
+  mRequestedVertexVersion = mJob->mVertexVersion;
+  mRequestedPolygonVersion = mJob->mPolygonVersion;
+  mSettingsChanged = false;
+  mRequested = true;
+
+  mThread = Thread::create(run, mJob);
+  if (!mThread)
+  {
+    run(mJob);
+    finish();
+  }
+}
+
+void GeometrySimplification::finish(void)
+{
+  delete mThread;
+  mThread = NULL;
+
+  mLevels.swap(mJob->mLevels);
+  mVertexVersion = mJob->mVertexVersion;
+  mPolygonVersion = mJob->mPolygonVersion;
+  mValid = true;
+
+  delete mJob;
+  mJob = NULL;
+}
+
+void GeometrySimplification::run(void* data)
+{
+  Job& job = *reinterpret_cast<Job*>(data);
+
+  if (!job.mMesh.mPolygons.empty())
+  {
+    // Each level continues collapsing where the previous one stopped.
+
+    Simplifier simplifier(job.mMesh);
+
+    for (unsigned int i = 0;  i < job.mLevelCount;  i++)
+    {
+      const size_t count = simplifier.getTriangleCount();
+      const size_t target = (size_t) (count * job.mReduction);
+
+      if (!simplifier.reduce(target, job.mMutex, job.mCancelled))
+	break;
+
+      if (simplifier.getTriangleCount() == count)
+	break;
+
+      job.mLevels.push_back(BaseMesh());
+      simplifier.getMesh(job.mLevels.back());
+    }
+  }
+
+  job.mMutex.lock();
+  job.mFinished = true;
+  job.mMutex.unlock();
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
@@ -0,0 +1,468 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <cmath>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+typedef std::vector<uint32> IndexList;
+typedef std::vector<real64> WeightList;
+
+// Rigid transform with a row-major rotation matrix.
+class Transform
+{
+public:
+  void set(const Vector3d& position, const Quaternion64& rotation);
+  void concatenate(const Transform& parent);
+  void invert(void);
+  void getMatrix(real64* matrix) const;
+  real64 mRotation[9];
+  Vector3d mPosition;
+};
+
+void Transform::set(const Vector3d& position, const Quaternion64& rotation)
+{
+  mPosition = position;
+
+  real64 x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+
+  const real64 length = std::sqrt(x * x + y * y + z * z + w * w);
+  if (length == 0.0)
+  {
+    x = y = z = 0.0;
+    w = 1.0;
+  }
+  else
+  {
+    x /= length;
+    y /= length;
+    z /= length;
+    w /= length;
+  }
+
+  mRotation[0] = 1.0 - 2.0 * (y * y + z * z);
+  mRotation[1] = 2.0 * (x * y - z * w);
+  mRotation[2] = 2.0 * (x * z + y * w);
+  mRotation[3] = 2.0 * (x * y + z * w);
+  mRotation[4] = 1.0 - 2.0 * (x * x + z * z);
+  mRotation[5] = 2.0 * (y * z - x * w);
+  mRotation[6] = 2.0 * (x * z - y * w);
+  mRotation[7] = 2.0 * (y * z + x * w);
+  mRotation[8] = 1.0 - 2.0 * (x * x + y * y);
+}
+
+void Transform::concatenate(const Transform& parent)
+{
+  // Makes this transform relative to the space of the parent instead.
+
+  real64 rotation[9];
+
+  for (unsigned int row = 0;  row < 3;  row++)
+  {
+    for (unsigned int column = 0;  column < 3;  column++)
+    {
+      rotation[row * 3 + column] = parent.mRotation[row * 3] * mRotation[column] +
+                                   parent.mRotation[row * 3 + 1] * mRotation[3 + column] +
+                                   parent.mRotation[row * 3 + 2] * mRotation[6 + column];
+    }
+  }
+
+  const Vector3d p = mPosition;
+  const real64* r = parent.mRotation;
+
+  mPosition.set(r[0] * p.x + r[1] * p.y + r[2] * p.z + parent.mPosition.x,
+                r[3] * p.x + r[4] * p.y + r[5] * p.z + parent.mPosition.y,
+                r[6] * p.x + r[7] * p.y + r[8] * p.z + parent.mPosition.z);
+
+  std::copy(rotation, rotation + 9, mRotation);
+}
+
+void Transform::invert(void)
+{
+  std::swap(mRotation[1], mRotation[3]);
+  std::swap(mRotation[2], mRotation[6]);
+  std::swap(mRotation[5], mRotation[7]);
+
+  const Vector3d p = mPosition;
+  const real64* r = mRotation;
+
+  mPosition.set(-(r[0] * p.x + r[1] * p.y + r[2] * p.z),
+                -(r[3] * p.x + r[4] * p.y + r[5] * p.z),
+                -(r[6] * p.x + r[7] * p.y + r[8] * p.z));
+}
+
+void Transform::getMatrix(real64* matrix) const
+{
+  // Column-major, as used by GeometryLayer::transformSlots.
+
+  for (unsigned int column = 0;  column < 3;  column++)
+  {
+    for (unsigned int row = 0;  row < 3;  row++)
+      matrix[column * 4 + row] = mRotation[row * 3 + column];
+
+    matrix[column * 4 + 3] = 0.0;
+  }
+
+  matrix[12] = mPosition.x;
+  matrix[13] = mPosition.y;
+  matrix[14] = mPosition.z;
+  matrix[15] = 1.0;
+}
+
+// The resolved layers of a single bone.
+class Source
+{
+public:
+  uint16 mID;
+  const real64* mWeights;
+  size_t mWeightCount;
+  real64 mDefaultWeight;
+  const uint32* mReferences;
+  size_t mReferenceCount;
+  uint32 mDefaultReference;
+};
+
+typedef std::vector<Source> SourceList;
+
+class Gather
+{
+public:
+  const SourceList* mSources;
+  const real64* mVertices;
+  size_t mVertexCount;
+  IndexList* mStarts;
+  IndexList* mBones;
+  WeightList* mWeights;
+};
+
+inline bool getInfluence(const Source& source, uint32 vertexID, real64& weight)
+{
+  if (source.mReferences)
+  {
+    uint32 reference = source.mDefaultReference;
+    if (vertexID < source.mReferenceCount)
+      reference = source.mReferences[vertexID];
+
+    if (reference != source.mID)
+      return false;
+  }
+
+  weight = 1.0;
+
+  if (source.mWeights)
+  {
+    weight = source.mDefaultWeight;
+    if (vertexID < source.mWeightCount)
+      weight = source.mWeights[vertexID];
+  }
+
+  return weight > 0.0;
+}
+
+inline bool isValidVertex(const Gather& gather, uint32 vertexID)
+{
+  return vertexID < gather.mVertexCount && gather.mVertices[vertexID * 3] != V_REAL64_MAX;
+}
+
+void countRange(void* data, uint32 first, uint32 count)
+{
+  Gather& gather = *reinterpret_cast<Gather*>(data);
+  const SourceList& sources = *gather.mSources;
+
+  for (uint32 vertexID = first;  vertexID < first + count;  vertexID++)
+  {
+    uint32 influences = 0;
+
+    if (isValidVertex(gather, vertexID))
+    {
+      real64 weight;
+
+      for (SourceList::const_iterator s = sources.begin();  s != sources.end();  s++)
+      {
+	if (getInfluence(*s, vertexID, weight))
+	  influences++;
+      }
+    }
+
+    (*gather.mStarts)[vertexID + 1] = influences;
+  }
+}
+
+void fillRange(void* data, uint32 first, uint32 count)
+{
+  Gather& gather = *reinterpret_cast<Gather*>(data);
+  const SourceList& sources = *gather.mSources;
+
+  for (uint32 vertexID = first;  vertexID < first + count;  vertexID++)
+  {
+    const uint32 start = (*gather.mStarts)[vertexID];
+    const uint32 end = (*gather.mStarts)[vertexID + 1];
+    if (start == end)
+      continue;
+
+    uint32 index = start;
+    real64 weight, total = 0.0;
+
+    for (uint32 i = 0;  i < sources.size();  i++)
+    {
+      if (getInfluence(sources[i], vertexID, weight))
+      {
+	(*gather.mBones)[index] = i;
+	(*gather.mWeights)[index] = weight;
+	total += weight;
+	index++;
+      }
+    }
+
+    for (uint32 i = start;  i < end;  i++)
+      (*gather.mWeights)[i] /= total;
+  }
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+void GeometrySkinning::setPose(uint16 boneID, const Vector3d& position, const Quaternion64& rotation)
+{
+  Pose& pose = mPoses[boneID];
+  pose.mPosition = position;
+  pose.mRotation = rotation;
+}
+
+void GeometrySkinning::resetPose(uint16 boneID)
+{
+  mPoses.erase(boneID);
+}
+
+void GeometrySkinning::resetPoses(void)
+{
+  mPoses.clear();
+}
+
+size_t GeometrySkinning::getInfluenceCount(void) const
+{
+  return mBones.size();
+}
+
+GeometryNode& GeometrySkinning::getNode(void) const
+{
+  return mNode;
+}
+
+GeometrySkinning::GeometrySkinning(GeometryNode& node):
+  mNode(node),
+  mNodeVersion(0),
+  mStructureVersion(0),
+  mVertexVersion(0),
+  mValid(false)
+{
+}
+
+void GeometrySkinning::update(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+
+  if (!vertexLayer)
+  {
+    mStarts.clear();
+    mBones.clear();
+    mWeights.clear();
+    mLayers.clear();
+    mVersions.clear();
+    mValid = false;
+    return;
+  }
+
+  bool changed = !mValid ||
+                 mNode.getDataVersion() != mNodeVersion ||
+                 mNode.getStructureVersion() != mStructureVersion ||
+                 vertexLayer->getStructureVersion() != mVertexVersion;
+
+  for (size_t i = 0;  !changed && i < mLayers.size();  i++)
+  {
+    if (mLayers[i]->getDataVersion() != mVersions[i])
+      changed = true;
+  }
+
+  if (changed)
+    rebuild();
+
+  mNodeVersion = mNode.getDataVersion();
+  mStructureVersion = mNode.getStructureVersion();
+  mVertexVersion = vertexLayer->getStructureVersion();
+  mValid = true;
+}
+
+void GeometrySkinning::rebuild(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+
+  uint32 vertexCount = mNode.getHighestVertexID();
+  if (vertexCount == INVALID_VERTEX_ID)
+    vertexCount = 0;
+  else
+    vertexCount++;
+
+  // Resolve the layers named by each bone, remembering them so that changes
+  // to their slots are noticed.
+
+  mLayers.clear();
+  mVersions.clear();
+
+  SourceList sources(mNode.mBones.size());
+
+  for (size_t i = 0;  i < sources.size();  i++)
+  {
+    const Bone& bone = *mNode.mBones[i];
+    Source& source = sources[i];
+
+    source.mID = bone.getID();
+    source.mWeights = NULL;
+    source.mReferences = NULL;
+
+    if (const GeometryLayer* layer = bone.getWeightLayer())
+    {
+      source.mWeights = reinterpret_cast<const real64*>(layer->mData.getitems());
+      source.mWeightCount = layer->mData.getItemCount();
+      source.mDefaultWeight = layer->mDefaultReal;
+      mLayers.push_back(layer);
+    }
+
+    if (const GeometryLayer* layer = bone.getReferenceLayer())
+    {
+      source.mReferences = reinterpret_cast<const uint32*>(layer->mData.getitems());
+      source.mReferenceCount = layer->mData.getItemCount();
+      source.mDefaultReference = layer->mDefaultInt;
+      mLayers.push_back(layer);
+    }
+  }
+
+  std::sort(mLayers.begin(), mLayers.end());
+  mLayers.erase(std::unique(mLayers.begin(), mLayers.end()), mLayers.end());
+
+  for (LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
+    mVersions.push_back((*i)->getDataVersion());
+
+  // Gather the influences on each vertex in two passes, first counting them
+  // and then filling them in once their offsets are known.
+
+  mStarts.assign(vertexCount + 1, 0);
+
+  Block vertexData;
+  vertexLayer->getSnapshot(vertexData);
+
+  Gather gather;
+  gather.mSources = &sources;
+  gather.mVertices = reinterpret_cast<const real64*>(vertexData.getitems());
+  gather.mVertexCount = vertexData.getItemCount();
+  gather.mStarts = &mStarts;
+  gather.mBones = &mBones;
+  gather.mWeights = &mWeights;
+
+  Thread::parallelFor(countRange, &gather, vertexCount, 1024);
+
+  for (uint32 i = 0;  i < vertexCount;  i++)
+    mStarts[i + 1] += mStarts[i];
+
+  mBones.resize(mStarts.back());
+  mWeights.resize(mStarts.back());
+
+  Thread::parallelFor(fillRange, &gather, vertexCount, 1024);
+}
+
+void GeometrySkinning::getMatrices(WeightList& matrices) const
+{
+  const GeometryNode::BoneList& bones = mNode.mBones;
+
+  // Each bone is placed in the space of its parent, in both its rest and its
+  // posed transform. A bone whose parent is missing or among its own
+  // descendants is treated as a root bone.
+
+  enum { UNVISITED, VISITING, VISITED };
+
+  std::vector<Transform> rest(bones.size());
+  std::vector<Transform> posed(bones.size());
+  std::vector<int> states(bones.size(), UNVISITED);
+  std::map<uint16,size_t> indices;
+
+  for (size_t i = 0;  i < bones.size();  i++)
+    indices[bones[i]->getID()] = i;
+
+  IndexList path;
+
+  for (size_t i = 0;  i < bones.size();  i++)
+  {
+    size_t index = i;
+
+    while (states[index] == UNVISITED)
+    {
+      states[index] = VISITING;
+      path.push_back(index);
+
+      std::map<uint16,size_t>::const_iterator parent = indices.find(bones[index]->getParentID());
+      if (parent == indices.end() || states[parent->second] == VISITING)
+	break;
+
+      index = parent->second;
+    }
+
+    while (!path.empty())
+    {
+      const size_t current = path.back();
+      path.pop_back();
+
+      const Bone& bone = *bones[current];
+
+      rest[current].set(bone.getPosition(), bone.getRotation());
+
+      PoseMap::const_iterator pose = mPoses.find(bone.getID());
+      if (pose == mPoses.end())
+	posed[current] = rest[current];
+      else
+	posed[current].set(pose->second.mPosition, pose->second.mRotation);
+
+      std::map<uint16,size_t>::const_iterator parent = indices.find(bone.getParentID());
+      if (parent != indices.end() && states[parent->second] == VISITED)
+      {
+	rest[current].concatenate(rest[parent->second]);
+	posed[current].concatenate(posed[parent->second]);
+      }
+
+      states[current] = VISITED;
+    }
+  }
+
+  // The skinning matrix of each bone takes a vertex from the rest space of
+  // the bone to its posed space.
+
+  matrices.resize(bones.size() * 16);
+
+  for (size_t i = 0;  i < bones.size();  i++)
+  {
+    Transform skin = rest[i];
+    skin.invert();
+    skin.concatenate(posed[i]);
+    skin.getMatrix(&matrices[i * 16]);
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
@@ -0,0 +1,777 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+typedef std::vector<uint32> IDList;
+typedef std::vector<uint8> CountList;
+typedef std::vector<real64> WeightList;
+
+const real64 MAX_CREASE = 4294967295.0;
+
+class Term
+{
+public:
+  Term(uint32 index, real64 weight);
+  bool operator < (const Term& other) const;
+  uint32 mIndex;
+  real64 mWeight;
+};
+
+typedef std::vector<Term> TermList;
+
+Term::Term(uint32 index, real64 weight):
+  mIndex(index),
+  mWeight(weight)
+{
+}
+
+bool Term::operator < (const Term& other) const
+{
+  return mIndex < other.mIndex;
+}
+
+class Corner
+{
+public:
+  bool operator < (const Corner& other) const;
+  uint32 mFirst;
+  uint32 mSecond;
+  uint32 mCorner;
+};
+
+bool Corner::operator < (const Corner& other) const
+{
+  if (mFirst != other.mFirst)
+    return mFirst < other.mFirst;
+  if (mSecond != other.mSecond)
+    return mSecond < other.mSecond;
+
+  return mCorner < other.mCorner;
+}
+
+// Topology of a single subdivision level. Faces have four slots each, and
+// the crease of corner i applies to the edge from corner i to corner i + 1.
+class Level
+{
+public:
+  void buildEdges(void);
+  void refine(Level& next) const;
+  void getTerms(uint32 vertexID, TermList& terms) const;
+  void addFace(uint32 faceID, real64 weight, TermList& terms) const;
+  uint32 mVertexCount;
+  IDList mFaces;
+  CountList mCornerCounts;
+  WeightList mCornerWeights;
+  WeightList mVertexWeights;
+  IDList mFaceEdges;
+  IDList mEdgeVertices;
+  IDList mEdgeFaces;
+  IDList mEdgeFaceCounts;
+  WeightList mEdgeWeights;
+  IDList mVertexEdgeStarts;
+  IDList mVertexEdges;
+  IDList mVertexFaceStarts;
+  IDList mVertexFaces;
+};
+
+void Level::buildEdges(void)
+{
+  const uint32 faceCount = mCornerCounts.size();
+
+  std::vector<Corner> corners;
+
+  for (uint32 faceID = 0;  faceID < faceCount;  faceID++)
+  {
+    const unsigned int cornerCount = mCornerCounts[faceID];
+
+    for (unsigned int i = 0;  i < cornerCount;  i++)
+    {
+      const uint32 a = mFaces[faceID * 4 + i];
+      const uint32 b = mFaces[faceID * 4 + (i + 1) % cornerCount];
+
+      Corner corner;
+      corner.mFirst = std::min(a, b);
+      corner.mSecond = std::max(a, b);
+      corner.mCorner = faceID * 4 + i;
+      corners.push_back(corner);
+    }
+  }
+
+  std::sort(corners.begin(), corners.end());
+
+  mFaceEdges.assign(faceCount * 4, INVALID_EDGE_ID);
+  mEdgeVertices.clear();
+  mEdgeFaces.clear();
+  mEdgeFaceCounts.clear();
+  mEdgeWeights.clear();
+
+  for (size_t i = 0;  i < corners.size();  )
+  {
+    const uint32 edgeID = mEdgeFaceCounts.size();
+
+    mEdgeVertices.push_back(corners[i].mFirst);
+    mEdgeVertices.push_back(corners[i].mSecond);
+    mEdgeFaces.push_back(corners[i].mCorner / 4);
+    mEdgeFaces.push_back(INVALID_POLYGON_ID);
+    mEdgeFaceCounts.push_back(0);
+    mEdgeWeights.push_back(0.0);
+
+    size_t j = i;
+
+    while (j < corners.size() &&
+           corners[j].mFirst == corners[i].mFirst &&
+	   corners[j].mSecond == corners[i].mSecond)
+    {
+      if (j == i + 1)
+	mEdgeFaces[edgeID * 2 + 1] = corners[j].mCorner / 4;
+
+      mFaceEdges[corners[j].mCorner] = edgeID;
+      mEdgeFaceCounts[edgeID]++;
+      mEdgeWeights[edgeID] = std::max(mEdgeWeights[edgeID], mCornerWeights[corners[j].mCorner]);
+      j++;
+    }
+
+    i = j;
+  }
+
+  const uint32 edgeCount = mEdgeFaceCounts.size();
+
+  mVertexEdgeStarts.assign(mVertexCount + 1, 0);
+
+  for (uint32 edgeID = 0;  edgeID < edgeCount;  edgeID++)
+  {
+    mVertexEdgeStarts[mEdgeVertices[edgeID * 2] + 1]++;
+    mVertexEdgeStarts[mEdgeVertices[edgeID * 2 + 1] + 1]++;
+  }
+
+  for (uint32 vertexID = 0;  vertexID < mVertexCount;  vertexID++)
+    mVertexEdgeStarts[vertexID + 1] += mVertexEdgeStarts[vertexID];
+
+  mVertexEdges.resize(mVertexEdgeStarts[mVertexCount]);
+
+  IDList positions(mVertexEdgeStarts.begin(), mVertexEdgeStarts.end() - 1);
+
+  for (uint32 edgeID = 0;  edgeID < edgeCount;  edgeID++)
+  {
+    mVertexEdges[positions[mEdgeVertices[edgeID * 2]]++] = edgeID;
+    mVertexEdges[positions[mEdgeVertices[edgeID * 2 + 1]]++] = edgeID;
+  }
+
+  mVertexFaceStarts.assign(mVertexCount + 1, 0);
+
+  for (uint32 faceID = 0;  faceID < faceCount;  faceID++)
+  {
+    for (unsigned int i = 0;  i < mCornerCounts[faceID];  i++)
+      mVertexFaceStarts[mFaces[faceID * 4 + i] + 1]++;
+  }
+
+  for (uint32 vertexID = 0;  vertexID < mVertexCount;  vertexID++)
+    mVertexFaceStarts[vertexID + 1] += mVertexFaceStarts[vertexID];
+
+  mVertexFaces.resize(mVertexFaceStarts[mVertexCount]);
+
+  positions.assign(mVertexFaceStarts.begin(), mVertexFaceStarts.end() - 1);
+
+  for (uint32 faceID = 0;  faceID < faceCount;  faceID++)
+  {
+    for (unsigned int i = 0;  i < mCornerCounts[faceID];  i++)
+      mVertexFaces[positions[mFaces[faceID * 4 + i]]++] = faceID;
+  }
+}
+
+void Level::refine(Level& next) const
+{
+  // Refined vertices are numbered with face points first, then edge points
+  // and finally vertex points.
+
+  const uint32 faceCount = mCornerCounts.size();
+  const uint32 edgeCount = mEdgeFaceCounts.size();
+
+  next.mVertexCount = faceCount + edgeCount + mVertexCount;
+
+  next.mFaces.clear();
+  next.mCornerCounts.clear();
+  next.mCornerWeights.clear();
+
+  for (uint32 faceID = 0;  faceID < faceCount;  faceID++)
+  {
+    const unsigned int cornerCount = mCornerCounts[faceID];
+
+    for (unsigned int i = 0;  i < cornerCount;  i++)
+    {
+      const uint32 edge = mFaceEdges[faceID * 4 + i];
+      const uint32 previous = mFaceEdges[faceID * 4 + (i + cornerCount - 1) % cornerCount];
+
+      next.mFaces.push_back(faceCount + edgeCount + mFaces[faceID * 4 + i]);
+      next.mFaces.push_back(faceCount + edge);
+      next.mFaces.push_back(faceID);
+      next.mFaces.push_back(faceCount + previous);
+      next.mCornerCounts.push_back(4);
+
+      next.mCornerWeights.push_back(mEdgeWeights[edge]);
+      next.mCornerWeights.push_back(0.0);
+      next.mCornerWeights.push_back(0.0);
+      next.mCornerWeights.push_back(mEdgeWeights[previous]);
+    }
+  }
+
+  next.mVertexWeights.assign(faceCount + edgeCount, 0.0);
+  next.mVertexWeights.insert(next.mVertexWeights.end(), mVertexWeights.begin(), mVertexWeights.end());
+}
+
+void Level::addFace(uint32 faceID, real64 weight, TermList& terms) const
+{
+  const unsigned int cornerCount = mCornerCounts[faceID];
+
+  for (unsigned int i = 0;  i < cornerCount;  i++)
+    terms.push_back(Term(mFaces[faceID * 4 + i], weight / cornerCount));
+}
+
+void Level::getTerms(uint32 vertexID, TermList& terms) const
+{
+  const uint32 faceCount = mCornerCounts.size();
+  const uint32 edgeCount = mEdgeFaceCounts.size();
+
+  if (vertexID < faceCount)
+  {
+    addFace(vertexID, 1.0, terms);
+    return;
+  }
+
+  if (vertexID < faceCount + edgeCount)
+  {
+    const uint32 edgeID = vertexID - faceCount;
+    const uint32 a = mEdgeVertices[edgeID * 2];
+    const uint32 b = mEdgeVertices[edgeID * 2 + 1];
+
+    real64 sharpness = mEdgeWeights[edgeID];
+    if (mEdgeFaceCounts[edgeID] != 2)
+      sharpness = 1.0;
+
+    const real64 smoothness = 1.0 - sharpness;
+
+    terms.push_back(Term(a, sharpness / 2.0 + smoothness / 4.0));
+    terms.push_back(Term(b, sharpness / 2.0 + smoothness / 4.0));
+
+    if (smoothness > 0.0)
+    {
+      addFace(mEdgeFaces[edgeID * 2], smoothness / 4.0, terms);
+      addFace(mEdgeFaces[edgeID * 2 + 1], smoothness / 4.0, terms);
+    }
+
+    return;
+  }
+
+  vertexID -= faceCount + edgeCount;
+
+  const uint32 edgeStart = mVertexEdgeStarts[vertexID];
+  const uint32 edgeEnd = mVertexEdgeStarts[vertexID + 1];
+  const uint32 faceStart = mVertexFaceStarts[vertexID];
+  const uint32 faceEnd = mVertexFaceStarts[vertexID + 1];
+
+  // Find the two sharpest creased edges, treating boundary edges as fully
+  // sharp.
+
+  unsigned int creaseCount = 0;
+  unsigned int boundaryCount = 0;
+  real64 creaseSum = 0.0;
+  uint32 sharpest[2] = { INVALID_EDGE_ID, INVALID_EDGE_ID };
+  real64 sharpestWeights[2] = { 0.0, 0.0 };
+
+  for (uint32 i = edgeStart;  i < edgeEnd;  i++)
+  {
+    const uint32 edgeID = mVertexEdges[i];
+
+    real64 weight = mEdgeWeights[edgeID];
+    if (mEdgeFaceCounts[edgeID] != 2)
+    {
+      weight = 1.0;
+      boundaryCount++;
+    }
+
+    if (weight <= 0.0)
+      continue;
+
+    creaseCount++;
+    creaseSum += weight;
+
+    if (weight > sharpestWeights[0])
+    {
+      sharpest[1] = sharpest[0];
+      sharpestWeights[1] = sharpestWeights[0];
+      sharpest[0] = edgeID;
+      sharpestWeights[0] = weight;
+    }
+    else if (weight > sharpestWeights[1])
+    {
+      sharpest[1] = edgeID;
+      sharpestWeights[1] = weight;
+    }
+  }
+
+  const real64 corner = mVertexWeights[vertexID];
+  const real64 rest = 1.0 - corner;
+
+  real64 smooth = 0.0, crease = 0.0, sharp = corner;
+
+  if (boundaryCount)
+  {
+    if (boundaryCount == 2 && creaseCount == 2)
+      crease = rest;
+    else
+      sharp += rest;
+  }
+  else if (creaseCount < 2)
+    smooth = rest;
+  else if (creaseCount == 2)
+  {
+    crease = rest * creaseSum / 2.0;
+    smooth = rest - crease;
+  }
+  else
+  {
+    sharp += rest * creaseSum / creaseCount;
+    smooth = 1.0 - sharp;
+  }
+
+  if (edgeEnd == edgeStart)
+  {
+    terms.push_back(Term(vertexID, 1.0));
+    return;
+  }
+
+  terms.push_back(Term(vertexID, sharp));
+
+  if (crease > 0.0)
+  {
+    terms.push_back(Term(vertexID, crease * 6.0 / 8.0));
+
+    for (unsigned int i = 0;  i < 2;  i++)
+    {
+      const uint32 a = mEdgeVertices[sharpest[i] * 2];
+      const uint32 b = mEdgeVertices[sharpest[i] * 2 + 1];
+      terms.push_back(Term(a == vertexID ? b : a, crease / 8.0));
+    }
+  }
+
+  if (smooth > 0.0)
+  {
+    // The smooth rule is (Q + 2R + (n - 3)P) / n, with Q the average of the
+    // face points and R the average of the edge midpoints.
+
+    const real64 n = edgeEnd - edgeStart;
+
+    terms.push_back(Term(vertexID, smooth * (n - 3.0) / n));
+
+    for (uint32 i = edgeStart;  i < edgeEnd;  i++)
+    {
+      const uint32 edgeID = mVertexEdges[i];
+      terms.push_back(Term(mEdgeVertices[edgeID * 2], smooth / (n * n)));
+      terms.push_back(Term(mEdgeVertices[edgeID * 2 + 1], smooth / (n * n)));
+    }
+
+    const real64 faceWeight = smooth / (n * (faceEnd - faceStart));
+
+    for (uint32 i = faceStart;  i < faceEnd;  i++)
+      addFace(mVertexFaces[i], faceWeight, terms);
+  }
+}
+
+// Composes the stencils of one level with the local refinement rules,
+// giving the stencils of the next level in terms of base vertices.
+class Refinement
+{
+public:
+  const Level* mLevel;
+  const IDList* mSourceStarts;
+  const IDList* mSourceIndices;
+  const WeightList* mSourceWeights;
+  IDList mStarts;
+  IDList mCounts;
+  IDList mIndices;
+  WeightList mWeights;
+  bool mFill;
+};
+
+void refineRange(void* data, uint32 first, uint32 count)
+{
+  Refinement& refinement = *reinterpret_cast<Refinement*>(data);
+
+  const IDList& sourceStarts = *refinement.mSourceStarts;
+  const IDList& sourceIndices = *refinement.mSourceIndices;
+  const WeightList& sourceWeights = *refinement.mSourceWeights;
+
+  TermList local;
+  TermList expanded;
+
+  for (uint32 vertexID = first;  vertexID < first + count;  vertexID++)
+  {
+    local.clear();
+    refinement.mLevel->getTerms(vertexID, local);
+
+    // The first pass only finds an upper bound for the size of each stencil.
+
+    if (!refinement.mFill)
+    {
+      uint32 bound = 0;
+
+      for (TermList::const_iterator i = local.begin();  i != local.end();  i++)
+	bound += sourceStarts[i->mIndex + 1] - sourceStarts[i->mIndex];
+
+      refinement.mCounts[vertexID] = bound;
+      continue;
+    }
+
+    expanded.clear();
+
+    for (TermList::const_iterator i = local.begin();  i != local.end();  i++)
+    {
+      if (i->mWeight == 0.0)
+	continue;
+
+      for (uint32 j = sourceStarts[i->mIndex];  j < sourceStarts[i->mIndex + 1];  j++)
+	expanded.push_back(Term(sourceIndices[j], i->mWeight * sourceWeights[j]));
+    }
+
+    std::sort(expanded.begin(), expanded.end());
+
+    uint32 target = refinement.mStarts[vertexID];
+
+    for (TermList::const_iterator i = expanded.begin();  i != expanded.end();  )
+    {
+      const uint32 index = i->mIndex;
+      real64 weight = 0.0;
+
+      while (i != expanded.end() && i->mIndex == index)
+      {
+	weight += i->mWeight;
+	i++;
+      }
+
+      refinement.mIndices[target] = index;
+      refinement.mWeights[target] = weight;
+      target++;
+    }
+
+    refinement.mCounts[vertexID] = target - refinement.mStarts[vertexID];
+  }
+}
+
+}
+
+//---------------------------------------------------------------------
+
+const GeometrySubdivision::PointList& GeometrySubdivision::getPoints(void) const
+{
+  return mPoints;
+}
+
+const GeometrySubdivision::IndexList& GeometrySubdivision::getFaces(void) const
+{
+  return mFaces;
+}
+
+unsigned int GeometrySubdivision::getLevelCount(void) const
+{
+  return mLevelCount;
+}
+
+void GeometrySubdivision::setLevelCount(unsigned int count)
+{
+  if (count != mLevelCount)
+  {
+    mLevelCount = count;
+    mLevelsChanged = true;
+  }
+}
+
+GeometryNode& GeometrySubdivision::getNode(void) const
+{
+  return mNode;
+}
+
+GeometrySubdivision::GeometrySubdivision(GeometryNode& node):
+  mNode(node),
+  mLevelCount(2),
+  mEdgeCreaseLayer(NULL),
+  mVertexCreaseLayer(NULL),
+  mNodeVersion(0),
+  mStructureVersion(0),
+  mVertexVersion(0),
+  mPolygonVersion(0),
+  mEdgeCreaseVersion(0),
+  mVertexCreaseVersion(0),
+  mLevelsChanged(false),
+  mValid(false)
+{
+}
+
+void GeometrySubdivision::update(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (!vertexLayer || !polygonLayer)
+  {
+    mPoints.clear();
+    mFaces.clear();
+    mStencilStarts.clear();
+    mStencilIndices.clear();
+    mStencilWeights.clear();
+    mValid = false;
+    return;
+  }
+
+  const GeometryLayer* edgeCreaseLayer = mNode.getEdgeCreaseLayer();
+  const GeometryLayer* vertexCreaseLayer = mNode.getVertexCreaseLayer();
+
+  // Anything but moved vertices changes the stencils.
+
+  if (!mValid ||
+      mLevelsChanged ||
+      mNode.getDataVersion() != mNodeVersion ||
+      vertexLayer->getStructureVersion() != mStructureVersion ||
+      polygonLayer->getDataVersion() != mPolygonVersion ||
+      edgeCreaseLayer != mEdgeCreaseLayer ||
+      vertexCreaseLayer != mVertexCreaseLayer ||
+      (edgeCreaseLayer && edgeCreaseLayer->getDataVersion() != mEdgeCreaseVersion) ||
+      (vertexCreaseLayer && vertexCreaseLayer->getDataVersion() != mVertexCreaseVersion))
+  {
+    rebuild();
+    evaluate();
+  }
+  else if (vertexLayer->getDataVersion() != mVertexVersion)
+    evaluate();
+
+  mEdgeCreaseLayer = edgeCreaseLayer;
+  mVertexCreaseLayer = vertexCreaseLayer;
+  if (edgeCreaseLayer)
+    mEdgeCreaseVersion = edgeCreaseLayer->getDataVersion();
+  if (vertexCreaseLayer)
+    mVertexCreaseVersion = vertexCreaseLayer->getDataVersion();
+  mNodeVersion = mNode.getDataVersion();
+  mStructureVersion = vertexLayer->getStructureVersion();
+  mVertexVersion = vertexLayer->getDataVersion();
+  mPolygonVersion = polygonLayer->getDataVersion();
+  mLevelsChanged = false;
+  mValid = true;
+}
+
+void GeometrySubdivision::rebuild(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+  const GeometryLayer* edgeCreaseLayer = mNode.getEdgeCreaseLayer();
+  const GeometryLayer* vertexCreaseLayer = mNode.getVertexCreaseLayer();
+
+  const BasePolygon* polygons = reinterpret_cast<const BasePolygon*>(polygonLayer->mData.getitems());
+
+  uint32 vertexCount = mNode.getHighestVertexID();
+  if (vertexCount == INVALID_VERTEX_ID)
+    vertexCount = 0;
+  else
+    vertexCount++;
+
+  uint32 polygonCount = mNode.getHighestPolygonID();
+  if (polygonCount == INVALID_POLYGON_ID)
+    polygonCount = 0;
+  else
+    polygonCount++;
+
+  // Build the base level from the valid polygons, numbering only the
+  // vertices they use.
+
+  Level levels[2];
+  Level* level = levels;
+  level->mVertexCount = 0;
+
+  IDList remap(vertexCount, INVALID_VERTEX_ID);
+  IDList baseIDs;
+
+  for (uint32 polygonID = 0;  polygonID < polygonCount;  polygonID++)
+  {
+    const BasePolygon& polygon = polygons[polygonID];
+
+    unsigned int cornerCount = 0;
+
+    while (cornerCount < 4)
+    {
+      const uint32 vertexID = polygon.mIndices[cornerCount];
+      if (vertexID >= vertexCount || !mNode.isVertex(vertexID))
+	break;
+
+      cornerCount++;
+    }
+
+    if (cornerCount < 3)
+      continue;
+
+    for (unsigned int i = 0;  i < 4;  i++)
+    {
+      if (i >= cornerCount)
+      {
+	level->mFaces.push_back(INVALID_VERTEX_ID);
+	level->mCornerWeights.push_back(0.0);
+	continue;
+      }
+
+      const uint32 vertexID = polygon.mIndices[i];
+
+      if (remap[vertexID] == INVALID_VERTEX_ID)
+      {
+	remap[vertexID] = baseIDs.size();
+	baseIDs.push_back(vertexID);
+      }
+
+      level->mFaces.push_back(remap[vertexID]);
+
+      uint32 crease = mNode.getEdgeDefaultCrease();
+      if (edgeCreaseLayer)
+      {
+	crease = edgeCreaseLayer->getDefaultInt();
+	if (polygonID < edgeCreaseLayer->mData.getItemCount())
+	  crease = reinterpret_cast<const uint32*>(edgeCreaseLayer->mData.getitems())[polygonID * 4 + i];
+      }
+
+      level->mCornerWeights.push_back(crease / MAX_CREASE);
+    }
+
+    level->mCornerCounts.push_back(cornerCount);
+  }
+
+  level->mVertexCount = baseIDs.size();
+
+  for (IDList::const_iterator i = baseIDs.begin();  i != baseIDs.end();  i++)
+  {
+    uint32 crease = mNode.getVertexDefaultCrease();
+    if (vertexCreaseLayer)
+    {
+      crease = vertexCreaseLayer->getDefaultInt();
+      if (*i < vertexCreaseLayer->mData.getItemCount())
+	crease = reinterpret_cast<const uint32*>(vertexCreaseLayer->mData.getitems())[*i];
+    }
+
+    level->mVertexWeights.push_back(crease / MAX_CREASE);
+  }
+
+  // The stencils of the base level simply select each base vertex.
+
+  mStencilStarts.resize(baseIDs.size() + 1);
+  mStencilIndices = baseIDs;
+  mStencilWeights.assign(baseIDs.size(), 1.0);
+
+  for (uint32 i = 0;  i <= baseIDs.size();  i++)
+    mStencilStarts[i] = i;
+
+  for (unsigned int i = 0;  i < mLevelCount;  i++)
+  {
+    level->buildEdges();
+
+    Level& next = levels[level == levels ? 1 : 0];
+    level->refine(next);
+
+    Refinement refinement;
+    refinement.mLevel = level;
+    refinement.mSourceStarts = &mStencilStarts;
+    refinement.mSourceIndices = &mStencilIndices;
+    refinement.mSourceWeights = &mStencilWeights;
+    refinement.mCounts.resize(next.mVertexCount);
+    refinement.mFill = false;
+
+    Thread::parallelFor(refineRange, &refinement, next.mVertexCount, 1024);
+
+    refinement.mStarts.resize(next.mVertexCount + 1);
+    refinement.mStarts[0] = 0;
+
+    for (uint32 j = 0;  j < next.mVertexCount;  j++)
+      refinement.mStarts[j + 1] = refinement.mStarts[j] + refinement.mCounts[j];
+
+    refinement.mIndices.resize(refinement.mStarts[next.mVertexCount]);
+    refinement.mWeights.resize(refinement.mStarts[next.mVertexCount]);
+    refinement.mFill = true;
+
+    Thread::parallelFor(refineRange, &refinement, next.mVertexCount, 1024);
+
+    // Pack the stencils, as merging terms leaves gaps after most of them.
+
+    mStencilStarts.resize(next.mVertexCount + 1);
+    mStencilIndices.clear();
+    mStencilWeights.clear();
+
+    for (uint32 j = 0;  j < next.mVertexCount;  j++)
+    {
+      const uint32 start = refinement.mStarts[j];
+
+      mStencilStarts[j] = mStencilIndices.size();
+      mStencilIndices.insert(mStencilIndices.end(),
+                             refinement.mIndices.begin() + start,
+			     refinement.mIndices.begin() + start + refinement.mCounts[j]);
+      mStencilWeights.insert(mStencilWeights.end(),
+                             refinement.mWeights.begin() + start,
+			     refinement.mWeights.begin() + start + refinement.mCounts[j]);
+    }
+
+    mStencilStarts[next.mVertexCount] = mStencilIndices.size();
+
+    level = &next;
+  }
+
+  mFaces.swap(level->mFaces);
+  mPoints.resize(mStencilStarts.size() - 1);
+}
+
+void GeometrySubdivision::evaluate(void)
+{
+  // The snapshot expands compact vertices, and is only kept while the
+  // points are being evaluated.
+
+  mNode.mBaseVertexLayer->getSnapshot(mVertices);
+  Thread::parallelFor(evaluateRange, this, mPoints.size(), 1024);
+  mVertices.release();
+}
+
+void GeometrySubdivision::evaluateRange(void* data, uint32 first, uint32 count)
+{
+  GeometrySubdivision& subdivision = *reinterpret_cast<GeometrySubdivision*>(data);
+
+  const BaseVertex* vertices = reinterpret_cast<const BaseVertex*>(subdivision.mVertices.getitems());
+
+  for (uint32 i = first;  i < first + count;  i++)
+  {
+    Vector3d point(0.0, 0.0, 0.0);
+
+    for (uint32 j = subdivision.mStencilStarts[i];  j < subdivision.mStencilStarts[i + 1];  j++)
+    {
+      const BaseVertex& vertex = vertices[subdivision.mStencilIndices[j]];
+      const real64 weight = subdivision.mStencilWeights[j];
+
+      point.x += vertex.x * weight;
+      point.y += vertex.y * weight;
+      point.z += vertex.z * weight;
+    }
+
+    subdivision.mPoints[i] = point;
+  }
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
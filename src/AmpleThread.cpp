@@ -0,0 +1,405 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <list>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+class ThreadStart
+{
+public:
+  Thread::Function mFunction;
+  void* mData;
+};
+
+#ifdef _WIN32
+
+DWORD WINAPI runThread(LPVOID data)
+{
+  ThreadStart* start = reinterpret_cast<ThreadStart*>(data);
+  start->mFunction(start->mData);
+  delete start;
+  return 0;
+}
+
+#else
+
+void* runThread(void* data)
+{
+  ThreadStart* start = reinterpret_cast<ThreadStart*>(data);
+  start->mFunction(start->mData);
+  delete start;
+  return NULL;
+}
+
+#endif /*_WIN32*/
+
+// Number of chunks each thread should get on average when a range is split,
+// so that idle threads can take over work from busy ones.
+const uint32 CHUNKS_PER_THREAD = 8;
+
+// Range being processed by Thread::parallelFor. Chunks are claimed in order
+// by any thread that is idle, including the one that posted the range.
+class RangeBatch
+{
+public:
+  Thread::RangeFunction mFunction;
+  void* mData;
+  uint32 mCount;
+  uint32 mChunkSize;
+  uint32 mNext;
+  uint32 mBusy;
+};
+
+// Worker threads shared by all calls to Thread::parallelFor, started the
+// first time they're needed and kept until exit.
+class WorkerPool
+{
+public:
+  WorkerPool(void);
+  ~WorkerPool(void);
+  void run(RangeBatch& batch);
+private:
+  typedef std::list<RangeBatch*> BatchList;
+  void start(void);
+  void claim(RangeBatch& batch);
+  static void work(void* data);
+  Mutex mMutex;
+  Condition mPosted;
+  Condition mFinished;
+  std::vector<Thread*> mThreads;
+  BatchList mBatches;
+  bool mStarted;
+  bool mStopping;
+};
+
+WorkerPool::WorkerPool(void):
+  mStarted(false),
+  mStopping(false)
+{
+}
+
+WorkerPool::~WorkerPool(void)
+{
+  mMutex.lock();
+  mStopping = true;
+  mPosted.signal();
+  mMutex.unlock();
+
+  for (std::vector<Thread*>::iterator i = mThreads.begin();  i != mThreads.end();  i++)
+    delete *i;
+}
+
+void WorkerPool::run(RangeBatch& batch)
+{
+  mMutex.lock();
+
+  if (!mStarted)
+    start();
+
+  mBatches.push_back(&batch);
+  mPosted.signal();
+
+  // The posting thread works on its own range as well, so ranges posted
+  // from within a range function cannot deadlock waiting for the pool.
+
+  while (batch.mNext < batch.mCount)
+    claim(batch);
+
+  while (batch.mBusy)
+    mFinished.wait(mMutex);
+
+  mMutex.unlock();
+}
+
+void WorkerPool::start(void)
+{
+  // The calling thread makes up the last processor. Any worker that could
+  // not be started simply leaves more chunks for the others.
+
+  const unsigned int count = Thread::getProcessorCount();
+
+  for (unsigned int i = 1;  i < count;  i++)
+  {
+    if (Thread* thread = Thread::create(work, this))
+      mThreads.push_back(thread);
+  }
+
+  mStarted = true;
+}
+
+void WorkerPool::claim(RangeBatch& batch)
+{
+  // Called with the mutex locked, which is released while the chunk is
+  // being processed.
+
+  const uint32 first = batch.mNext;
+  const uint32 count = std::min(batch.mChunkSize, batch.mCount - first);
+
+  batch.mNext += count;
+  batch.mBusy++;
+
+  if (batch.mNext == batch.mCount)
+    mBatches.remove(&batch);
+
+  mMutex.unlock();
+  batch.mFunction(batch.mData, first, count);
+  mMutex.lock();
+
+  batch.mBusy--;
+
+  if (!batch.mBusy && batch.mNext == batch.mCount)
+    mFinished.signal();
+}
+
+void WorkerPool::work(void* data)
+{
+  WorkerPool& pool = *reinterpret_cast<WorkerPool*>(data);
+
+  pool.mMutex.lock();
+
+  while (!pool.mStopping)
+  {
+    if (pool.mBatches.empty())
+      pool.mPosted.wait(pool.mMutex);
+    else
+      pool.claim(*pool.mBatches.front());
+  }
+
+  pool.mMutex.unlock();
+}
+
+WorkerPool workers;
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+Thread::~Thread(void)
+{
+  wait();
+}
+
+void Thread::wait(void)
+{
+  if (!mHandle)
+    return;
+
+#ifdef _WIN32
+  HANDLE handle = reinterpret_cast<HANDLE>(mHandle);
+  WaitForSingleObject(handle, INFINITE);
+  CloseHandle(handle);
+#else
+  pthread_t* handle = reinterpret_cast<pthread_t*>(mHandle);
+  pthread_join(*handle, NULL);
+  delete handle;
+#endif
+
+  mHandle = NULL;
+}
+
+Thread* Thread::create(Function function, void* data)
+{
+  ThreadStart* start = new ThreadStart;
+  start->mFunction = function;
+  start->mData = data;
+
+#ifdef _WIN32
+  HANDLE handle = CreateThread(NULL, 0, runThread, start, 0, NULL);
+  if (!handle)
+  {
+    delete start;
+    return NULL;
+  }
+#else
+  pthread_t* handle = new pthread_t;
+  if (pthread_create(handle, NULL, runThread, start) != 0)
+  {
+    delete handle;
+    delete start;
+    return NULL;
+  }
+#endif
+
+  Thread* thread = new Thread();
+  thread->mHandle = handle;
+  return thread;
+}
+
+void Thread::parallelFor(RangeFunction function, void* data, uint32 count, uint32 grain)
+{
+  if (!count)
+    return;
+
+  uint32 workerCount = getProcessorCount();
+
+  if (grain)
+    workerCount = std::min(workerCount, (count + grain - 1) / grain);
+
+  if (workerCount < 2)
+  {
+    function(data, 0, count);
+    return;
+  }
+
+  RangeBatch batch;
+  batch.mFunction = function;
+  batch.mData = data;
+  batch.mCount = count;
+  batch.mChunkSize = std::max(std::max(grain, (uint32) 1),
+                              count / (workerCount * CHUNKS_PER_THREAD));
+  batch.mNext = 0;
+  batch.mBusy = 0;
+
+  workers.run(batch);
+}
+
+unsigned int Thread::getProcessorCount(void)
+{
+  static unsigned int count = 0;
+
+  if (!count)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    count = info.dwNumberOfProcessors;
+#else
+    long result = sysconf(_SC_NPROCESSORS_ONLN);
+    if (result > 0)
+      count = (unsigned int) result;
+#endif
+
+    if (!count)
+      count = 1;
+  }
+
+  return count;
+}
+
+Thread::Thread(void):
+  mHandle(NULL)
+{
+}
+
+//---------------------------------------------------------------------
+
+Mutex::Mutex(void)
+{
+#ifdef _WIN32
+  CRITICAL_SECTION* handle = new CRITICAL_SECTION;
+  InitializeCriticalSection(handle);
+#else
+  pthread_mutex_t* handle = new pthread_mutex_t;
+  pthread_mutex_init(handle, NULL);
+#endif
+
+  mHandle = handle;
+}
+
+Mutex::~Mutex(void)
+{
+#ifdef _WIN32
+  CRITICAL_SECTION* handle = reinterpret_cast<CRITICAL_SECTION*>(mHandle);
+  DeleteCriticalSection(handle);
+#else
+  pthread_mutex_t* handle = reinterpret_cast<pthread_mutex_t*>(mHandle);
+  pthread_mutex_destroy(handle);
+#endif
+
+  delete handle;
+}
+
+void Mutex::lock(void)
+{
+#ifdef _WIN32
+  EnterCriticalSection(reinterpret_cast<CRITICAL_SECTION*>(mHandle));
+#else
+  pthread_mutex_lock(reinterpret_cast<pthread_mutex_t*>(mHandle));
+#endif
+}
+
+void Mutex::unlock(void)
+{
+#ifdef _WIN32
+  LeaveCriticalSection(reinterpret_cast<CRITICAL_SECTION*>(mHandle));
+#else
+  pthread_mutex_unlock(reinterpret_cast<pthread_mutex_t*>(mHandle));
+#endif
+}
+
+//---------------------------------------------------------------------
+
+Condition::Condition(void)
+{
+#ifdef _WIN32
+  CONDITION_VARIABLE* handle = new CONDITION_VARIABLE;
+  InitializeConditionVariable(handle);
+#else
+  pthread_cond_t* handle = new pthread_cond_t;
+  pthread_cond_init(handle, NULL);
+#endif
+
+  mHandle = handle;
+}
+
+Condition::~Condition(void)
+{
+#ifdef _WIN32
+  CONDITION_VARIABLE* handle = reinterpret_cast<CONDITION_VARIABLE*>(mHandle);
+#else
+  pthread_cond_t* handle = reinterpret_cast<pthread_cond_t*>(mHandle);
+  pthread_cond_destroy(handle);
+#endif
+
+  delete handle;
+}
+
+void Condition::wait(Mutex& mutex)
+{
+#ifdef _WIN32
+  SleepConditionVariableCS(reinterpret_cast<CONDITION_VARIABLE*>(mHandle),
+                           reinterpret_cast<CRITICAL_SECTION*>(mutex.mHandle),
+			   INFINITE);
+#else
+  pthread_cond_wait(reinterpret_cast<pthread_cond_t*>(mHandle),
+                    reinterpret_cast<pthread_mutex_t*>(mutex.mHandle));
+#endif
+}
+
+void Condition::signal(void)
+{
+#ifdef _WIN32
+  WakeAllConditionVariable(reinterpret_cast<CONDITION_VARIABLE*>(mHandle));
+#else
+  pthread_cond_broadcast(reinterpret_cast<pthread_cond_t*>(mHandle));
+#endif
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
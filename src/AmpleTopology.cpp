@@ -0,0 +1,449 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+uint32 GeometryTopology::getPolygonEdge(uint32 polygonID) const
+{
+  if (!getCornerCount(polygonID))
+    return INVALID_EDGE_ID;
+
+  return polygonID * 4;
+}
+
+uint32 GeometryTopology::getVertexEdge(uint32 vertexID) const
+{
+  if (vertexID >= mVertexEdges.size())
+    return INVALID_EDGE_ID;
+
+  return mVertexEdges[vertexID];
+}
+
+uint32 GeometryTopology::getNextEdge(uint32 edgeID) const
+{
+  if (!isValidEdge(edgeID))
+    return INVALID_EDGE_ID;
+
+  const uint32 polygonID = edgeID / 4;
+  return polygonID * 4 + (edgeID % 4 + 1) % mCornerCounts[polygonID];
+}
+
+uint32 GeometryTopology::getPreviousEdge(uint32 edgeID) const
+{
+  if (!isValidEdge(edgeID))
+    return INVALID_EDGE_ID;
+
+  const uint32 polygonID = edgeID / 4;
+  const unsigned int cornerCount = mCornerCounts[polygonID];
+  return polygonID * 4 + (edgeID % 4 + cornerCount - 1) % cornerCount;
+}
+
+uint32 GeometryTopology::getTwinEdge(uint32 edgeID) const
+{
+  if (!isValidEdge(edgeID))
+    return INVALID_EDGE_ID;
+
+  return mTwins[edgeID];
+}
+
+uint32 GeometryTopology::getEdgeOrigin(uint32 edgeID) const
+{
+  if (!isValidEdge(edgeID))
+    return INVALID_VERTEX_ID;
+
+  return mIndices[edgeID];
+}
+
+uint32 GeometryTopology::getEdgeTarget(uint32 edgeID) const
+{
+  if (!isValidEdge(edgeID))
+    return INVALID_VERTEX_ID;
+
+  return mIndices[getNextEdge(edgeID)];
+}
+
+uint32 GeometryTopology::getEdgePolygon(uint32 edgeID) const
+{
+  if (!isValidEdge(edgeID))
+    return INVALID_POLYGON_ID;
+
+  return edgeID / 4;
+}
+
+bool GeometryTopology::isValidEdge(uint32 edgeID) const
+{
+  return edgeID % 4 < getCornerCount(edgeID / 4);
+}
+
+bool GeometryTopology::isBoundaryEdge(uint32 edgeID) const
+{
+  return isValidEdge(edgeID) && mTwins[edgeID] == INVALID_EDGE_ID;
+}
+
+bool GeometryTopology::isBoundaryVertex(uint32 vertexID) const
+{
+  // Outgoing boundary half-edges are preferred for vertices, so checking
+  // the one stored is enough.
+
+  return isBoundaryEdge(getVertexEdge(vertexID));
+}
+
+unsigned int GeometryTopology::getCornerCount(uint32 polygonID) const
+{
+  if (polygonID >= mCornerCounts.size())
+    return 0;
+
+  return mCornerCounts[polygonID];
+}
+
+GeometryNode& GeometryTopology::getNode(void) const
+{
+  return mNode;
+}
+
+GeometryTopology::GeometryTopology(GeometryNode& node):
+  mNode(node),
+  mVertexStructureVersion(0),
+  mVertexVersion(0),
+  mPolygonVersion(0),
+  mValid(false)
+{
+}
+
+void GeometryTopology::update(void)
+{
+  const GeometryLayer* vertexLayer = mNode.mBaseVertexLayer;
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (!vertexLayer || !polygonLayer)
+  {
+    mIndices.clear();
+    mCornerCounts.clear();
+    mTwins.clear();
+    mVertexEdges.clear();
+    mEdges.clear();
+    mDetached.clear();
+    mValid = false;
+    return;
+  }
+
+  bool full = !mValid;
+
+  IDRangeSet polygons;
+
+  if (!full && polygonLayer->getDataVersion() != mPolygonVersion)
+  {
+    if (!polygonLayer->getChangedSlots(mPolygonVersion, polygons))
+      full = true;
+    else if (polygons.getIDCount() > mCornerCounts.size() / 2)
+      full = true;
+  }
+
+  // Moved vertices don't affect the topology, but deleted and created ones
+  // change which polygons and corners are valid.
+
+  IDRangeSet vertices;
+
+  if (!full && vertexLayer->getStructureVersion() != mVertexStructureVersion)
+  {
+    if (!vertexLayer->getChangedSlots(mVertexVersion, vertices))
+      full = true;
+  }
+
+  if (full)
+    rebuild();
+  else if (!polygons.isEmpty() || !vertices.isEmpty())
+  {
+    uint32 polygonCount = mNode.getHighestPolygonID();
+    if (polygonCount == INVALID_POLYGON_ID)
+      polygonCount = 0;
+    else
+      polygonCount++;
+
+    uint32 vertexCount = mNode.getHighestVertexID();
+    if (vertexCount == INVALID_VERTEX_ID)
+      vertexCount = 0;
+    else
+      vertexCount++;
+
+    reserve(polygonCount, vertexCount);
+
+    IDList changed;
+
+    const IDRangeSet::RangeList& polygonRanges = polygons.getRanges();
+    for (IDRangeSet::RangeList::const_iterator i = polygonRanges.begin();  i != polygonRanges.end();  i++)
+    {
+      for (uint32 polygonID = (*i).mFirst;  polygonID < (*i).getEnd();  polygonID++)
+	changed.push_back(polygonID);
+    }
+
+    bool created = false;
+
+    const IDRangeSet::RangeList& vertexRanges = vertices.getRanges();
+    for (IDRangeSet::RangeList::const_iterator i = vertexRanges.begin();  i != vertexRanges.end();  i++)
+    {
+      const uint32 end = std::min((*i).getEnd(), (uint32) mVertexEdges.size());
+
+      for (uint32 vertexID = (*i).mFirst;  vertexID < end;  vertexID++)
+      {
+	if (vertexID < vertexCount && mNode.isVertex(vertexID))
+	{
+	  created = true;
+	  continue;
+	}
+
+	// Every polygon using a vertex has a half-edge starting at it.
+
+	EdgeMap::const_iterator edge = mEdges.lower_bound(VertexPair(vertexID, 0));
+	while (edge != mEdges.end() && edge->first.first == vertexID)
+	{
+	  changed.push_back(edge->second / 4);
+	  edge++;
+	}
+      }
+    }
+
+    if (created)
+      changed.insert(changed.end(), mDetached.begin(), mDetached.end());
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    for (IDList::const_iterator i = changed.begin();  i != changed.end();  i++)
+      detachPolygon(*i);
+
+    for (IDList::const_iterator i = changed.begin();  i != changed.end();  i++)
+      attachPolygon(*i);
+
+    resolvePairs();
+    resolveVertices();
+  }
+
+  mVertexStructureVersion = vertexLayer->getStructureVersion();
+  mVertexVersion = vertexLayer->getDataVersion();
+  mPolygonVersion = polygonLayer->getDataVersion();
+  mValid = true;
+}
+
+void GeometryTopology::rebuild(void)
+{
+  uint32 polygonCount = mNode.getHighestPolygonID();
+  if (polygonCount == INVALID_POLYGON_ID)
+    polygonCount = 0;
+  else
+    polygonCount++;
+
+  uint32 vertexCount = mNode.getHighestVertexID();
+  if (vertexCount == INVALID_VERTEX_ID)
+    vertexCount = 0;
+  else
+    vertexCount++;
+
+  mIndices.clear();
+  mCornerCounts.clear();
+  mTwins.clear();
+  mVertexEdges.clear();
+  mEdges.clear();
+  mDetached.clear();
+
+  reserve(polygonCount, vertexCount);
+
+  for (uint32 polygonID = 0;  polygonID < polygonCount;  polygonID++)
+    attachPolygon(polygonID);
+
+  resolvePairs();
+  resolveVertices();
+}
+
+void GeometryTopology::detachPolygon(uint32 polygonID)
+{
+  mDetached.erase(polygonID);
+
+  if (polygonID >= mCornerCounts.size())
+    return;
+
+  const unsigned int cornerCount = getCornerCount(polygonID);
+
+  for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+  {
+    const uint32 edgeID = polygonID * 4 + corner;
+    const uint32 origin = mIndices[edgeID];
+    const uint32 target = mIndices[polygonID * 4 + (corner + 1) % cornerCount];
+
+    std::pair<EdgeMap::iterator,EdgeMap::iterator> range = mEdges.equal_range(VertexPair(origin, target));
+    for (EdgeMap::iterator i = range.first;  i != range.second;  i++)
+    {
+      if (i->second == edgeID)
+      {
+	mEdges.erase(i);
+	break;
+      }
+    }
+
+    mPendingPairs.push_back(VertexPair(std::min(origin, target), std::max(origin, target)));
+    mPendingVertices.push_back(origin);
+  }
+
+  for (unsigned int corner = 0;  corner < 4;  corner++)
+  {
+    mIndices[polygonID * 4 + corner] = INVALID_VERTEX_ID;
+    mTwins[polygonID * 4 + corner] = INVALID_EDGE_ID;
+  }
+
+  mCornerCounts[polygonID] = 0;
+}
+
+void GeometryTopology::attachPolygon(uint32 polygonID)
+{
+  const GeometryLayer* polygonLayer = mNode.mBasePolygonLayer;
+
+  if (polygonID >= mCornerCounts.size() ||
+      polygonID >= polygonLayer->mData.getItemCount())
+    return;
+
+  const BasePolygon& polygon = reinterpret_cast<const BasePolygon*>(polygonLayer->mData.getitems())[polygonID];
+  if (!polygon.isValid())
+    return;
+
+  const uint32 vertexCount = mVertexEdges.size();
+
+  // Polygons using deleted vertices are remembered, so that they can be
+  // brought back if those vertices are created again.
+
+  unsigned int cornerCount = 0;
+
+  while (cornerCount < 4)
+  {
+    const uint32 vertexID = polygon.mIndices[cornerCount];
+    if (vertexID >= vertexCount || !mNode.isVertex(vertexID))
+      break;
+
+    cornerCount++;
+  }
+
+  if (cornerCount < 4 && polygon.mIndices[cornerCount] != INVALID_VERTEX_ID)
+    mDetached.insert(polygonID);
+
+  if (cornerCount < 3)
+    return;
+
+  for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+    mIndices[polygonID * 4 + corner] = polygon.mIndices[corner];
+
+  mCornerCounts[polygonID] = cornerCount;
+
+  for (unsigned int corner = 0;  corner < cornerCount;  corner++)
+  {
+    const uint32 origin = polygon.mIndices[corner];
+    const uint32 target = polygon.mIndices[(corner + 1) % cornerCount];
+
+    mEdges.insert(EdgeMap::value_type(VertexPair(origin, target), polygonID * 4 + corner));
+
+    mPendingPairs.push_back(VertexPair(std::min(origin, target), std::max(origin, target)));
+    mPendingVertices.push_back(origin);
+  }
+}
+
+void GeometryTopology::resolvePairs(void)
+{
+  std::sort(mPendingPairs.begin(), mPendingPairs.end());
+  mPendingPairs.erase(std::unique(mPendingPairs.begin(), mPendingPairs.end()), mPendingPairs.end());
+
+  for (PairList::const_iterator i = mPendingPairs.begin();  i != mPendingPairs.end();  i++)
+  {
+    std::pair<EdgeMap::iterator,EdgeMap::iterator> forward = mEdges.equal_range(*i);
+    std::pair<EdgeMap::iterator,EdgeMap::iterator> reverse = mEdges.equal_range(VertexPair(i->second, i->first));
+
+    const size_t forwardCount = std::distance(forward.first, forward.second);
+    const size_t reverseCount = std::distance(reverse.first, reverse.second);
+
+    // Half-edges are only twinned if they are alone in each direction.
+
+    if (i->first != i->second && forwardCount == 1 && reverseCount == 1)
+    {
+      mTwins[forward.first->second] = reverse.first->second;
+      mTwins[reverse.first->second] = forward.first->second;
+      continue;
+    }
+
+    for (EdgeMap::iterator j = forward.first;  j != forward.second;  j++)
+      mTwins[j->second] = INVALID_EDGE_ID;
+
+    for (EdgeMap::iterator j = reverse.first;  j != reverse.second;  j++)
+      mTwins[j->second] = INVALID_EDGE_ID;
+
+    // The boundary status of the vertices may have changed.
+
+    mPendingVertices.push_back(i->first);
+    mPendingVertices.push_back(i->second);
+  }
+
+  mPendingPairs.clear();
+}
+
+void GeometryTopology::resolveVertices(void)
+{
+  std::sort(mPendingVertices.begin(), mPendingVertices.end());
+  mPendingVertices.erase(std::unique(mPendingVertices.begin(), mPendingVertices.end()), mPendingVertices.end());
+
+  for (IDList::const_iterator i = mPendingVertices.begin();  i != mPendingVertices.end();  i++)
+    resolveVertex(*i);
+
+  mPendingVertices.clear();
+}
+
+void GeometryTopology::resolveVertex(uint32 vertexID)
+{
+  if (vertexID >= mVertexEdges.size())
+    return;
+
+  uint32 result = INVALID_EDGE_ID;
+
+  EdgeMap::const_iterator edge = mEdges.lower_bound(VertexPair(vertexID, 0));
+  while (edge != mEdges.end() && edge->first.first == vertexID)
+  {
+    if (mTwins[edge->second] == INVALID_EDGE_ID)
+    {
+      result = edge->second;
+      break;
+    }
+
+    if (result == INVALID_EDGE_ID)
+      result = edge->second;
+
+    edge++;
+  }
+
+  mVertexEdges[vertexID] = result;
+}
+
+void GeometryTopology::reserve(uint32 polygonCount, uint32 vertexCount)
+{
+  if (polygonCount > mCornerCounts.size())
+  {
+    mIndices.resize(polygonCount * 4, INVALID_VERTEX_ID);
+    mTwins.resize(polygonCount * 4, INVALID_EDGE_ID);
+    mCornerCounts.resize(polygonCount, 0);
+  }
+
+  if (vertexCount > mVertexEdges.size())
+    mVertexEdges.resize(vertexCount, INVALID_EDGE_ID);
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+
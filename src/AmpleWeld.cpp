@@ -0,0 +1,427 @@
+//---------------------------------------------------------------------
+// Simple C++ retained mode library for Verse
+// Copyright (c) PDC, KTH
+// Written by Camilla Berglund <elmindreda@elmindreda.org>
+//---------------------------------------------------------------------
+
+#include <verse.h>
+
+#include <Ample.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace verse
+{
+  namespace ample
+  {
+
+//---------------------------------------------------------------------
+
+namespace
+{
+
+// Number of vertex slots searched by each task.
+const uint32 CHUNK_SIZE = 16384;
+
+uint32 getChunkCount(uint32 count)
+{
+  return (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// The stored slots of a vertex layer other than the base layer, which must
+// be identical for two vertices to be merged.
+class Attribute
+{
+public:
+  const uint8* getSlot(uint32 vertexID) const;
+  const uint8* mSlots;
+  uint32 mSlotCount;
+  uint32 mSlotSize;
+  std::vector<uint8> mDefaults;
+};
+
+const uint8* Attribute::getSlot(uint32 vertexID) const
+{
+  if (vertexID < mSlotCount)
+    return mSlots + vertexID * mSlotSize;
+
+  return &mDefaults[0];
+}
+
+// A vertex and a lower-numbered vertex it may be merged into.
+class Candidate
+{
+public:
+  bool operator < (const Candidate& other) const;
+  bool operator == (const Candidate& other) const;
+  uint32 mVertexID;
+  uint32 mTargetID;
+};
+
+bool Candidate::operator < (const Candidate& other) const
+{
+  if (mVertexID != other.mVertexID)
+    return mVertexID < other.mVertexID;
+
+  return mTargetID < other.mTargetID;
+}
+
+bool Candidate::operator == (const Candidate& other) const
+{
+  return mVertexID == other.mVertexID && mTargetID == other.mTargetID;
+}
+
+typedef std::vector<Candidate> CandidateList;
+
+// State shared by the passes of a weld. Vertices are hashed by the grid cell
+// they fall in, with cells as wide as the tolerance, so every vertex within
+// the tolerance of another is found in the surrounding cells.
+class Weld
+{
+public:
+  bool isVertex(uint32 vertexID) const;
+  bool isMatch(uint32 vertexID, uint32 otherID) const;
+  void getCell(uint32 vertexID, real64* cell) const;
+  uint32 getBucket(const real64* cell) const;
+  Block mVertexData;
+  const real64* mVertices;
+  uint32 mVertexCount;
+  real64 mTolerance;
+  real64 mScale;
+  int mRadius;
+  std::vector<Attribute> mAttributes;
+  uint32 mBucketMask;
+  std::vector<uint32> mBuckets;
+  std::vector<uint32> mOffsets;
+  std::vector<uint32> mEntries;
+  std::vector<CandidateList> mCandidates;
+};
+
+bool Weld::isVertex(uint32 vertexID) const
+{
+  if (vertexID >= mVertexCount)
+    return false;
+
+  const real64* vertex = mVertices + vertexID * 3;
+  return vertex[0] != V_REAL64_MAX && vertex[1] != V_REAL64_MAX && vertex[2] != V_REAL64_MAX;
+}
+
+bool Weld::isMatch(uint32 vertexID, uint32 otherID) const
+{
+  const real64* vertex = mVertices + vertexID * 3;
+  const real64* other = mVertices + otherID * 3;
+
+  real64 distance = 0.0;
+
+  for (unsigned int i = 0;  i < 3;  i++)
+    distance += (vertex[i] - other[i]) * (vertex[i] - other[i]);
+
+  if (distance > mTolerance * mTolerance)
+    return false;
+
+  for (std::vector<Attribute>::const_iterator i = mAttributes.begin();  i != mAttributes.end();  i++)
+  {
+    if (std::memcmp((*i).getSlot(vertexID), (*i).getSlot(otherID), (*i).mSlotSize) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+void Weld::getCell(uint32 vertexID, real64* cell) const
+{
+  // Without a tolerance, each distinct position is a cell of its own. Adding
+  // zero turns negative zero into zero, so both land in the same cell.
+
+  const real64* vertex = mVertices + vertexID * 3;
+
+  for (unsigned int i = 0;  i < 3;  i++)
+  {
+    if (mRadius)
+      cell[i] = std::floor(vertex[i] * mScale);
+    else
+      cell[i] = vertex[i] + 0.0;
+  }
+}
+
+uint32 Weld::getBucket(const real64* cell) const
+{
+  uint32 words[6];
+  std::memcpy(words, cell, sizeof(words));
+
+  uint32 hash = 0;
+
+  for (unsigned int i = 0;  i < 6;  i++)
+    hash = (hash ^ words[i]) * 0x9e3779b1;
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+
+  return hash & mBucketMask;
+}
+
+void hashVertices(void* data, uint32 first, uint32 count)
+{
+  Weld& weld = *reinterpret_cast<Weld*>(data);
+
+  for (uint32 vertexID = first;  vertexID < first + count;  vertexID++)
+  {
+    if (!weld.isVertex(vertexID))
+    {
+      weld.mBuckets[vertexID] = INVALID_VERTEX_ID;
+      continue;
+    }
+
+    real64 cell[3];
+    weld.getCell(vertexID, cell);
+    weld.mBuckets[vertexID] = weld.getBucket(cell);
+  }
+}
+
+void searchChunks(void* data, uint32 first, uint32 count)
+{
+  Weld& weld = *reinterpret_cast<Weld*>(data);
+
+  for (uint32 chunk = first;  chunk < first + count;  chunk++)
+  {
+    const uint32 start = chunk * CHUNK_SIZE;
+    const uint32 end = std::min(start + CHUNK_SIZE, weld.mVertexCount);
+
+    CandidateList& candidates = weld.mCandidates[chunk];
+
+    for (uint32 vertexID = start;  vertexID < end;  vertexID++)
+    {
+      if (weld.mBuckets[vertexID] == INVALID_VERTEX_ID)
+	continue;
+
+      real64 cell[3];
+      weld.getCell(vertexID, cell);
+
+      const size_t found = candidates.size();
+
+      for (int x = -weld.mRadius;  x <= weld.mRadius;  x++)
+      {
+	for (int y = -weld.mRadius;  y <= weld.mRadius;  y++)
+	{
+	  for (int z = -weld.mRadius;  z <= weld.mRadius;  z++)
+	  {
+	    const real64 neighbor[3] = { cell[0] + x, cell[1] + y, cell[2] + z };
+	    const uint32 bucket = weld.getBucket(neighbor);
+
+	    for (uint32 i = weld.mOffsets[bucket];  i < weld.mOffsets[bucket + 1];  i++)
+	    {
+	      const uint32 otherID = weld.mEntries[i];
+
+	      if (otherID < vertexID && weld.isMatch(vertexID, otherID))
+	      {
+		Candidate candidate;
+		candidate.mVertexID = vertexID;
+		candidate.mTargetID = otherID;
+		candidates.push_back(candidate);
+	      }
+	    }
+	  }
+	}
+      }
+
+      // Neighbouring cells may share a bucket, so the same vertex can be
+      // found more than once.
+
+      std::sort(candidates.begin() + found, candidates.end());
+      candidates.erase(std::unique(candidates.begin() + found, candidates.end()), candidates.end());
+    }
+  }
+}
+
+} /*namespace*/
+
+//---------------------------------------------------------------------
+
+size_t GeometryNode::weldVertices(real64 tolerance, ProgressFunction function, void* data)
+{
+  if (!mBaseVertexLayer || !mBasePolygonLayer)
+    return 0;
+
+  Weld weld;
+  mBaseVertexLayer->getSnapshot(weld.mVertexData);
+  weld.mVertices = reinterpret_cast<const real64*>(weld.mVertexData.getitems());
+  weld.mVertexCount = weld.mVertexData.getItemCount();
+  weld.mTolerance = std::max(tolerance, 0.0);
+
+  if (weld.mTolerance > 0.0)
+  {
+    weld.mScale = 1.0 / weld.mTolerance;
+    weld.mRadius = 1;
+  }
+  else
+  {
+    weld.mScale = 0.0;
+    weld.mRadius = 0;
+  }
+
+  for (LayerList::const_iterator i = mLayers.begin();  i != mLayers.end();  i++)
+  {
+    const GeometryLayer& layer = **i;
+
+    if (layer.getStack() != GeometryLayer::VERTEX || &layer == mBaseVertexLayer)
+      continue;
+
+    Attribute attribute;
+    attribute.mSlots = reinterpret_cast<const uint8*>(layer.mData.getitems());
+    attribute.mSlotCount = layer.mData.getItemCount();
+    attribute.mSlotSize = layer.getSlotSize();
+    attribute.mDefaults.resize(attribute.mSlotSize);
+    layer.readSlot(attribute.mSlotCount, &attribute.mDefaults[0]);
+    weld.mAttributes.push_back(attribute);
+  }
+
+  // Hash the vertices in parallel, then sort them by bucket.
+
+  uint32 bucketCount = 1;
+
+  while (bucketCount < weld.mVertexCount)
+    bucketCount <<= 1;
+
+  weld.mBucketMask = bucketCount - 1;
+  weld.mBuckets.resize(weld.mVertexCount);
+
+  Thread::parallelFor(hashVertices, &weld, weld.mVertexCount, CHUNK_SIZE);
+
+  weld.mOffsets.assign(bucketCount + 1, 0);
+
+  for (uint32 vertexID = 0;  vertexID < weld.mVertexCount;  vertexID++)
+  {
+    if (weld.mBuckets[vertexID] != INVALID_VERTEX_ID)
+      weld.mOffsets[weld.mBuckets[vertexID] + 1]++;
+  }
+
+  for (uint32 i = 0;  i < bucketCount;  i++)
+    weld.mOffsets[i + 1] += weld.mOffsets[i];
+
+  weld.mEntries.resize(weld.mOffsets[bucketCount]);
+
+  {
+    std::vector<uint32> next(weld.mOffsets.begin(), weld.mOffsets.end() - 1);
+
+    for (uint32 vertexID = 0;  vertexID < weld.mVertexCount;  vertexID++)
+    {
+      if (weld.mBuckets[vertexID] != INVALID_VERTEX_ID)
+	weld.mEntries[next[weld.mBuckets[vertexID]]++] = vertexID;
+    }
+  }
+
+  // Search for matches in parallel, then merge each vertex into its lowest
+  // matching vertex that is kept. The candidates of each vertex are sorted,
+  // and all lower vertices are settled before it.
+
+  weld.mCandidates.resize(getChunkCount(weld.mVertexCount));
+
+  Thread::parallelFor(searchChunks, &weld, weld.mCandidates.size(), 1);
+
+  std::vector<uint32> targets(weld.mVertexCount);
+
+  for (uint32 vertexID = 0;  vertexID < weld.mVertexCount;  vertexID++)
+    targets[vertexID] = vertexID;
+
+  for (std::vector<CandidateList>::const_iterator i = weld.mCandidates.begin();  i != weld.mCandidates.end();  i++)
+  {
+    for (CandidateList::const_iterator j = (*i).begin();  j != (*i).end();  j++)
+    {
+      if (targets[(*j).mVertexID] == (*j).mVertexID && targets[(*j).mTargetID] == (*j).mTargetID)
+	targets[(*j).mVertexID] = (*j).mTargetID;
+    }
+  }
+
+  const CornerUint32View polygons(*mBasePolygonLayer);
+  const uint32 polygonLimit = polygons.getSlotCount();
+
+  const uint32 total = weld.mVertexCount + polygonLimit;
+  uint32 done = weld.mVertexCount;
+
+  if (function)
+    function(data, done, total);
+
+  uint32 vertexCount = 0;
+  uint32 polygonCount = 0;
+
+  getSession().push();
+
+  // Point the polygons at the kept vertices, sending only those that change.
+  // A fourth corner made equal to another is dropped, but other repeated
+  // corners are kept, as moving corners would misalign the corner layers.
+
+  for (uint32 polygonID = 0;  polygonID < polygonLimit;  polygonID++)
+  {
+    if (function && (++done % 1024) == 0)
+      function(data, done, total);
+
+    if (!isPolygon(polygonID))
+      continue;
+
+    uint32 corners[4];
+    bool changed = false;
+
+    for (unsigned int i = 0;  i < 4;  i++)
+    {
+      corners[i] = polygons[polygonID][i];
+
+      if (weld.isVertex(corners[i]) && targets[corners[i]] != corners[i])
+      {
+	corners[i] = targets[corners[i]];
+	changed = true;
+      }
+    }
+
+    if (!changed)
+      continue;
+
+    if (std::find(corners, corners + 3, corners[3]) != corners + 3)
+      corners[3] = INVALID_VERTEX_ID;
+
+    unsigned int count = 0;
+
+    for (unsigned int i = 0;  i < 4;  i++)
+    {
+      if (weld.isVertex(corners[i]) && std::find(corners, corners + i, corners[i]) == corners + i)
+	count++;
+    }
+
+    if (count < 3)
+    {
+      deletePolygon(polygonID);
+      polygonCount++;
+    }
+    else
+      setBasePolygon(polygonID, BasePolygon(corners[0], corners[1], corners[2], corners[3]));
+  }
+
+  // No polygon references the merged vertices anymore, so deleting them takes
+  // no other polygons along.
+
+  for (uint32 vertexID = 0;  vertexID < weld.mVertexCount;  vertexID++)
+  {
+    if (targets[vertexID] != vertexID)
+    {
+      deleteVertex(vertexID);
+      vertexCount++;
+    }
+  }
+
+  getSession().pop();
+
+  if (function)
+    function(data, total, total);
+
+  return vertexCount * getVertexSize() + polygonCount * getPolygonSize();
+}
+
+//---------------------------------------------------------------------
+
+  } /*namespace ample*/
+} /*namespace verse*/
+